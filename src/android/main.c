@@ -231,7 +231,7 @@ bool native_move_file(const uint8_t *current_name, const uint8_t *new_name) {
     return rename((char *)current_name, (char *)new_name);
 }
 
-void native_select_dir_ft(uint32_t fid, void *file) {
+void native_select_dir_ft(uint32_t fid, uint32_t num, const char *name, size_t name_length) {
     return; /* TODO unsupported on android
     //fall back to working dir
     char *path = malloc(file->name_length + 1);
@@ -318,6 +318,9 @@ bool native_video_endread(void) {
 int native_video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, uint16_t height) {
     return 0; /* Unsupported on android */
 }
+bool native_video_wait(uint32_t timeout_ms) {
+    return false; /* Unsupported on android */
+}
 int file_unlock(FILE *file, uint64_t start, size_t length) {
     return 0; /* Unsupported on android */
 }
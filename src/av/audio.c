@@ -1,7 +1,10 @@
 #include "audio.h"
 
 #include "utox_av.h"
+#include "audio_jitter.h"
+#include "audio_send.h"
 #include "filter_audio.h"
+#include "group_mixer.h"
 
 #include "../native/audio.h"
 #include "../native/keyboard.h"
@@ -21,6 +24,7 @@
 #include "../../langs/i18n_decls.h"
 
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <tox/toxav.h>
@@ -65,6 +69,38 @@ static ALuint ringtone, preview, notifytone;
 
 static ALuint RingBuffer, ToneBuffer;
 
+#define CAPTURE_FRAME_NS ((uint64_t)UTOX_DEFAULT_FRAME_A * 1000 * 1000)
+
+static struct {
+    uint64_t next; // when the next whole frame should be in from the microphone
+
+    pthread_mutex_t     lock; // only for the stats, everything else is the audio thread's
+    AUDIO_CAPTURE_STATS stats;
+} capture = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Guards the friends' audio_jitter pointers. toxav's thread pushes into them, while they're made and freed by the
+ * audio thread. */
+static pthread_mutex_t audio_jitter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Guards the groups' mixer and audio_dest. The audio thread holds it while it plays a group out, and toxav's thread
+ * while it pushes into the mixer, so a group being removed can take them away in between. */
+static pthread_mutex_t audio_group_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A removed group's audio, for the audio thread to tear down. */
+typedef struct {
+    GROUP_MIXER *mixer;
+    ALuint       source;
+    ALuint       buffers[UTOX_GROUP_AUDIO_BUFFERS];
+} GROUP_AUDIO;
+
+/* Hearing yourself goes through the same playout as a call. */
+static AUDIO_JITTER *preview_jitter;
+static ALuint        preview_buffers[UTOX_FRIEND_AUDIO_BUFFERS], preview_free[UTOX_FRIEND_AUDIO_BUFFERS];
+static uint8_t       preview_free_count;
+
+/* How many frames are queued up in a source at once, the rest wait in the jitter buffer. */
+#define PLAYOUT_QUEUED 2
+
 static bool audio_in_device_open(void) {
     if (!audio_in_device) {
         return false;
@@ -100,6 +136,25 @@ static bool audio_in_device_close(void) {
     return false;
 }
 
+static void audio_capture_start(void) {
+    settings.audio_filtering_enabled = filter_audio_check();
+
+    pthread_mutex_lock(&capture.lock);
+    memset(&capture.stats, 0, sizeof(capture.stats));
+    pthread_mutex_unlock(&capture.lock);
+    capture.next = get_time();
+}
+
+static void audio_capture_log_stats(void) {
+    AUDIO_CAPTURE_STATS stats;
+    utox_audio_capture_stats(&stats);
+
+    const uint64_t frames = stats.frames ? stats.frames : 1;
+    LOG_INFO("uTox Audio", "Captured %lu frames, %lu late, %lu/%lu us from capture to send (average/max)",
+             (unsigned long)stats.frames, (unsigned long)stats.late,
+             (unsigned long)(stats.latency_total / frames / 1000), (unsigned long)(stats.latency_max / 1000));
+}
+
 static bool audio_in_listen(void) {
     if (microphone_on) {
         microphone_count++;
@@ -109,6 +164,7 @@ static bool audio_in_listen(void) {
     if (audio_in_handle) {
         if (audio_in_device == (void *)1) {
             audio_init(audio_in_handle);
+            audio_capture_start();
             return true;
         }
         alcCaptureStart(audio_in_handle);
@@ -125,6 +181,7 @@ static bool audio_in_listen(void) {
     if (audio_in_handle) {
         microphone_on    = true;
         microphone_count = 1;
+        audio_capture_start();
         return true;
     }
 
@@ -148,6 +205,7 @@ static bool audio_in_ignore(void) {
             audio_close(audio_in_handle);
             microphone_on    = false;
             microphone_count = 0;
+            audio_capture_log_stats();
             return false;
         }
         alcCaptureStop(audio_in_handle);
@@ -155,9 +213,61 @@ static bool audio_in_ignore(void) {
 
     microphone_on = false;
     microphone_count = 0;
+    audio_capture_log_stats();
     return false;
 }
 
+/* Reads the next whole frame off the microphone into buf, with ready set to about when the last of it was captured.
+ * Returns false once there isn't one, having worked out when there should be. */
+static bool audio_capture_frame(int16_t *buf, int perframe, uint64_t *ready) {
+    const uint64_t now = get_time();
+
+    if (audio_in_handle == (void *)1) {
+        if (audio_frame(buf)) {
+            *ready = now;
+            return true;
+        }
+
+        /* There's no telling how long until the next one, so look again on the next frame period. */
+        if (capture.next <= now) {
+            capture.next = now + CAPTURE_FRAME_NS - (now - capture.next) % CAPTURE_FRAME_NS;
+        }
+        return false;
+    }
+
+    ALint samples = 0;
+    alcGetIntegerv(audio_in_handle, ALC_CAPTURE_SAMPLES, sizeof(samples), &samples);
+    if (samples < perframe) {
+        const uint64_t missing = (uint64_t)(perframe - samples) * 1000 * 1000 * 1000 / UTOX_DEFAULT_SAMPLE_RATE_A;
+        capture.next           = now + MAX(missing, 1000 * 1000);
+        return false;
+    }
+
+    alcCaptureSamples(audio_in_handle, buf, perframe);
+    *ready = now - (uint64_t)(samples - perframe) * 1000 * 1000 * 1000 / UTOX_DEFAULT_SAMPLE_RATE_A;
+    return true;
+}
+
+/* Accounts for a frame that's been sent, or would have been if there was anyone to send it to. */
+static void audio_capture_sent(uint64_t ready) {
+    const uint64_t latency = get_time() - ready;
+
+    pthread_mutex_lock(&capture.lock);
+    capture.stats.frames++;
+    if (latency > CAPTURE_FRAME_NS) {
+        capture.stats.late++;
+    }
+    capture.stats.latency_total += latency;
+    capture.stats.latency_max = MAX(capture.stats.latency_max, latency);
+    pthread_mutex_unlock(&capture.lock);
+}
+
+void utox_audio_capture_stats(AUDIO_CAPTURE_STATS *stats) {
+    pthread_mutex_lock(&capture.lock);
+    *stats = capture.stats;
+    pthread_mutex_unlock(&capture.lock);
+}
+
 bool utox_audio_in_device_set(ALCdevice *new_device) {
     if (microphone_on || microphone_count) {
         return false;
@@ -283,49 +393,167 @@ ALCdevice *utox_audio_out_device_get(void) {
 }
 
 void sourceplaybuffer(unsigned int f, const int16_t *data, int samples, uint8_t channels, unsigned int sample_rate) {
-    if (!channels || channels > 2) {
+    if (f >= self.friend_list_size) {
+        /* The preview's only ever fed from the audio thread, which is the one that frees it. */
+        if (preview_jitter) {
+            audio_jitter_push(preview_jitter, data, samples, channels, sample_rate);
+        }
         return;
     }
 
-    ALuint source;
-    if (f >= self.friend_list_size) {
-        source = preview;
+    pthread_mutex_lock(&audio_jitter_lock);
+    FRIEND *fr = get_friend(f);
+    if (fr && fr->audio_jitter) {
+        audio_jitter_push(fr->audio_jitter, data, samples, channels, sample_rate);
+    }
+    pthread_mutex_unlock(&audio_jitter_lock);
+}
+
+void utox_audio_jitter_release(AUDIO_JITTER **jitter) {
+    pthread_mutex_lock(&audio_jitter_lock);
+    AUDIO_JITTER *released = *jitter;
+    *jitter = NULL;
+    pthread_mutex_unlock(&audio_jitter_lock);
+
+    if (!released) {
+        return;
+    }
+
+    if (utox_audio_thread_init) {
+        postmessage_audio(UTOXAUDIO_FREE_JITTER, 0, 0, released);
     } else {
-        source = get_friend(f)->audio_dest;
+        audio_jitter_free(released);
     }
+}
 
-    ALuint bufid;
-    ALint processed = 0, queued = 16;
-    alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
-    alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
-    alSourcei(source, AL_LOOPING, AL_FALSE);
-
-    if (processed) {
-        ALuint bufids[processed];
-        alSourceUnqueueBuffers(source, processed, bufids);
-        alDeleteBuffers(processed - 1, bufids + 1);
-        bufid = bufids[0];
-    } else if (queued < 16) {
-        alGenBuffers(1, &bufid);
+void utox_audio_group_release(GROUPCHAT *g) {
+    GROUP_AUDIO *audio = calloc(1, sizeof(GROUP_AUDIO));
+
+    pthread_mutex_lock(&audio_group_lock);
+    if (!audio || !utox_audio_thread_init) {
+        /* Nothing's mixing with the lock held. Once the audio thread's gone its sources went with the device. */
+        if (g->audio_dest && utox_audio_thread_init) {
+            LOG_ERR("uTox Audio", "Unable to hand group %u's audio to the audio thread, leaking its source.",
+                    g->number);
+        }
+        group_mixer_free(g->mixer);
     } else {
-        LOG_TRACE("uTox Audio", "dropped audio frame" );
-        return;
+        audio->mixer  = g->mixer;
+        audio->source = g->audio_dest;
+        memcpy(audio->buffers, g->audio_buffers, sizeof(audio->buffers));
     }
+    g->mixer            = NULL;
+    g->audio_dest       = 0;
+    g->audio_free_count = 0;
+    pthread_mutex_unlock(&audio_group_lock);
 
-    alBufferData(bufid, (channels == 1) ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16, data, samples * 2 * channels,
-                 sample_rate);
-    alSourceQueueBuffers(source, 1, &bufid);
+    if (audio && utox_audio_thread_init) {
+        postmessage_audio(UTOXAUDIO_FREE_GROUP, 0, 0, audio);
+    } else {
+        free(audio);
+    }
+}
 
-    // LOG_TRACE("uTox Audio", "audio frame || samples == %i channels == %u rate == %u " , samples, channels, sample_rate);
+/* The friend's jitter buffer, or NULL. Only the audio thread frees them, so it can keep using what this returns. */
+static AUDIO_JITTER *audio_friend_jitter(FRIEND *f) {
+    pthread_mutex_lock(&audio_jitter_lock);
+    AUDIO_JITTER *jitter = f->audio_jitter;
+    pthread_mutex_unlock(&audio_jitter_lock);
+    return jitter;
+}
+
+/* Makes total buffers for a source to play out of, all free to start with. */
+static void audio_buffers_init(ALuint *buffers, ALuint *free_list, uint8_t *free_count, uint8_t total) {
+    alGenBuffers(total, buffers);
+    memcpy(free_list, buffers, total * sizeof(ALuint));
+    *free_count = total;
+}
+
+/* Takes back the buffers source has finished playing, onto the end of its free list. */
+static void audio_buffers_reclaim(ALuint source, ALuint *free_list, uint8_t *free_count, uint8_t total) {
+    ALint processed = 0;
+    alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+    if (processed > 0) {
+        processed = MIN(processed, total - *free_count);
+        alSourceUnqueueBuffers(source, processed, &free_list[*free_count]);
+        *free_count += processed;
+    }
+}
+
+/* Queues the first count buffers off the free list, in order, and makes sure source is playing. */
+static void audio_buffers_queue(ALuint source, ALuint *free_list, uint8_t *free_count, uint8_t count) {
+    if (!count) {
+        return;
+    }
+
+    alSourceQueueBuffers(source, count, free_list);
+    *free_count -= count;
+    memmove(free_list, &free_list[count], *free_count * sizeof(ALuint));
 
     ALint state;
     alGetSourcei(source, AL_SOURCE_STATE, &state);
     if (state != AL_PLAYING) {
         alSourcePlay(source);
-        // LOG_TRACE("uTox Audio", "Starting source %u" , i);
     }
 }
 
+/* Tops source up with frames out of jitter, made up ones too once it's down to the last. */
+static void audio_playout(ALuint source, AUDIO_JITTER *jitter, ALuint *free_list, uint8_t *free_count, uint8_t total) {
+    audio_buffers_reclaim(source, free_list, free_count, total);
+
+    int16_t  frame[AUDIO_JITTER_MAX_FRAME];
+    uint8_t  channels, filled = 0;
+    uint32_t sample_rate;
+    while (filled < *free_count && total - *free_count + filled < PLAYOUT_QUEUED) {
+        const bool   last    = total - *free_count + filled <= 1;
+        const size_t samples = audio_jitter_pull(jitter, frame, &channels, &sample_rate, last);
+        if (!samples) {
+            break;
+        }
+
+        alBufferData(free_list[filled++], channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16, frame,
+                     samples * channels * sizeof(int16_t), sample_rate);
+    }
+
+    audio_buffers_queue(source, free_list, free_count, filled);
+}
+
+/* Tops the group's source up with as much of the mix as is ready, into the buffers it's done playing. Only the
+ * audio thread touches the group's source and buffers, toxav's callback just pushes into the mixer. */
+static void group_audio_playout(GROUPCHAT *g) {
+    audio_buffers_reclaim(g->audio_dest, g->audio_free, &g->audio_free_count, UTOX_GROUP_AUDIO_BUFFERS);
+
+    int16_t frame[GROUP_MIXER_FRAME * GROUP_MIXER_CHANNELS];
+    uint8_t filled = 0;
+    while (filled < g->audio_free_count && UTOX_GROUP_AUDIO_BUFFERS - g->audio_free_count + filled < PLAYOUT_QUEUED
+           && group_mixer_ready(g->mixer)) {
+        group_mixer_mix(g->mixer, frame);
+        alBufferData(g->audio_free[filled++], AL_FORMAT_STEREO16, frame, sizeof(frame), GROUP_MIXER_SAMPLE_RATE);
+    }
+
+    audio_buffers_queue(g->audio_dest, g->audio_free, &g->audio_free_count, filled);
+}
+
+bool utox_audio_stats(uint32_t friend_number, AUDIO_JITTER_STATS *stats) {
+    FRIEND *f = get_friend(friend_number);
+    if (!f) {
+        return false;
+    }
+
+    pthread_mutex_lock(&audio_jitter_lock);
+    if (!f->audio_jitter) {
+        pthread_mutex_unlock(&audio_jitter_lock);
+        return false;
+    }
+    audio_jitter_stats(f->audio_jitter, stats);
+    pthread_mutex_unlock(&audio_jitter_lock);
+
+    if (f->audio_dest) {
+        stats->latency_ms += (UTOX_FRIEND_AUDIO_BUFFERS - f->audio_free_count) * AUDIO_JITTER_FRAME_MS;
+    }
+    return true;
+}
+
 static void audio_in_init(void) {
     const char *audio_in_device_list;
     audio_in_device_list = alcGetString(NULL, ALC_CAPTURE_DEVICE_SPECIFIER);
@@ -565,17 +793,10 @@ static void generate_tone_friend_new_msg() { generate_melody(friend_new_msg, 1,
 
 static void generate_tone_friend_request() { generate_melody(friend_request, 1, 8, &ToneBuffer); }
 
-void postmessage_audio(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (audio_thread_msg && utox_audio_thread_init) {
-        yieldcpu(1);
-    }
-
-    audio_msg.msg    = msg;
-    audio_msg.param1 = param1;
-    audio_msg.param2 = param2;
-    audio_msg.data   = data;
+static MSG_QUEUE audio_queue = MSG_QUEUE_INIT;
 
-    audio_thread_msg = 1;
+void postmessage_audio(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    msg_queue_post(&audio_queue, &utox_audio_thread_init, msg, param1, param2, data);
 }
 
 // TODO: This function is 300 lines long. Cut it up.
@@ -619,9 +840,12 @@ void utox_audio_thread(void *args) {
 
     utox_audio_thread_init = true;
     while (1) {
-        if (audio_thread_msg) {
-            const TOX_MSG *m = &audio_msg;
+        TOX_MSG queued;
+        bool    kill = false;
+        while (msg_queue_pop(&audio_queue, &queued)) {
+            const TOX_MSG *m = &queued;
             if (m->msg == UTOXAUDIO_KILL) {
+                kill = true;
                 break;
             }
 
@@ -633,6 +857,10 @@ void utox_audio_thread(void *args) {
 
                     break;
                 }
+                case UTOXAUDIO_CHANGE_FILTERING: {
+                    settings.audio_filtering_enabled = filter_audio_check();
+                    break;
+                }
                 case UTOXAUDIO_CHANGE_SPEAKER: {
                     while (audio_out_device_close()) { continue; }
 
@@ -641,6 +869,14 @@ void utox_audio_thread(void *args) {
                 case UTOXAUDIO_START_FRIEND: {
                     FRIEND *f = get_friend(m->param1);
                     if (f && !f->audio_dest) {
+                        if (!audio_friend_jitter(f)) {
+                            AUDIO_JITTER *jitter = audio_jitter_new();
+                            pthread_mutex_lock(&audio_jitter_lock);
+                            f->audio_jitter = jitter;
+                            pthread_mutex_unlock(&audio_jitter_lock);
+                        }
+                        audio_buffers_init(f->audio_buffers, f->audio_free, &f->audio_free_count,
+                                           UTOX_FRIEND_AUDIO_BUFFERS);
                         audio_source_init(&f->audio_dest);
                     }
                     audio_out_device_open();
@@ -652,11 +888,37 @@ void utox_audio_thread(void *args) {
                     if (f && f->audio_dest) {
                         audio_source_raze(&f->audio_dest);
                         f->audio_dest = 0;
+                        alDeleteBuffers(UTOX_FRIEND_AUDIO_BUFFERS, f->audio_buffers);
+                        f->audio_free_count = 0;
+                    }
+                    AUDIO_JITTER *jitter = f ? audio_friend_jitter(f) : NULL;
+                    if (jitter) {
+                        AUDIO_JITTER_STATS stats;
+                        audio_jitter_stats(jitter, &stats);
+                        LOG_NOTE("uTox Audio", "Call audio from friend %u: %u underruns, %u overruns, %u frames "
+                                 "concealed, %ums jitter, %ums target",
+                                 m->param1, stats.underruns, stats.overruns, stats.concealed, stats.jitter_ms,
+                                 stats.target_ms);
+                        audio_jitter_flush(jitter);
                     }
                     audio_in_ignore();
                     audio_out_device_close();
                     break;
                 }
+                case UTOXAUDIO_FREE_JITTER: {
+                    audio_jitter_free(m->data);
+                    break;
+                }
+                case UTOXAUDIO_FREE_GROUP: {
+                    GROUP_AUDIO *audio = m->data;
+                    if (audio->source) {
+                        audio_source_raze(&audio->source);
+                        alDeleteBuffers(UTOX_GROUP_AUDIO_BUFFERS, audio->buffers);
+                    }
+                    group_mixer_free(audio->mixer);
+                    free(audio);
+                    break;
+                }
                 case UTOXAUDIO_GROUPCHAT_START: {
                     LOG_DEBUG("Audio", "Starting Groupchat Audio %u", m->param1);
                     GROUPCHAT *g = get_group(m->param1);
@@ -665,9 +927,13 @@ void utox_audio_thread(void *args) {
                         break;
                     }
 
+                    pthread_mutex_lock(&audio_group_lock);
                     if (!g->audio_dest) {
+                        audio_buffers_init(g->audio_buffers, g->audio_free, &g->audio_free_count,
+                                           UTOX_GROUP_AUDIO_BUFFERS);
                         audio_source_init(&g->audio_dest);
                     }
+                    pthread_mutex_unlock(&audio_group_lock);
 
                     audio_out_device_open();
                     audio_in_listen();
@@ -681,22 +947,45 @@ void utox_audio_thread(void *args) {
                         break;
                     }
 
+                    pthread_mutex_lock(&audio_group_lock);
                     if (g->audio_dest) {
                         audio_source_raze(&g->audio_dest);
                         g->audio_dest = 0;
+                        alDeleteBuffers(UTOX_GROUP_AUDIO_BUFFERS, g->audio_buffers);
+                        g->audio_free_count = 0;
                     }
+                    if (g->mixer) {
+                        group_mixer_flush(g->mixer);
+                    }
+                    pthread_mutex_unlock(&audio_group_lock);
 
                     audio_in_ignore();
                     audio_out_device_close();
                     break;
                 }
                 case UTOXAUDIO_START_PREVIEW: {
-                    preview_on = true;
                     audio_out_device_open();
                     audio_in_listen();
+                    if (!preview_on) {
+                        if (!preview_jitter) {
+                            preview_jitter = audio_jitter_new();
+                        }
+                        audio_buffers_init(preview_buffers, preview_free, &preview_free_count,
+                                           UTOX_FRIEND_AUDIO_BUFFERS);
+                    }
+                    preview_on = true;
                     break;
                 }
                 case UTOXAUDIO_STOP_PREVIEW: {
+                    if (preview_on) {
+                        alSourceStop(preview);
+                        alSourcei(preview, AL_BUFFER, 0);
+                        alDeleteBuffers(UTOX_FRIEND_AUDIO_BUFFERS, preview_buffers);
+                        preview_free_count = 0;
+                        if (preview_jitter) {
+                            audio_jitter_flush(preview_jitter);
+                        }
+                    }
                     preview_on = false;
                     audio_in_ignore();
                     audio_out_device_close();
@@ -774,8 +1063,6 @@ void utox_audio_thread(void *args) {
                     audio_out_init();
                 }
             }
-            audio_thread_msg = 0;
-
             if (close_device_time && time(NULL) >= close_device_time) {
                 LOG_INFO("uTox Audio", "close device triggered!" );
                 audio_out_device_close();
@@ -783,50 +1070,29 @@ void utox_audio_thread(void *args) {
             }
         }
 
-        settings.audio_filtering_enabled = filter_audio_check();
-
-        bool sleep = true;
+        if (kill) {
+            break;
+        }
 
         if (microphone_on) {
-            ALint samples;
-            bool frame = 0;
-            /* If we have a device_in we're on linux so we can just call OpenAL, otherwise we're on something else so
-             * we'll need to call audio_frame() to add to the buffer for us. */
-            if (audio_in_handle == (void *)1) {
-                frame = audio_frame((void *)buf);
-                if (frame) {
-                    /* We have an audio frame to use, continue without sleeping. */
-                    sleep = false;
-                }
-            } else {
-                alcGetIntegerv(audio_in_handle, ALC_CAPTURE_SAMPLES, sizeof(samples), &samples);
-                if (samples >= perframe) {
-                    alcCaptureSamples(audio_in_handle, buf, perframe);
-                    frame = true;
-                    if (samples >= perframe * 2) {
-                        sleep = false;
-                    }
-                }
-            }
-
-            #ifdef AUDIO_FILTERING
-            #ifdef ALC_LOOPBACK_CAPTURE_SAMPLES
-            if (f_a && settings.audio_filtering_enabled) {
-                alcGetIntegerv(audio_out_device, ALC_LOOPBACK_CAPTURE_SAMPLES, sizeof(samples), &samples);
-                if (samples >= perframe) {
-                    int16_t buffer[perframe];
-                    alcCaptureSamplesLoopback(audio_out_handle, buffer, perframe);
-                    pass_audio_output(f_a, buffer, perframe);
-                    set_echo_delay_ms(f_a, UTOX_DEFAULT_FRAME_A);
-                    if (samples >= perframe * 2) {
-                        sleep = false;
+            /* Drain everything the microphone has, so frames don't wait on the next wakeup. */
+            uint64_t ready;
+            while (audio_capture_frame((int16_t *)buf, perframe, &ready)) {
+                #ifdef AUDIO_FILTERING
+                #ifdef ALC_LOOPBACK_CAPTURE_SAMPLES
+                if (f_a && settings.audio_filtering_enabled) {
+                    ALint samples;
+                    alcGetIntegerv(audio_out_device, ALC_LOOPBACK_CAPTURE_SAMPLES, sizeof(samples), &samples);
+                    if (samples >= perframe) {
+                        int16_t buffer[perframe];
+                        alcCaptureSamplesLoopback(audio_out_handle, buffer, perframe);
+                        pass_audio_output(f_a, buffer, perframe);
+                        set_echo_delay_ms(f_a, UTOX_DEFAULT_FRAME_A);
                     }
                 }
-            }
-            #endif
-            #endif
+                #endif
+                #endif
 
-            if (frame) {
                 bool voice = true;
                 #ifdef AUDIO_FILTERING
                 if (f_a) {
@@ -862,49 +1128,51 @@ void utox_audio_thread(void *args) {
                 }
 
                 if (voice) {
-                    size_t active_call_count = 0;
-                    for (size_t i = 0; i < self.friend_list_count; i++) {
-                        if (UTOX_SEND_AUDIO(i)) {
-                            active_call_count++;
-                            TOXAV_ERR_SEND_FRAME error = 0;
-                            // LOG_TRACE("uTox Audio", "Sending audio frame!" );
-                            FRIEND *f = get_friend(i);
-                            if (!f) {
-                                LOG_ERR("uToxAV", "Unable to get friend when sending audio frame %u", i);
-                                continue;
-                            }
-                            toxav_audio_send_frame(av, f->number, (const int16_t *)buf, perframe,
-                                                   UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A, &error);
-                            if (error) {
-                                LOG_TRACE("uTox Audio", "toxav_send_audio error friend == %lu, error ==  %i" , i, error);
-                            } else {
-                                // LOG_TRACE("uTox Audio", "Send a frame to friend %i" ,i);
-                                if (active_call_count >= UTOX_MAX_CALLS) {
-                                    LOG_TRACE("uTox Audio", "We're calling more peers than allowed by UTOX_MAX_CALLS, This is a bug" );
-                                    break;
-                                }
-                            }
-                        }
-                    }
+                    audio_send_frame(av, (const int16_t *)buf, perframe, UTOX_DEFAULT_AUDIO_CHANNELS,
+                                     UTOX_DEFAULT_SAMPLE_RATE_A);
+                }
 
-                    Tox *tox = toxav_get_tox(av);
-                    uint32_t num_chats = tox_conference_get_chatlist_size(tox);
+                audio_capture_sent(ready);
+            }
+        }
 
-                    if (num_chats) {
-                        for (size_t i = 0 ; i < num_chats; ++i) {
-                            if (get_group(i) && get_group(i)->active_call) {
-                                LOG_TRACE("uTox Audio", "Sending audio in groupchat %u", i);
-                                toxav_group_send_audio(tox, i, (int16_t *)buf, perframe,
-                                                       UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A);
-                            }
-                        }
-                    }
-                }
+        /* Keep everything that's being listened to playing. */
+        bool playing = false;
+        for (size_t i = 0; i < self.friend_list_count; ++i) {
+            FRIEND *      f      = get_friend(i);
+            AUDIO_JITTER *jitter = f && f->audio_dest ? audio_friend_jitter(f) : NULL;
+            if (jitter) {
+                audio_playout(f->audio_dest, jitter, f->audio_free, &f->audio_free_count,
+                              UTOX_FRIEND_AUDIO_BUFFERS);
+                playing = true;
             }
         }
+        for (size_t i = 0; i < self.groups_list_size; ++i) {
+            GROUPCHAT *g = get_group(i);
+            if (!g) {
+                continue;
+            }
 
-        if (sleep) {
-            yieldcpu(50);
+            pthread_mutex_lock(&audio_group_lock);
+            if (g->audio_dest && g->mixer) {
+                group_audio_playout(g);
+                playing = true;
+            }
+            pthread_mutex_unlock(&audio_group_lock);
+        }
+        if (preview_on && preview_jitter) {
+            audio_playout(preview, preview_jitter, preview_free, &preview_free_count, UTOX_FRIEND_AUDIO_BUFFERS);
+            playing = true;
+        }
+
+        /* Sleep until the next frame's due in from the microphone, or it's time to top up playback. */
+        uint64_t wait = playing ? UTOX_DEFAULT_FRAME_A / 2 : 50;
+        if (microphone_on) {
+            const uint64_t now = get_time();
+            wait = MIN(wait, capture.next > now ? (capture.next - now + 999999) / (1000 * 1000) : 0);
+        }
+        if (wait) {
+            msg_queue_wait(&audio_queue, wait);
         }
     }
 
@@ -919,9 +1187,10 @@ void utox_audio_thread(void *args) {
     while (audio_in_device_close()) { continue; }
     while (audio_out_device_close()) {continue; }
 
-    audio_thread_msg       = 0;
     utox_audio_thread_init = false;
     free(preview_buffer);
+    audio_jitter_free(preview_jitter);
+    preview_jitter = NULL;
     LOG_TRACE("uTox Audio", "Clean thread exit!");
 }
 
@@ -958,52 +1227,51 @@ void callback_av_group_audio(void *UNUSED(tox), uint32_t groupnumber, uint32_t p
         return;
     }
 
-    ALuint bufid;
-    ALint processed = 0, queued = 16;
-    alGetSourcei(g->source[peernumber], AL_BUFFERS_PROCESSED, &processed);
-    alGetSourcei(g->source[peernumber], AL_BUFFERS_QUEUED, &queued);
-    alSourcei(g->source[peernumber], AL_LOOPING, AL_FALSE);
+    /* The audio thread mixes it down and plays it. */
+    pthread_mutex_lock(&audio_group_lock);
+    if (g->mixer) {
+        group_mixer_push(g->mixer, peernumber, pcm, samples, channels, sample_rate);
+    }
+    pthread_mutex_unlock(&audio_group_lock);
+}
 
-    if (processed) {
-        ALuint bufids[processed];
-        alSourceUnqueueBuffers(g->source[peernumber], processed, bufids);
-        alDeleteBuffers(processed - 1, bufids + 1);
-        bufid = bufids[0];
-    } else if(queued < 16) {
-        alGenBuffers(1, &bufid);
-    } else {
-        LOG_WARN("uTox Audio", "dropped audio frame %i %i" , groupnumber, peernumber);
+void group_av_peer_add(GROUPCHAT *g, int peernumber) {
+    if (!g || peernumber < 0) {
+        LOG_ERR("uTox Audio", "Invalid groupchat or peer number");
         return;
     }
 
-    alBufferData(bufid, (channels == 1) ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16, pcm, samples * 2 * channels,
-                    sample_rate);
-    alSourceQueueBuffers(g->source[peernumber], 1, &bufid);
-
-    ALint state;
-    alGetSourcei(g->source[peernumber], AL_SOURCE_STATE, &state);
-    if (state != AL_PLAYING) {
-        alSourcePlay(g->source[peernumber]);
-        LOG_DEBUG("uTox Audio", "Starting source %i %i" , groupnumber, peernumber);
+    LOG_INFO("uTox Audio", "Adding peer %u to the mix in group %u", peernumber, g->number);
+    pthread_mutex_lock(&audio_group_lock);
+    if (g->mixer) {
+        group_mixer_peer_remove(g->mixer, peernumber);
     }
+    pthread_mutex_unlock(&audio_group_lock);
 }
 
-void group_av_peer_add(GROUPCHAT *g, int peernumber) {
+void group_av_peer_remove(GROUPCHAT *g, int peernumber) {
     if (!g || peernumber < 0) {
         LOG_ERR("uTox Audio", "Invalid groupchat or peer number");
         return;
     }
 
-    LOG_INFO("uTox Audio", "Adding source for peer %u in group %u", peernumber, g->number);
-    alGenSources(1, &g->source[peernumber]);
+    LOG_INFO("uTox Audio", "Removing peer %u from the mix in group %u", peernumber, g->number);
+    pthread_mutex_lock(&audio_group_lock);
+    if (g->mixer) {
+        group_mixer_peer_remove(g->mixer, peernumber);
+    }
+    pthread_mutex_unlock(&audio_group_lock);
 }
 
-void group_av_peer_remove(GROUPCHAT *g, int peernumber) {
-    if (!g || peernumber < 0) {
+void group_av_peer_move(GROUPCHAT *g, int from, int to) {
+    if (!g || from < 0 || to < 0) {
         LOG_ERR("uTox Audio", "Invalid groupchat or peer number");
         return;
     }
 
-    LOG_INFO("uTox Audio", "Deleting source for peer %u in group %u", peernumber, g->number);
-    alDeleteSources(1, &g->source[peernumber]);
+    pthread_mutex_lock(&audio_group_lock);
+    if (g->mixer) {
+        group_mixer_peer_move(g->mixer, from, to);
+    }
+    pthread_mutex_unlock(&audio_group_lock);
 }
@@ -1,6 +1,8 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include "audio_jitter.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -19,9 +21,12 @@ enum {
 
     UTOXAUDIO_CHANGE_MIC,
     UTOXAUDIO_CHANGE_SPEAKER,
+    UTOXAUDIO_CHANGE_FILTERING, // settings.audio_filtering_enabled has been switched
 
     UTOXAUDIO_START_FRIEND,
     UTOXAUDIO_STOP_FRIEND,
+    UTOXAUDIO_FREE_JITTER, // data: an AUDIO_JITTER nothing's pushing into any more
+    UTOXAUDIO_FREE_GROUP,  // data: a removed group's mixer, source and buffers
 
     UTOXAUDIO_GROUPCHAT_START,
     UTOXAUDIO_GROUPCHAT_STOP,
@@ -81,8 +86,31 @@ void utox_audio_in_device_close(void);
 void utox_audio_in_listen(void);
 void utox_audio_in_ignore(void);
 
+/* Queues up audio for the audio thread to play out, from friend i or the preview past the end of the friend list. */
 void sourceplaybuffer(unsigned int i, const int16_t *data, int samples, uint8_t channels, unsigned int sample_rate);
 
+/* Takes a friend's jitter buffer away from sourceplaybuffer() and clears the pointer, then has the audio thread free
+ * it once it's done playing out of it. For when the friend's removed. */
+void utox_audio_jitter_release(AUDIO_JITTER **jitter);
+
+/* Takes the group's mixer, source and buffers away and clears them, then has the audio thread delete them. For when
+ * the group's removed. */
+typedef struct groupchat GROUPCHAT;
+void utox_audio_group_release(GROUPCHAT *g);
+
+/* Copies out how playing friend_number's call audio is going, false if they've not been called. Any thread. */
+bool utox_audio_stats(uint32_t friend_number, AUDIO_JITTER_STATS *stats);
+
+typedef struct {
+    uint64_t frames; // frames captured off the microphone
+    uint64_t late;   // frames that had been waiting longer than a frame period to be read
+
+    uint64_t latency_total, latency_max; // ns from a frame's last sample being captured to it being sent
+} AUDIO_CAPTURE_STATS;
+
+/* Copies out the capture stats since the microphone was last started. Any thread. */
+void utox_audio_capture_stats(AUDIO_CAPTURE_STATS *stats);
+
 /* send a message to the audio thread */
 void postmessage_audio(uint8_t msg, uint32_t param1, uint32_t param2, void *data);
 
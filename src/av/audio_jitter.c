@@ -0,0 +1,208 @@
+#include "audio_jitter.h"
+
+#include "../debug.h"
+#include "../macros.h"
+
+#include "../native/time.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NS_PER_MS (1000 * 1000)
+
+// How many frames have to play before the extra target from running out goes down by 1ms.
+#define SPIKE_DECAY_FRAMES 5
+
+static size_t ms_to_samples(const AUDIO_JITTER *jitter, uint32_t ms) {
+    return (size_t)jitter->sample_rate * ms / 1000;
+}
+
+static uint32_t target_ms(const AUDIO_JITTER *jitter) {
+    const uint64_t target = AUDIO_JITTER_MIN_MS + 2 * jitter->jitter / NS_PER_MS + jitter->spike_ms;
+    return MIN(target, AUDIO_JITTER_MAX_MS);
+}
+
+static void reset(AUDIO_JITTER *jitter) {
+    jitter->read         = 0;
+    jitter->fill         = 0;
+    jitter->buffering    = true;
+    jitter->missing      = 0;
+    jitter->last_arrival = 0;
+    jitter->jitter       = 0;
+    jitter->spike_ms     = 0;
+    jitter->played       = 0;
+    memset(jitter->last, 0, sizeof(jitter->last));
+    memset(&jitter->stats, 0, sizeof(jitter->stats));
+}
+
+AUDIO_JITTER *audio_jitter_new(void) {
+    AUDIO_JITTER *jitter = calloc(1, sizeof(AUDIO_JITTER));
+    if (!jitter) {
+        LOG_ERR("Audio Jitter", "Unable to allocate a jitter buffer.");
+        return NULL;
+    }
+
+    pthread_mutex_init(&jitter->lock, NULL);
+    jitter->conceal = audio_jitter_conceal_fade;
+    reset(jitter);
+
+    return jitter;
+}
+
+void audio_jitter_free(AUDIO_JITTER *jitter) {
+    if (!jitter) {
+        return;
+    }
+
+    pthread_mutex_destroy(&jitter->lock);
+    free(jitter->samples);
+    free(jitter);
+}
+
+/* Drops the oldest count samples. */
+static void drop(AUDIO_JITTER *jitter, size_t count) {
+    jitter->read = (jitter->read + count) % jitter->size;
+    jitter->fill -= count;
+    jitter->stats.overruns++;
+}
+
+bool audio_jitter_push(AUDIO_JITTER *jitter, const int16_t *pcm, size_t samples, uint8_t channels,
+                       uint32_t sample_rate) {
+    if (!channels || channels > 2 || !sample_rate || sample_rate > 48000) {
+        return false;
+    }
+
+    pthread_mutex_lock(&jitter->lock);
+
+    if (!jitter->samples || channels != jitter->channels || sample_rate != jitter->sample_rate) {
+        LOG_INFO("Audio Jitter", "Playing %u channel audio at %uHz", channels, sample_rate);
+
+        free(jitter->samples);
+        jitter->channels    = channels;
+        jitter->sample_rate = sample_rate;
+        jitter->size = ms_to_samples(jitter, AUDIO_JITTER_MAX_MS + AUDIO_JITTER_EXCESS_MS + AUDIO_JITTER_FRAME_MS);
+        jitter->samples = malloc(jitter->size * channels * sizeof(int16_t));
+        reset(jitter);
+
+        if (!jitter->samples) {
+            pthread_mutex_unlock(&jitter->lock);
+            LOG_ERR("Audio Jitter", "Unable to allocate %zu samples of audio.", jitter->size);
+            return false;
+        }
+    }
+
+    /* Compare when this arrived to when it would have if everything before had arrived on time. */
+    const uint64_t now = get_time();
+    if (jitter->last_arrival) {
+        const uint64_t expected  = jitter->last_arrival + jitter->last_duration;
+        uint64_t       deviation = now > expected ? now - expected : expected - now;
+        deviation                = MIN(deviation, (uint64_t)AUDIO_JITTER_MAX_MS * NS_PER_MS);
+
+        jitter->jitter = (jitter->jitter * 15 + deviation) / 16;
+    }
+    jitter->last_arrival  = now;
+    jitter->last_duration = (uint64_t)samples * 1000 * NS_PER_MS / sample_rate;
+
+    if (samples > jitter->size) {
+        pcm += (samples - jitter->size) * channels;
+        samples = jitter->size;
+    }
+    if (jitter->fill + samples > jitter->size) {
+        drop(jitter, jitter->fill + samples - jitter->size);
+    }
+
+    size_t write = (jitter->read + jitter->fill) % jitter->size;
+    for (size_t i = 0; i < samples; ++i) {
+        memcpy(&jitter->samples[write * channels], &pcm[i * channels], channels * sizeof(int16_t));
+        write = (write + 1) % jitter->size;
+    }
+    jitter->fill += samples;
+
+    /* Too far behind what's arriving, catch back up. */
+    const size_t target = ms_to_samples(jitter, target_ms(jitter));
+    if (jitter->fill > target + ms_to_samples(jitter, AUDIO_JITTER_EXCESS_MS)) {
+        drop(jitter, jitter->fill - target);
+    }
+
+    if (jitter->buffering && jitter->fill >= target) {
+        jitter->buffering = false;
+    }
+
+    pthread_mutex_unlock(&jitter->lock);
+    return true;
+}
+
+size_t audio_jitter_pull(AUDIO_JITTER *jitter, int16_t *out, uint8_t *channels, uint32_t *sample_rate, bool conceal) {
+    pthread_mutex_lock(&jitter->lock);
+    if (!jitter->samples) {
+        pthread_mutex_unlock(&jitter->lock);
+        return 0;
+    }
+
+    const size_t frame = ms_to_samples(jitter, AUDIO_JITTER_FRAME_MS);
+    *channels          = jitter->channels;
+    *sample_rate       = jitter->sample_rate;
+
+    if (!jitter->buffering && jitter->fill >= frame) {
+        for (size_t i = 0; i < frame; ++i) {
+            const size_t at = (jitter->read + i) % jitter->size;
+            memcpy(&out[i * jitter->channels], &jitter->samples[at * jitter->channels],
+                   jitter->channels * sizeof(int16_t));
+        }
+        jitter->read = (jitter->read + frame) % jitter->size;
+        jitter->fill -= frame;
+        jitter->missing = 0;
+
+        if (jitter->spike_ms && ++jitter->played >= SPIKE_DECAY_FRAMES) {
+            jitter->spike_ms--;
+            jitter->played = 0;
+        }
+    } else if (conceal && (!jitter->buffering || (jitter->missing && jitter->missing < AUDIO_JITTER_CONCEAL_MAX))) {
+        /* It's run out, keep going with something made up while waiting for more. */
+        if (!jitter->buffering) {
+            jitter->buffering = true;
+            jitter->spike_ms  = MIN(jitter->spike_ms + AUDIO_JITTER_FRAME_MS, AUDIO_JITTER_MAX_MS);
+            jitter->stats.underruns++;
+        }
+
+        jitter->missing++;
+        jitter->conceal(out, jitter->last, frame, jitter->channels, jitter->missing, jitter->conceal_userdata);
+        jitter->stats.concealed++;
+    } else {
+        pthread_mutex_unlock(&jitter->lock);
+        return 0;
+    }
+
+    memcpy(jitter->last, out, frame * jitter->channels * sizeof(int16_t));
+    pthread_mutex_unlock(&jitter->lock);
+    return frame;
+}
+
+void audio_jitter_flush(AUDIO_JITTER *jitter) {
+    pthread_mutex_lock(&jitter->lock);
+    reset(jitter);
+    pthread_mutex_unlock(&jitter->lock);
+}
+
+void audio_jitter_set_conceal(AUDIO_JITTER *jitter, AUDIO_JITTER_CONCEAL conceal, void *userdata) {
+    pthread_mutex_lock(&jitter->lock);
+    jitter->conceal          = conceal ? conceal : audio_jitter_conceal_fade;
+    jitter->conceal_userdata = userdata;
+    pthread_mutex_unlock(&jitter->lock);
+}
+
+void audio_jitter_conceal_fade(int16_t *out, const int16_t *last, size_t samples, uint8_t channels,
+                               uint32_t UNUSED(missing), void *UNUSED(userdata)) {
+    for (size_t i = 0; i < samples * channels; ++i) {
+        out[i] = last[i] / 2;
+    }
+}
+
+void audio_jitter_stats(AUDIO_JITTER *jitter, AUDIO_JITTER_STATS *stats) {
+    pthread_mutex_lock(&jitter->lock);
+    *stats            = jitter->stats;
+    stats->latency_ms = jitter->sample_rate ? jitter->fill * 1000 / jitter->sample_rate : 0;
+    stats->target_ms  = target_ms(jitter);
+    stats->jitter_ms  = jitter->jitter / NS_PER_MS;
+    pthread_mutex_unlock(&jitter->lock);
+}
@@ -0,0 +1,97 @@
+#ifndef AUDIO_JITTER_H
+#define AUDIO_JITTER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Audio is played out in frames this long. */
+#define AUDIO_JITTER_FRAME_MS 20
+/* The most samples a frame can have, at 48kHz stereo. */
+#define AUDIO_JITTER_MAX_FRAME (48000 / (1000 / AUDIO_JITTER_FRAME_MS) * 2)
+
+/* How far behind what's arrived playback can be made to run, in ms. The target moves between the first two with how
+ * unevenly audio has been arriving. Past the target by more than the last, the oldest audio's dropped to catch up. */
+#define AUDIO_JITTER_MIN_MS 60
+#define AUDIO_JITTER_MAX_MS 300
+#define AUDIO_JITTER_EXCESS_MS 80
+
+/* How many frames in a row are made up by concealment before giving up and going quiet. */
+#define AUDIO_JITTER_CONCEAL_MAX 5
+
+/* Makes up a frame of audio that didn't arrive in time, samples per channel into out. last is the frame played just
+ * before, missing is how many frames in a row have had to be made up, counting this one. */
+typedef void (*AUDIO_JITTER_CONCEAL)(int16_t *out, const int16_t *last, size_t samples, uint8_t channels,
+                                     uint32_t missing, void *userdata);
+
+typedef struct {
+    uint32_t underruns; // times audio ran out before the next arrived
+    uint32_t overruns;  // times the oldest audio was dropped to catch up
+    uint32_t concealed; // frames made up to cover for missing audio
+
+    uint32_t latency_ms; // how much audio's waiting to be played
+    uint32_t target_ms;
+    uint32_t jitter_ms; // how far from when it's due audio's been arriving, on average
+} AUDIO_JITTER_STATS;
+
+/* Holds a friend's incoming audio back long enough to play it out smoothly when it arrives unevenly.
+ *
+ * Audio's pushed in as it arrives, and pulled out a frame at a time as the speakers are ready for it. Nothing comes
+ * out until there's enough to ride out the arrival times seen so far. If it does run out the gap's covered by
+ * concealment, and the target gets longer for a while. */
+typedef struct audio_jitter {
+    pthread_mutex_t lock;
+
+    int16_t *samples; // ring, interleaved
+    size_t   size, read, fill; // in samples per channel
+
+    uint8_t  channels;
+    uint32_t sample_rate;
+
+    bool     buffering; // waiting to reach the target before playing anything
+    uint32_t missing;   // frames concealed in a row
+
+    uint64_t last_arrival, last_duration; // in ns
+    uint64_t jitter;                      // in ns
+    uint32_t spike_ms;                    // added to the target after running out, wears off over time
+    uint32_t played;                      // frames played since the spike last wore down
+
+    AUDIO_JITTER_CONCEAL conceal;
+    void *               conceal_userdata;
+
+    int16_t last[AUDIO_JITTER_MAX_FRAME];
+
+    AUDIO_JITTER_STATS stats;
+} AUDIO_JITTER;
+
+/* Returns NULL if out of memory. */
+AUDIO_JITTER *audio_jitter_new(void);
+
+void audio_jitter_free(AUDIO_JITTER *jitter);
+
+/* Adds newly arrived audio. A change in channels or sample rate throws away whatever's waiting. Returns false if it
+ * can't be played. */
+bool audio_jitter_push(AUDIO_JITTER *jitter, const int16_t *pcm, size_t samples, uint8_t channels,
+                       uint32_t sample_rate);
+
+/* Takes the next frame to play, up to AUDIO_JITTER_MAX_FRAME samples into out. Returns how many samples per channel
+ * it is, 0 if there's nothing to play, with its format in channels and sample_rate.
+ *
+ * Only if conceal is set, for when there's nothing else left to play, is running out treated as audio gone missing
+ * and made up for. Otherwise the next audio might still come in time. */
+size_t audio_jitter_pull(AUDIO_JITTER *jitter, int16_t *out, uint8_t *channels, uint32_t *sample_rate, bool conceal);
+
+/* Throws away all the waiting audio, and starts over as if nothing had arrived yet. */
+void audio_jitter_flush(AUDIO_JITTER *jitter);
+
+/* Replaces how missing audio is made up, NULL for audio_jitter_conceal_fade(). */
+void audio_jitter_set_conceal(AUDIO_JITTER *jitter, AUDIO_JITTER_CONCEAL conceal, void *userdata);
+
+/* The default concealment, repeats the last frame half as loud each time. */
+void audio_jitter_conceal_fade(int16_t *out, const int16_t *last, size_t samples, uint8_t channels, uint32_t missing,
+                               void *userdata);
+
+void audio_jitter_stats(AUDIO_JITTER *jitter, AUDIO_JITTER_STATS *stats);
+
+#endif
@@ -0,0 +1,136 @@
+#include "audio_send.h"
+
+#include "audio.h"
+
+#include "../debug.h"
+#include "../friend.h"
+#include "../macros.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tox/toxav.h>
+
+typedef struct {
+    bool     group;
+    uint32_t number; // friend or group number
+} AUDIO_SINK;
+
+/* Grows as needed, friend calls and group calls share it. */
+static AUDIO_SINK *    audio_sinks;
+static size_t          audio_sink_count, audio_sink_size;
+static pthread_mutex_t audio_sinks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The audio thread's copy of the list, so it's not holding the lock while it sends. */
+static AUDIO_SINK *audio_sinks_sending;
+static size_t      audio_sinks_sending_size;
+
+/* Must be called with audio_sinks_lock held. */
+static bool audio_sinks_grow(void) {
+    const size_t size  = audio_sink_size ? audio_sink_size * 2 : UTOX_MAX_CALLS;
+    AUDIO_SINK * sinks = realloc(audio_sinks, size * sizeof(AUDIO_SINK));
+    if (!sinks) {
+        return false;
+    }
+
+    audio_sinks     = sinks;
+    audio_sink_size = size;
+    return true;
+}
+
+static bool audio_sink_set(bool group, uint32_t number, bool sending) {
+    const char *kind = group ? "group" : "friend";
+
+    pthread_mutex_lock(&audio_sinks_lock);
+
+    size_t i = 0;
+    while (i < audio_sink_count && (audio_sinks[i].group != group || audio_sinks[i].number != number)) {
+        i++;
+    }
+
+    bool ok = true;
+    if (sending && i == audio_sink_count) {
+        ok = audio_sink_count < audio_sink_size || audio_sinks_grow();
+        if (ok) {
+            audio_sinks[audio_sink_count++] = (AUDIO_SINK){ .group = group, .number = number };
+            LOG_INFO("uTox Audio", "Sending audio to %s %u, %lu audio calls now.", kind, number,
+                     (unsigned long)audio_sink_count);
+        } else {
+            LOG_ERR("uTox Audio", "Unable to allocate to send audio to %s %u, as well as %lu other calls.", kind,
+                    number, (unsigned long)audio_sink_count);
+        }
+    } else if (!sending && i < audio_sink_count) {
+        audio_sinks[i] = audio_sinks[--audio_sink_count];
+        LOG_INFO("uTox Audio", "Stopped sending audio to %s %u, %lu audio calls left.", kind, number,
+                 (unsigned long)audio_sink_count);
+    }
+
+    pthread_mutex_unlock(&audio_sinks_lock);
+    return ok;
+}
+
+bool audio_send_set(uint32_t friend_number, bool sending) {
+    return audio_sink_set(false, friend_number, sending);
+}
+
+bool audio_send_update(uint32_t friend_number) {
+    if (!get_friend(friend_number)) {
+        return audio_send_set(friend_number, false);
+    }
+
+    return audio_send_set(friend_number, UTOX_SEND_AUDIO(friend_number));
+}
+
+bool audio_send_group(uint32_t group_number, bool sending) {
+    return audio_sink_set(true, group_number, sending);
+}
+
+size_t audio_send_frame(ToxAV *av, const int16_t *pcm, size_t samples, uint8_t channels, uint32_t sample_rate) {
+    pthread_mutex_lock(&audio_sinks_lock);
+    if (audio_sinks_sending_size < audio_sink_size) {
+        AUDIO_SINK *sending = realloc(audio_sinks_sending, audio_sink_size * sizeof(AUDIO_SINK));
+        if (sending) {
+            audio_sinks_sending      = sending;
+            audio_sinks_sending_size = audio_sink_size;
+        } else {
+            LOG_ERR("uTox Audio", "Unable to allocate to send audio to %lu calls, only sending to %lu.",
+                    (unsigned long)audio_sink_count, (unsigned long)audio_sinks_sending_size);
+        }
+    }
+
+    AUDIO_SINK * sinks = audio_sinks_sending;
+    const size_t count = MIN(audio_sink_count, audio_sinks_sending_size);
+    if (count) {
+        memcpy(sinks, audio_sinks, count * sizeof(AUDIO_SINK));
+    }
+    pthread_mutex_unlock(&audio_sinks_lock);
+
+    size_t sent = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (sinks[i].group) {
+            if (toxav_group_send_audio(toxav_get_tox(av), sinks[i].number, pcm, samples, channels, sample_rate)) {
+                LOG_TRACE("uTox Audio", "toxav_group_send_audio error group == %u", sinks[i].number);
+                continue;
+            }
+        } else {
+            TOXAV_ERR_SEND_FRAME error = 0;
+            toxav_audio_send_frame(av, sinks[i].number, pcm, samples, channels, sample_rate, &error);
+            if (error) {
+                LOG_TRACE("uTox Audio", "toxav_send_audio error friend == %u, error ==  %i", sinks[i].number, error);
+                continue;
+            }
+        }
+
+        sent++;
+    }
+
+    return sent;
+}
+
+size_t audio_send_count(void) {
+    pthread_mutex_lock(&audio_sinks_lock);
+    const size_t count = audio_sink_count;
+    pthread_mutex_unlock(&audio_sinks_lock);
+
+    return count;
+}
@@ -0,0 +1,32 @@
+#ifndef AUDIO_SEND_H
+#define AUDIO_SEND_H
+
+#include "utox_av.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fanning captured audio out to calls and group calls.
+ *
+ * Whoever changes a friend's call state calls audio_send_update(), and whoever starts or ends a group call calls
+ * audio_send_group(). Between them they keep a list of everywhere we're sending audio, so the audio thread only ever
+ * looks at that list, instead of every friend and every group every frame. */
+
+/* Adds or removes the call from the list depending on whether we should be sending it audio. Any thread. Returns
+ * false if it couldn't be added, when out of memory. */
+bool audio_send_update(uint32_t friend_number);
+
+/* Same as audio_send_update(), for when the caller's already worked out what the friend's state is. */
+bool audio_send_set(uint32_t friend_number, bool sending);
+
+/* Adds or removes the group call from the list. Any thread. Returns false if it couldn't be added. */
+bool audio_send_group(uint32_t group_number, bool sending);
+
+/* Sends the frame to everywhere in the list. Returns how many calls and group calls it went to. Audio thread only. */
+size_t audio_send_frame(ToxAV *av, const int16_t *pcm, size_t samples, uint8_t channels, uint32_t sample_rate);
+
+/* How many calls and group calls are in the list. */
+size_t audio_send_count(void);
+
+#endif
@@ -0,0 +1,317 @@
+#include "colorspace.h"
+
+#include "../debug.h"
+#include "../macros.h"
+
+#include <pthread.h>
+
+/* Pixels of 24 bit BGR that are widened to BGRX at a time, so the BGRX kernels can convert them. */
+#define COLORSPACE_CHUNK 64
+
+static uint8_t rgb_to_y(int r, int g, int b) {
+    const int y = ((9798 * r + 19235 * g + 3736 * b) >> 15);
+    return y > 255 ? 255 : y < 0 ? 0 : y;
+}
+
+static uint8_t rgb_to_u(int r, int g, int b) {
+    const int u = ((-5538 * r + -10846 * g + 16351 * b) >> 15) + 128;
+    return u > 255 ? 255 : u < 0 ? 0 : u;
+}
+
+static uint8_t rgb_to_v(int r, int g, int b) {
+    const int v = ((16351 * r + -13697 * g + -2664 * b) >> 15) + 128;
+    return v > 255 ? 255 : v < 0 ? 0 : v;
+}
+
+static uint8_t yuv_clamp(int x) {
+    return x > 255 ? 255 : x < 0 ? 0 : x;
+}
+
+static size_t yuv420_to_bgrx_c(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *out, size_t width) {
+    for (size_t j = 0; j < width; ++j) {
+        const int t_y = y[j] < 16 ? 0 : y[j] - 16;
+        const int t_u = u[j / 2] - 128;
+        const int t_v = v[j / 2] - 128;
+
+        out[j * 4 + 2] = yuv_clamp((298 * t_y + 409 * t_v + 128) >> 8);
+        out[j * 4 + 1] = yuv_clamp((298 * t_y - 100 * t_u - 208 * t_v + 128) >> 8);
+        out[j * 4 + 0] = yuv_clamp((298 * t_y + 516 * t_u + 128) >> 8);
+        out[j * 4 + 3] = ~0;
+    }
+    return width;
+}
+
+static size_t yuv422_to_yuv420_c(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                 uint8_t *v, size_t width) {
+    for (size_t x = 0; x < width; x += 2) {
+        y0[x]     = row0[x * 2];
+        v[x / 2]  = row0[x * 2 + 1];
+        y0[x + 1] = row0[x * 2 + 2];
+        u[x / 2]  = row0[x * 2 + 3];
+
+        y1[x]     = row1[x * 2];
+        y1[x + 1] = row1[x * 2 + 2];
+    }
+    return width;
+}
+
+static size_t bgrx_to_yuv420_c(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u,
+                               uint8_t *v, size_t width) {
+    for (size_t x = 0; x < width; ++x) {
+        y0[x] = rgb_to_y(row0[x * 4 + 2], row0[x * 4 + 1], row0[x * 4]);
+        y1[x] = rgb_to_y(row1[x * 4 + 2], row1[x * 4 + 1], row1[x * 4]);
+    }
+
+    for (size_t x = 0; x < width; x += 2) {
+        const uint8_t *a = row0 + x * 4, *b = row1 + x * 4;
+
+        const int blue  = (a[0] + a[4] + b[0] + b[4] + 2) / 4;
+        const int green = (a[1] + a[5] + b[1] + b[5] + 2) / 4;
+        const int red   = (a[2] + a[6] + b[2] + b[6] + 2) / 4;
+
+        u[x / 2] = rgb_to_u(red, green, blue);
+        v[x / 2] = rgb_to_v(red, green, blue);
+    }
+    return width;
+}
+
+const COLORSPACE_KERNELS colorspace_c = {
+    .name             = "C",
+    .yuv420_to_bgrx   = yuv420_to_bgrx_c,
+    .yuv422_to_yuv420 = yuv422_to_yuv420_c,
+    .bgrx_to_yuv420   = bgrx_to_yuv420_c,
+};
+
+/* Best first, the C kernels always work so they come last. */
+static const COLORSPACE_KERNELS *const colorspace_all[] = {
+#ifdef COLORSPACE_X86
+    &colorspace_avx2,
+    &colorspace_sse2,
+#endif
+#ifdef COLORSPACE_NEON
+    &colorspace_neon,
+#endif
+    &colorspace_c,
+};
+
+static const COLORSPACE_KERNELS *kernels = &colorspace_c;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void colorspace_select(void) {
+    for (size_t i = 0; i < COUNTOF(colorspace_all); ++i) {
+        if (!colorspace_all[i]->supported || colorspace_all[i]->supported()) {
+            kernels = colorspace_all[i];
+            break;
+        }
+    }
+    LOG_INFO("Colorspace", "Converting video frames with the %s kernels", kernels->name);
+}
+
+static const COLORSPACE_KERNELS *colorspace_get(void) {
+    pthread_once(&kernels_once, colorspace_select);
+    return kernels;
+}
+
+const char *colorspace_kernels_name(void) {
+    return colorspace_get()->name;
+}
+
+/* The original whole frame conversions. Frames with odd sizes still go through these, the row kernels can't
+ * reproduce how they walk off the end of a row. */
+
+static void yuv422to420_frame(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width,
+                              uint16_t height) {
+    const uint8_t *end = input + width * height * 2;
+    while (input != end) {
+        uint8_t *line_end = input + width * 2;
+        while (input != line_end) {
+            *plane_y++ = *input++;
+            *plane_v++ = *input++;
+            *plane_y++ = *input++;
+            *plane_u++ = *input++;
+        }
+
+        line_end = input + width * 2;
+        while (input != line_end) {
+            *plane_y++ = *input++;
+            input++; // u
+            *plane_y++ = *input++;
+            input++; // v
+        }
+    }
+}
+
+static void bgrtoyuv420_frame(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width,
+                              uint16_t height) {
+    uint8_t *p;
+    uint8_t  r, g, b;
+
+    for (uint16_t y = 0; y != height; y += 2) {
+        p = rgb;
+        for (uint16_t x = 0; x != width; x++) {
+            b          = *rgb++;
+            g          = *rgb++;
+            r          = *rgb++;
+            *plane_y++ = rgb_to_y(r, g, b);
+        }
+
+        for (uint16_t x = 0; x != width / 2; x++) {
+            b          = *rgb++;
+            g          = *rgb++;
+            r          = *rgb++;
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b          = *rgb++;
+            g          = *rgb++;
+            r          = *rgb++;
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = ((int)b + (int)*(rgb - 6) + (int)*p + (int)*(p + 3) + 2) / 4;
+            p++;
+            g = ((int)g + (int)*(rgb - 5) + (int)*p + (int)*(p + 3) + 2) / 4;
+            p++;
+            r = ((int)r + (int)*(rgb - 4) + (int)*p + (int)*(p + 3) + 2) / 4;
+            p++;
+
+            *plane_u++ = rgb_to_u(r, g, b);
+            *plane_v++ = rgb_to_v(r, g, b);
+
+            p += 3;
+        }
+    }
+}
+
+static void bgrxtoyuv420_frame(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width,
+                               uint16_t height) {
+    uint8_t *p;
+    uint8_t  r, g, b;
+
+    for (uint16_t y = 0; y != height; y += 2) {
+        p = rgb;
+        for (uint16_t x = 0; x != width; x++) {
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            rgb++;
+
+            *plane_y++ = rgb_to_y(r, g, b);
+        }
+
+        for (uint16_t x = 0; x != width / 2; x++) {
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            rgb++;
+
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = *rgb++;
+            g = *rgb++;
+            r = *rgb++;
+            rgb++;
+
+            *plane_y++ = rgb_to_y(r, g, b);
+
+            b = ((int)b + (int)*(rgb - 8) + (int)*p + (int)*(p + 4) + 2) / 4;
+            p++;
+            g = ((int)g + (int)*(rgb - 7) + (int)*p + (int)*(p + 4) + 2) / 4;
+            p++;
+            r = ((int)r + (int)*(rgb - 6) + (int)*p + (int)*(p + 4) + 2) / 4;
+            p++;
+            p++;
+
+            *plane_u++ = rgb_to_u(r, g, b);
+            *plane_v++ = rgb_to_v(r, g, b);
+
+            p += 4;
+        }
+    }
+}
+
+void yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                 unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out) {
+    const COLORSPACE_KERNELS *k = colorspace_get();
+
+    for (size_t i = 0; i < height; ++i) {
+        const uint8_t *row_y = y + i * ystride, *row_u = u + (i / 2) * ustride, *row_v = v + (i / 2) * vstride;
+        uint8_t *      row   = out + i * width * 4;
+
+        size_t done = k->yuv420_to_bgrx(row_y, row_u, row_v, row, width);
+        yuv420_to_bgrx_c(row_y + done, row_u + done / 2, row_v + done / 2, row + done * 4, width - done);
+    }
+}
+
+void yuv422to420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width, uint16_t height) {
+    if ((width | height) & 1) {
+        yuv422to420_frame(plane_y, plane_u, plane_v, input, width, height);
+        return;
+    }
+
+    const COLORSPACE_KERNELS *k = colorspace_get();
+
+    for (size_t i = 0; i < height; i += 2) {
+        const uint8_t *row0 = input + i * width * 2, *row1 = row0 + width * 2;
+        uint8_t *      y0 = plane_y + i * width, *y1 = y0 + width;
+        uint8_t *      u = plane_u + i / 2 * width / 2, *v = plane_v + i / 2 * width / 2;
+
+        size_t done = k->yuv422_to_yuv420(row0, row1, y0, y1, u, v, width);
+        yuv422_to_yuv420_c(row0 + done * 2, row1 + done * 2, y0 + done, y1 + done, u + done / 2, v + done / 2,
+                           width - done);
+    }
+}
+
+static void bgrx_rows(const COLORSPACE_KERNELS *k, const uint8_t *row0, const uint8_t *row1, uint8_t *y0,
+                      uint8_t *y1, uint8_t *u, uint8_t *v, size_t width) {
+    size_t done = k->bgrx_to_yuv420(row0, row1, y0, y1, u, v, width);
+    bgrx_to_yuv420_c(row0 + done * 4, row1 + done * 4, y0 + done, y1 + done, u + done / 2, v + done / 2,
+                     width - done);
+}
+
+void bgrxtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height) {
+    if ((width | height) & 1) {
+        bgrxtoyuv420_frame(plane_y, plane_u, plane_v, rgb, width, height);
+        return;
+    }
+
+    const COLORSPACE_KERNELS *k = colorspace_get();
+
+    for (size_t i = 0; i < height; i += 2) {
+        const uint8_t *row0 = rgb + i * width * 4;
+        uint8_t *      y0   = plane_y + i * width;
+
+        bgrx_rows(k, row0, row0 + width * 4, y0, y0 + width, plane_u + i / 2 * width / 2,
+                  plane_v + i / 2 * width / 2, width);
+    }
+}
+
+static void bgr_widen(const uint8_t *bgr, uint8_t *bgrx, size_t width) {
+    for (size_t x = 0; x < width; ++x) {
+        bgrx[x * 4]     = bgr[x * 3];
+        bgrx[x * 4 + 1] = bgr[x * 3 + 1];
+        bgrx[x * 4 + 2] = bgr[x * 3 + 2];
+        bgrx[x * 4 + 3] = 0;
+    }
+}
+
+void bgrtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height) {
+    if ((width | height) & 1) {
+        bgrtoyuv420_frame(plane_y, plane_u, plane_v, rgb, width, height);
+        return;
+    }
+
+    const COLORSPACE_KERNELS *k = colorspace_get();
+    uint8_t                   rows[2][COLORSPACE_CHUNK * 4];
+
+    for (size_t i = 0; i < height; i += 2) {
+        const uint8_t *row0 = rgb + i * width * 3, *row1 = row0 + width * 3;
+        uint8_t *      y0 = plane_y + i * width, *y1 = y0 + width;
+        uint8_t *      u = plane_u + i / 2 * width / 2, *v = plane_v + i / 2 * width / 2;
+
+        for (size_t x = 0; x < width; x += COLORSPACE_CHUNK) {
+            const size_t count = MIN(width - x, COLORSPACE_CHUNK);
+            bgr_widen(row0 + x * 3, rows[0], count);
+            bgr_widen(row1 + x * 3, rows[1], count);
+            bgrx_rows(k, rows[0], rows[1], y0 + x, y1 + x, u + x / 2, v + x / 2, count);
+        }
+    }
+}
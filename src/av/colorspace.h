@@ -0,0 +1,50 @@
+#ifndef COLORSPACE_H
+#define COLORSPACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Color format conversion functions
+//
+// These pick the fastest kernels the CPU supports the first time they're called. Every kernel gives exactly the same
+// output as the plain C one.
+
+void yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                 unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out);
+void yuv422to420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width, uint16_t height);
+void bgrtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height);
+void bgrxtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height);
+
+/* Name of the kernels in use, for logging. */
+const char *colorspace_kernels_name(void);
+
+/* A set of row kernels for one instruction set.
+ *
+ * Each kernel converts as many whole blocks of pixels from the start of the row as it can, and returns how many
+ * pixels that was. The rest of the row is left for the plain C kernels. yuv422 and bgrx kernels take a pair of rows,
+ * the second of which shares the first one's chroma, and are only ever given an even width. */
+typedef struct colorspace_kernels {
+    const char *name;
+    bool (*supported)(void); // NULL if this build can always use them
+
+    size_t (*yuv420_to_bgrx)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *out, size_t width);
+    size_t (*yuv422_to_yuv420)(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u,
+                               uint8_t *v, size_t width);
+    size_t (*bgrx_to_yuv420)(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u,
+                             uint8_t *v, size_t width);
+} COLORSPACE_KERNELS;
+
+#if defined __x86_64__ || defined __i386__ || defined _M_X64 || defined _M_IX86
+#define COLORSPACE_X86
+extern const COLORSPACE_KERNELS colorspace_sse2, colorspace_avx2;
+#endif
+
+#if defined __ARM_NEON || defined __ARM_NEON__
+#define COLORSPACE_NEON
+extern const COLORSPACE_KERNELS colorspace_neon;
+#endif
+
+extern const COLORSPACE_KERNELS colorspace_c;
+
+#endif
@@ -0,0 +1,128 @@
+#include "colorspace.h"
+
+/* NEON kernels. NEON is part of every ARMv8 CPU and 32 bit builds only get here when they're built for it, so unlike
+ * on x86 there's nothing to check at runtime.
+ *
+ * Widening multiplies keep the arithmetic in 32 bits just like the C kernels, and the saturating narrows at the end
+ * are the clamp to 0 - 255. */
+
+#ifdef COLORSPACE_NEON
+
+#include <arm_neon.h>
+
+/* 8 pixels of BGRX from 8 luma and 8 already doubled up chroma samples. */
+static void yuv_to_bgrx_neon(uint8x8_t y, uint8x8_t u, uint8x8_t v, uint8_t *out) {
+    const int16x8_t yw = vreinterpretq_s16_u16(vsubl_u8(vmax_u8(y, vdup_n_u8(16)), vdup_n_u8(16)));
+    const int16x8_t uw = vreinterpretq_s16_u16(vsubl_u8(u, vdup_n_u8(128)));
+    const int16x8_t vw = vreinterpretq_s16_u16(vsubl_u8(v, vdup_n_u8(128)));
+    const int32x4_t round = vdupq_n_s32(128);
+
+    int32x4_t y_lo = vmlaq_n_s32(round, vmovl_s16(vget_low_s16(yw)), 298);
+    int32x4_t y_hi = vmlaq_n_s32(round, vmovl_s16(vget_high_s16(yw)), 298);
+
+    int32x4_t r_lo = vmlal_n_s16(y_lo, vget_low_s16(vw), 409), r_hi = vmlal_n_s16(y_hi, vget_high_s16(vw), 409);
+    int32x4_t b_lo = vmlal_n_s16(y_lo, vget_low_s16(uw), 516), b_hi = vmlal_n_s16(y_hi, vget_high_s16(uw), 516);
+    int32x4_t g_lo = vmlal_n_s16(vmlal_n_s16(y_lo, vget_low_s16(uw), -100), vget_low_s16(vw), -208);
+    int32x4_t g_hi = vmlal_n_s16(vmlal_n_s16(y_hi, vget_high_s16(uw), -100), vget_high_s16(vw), -208);
+
+    uint8x8x4_t px;
+    px.val[0] = vqmovun_s16(vcombine_s16(vshrn_n_s32(b_lo, 8), vshrn_n_s32(b_hi, 8)));
+    px.val[1] = vqmovun_s16(vcombine_s16(vshrn_n_s32(g_lo, 8), vshrn_n_s32(g_hi, 8)));
+    px.val[2] = vqmovun_s16(vcombine_s16(vshrn_n_s32(r_lo, 8), vshrn_n_s32(r_hi, 8)));
+    px.val[3] = vdup_n_u8(0xFF);
+    vst4_u8(out, px);
+}
+
+static size_t yuv420_to_bgrx_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *out, size_t width) {
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t  yy = vld1q_u8(y + x);
+        uint8x8x2_t uu = vzip_u8(vld1_u8(u + x / 2), vld1_u8(u + x / 2));
+        uint8x8x2_t vv = vzip_u8(vld1_u8(v + x / 2), vld1_u8(v + x / 2));
+
+        yuv_to_bgrx_neon(vget_low_u8(yy), uu.val[0], vv.val[0], out + x * 4);
+        yuv_to_bgrx_neon(vget_high_u8(yy), uu.val[1], vv.val[1], out + x * 4 + 32);
+    }
+    return x;
+}
+
+static size_t yuv422_to_yuv420_neon(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                    uint8_t *v, size_t width) {
+    size_t x = 0;
+    for (; x + 32 <= width; x += 32) {
+        // y v y u
+        uint8x16x4_t in = vld4q_u8(row0 + x * 2);
+        uint8x16x2_t luma = { { in.val[0], in.val[2] } };
+        vst2q_u8(y0 + x, luma);
+        vst1q_u8(v + x / 2, in.val[1]);
+        vst1q_u8(u + x / 2, in.val[3]);
+
+        vst1q_u8(y1 + x, vld2q_u8(row1 + x * 2).val[0]);
+        vst1q_u8(y1 + x + 16, vld2q_u8(row1 + x * 2 + 32).val[0]);
+    }
+    return x;
+}
+
+static uint8x8_t bgrx_luma_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+    const uint16x8_t rw = vmovl_u8(r), gw = vmovl_u8(g), bw = vmovl_u8(b);
+
+    uint32x4_t lo = vmull_n_u16(vget_low_u16(rw), 9798);
+    lo            = vmlal_n_u16(lo, vget_low_u16(gw), 19235);
+    lo            = vmlal_n_u16(lo, vget_low_u16(bw), 3736);
+
+    uint32x4_t hi = vmull_n_u16(vget_high_u16(rw), 9798);
+    hi            = vmlal_n_u16(hi, vget_high_u16(gw), 19235);
+    hi            = vmlal_n_u16(hi, vget_high_u16(bw), 3736);
+
+    return vqmovn_u16(vcombine_u16(vshrn_n_u32(lo, 15), vshrn_n_u32(hi, 15)));
+}
+
+/* One chroma plane for 8 averaged pixels. */
+static uint8x8_t bgrx_chroma_neon(int16x8_t r, int16x8_t g, int16x8_t b, int16_t cr, int16_t cg, int16_t cb) {
+    int32x4_t lo = vmull_n_s16(vget_low_s16(r), cr);
+    lo           = vmlal_n_s16(lo, vget_low_s16(g), cg);
+    lo           = vmlal_n_s16(lo, vget_low_s16(b), cb);
+
+    int32x4_t hi = vmull_n_s16(vget_high_s16(r), cr);
+    hi           = vmlal_n_s16(hi, vget_high_s16(g), cg);
+    hi           = vmlal_n_s16(hi, vget_high_s16(b), cb);
+
+    int16x8_t sum = vcombine_s16(vshrn_n_s32(lo, 15), vshrn_n_s32(hi, 15));
+    return vqmovun_s16(vaddq_s16(sum, vdupq_n_s16(128)));
+}
+
+/* (a0 + a1 + b0 + b1 + 2) / 4 for each neighbouring pair. */
+static int16x8_t bgrx_average_neon(uint8x16_t a, uint8x16_t b) {
+    return vreinterpretq_s16_u16(vshrq_n_u16(vaddq_u16(vaddq_u16(vpaddlq_u8(a), vpaddlq_u8(b)), vdupq_n_u16(2)), 2));
+}
+
+static size_t bgrx_to_yuv420_neon(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *u,
+                                  uint8_t *v, size_t width) {
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // b g r x
+        uint8x16x4_t a = vld4q_u8(row0 + x * 4), b = vld4q_u8(row1 + x * 4);
+
+        vst1q_u8(y0 + x, vcombine_u8(bgrx_luma_neon(vget_low_u8(a.val[2]), vget_low_u8(a.val[1]), vget_low_u8(a.val[0])),
+                                     bgrx_luma_neon(vget_high_u8(a.val[2]), vget_high_u8(a.val[1]), vget_high_u8(a.val[0]))));
+        vst1q_u8(y1 + x, vcombine_u8(bgrx_luma_neon(vget_low_u8(b.val[2]), vget_low_u8(b.val[1]), vget_low_u8(b.val[0])),
+                                     bgrx_luma_neon(vget_high_u8(b.val[2]), vget_high_u8(b.val[1]), vget_high_u8(b.val[0]))));
+
+        int16x8_t blue  = bgrx_average_neon(a.val[0], b.val[0]);
+        int16x8_t green = bgrx_average_neon(a.val[1], b.val[1]);
+        int16x8_t red   = bgrx_average_neon(a.val[2], b.val[2]);
+
+        vst1_u8(u + x / 2, bgrx_chroma_neon(red, green, blue, -5538, -10846, 16351));
+        vst1_u8(v + x / 2, bgrx_chroma_neon(red, green, blue, 16351, -13697, -2664));
+    }
+    return x;
+}
+
+const COLORSPACE_KERNELS colorspace_neon = {
+    .name             = "NEON",
+    .yuv420_to_bgrx   = yuv420_to_bgrx_neon,
+    .yuv422_to_yuv420 = yuv422_to_yuv420_neon,
+    .bgrx_to_yuv420   = bgrx_to_yuv420_neon,
+};
+
+#endif
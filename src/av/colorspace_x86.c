@@ -0,0 +1,302 @@
+#include "colorspace.h"
+
+/* SSE2 and AVX2 kernels. They're built with target attributes instead of compiler flags, so the rest of uTox still
+ * runs on CPUs without them, and the dispatch in colorspace.c only picks them when __builtin_cpu_supports() says so.
+ *
+ * All the arithmetic is done exactly the way the C kernels do it. Products go through madd into 32 bits, so nothing
+ * is rounded differently, and the final clamp to 0 - 255 is the saturation when packing back down to bytes. */
+
+#ifdef COLORSPACE_X86
+
+#include <immintrin.h>
+#include <string.h>
+
+/* Lets madd multiply every pair of 16 bit lanes by a and b. */
+#define COLORSPACE_PAIR(a, b) ((int32_t)(((uint32_t)(uint16_t)(b) << 16) | (uint16_t)(a)))
+
+/* Coefficients for madd on widened BGRX pixels, b g r x in each group of four lanes. */
+#define COLORSPACE_BGRX(b, g, r) (b), (g), (r), 0, (b), (g), (r), 0
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+static bool sse2_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static bool avx2_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/* 8 pixels of BGRX from 8 luma and 8 already doubled up chroma samples, all widened to 16 bits. */
+SSE2 static void yuv_to_bgrx_sse2(__m128i y, __m128i u, __m128i v, uint8_t *out) {
+    const __m128i round = _mm_set1_epi32(128), one = _mm_set1_epi16(1);
+
+    y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    __m128i yv_lo = _mm_unpacklo_epi16(y, v), yv_hi = _mm_unpackhi_epi16(y, v);
+    __m128i yu_lo = _mm_unpacklo_epi16(y, u), yu_hi = _mm_unpackhi_epi16(y, u);
+    __m128i v1_lo = _mm_unpacklo_epi16(v, one), v1_hi = _mm_unpackhi_epi16(v, one);
+
+    const __m128i rc = _mm_set1_epi32(COLORSPACE_PAIR(298, 409)), gc = _mm_set1_epi32(COLORSPACE_PAIR(298, -100)),
+                  gv = _mm_set1_epi32(COLORSPACE_PAIR(-208, 128)), bc = _mm_set1_epi32(COLORSPACE_PAIR(298, 516));
+
+    __m128i r = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv_lo, rc), round), 8),
+                                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv_hi, rc), round), 8));
+    __m128i g = _mm_packs_epi32(
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu_lo, gc), _mm_madd_epi16(v1_lo, gv)), 8),
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu_hi, gc), _mm_madd_epi16(v1_hi, gv)), 8));
+    __m128i b = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu_lo, bc), round), 8),
+                                _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu_hi, bc), round), 8));
+
+    r = _mm_packus_epi16(r, r);
+    g = _mm_packus_epi16(g, g);
+    b = _mm_packus_epi16(b, b);
+
+    __m128i bg = _mm_unpacklo_epi8(b, g), ra = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1));
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi16(bg, ra));
+}
+
+SSE2 static size_t yuv420_to_bgrx_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *out,
+                                       size_t width) {
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        int32_t u4, v4;
+        memcpy(&u4, u + x / 2, sizeof(u4));
+        memcpy(&v4, v + x / 2, sizeof(v4));
+
+        __m128i yy = _mm_max_epu8(_mm_loadl_epi64((const __m128i *)(y + x)), _mm_set1_epi8(16));
+        __m128i uu = _mm_cvtsi32_si128(u4), vv = _mm_cvtsi32_si128(v4);
+
+        yuv_to_bgrx_sse2(_mm_unpacklo_epi8(yy, zero), _mm_unpacklo_epi8(_mm_unpacklo_epi8(uu, uu), zero),
+                         _mm_unpacklo_epi8(_mm_unpacklo_epi8(vv, vv), zero), out + x * 4);
+    }
+    return x;
+}
+
+SSE2 static size_t yuv422_to_yuv420_sse2(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                                         uint8_t *u, uint8_t *v, size_t width) {
+    const __m128i low = _mm_set1_epi16(0xFF), zero = _mm_setzero_si128();
+
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(row0 + x * 2)),
+                b = _mm_loadu_si128((const __m128i *)(row0 + x * 2 + 16));
+
+        _mm_storeu_si128((__m128i *)(y0 + x), _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+
+        // v u v u ...
+        __m128i vu = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storel_epi64((__m128i *)(v + x / 2), _mm_packus_epi16(_mm_and_si128(vu, low), zero));
+        _mm_storel_epi64((__m128i *)(u + x / 2), _mm_packus_epi16(_mm_srli_epi16(vu, 8), zero));
+
+        a = _mm_loadu_si128((const __m128i *)(row1 + x * 2));
+        b = _mm_loadu_si128((const __m128i *)(row1 + x * 2 + 16));
+        _mm_storeu_si128((__m128i *)(y1 + x), _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+    }
+    return x;
+}
+
+/* Adds neighbouring pairs of 32 bit lanes, giving a0+a1, a2+a3, b0+b1, b2+b3. */
+SSE2 static __m128i hadd_sse2(__m128i a, __m128i b) {
+    __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 odd  = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+}
+
+/* Luma for 8 pixels of BGRX, as 8 bytes in the low half. */
+SSE2 static __m128i bgrx_luma_sse2(__m128i a, __m128i b) {
+    const __m128i zero = _mm_setzero_si128(), c = _mm_setr_epi16(COLORSPACE_BGRX(3736, 19235, 9798));
+
+    __m128i lo = hadd_sse2(_mm_madd_epi16(_mm_unpacklo_epi8(a, zero), c), _mm_madd_epi16(_mm_unpackhi_epi8(a, zero), c));
+    __m128i hi = hadd_sse2(_mm_madd_epi16(_mm_unpacklo_epi8(b, zero), c), _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), c));
+
+    lo = _mm_packs_epi32(_mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15));
+    return _mm_packus_epi16(lo, lo);
+}
+
+/* Averages 4 pixels from each row down to 2, as widened b g r x. */
+SSE2 static __m128i bgrx_average_sse2(__m128i a, __m128i b) {
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    lo         = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    hi         = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+    return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_set1_epi16(2)), 2);
+}
+
+/* One chroma plane for 4 averaged pixels, as 4 bytes in the low quarter. */
+SSE2 static __m128i bgrx_chroma_sse2(__m128i avg0, __m128i avg1, __m128i c) {
+    __m128i sum = _mm_srai_epi32(hadd_sse2(_mm_madd_epi16(avg0, c), _mm_madd_epi16(avg1, c)), 15);
+    sum         = _mm_add_epi32(sum, _mm_set1_epi32(128));
+    sum         = _mm_packs_epi32(sum, sum);
+    return _mm_packus_epi16(sum, sum);
+}
+
+SSE2 static size_t bgrx_to_yuv420_sse2(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                                       uint8_t *u, uint8_t *v, size_t width) {
+    const __m128i uc = _mm_setr_epi16(COLORSPACE_BGRX(16351, -10846, -5538)),
+                  vc = _mm_setr_epi16(COLORSPACE_BGRX(-2664, -13697, 16351));
+
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + x * 4)),
+                a1 = _mm_loadu_si128((const __m128i *)(row0 + x * 4 + 16)),
+                b0 = _mm_loadu_si128((const __m128i *)(row1 + x * 4)),
+                b1 = _mm_loadu_si128((const __m128i *)(row1 + x * 4 + 16));
+
+        _mm_storel_epi64((__m128i *)(y0 + x), bgrx_luma_sse2(a0, a1));
+        _mm_storel_epi64((__m128i *)(y1 + x), bgrx_luma_sse2(b0, b1));
+
+        __m128i avg0 = bgrx_average_sse2(a0, b0), avg1 = bgrx_average_sse2(a1, b1);
+
+        int32_t out = _mm_cvtsi128_si32(bgrx_chroma_sse2(avg0, avg1, uc));
+        memcpy(u + x / 2, &out, sizeof(out));
+        out = _mm_cvtsi128_si32(bgrx_chroma_sse2(avg0, avg1, vc));
+        memcpy(v + x / 2, &out, sizeof(out));
+    }
+    return x;
+}
+
+const COLORSPACE_KERNELS colorspace_sse2 = {
+    .name             = "SSE2",
+    .supported        = sse2_supported,
+    .yuv420_to_bgrx   = yuv420_to_bgrx_sse2,
+    .yuv422_to_yuv420 = yuv422_to_yuv420_sse2,
+    .bgrx_to_yuv420   = bgrx_to_yuv420_sse2,
+};
+
+/* AVX2 works on two 128 bit lanes that unpack and pack separately, the comments give the pixels in each lane. */
+
+AVX2 static size_t yuv420_to_bgrx_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *out,
+                                       size_t width) {
+    const __m256i round = _mm256_set1_epi32(128), one = _mm256_set1_epi16(1);
+    const __m256i rc = _mm256_set1_epi32(COLORSPACE_PAIR(298, 409)), gc = _mm256_set1_epi32(COLORSPACE_PAIR(298, -100)),
+                  gv = _mm256_set1_epi32(COLORSPACE_PAIR(-208, 128)), bc = _mm256_set1_epi32(COLORSPACE_PAIR(298, 516));
+
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i yy = _mm_max_epu8(_mm_loadu_si128((const __m128i *)(y + x)), _mm_set1_epi8(16));
+        __m128i uu = _mm_loadl_epi64((const __m128i *)(u + x / 2)), vv = _mm_loadl_epi64((const __m128i *)(v + x / 2));
+
+        __m256i yw = _mm256_sub_epi16(_mm256_cvtepu8_epi16(yy), _mm256_set1_epi16(16));
+        __m256i uw = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(uu, uu)), _mm256_set1_epi16(128));
+        __m256i vw = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(vv, vv)), _mm256_set1_epi16(128));
+
+        // lo: 0-3 | 8-11, hi: 4-7 | 12-15, so packing them puts everything back in order.
+        __m256i yv_lo = _mm256_unpacklo_epi16(yw, vw), yv_hi = _mm256_unpackhi_epi16(yw, vw);
+        __m256i yu_lo = _mm256_unpacklo_epi16(yw, uw), yu_hi = _mm256_unpackhi_epi16(yw, uw);
+        __m256i v1_lo = _mm256_unpacklo_epi16(vw, one), v1_hi = _mm256_unpackhi_epi16(vw, one);
+
+        __m256i r = _mm256_packs_epi32(
+            _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yv_lo, rc), round), 8),
+            _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yv_hi, rc), round), 8));
+        __m256i g = _mm256_packs_epi32(
+            _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yu_lo, gc), _mm256_madd_epi16(v1_lo, gv)), 8),
+            _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yu_hi, gc), _mm256_madd_epi16(v1_hi, gv)), 8));
+        __m256i b = _mm256_packs_epi32(
+            _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yu_lo, bc), round), 8),
+            _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(yu_hi, bc), round), 8));
+
+        const __m256i zero = _mm256_setzero_si256(), max = _mm256_set1_epi16(255);
+        r = _mm256_min_epi16(_mm256_max_epi16(r, zero), max);
+        g = _mm256_min_epi16(_mm256_max_epi16(g, zero), max);
+        b = _mm256_min_epi16(_mm256_max_epi16(b, zero), max);
+
+        __m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+        __m256i ra = _mm256_or_si256(r, _mm256_set1_epi16((int16_t)0xFF00));
+
+        // lo: 0-3 | 8-11, hi: 4-7 | 12-15
+        __m256i lo = _mm256_unpacklo_epi16(bg, ra), hi = _mm256_unpackhi_epi16(bg, ra);
+        _mm256_storeu_si256((__m256i *)(out + x * 4), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + x * 4 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    /* Let SSE2 have a go at what's left before it drops to C. */
+    return x + yuv420_to_bgrx_sse2(y + x, u + x / 2, v + x / 2, out + x * 4, width - x);
+}
+
+/* Luma for 8 pixels of BGRX, as 8 32 bit lanes in order. */
+AVX2 static __m256i bgrx_luma_avx2(__m256i px) {
+    const __m256i zero = _mm256_setzero_si256(), c = _mm256_setr_epi16(
+                                                       COLORSPACE_BGRX(3736, 19235, 9798), COLORSPACE_BGRX(3736, 19235, 9798));
+
+    // lo: 0-1 | 4-5, hi: 2-3 | 6-7, so the sums come out 0-3 | 4-7.
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), c);
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), c);
+    return _mm256_srai_epi32(_mm256_hadd_epi32(lo, hi), 15);
+}
+
+/* Averages 8 pixels from each row down to 4 widened b g r x, 0-1 | 2-3. */
+AVX2 static __m256i bgrx_average_avx2(__m256i a, __m256i b) {
+    const __m256i zero = _mm256_setzero_si256();
+
+    // lo: 0-1 | 4-5, hi: 2-3 | 6-7
+    __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+    __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+    lo         = _mm256_add_epi16(lo, _mm256_bsrli_epi128(lo, 8));
+    hi         = _mm256_add_epi16(hi, _mm256_bsrli_epi128(hi, 8));
+
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_set1_epi16(2)), 2);
+}
+
+/* One chroma plane for 8 averaged pixels, as 8 bytes. */
+AVX2 static __m128i bgrx_chroma_avx2(__m256i avg0, __m256i avg1, __m256i c) {
+    // 0-1, 4-5 | 2-3, 6-7
+    __m256i sum = _mm256_hadd_epi32(_mm256_madd_epi16(avg0, c), _mm256_madd_epi16(avg1, c));
+    sum         = _mm256_permutevar8x32_epi32(sum, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+    sum         = _mm256_add_epi32(_mm256_srai_epi32(sum, 15), _mm256_set1_epi32(128));
+
+    __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return _mm_packus_epi16(packed, packed);
+}
+
+/* Packs 16 32 bit lanes that are in order down to bytes. */
+AVX2 static __m128i pack_bytes_avx2(__m256i a, __m256i b) {
+    __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+}
+
+AVX2 static size_t bgrx_to_yuv420_avx2(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                                       uint8_t *u, uint8_t *v, size_t width) {
+    const __m256i uc = _mm256_setr_epi16(COLORSPACE_BGRX(16351, -10846, -5538), COLORSPACE_BGRX(16351, -10846, -5538)),
+                  vc = _mm256_setr_epi16(COLORSPACE_BGRX(-2664, -13697, 16351), COLORSPACE_BGRX(-2664, -13697, 16351));
+
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(row0 + x * 4)),
+                a1 = _mm256_loadu_si256((const __m256i *)(row0 + x * 4 + 32)),
+                b0 = _mm256_loadu_si256((const __m256i *)(row1 + x * 4)),
+                b1 = _mm256_loadu_si256((const __m256i *)(row1 + x * 4 + 32));
+
+        _mm_storeu_si128((__m128i *)(y0 + x), pack_bytes_avx2(bgrx_luma_avx2(a0), bgrx_luma_avx2(a1)));
+        _mm_storeu_si128((__m128i *)(y1 + x), pack_bytes_avx2(bgrx_luma_avx2(b0), bgrx_luma_avx2(b1)));
+
+        __m256i avg0 = bgrx_average_avx2(a0, b0), avg1 = bgrx_average_avx2(a1, b1);
+        _mm_storel_epi64((__m128i *)(u + x / 2), bgrx_chroma_avx2(avg0, avg1, uc));
+        _mm_storel_epi64((__m128i *)(v + x / 2), bgrx_chroma_avx2(avg0, avg1, vc));
+    }
+
+    /* Let SSE2 have a go at what's left before it drops to C. */
+    return x + bgrx_to_yuv420_sse2(row0 + x * 4, row1 + x * 4, y0 + x, y1 + x, u + x / 2, v + x / 2, width - x);
+}
+
+/* Splitting yuv422 up is all shuffling and bound by memory, SSE2 already keeps up with it. */
+const COLORSPACE_KERNELS colorspace_avx2 = {
+    .name             = "AVX2",
+    .supported        = avx2_supported,
+    .yuv420_to_bgrx   = yuv420_to_bgrx_avx2,
+    .yuv422_to_yuv420 = yuv422_to_yuv420_sse2,
+    .bgrx_to_yuv420   = bgrx_to_yuv420_avx2,
+};
+
+#endif
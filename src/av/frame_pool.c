@@ -0,0 +1,168 @@
+#include "frame_pool.h"
+
+#include "../debug.h"
+
+#include <stdlib.h>
+
+static void frame_free(UTOX_FRAME_PKG *frame) {
+    free(frame->img);
+    free(frame);
+}
+
+FRAME_POOL *frame_pool_new(void) {
+    FRAME_POOL *pool = calloc(1, sizeof(FRAME_POOL));
+    if (!pool) {
+        LOG_ERR("Frame Pool", "Unable to allocate a frame pool.");
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+/* Called with the lock held. Frees the pool if it's been let go of and nothing's in flight. Returns true if it did,
+ * the lock's gone with it then. */
+static bool frame_pool_reap(FRAME_POOL *pool) {
+    if (!pool->orphaned || pool->in_flight) {
+        return false;
+    }
+
+    while (pool->idle) {
+        UTOX_FRAME_PKG *next = pool->idle->next;
+        frame_free(pool->idle);
+        pool->idle = next;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+    return true;
+}
+
+void frame_pool_free(FRAME_POOL *pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->orphaned = true;
+    if (!frame_pool_reap(pool)) {
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+UTOX_FRAME_PKG *frame_pool_get(FRAME_POOL *pool, uint16_t w, uint16_t h) {
+    const size_t size = (size_t)w * h * 4;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->in_flight >= FRAME_POOL_DEPTH) {
+        pool->stats.dropped++;
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+
+    UTOX_FRAME_PKG *frame = pool->idle;
+    if (frame) {
+        pool->idle = frame->next;
+        pool->idle_count--;
+    }
+    pool->in_flight++;
+
+    if (frame && frame->capacity >= size) {
+        pool->stats.hits++;
+    } else {
+        pool->stats.misses++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!frame) {
+        frame = calloc(1, sizeof(UTOX_FRAME_PKG));
+        if (!frame) {
+            LOG_ERR("Frame Pool", "Unable to allocate a frame.");
+            goto fail;
+        }
+        frame->pool = pool;
+    }
+
+    if (frame->capacity < size) {
+        /* Nothing in the old image is worth copying, so don't let realloc do it. */
+        free(frame->img);
+        frame->capacity = 0;
+        frame->img      = malloc(size);
+        if (!frame->img) {
+            LOG_ERR("Frame Pool", "Unable to allocate a %ux%u frame.", w, h);
+            free(frame);
+            goto fail;
+        }
+        frame->capacity = size;
+    }
+
+    frame->w    = w;
+    frame->h    = h;
+    frame->size = size;
+    frame->next = NULL;
+    atomic_store_explicit(&frame->refs, 1, memory_order_relaxed);
+    return frame;
+
+fail:
+    pthread_mutex_lock(&pool->lock);
+    pool->in_flight--;
+    if (!frame_pool_reap(pool)) {
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+void frame_ref(UTOX_FRAME_PKG *frame) {
+    atomic_fetch_add_explicit(&frame->refs, 1, memory_order_relaxed);
+}
+
+void frame_release(UTOX_FRAME_PKG *frame) {
+    if (!frame || atomic_fetch_sub_explicit(&frame->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    FRAME_POOL *pool = frame->pool;
+    pthread_mutex_lock(&pool->lock);
+    pool->in_flight--;
+
+    /* Every frame is either idle or in flight, so the idle list never outgrows FRAME_POOL_DEPTH. */
+    frame->next = pool->idle;
+    pool->idle  = frame;
+    pool->idle_count++;
+
+    if (!frame_pool_reap(pool)) {
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void frame_pool_trim(FRAME_POOL *pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    UTOX_FRAME_PKG *idle = pool->idle;
+    pool->idle       = NULL;
+    pool->idle_count = 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    while (idle) {
+        UTOX_FRAME_PKG *next = idle->next;
+        frame_free(idle);
+        idle = next;
+    }
+}
+
+void frame_pool_log_stats(FRAME_POOL *pool, const char *name) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    FRAME_POOL_STATS stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+
+    LOG_INFO("Frame Pool", "%s: %lu frames reused, %lu allocated, %lu dropped", name, (unsigned long)stats.hits,
+             (unsigned long)stats.misses, (unsigned long)stats.dropped);
+}
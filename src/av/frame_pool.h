@@ -0,0 +1,71 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* How many of a stream's frames can be waiting for the UI at once. Anything decoded past that is dropped, it'd only
+ * be shown late anyway. */
+#define FRAME_POOL_DEPTH 3
+
+typedef struct frame_pool FRAME_POOL;
+
+typedef struct utox_frame_pkg {
+    uint16_t w, h;
+    size_t size;
+
+    void *img;
+
+    /* Only used by pooled frames. */
+    FRAME_POOL *           pool;
+    size_t                 capacity; // bytes allocated for img
+    atomic_uint            refs;
+    struct utox_frame_pkg *next; // in the pool's idle list
+} UTOX_FRAME_PKG;
+
+typedef struct {
+    uint64_t hits;    // frames handed out without allocating
+    uint64_t misses;  // frames that had to be allocated or grown
+    uint64_t dropped; // frames refused because too many were in flight
+} FRAME_POOL_STATS;
+
+/* Recycles the BGRX frames of one video stream between the thread decoding them and the UI thread showing them, so
+ * a call in a steady state doesn't allocate anything per frame.
+ *
+ * Frames are reference counted. The producer gets one holding a single reference, and whoever holds the last one
+ * hands it back to the pool by releasing it, on whatever thread that happens to be. */
+struct frame_pool {
+    pthread_mutex_t lock;
+    UTOX_FRAME_PKG *idle;
+    unsigned        idle_count;
+    unsigned        in_flight;
+    bool            orphaned; // the owner's let go, free it once the last frame comes back
+
+    FRAME_POOL_STATS stats;
+};
+
+/* Returns NULL if out of memory. */
+FRAME_POOL *frame_pool_new(void);
+
+/* Lets go of the pool. It's freed straight away, or once the last frame still in flight is released. */
+void frame_pool_free(FRAME_POOL *pool);
+
+/* Takes a frame of w by h BGRX pixels, holding one reference. Returns NULL if FRAME_POOL_DEPTH frames are already in
+ * flight, counting the frame as dropped, or if out of memory. */
+UTOX_FRAME_PKG *frame_pool_get(FRAME_POOL *pool, uint16_t w, uint16_t h);
+
+/* Frees the pool's idle frames, for when its stream stops. */
+void frame_pool_trim(FRAME_POOL *pool);
+
+/* Logs a summary of the pool's stats under name. */
+void frame_pool_log_stats(FRAME_POOL *pool, const char *name);
+
+void frame_ref(UTOX_FRAME_PKG *frame);
+
+/* Drops a reference, returning the frame to its pool with the last one. */
+void frame_release(UTOX_FRAME_PKG *frame);
+
+#endif
@@ -0,0 +1,202 @@
+#include "group_mixer.h"
+
+#include "../debug.h"
+#include "../macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_SIZE (GROUP_MIXER_JITTER_MAX * GROUP_MIXER_FRAME) // samples per channel
+
+#define LIMITER_UNITY (1 << 24)
+// How much of the way back to unity the limiter goes each frame once the mix is quiet enough again, about 300ms.
+#define LIMITER_RELEASE 16
+
+static void peer_reset(GROUP_MIXER_PEER *peer) {
+    free(peer->samples);
+    memset(peer, 0, sizeof(*peer));
+    peer->buffering = true;
+}
+
+GROUP_MIXER *group_mixer_new(void) {
+    GROUP_MIXER *mixer = calloc(1, sizeof(GROUP_MIXER));
+    if (!mixer) {
+        LOG_ERR("Group Mixer", "Unable to allocate a mixer.");
+        return NULL;
+    }
+
+    pthread_mutex_init(&mixer->lock, NULL);
+    for (size_t i = 0; i < GROUP_MIXER_MAX_PEERS; ++i) {
+        peer_reset(&mixer->peers[i]);
+    }
+    mixer->limiter = LIMITER_UNITY;
+
+    return mixer;
+}
+
+void group_mixer_free(GROUP_MIXER *mixer) {
+    if (!mixer) {
+        return;
+    }
+
+    for (size_t i = 0; i < GROUP_MIXER_MAX_PEERS; ++i) {
+        free(mixer->peers[i].samples);
+    }
+    pthread_mutex_destroy(&mixer->lock);
+    free(mixer);
+}
+
+bool group_mixer_push(GROUP_MIXER *mixer, uint32_t peer_number, const int16_t *pcm, size_t samples, uint8_t channels,
+                      uint32_t sample_rate) {
+    if (peer_number >= GROUP_MIXER_MAX_PEERS || (channels != 1 && channels != 2)) {
+        return false;
+    }
+
+    if (sample_rate != GROUP_MIXER_SAMPLE_RATE) {
+        LOG_WARN("Group Mixer", "Peer %u sent audio at %uHz, only %uHz can be mixed.", peer_number, sample_rate,
+                 GROUP_MIXER_SAMPLE_RATE);
+        return false;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+    GROUP_MIXER_PEER *peer = &mixer->peers[peer_number];
+
+    if (!peer->samples) {
+        peer->samples = malloc(sizeof(int16_t) * RING_SIZE * GROUP_MIXER_CHANNELS);
+        if (!peer->samples) {
+            pthread_mutex_unlock(&mixer->lock);
+            LOG_ERR("Group Mixer", "Unable to allocate a jitter buffer for peer %u.", peer_number);
+            return false;
+        }
+    }
+
+    /* Only the newest audio is kept if there's more than fits. */
+    if (samples > RING_SIZE) {
+        peer->dropped += samples - RING_SIZE;
+        pcm += (samples - RING_SIZE) * channels;
+        samples = RING_SIZE;
+    }
+
+    if (peer->fill + samples > RING_SIZE) {
+        const size_t overflow = peer->fill + samples - RING_SIZE;
+        peer->read            = (peer->read + overflow) % RING_SIZE;
+        peer->fill -= overflow;
+        peer->dropped += overflow;
+    }
+
+    size_t write = (peer->read + peer->fill) % RING_SIZE;
+    for (size_t i = 0; i < samples; ++i) {
+        peer->samples[write * 2]     = pcm[i * channels];
+        peer->samples[write * 2 + 1] = pcm[i * channels + channels - 1];
+        write                        = (write + 1) % RING_SIZE;
+    }
+    peer->fill += samples;
+
+    if (peer->buffering && peer->fill >= GROUP_MIXER_JITTER_TARGET * GROUP_MIXER_FRAME) {
+        peer->buffering = false;
+    }
+
+    pthread_mutex_unlock(&mixer->lock);
+    return true;
+}
+
+bool group_mixer_ready(GROUP_MIXER *mixer) {
+    bool ready = false;
+
+    pthread_mutex_lock(&mixer->lock);
+    for (size_t i = 0; i < GROUP_MIXER_MAX_PEERS && !ready; ++i) {
+        ready = !mixer->peers[i].buffering && mixer->peers[i].fill >= GROUP_MIXER_FRAME;
+    }
+    pthread_mutex_unlock(&mixer->lock);
+
+    return ready;
+}
+
+size_t group_mixer_mix(GROUP_MIXER *mixer, int16_t *out) {
+    size_t mixed = 0;
+
+    pthread_mutex_lock(&mixer->lock);
+    memset(mixer->mix, 0, sizeof(mixer->mix));
+
+    for (size_t i = 0; i < GROUP_MIXER_MAX_PEERS; ++i) {
+        GROUP_MIXER_PEER *peer = &mixer->peers[i];
+        if (!peer->samples || peer->buffering) {
+            continue;
+        }
+
+        const size_t count = MIN(peer->fill, GROUP_MIXER_FRAME);
+        if (count) {
+            for (size_t j = 0; j < count; ++j) {
+                const size_t at = (peer->read + j) % RING_SIZE;
+                mixer->mix[j * 2] += peer->samples[at * 2];
+                mixer->mix[j * 2 + 1] += peer->samples[at * 2 + 1];
+            }
+            mixed++;
+        }
+        peer->read = (peer->read + count) % RING_SIZE;
+        peer->fill -= count;
+
+        /* They've run dry, go quiet until enough has come in to carry on smoothly. */
+        if (count < GROUP_MIXER_FRAME) {
+            peer->underruns++;
+            peer->buffering = true;
+        }
+    }
+
+    /* Turn the whole mix down straight away if it would clip, and back up slowly once it's quieter. */
+    int32_t peak = 0;
+    for (size_t i = 0; i < COUNTOF(mixer->mix); ++i) {
+        const int32_t level = mixer->mix[i] < 0 ? -mixer->mix[i] : mixer->mix[i];
+        peak                = MAX(peak, level);
+    }
+
+    const uint32_t fits = peak > INT16_MAX ? (uint64_t)INT16_MAX * LIMITER_UNITY / peak : LIMITER_UNITY;
+    if (fits < mixer->limiter) {
+        mixer->limiter = fits;
+    } else {
+        const uint32_t release = (LIMITER_UNITY - mixer->limiter + LIMITER_RELEASE - 1) / LIMITER_RELEASE;
+        mixer->limiter         = MIN(fits, mixer->limiter + release);
+    }
+
+    for (size_t i = 0; i < COUNTOF(mixer->mix); ++i) {
+        const int64_t sample = (int64_t)mixer->mix[i] * mixer->limiter / LIMITER_UNITY;
+        out[i]               = sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample;
+    }
+
+    pthread_mutex_unlock(&mixer->lock);
+    return mixed;
+}
+
+void group_mixer_flush(GROUP_MIXER *mixer) {
+    pthread_mutex_lock(&mixer->lock);
+    for (size_t i = 0; i < GROUP_MIXER_MAX_PEERS; ++i) {
+        mixer->peers[i].read      = 0;
+        mixer->peers[i].fill      = 0;
+        mixer->peers[i].buffering = true;
+    }
+    mixer->limiter = LIMITER_UNITY;
+    pthread_mutex_unlock(&mixer->lock);
+}
+
+void group_mixer_peer_remove(GROUP_MIXER *mixer, uint32_t peer) {
+    if (peer >= GROUP_MIXER_MAX_PEERS) {
+        return;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+    peer_reset(&mixer->peers[peer]);
+    pthread_mutex_unlock(&mixer->lock);
+}
+
+void group_mixer_peer_move(GROUP_MIXER *mixer, uint32_t from, uint32_t to) {
+    if (from >= GROUP_MIXER_MAX_PEERS || to >= GROUP_MIXER_MAX_PEERS || from == to) {
+        return;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+    free(mixer->peers[to].samples);
+    mixer->peers[to]           = mixer->peers[from];
+    mixer->peers[from].samples = NULL;
+    peer_reset(&mixer->peers[from]);
+    pthread_mutex_unlock(&mixer->lock);
+}
@@ -0,0 +1,70 @@
+#ifndef GROUP_MIXER_H
+#define GROUP_MIXER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The mix always comes out as 20ms frames of 16 bit stereo at 48kHz, which is what toxav decodes group audio to. */
+#define GROUP_MIXER_SAMPLE_RATE 48000
+#define GROUP_MIXER_CHANNELS 2
+#define GROUP_MIXER_FRAME (GROUP_MIXER_SAMPLE_RATE / 50) // samples per channel in a frame
+
+/* How much of a peer's audio is held back before it's mixed in, to ride out packets arriving unevenly, and the most
+ * that's kept before the oldest is dropped, in frames. */
+#define GROUP_MIXER_JITTER_TARGET 3
+#define GROUP_MIXER_JITTER_MAX 10
+
+#define GROUP_MIXER_MAX_PEERS 256
+
+typedef struct {
+    int16_t *samples; // ring of GROUP_MIXER_JITTER_MAX frames, interleaved stereo
+    size_t   read, fill; // in samples per channel
+
+    bool buffering; // waiting to have GROUP_MIXER_JITTER_TARGET frames before being mixed in
+
+    uint32_t dropped, underruns;
+} GROUP_MIXER_PEER;
+
+/* Mixes the audio of every peer in a group call down to one stream, for a single OpenAL source to play.
+ *
+ * Every peer gets a jitter buffer, which toxav's callback pushes their audio into. Whoever's feeding the output pulls
+ * mixed frames out while any peer has a frame ready. A peer that runs dry goes silent, and back to buffering, until
+ * enough of their audio has arrived again.
+ *
+ * Loud peers talking over each other are turned down for a while rather than clipped. */
+typedef struct group_mixer {
+    pthread_mutex_t  lock;
+    GROUP_MIXER_PEER peers[GROUP_MIXER_MAX_PEERS];
+    uint32_t         limiter; // 8.24 gain applied to the whole mix, below 1.0 while the mix would clip
+
+    int32_t mix[GROUP_MIXER_FRAME * GROUP_MIXER_CHANNELS];
+} GROUP_MIXER;
+
+/* Returns NULL if out of memory. */
+GROUP_MIXER *group_mixer_new(void);
+
+void group_mixer_free(GROUP_MIXER *mixer);
+
+/* Queues up samples of a peer's audio, mono or interleaved stereo. Returns false if it can't be mixed, if it's not
+ * at GROUP_MIXER_SAMPLE_RATE or out of memory. */
+bool group_mixer_push(GROUP_MIXER *mixer, uint32_t peer, const int16_t *pcm, size_t samples, uint8_t channels,
+                      uint32_t sample_rate);
+
+/* True if there's a frame to mix, from at least one peer. */
+bool group_mixer_ready(GROUP_MIXER *mixer);
+
+/* Mixes the next frame, GROUP_MIXER_FRAME samples per channel, into out. Returns how many peers are in it. */
+size_t group_mixer_mix(GROUP_MIXER *mixer, int16_t *out);
+
+/* Throws away everyone's buffered audio, for when the call stops. */
+void group_mixer_flush(GROUP_MIXER *mixer);
+
+/* Throws away the peer's buffered audio, for when they leave. */
+void group_mixer_peer_remove(GROUP_MIXER *mixer, uint32_t peer);
+
+/* Moves everything about peer from over to peer to, for when toxcore renumbers peers. */
+void group_mixer_peer_move(GROUP_MIXER *mixer, uint32_t from, uint32_t to);
+
+#endif
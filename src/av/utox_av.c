@@ -1,7 +1,9 @@
 #include "utox_av.h"
 
 #include "audio.h"
+#include "audio_send.h"
 #include "video.h"
+#include "video_send.h"
 
 #include "../debug.h"
 #include "../flist.h"
@@ -21,19 +23,10 @@
 
 bool utox_av_ctrl_init = false;
 
-static bool toxav_thread_msg = 0;
+static MSG_QUEUE utoxav_queue = MSG_QUEUE_INIT;
 
 void postmessage_utoxav(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (toxav_thread_msg && utox_av_ctrl_init) { /* I'm not convinced this is the best way */
-        yieldcpu(1);
-    }
-
-    toxav_msg.msg    = msg;
-    toxav_msg.param1 = param1;
-    toxav_msg.param2 = param2;
-    toxav_msg.data   = data;
-
-    toxav_thread_msg = 1;
+    msg_queue_post(&utoxav_queue, &utox_av_ctrl_init, msg, param1, param2, data);
 }
 
 void utox_av_ctrl_thread(void *UNUSED(args)) {
@@ -47,9 +40,12 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
     // volatile bool video_on  = 0;
 
     while (1) {
-        if (toxav_thread_msg) {
-            TOX_MSG *msg = &toxav_msg;
+        TOX_MSG queued;
+        bool    kill = false;
+        while (msg_queue_pop(&utoxav_queue, &queued)) {
+            TOX_MSG *msg = &queued;
             if (msg->msg == UTOXAV_KILL) {
+                kill = true;
                 break;
             } else if (msg->msg == UTOXAV_NEW_TOX_INSTANCE) {
                 if (av) { /* toxcore restart */
@@ -91,6 +87,8 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
                         utox_video_start(0);
                         f->call_state_self |= (TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V);
                     }
+                    video_send_set_bitrate(msg->param1, 0);
+                    audio_send_update(msg->param1);
                     break;
                 }
 
@@ -112,6 +110,8 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
                         utox_video_start(0);
                         f->call_state_self |= (TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V);
                     }
+                    video_send_set_bitrate(msg->param1, 0);
+                    audio_send_update(msg->param1);
                     break;
                 }
 
@@ -166,11 +166,16 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
                 case UTOXAV_GROUPCALL_START: {
                     call_count++;
                     LOG_INFO("uToxAv", "Starting group call in groupchat %u", msg->param1);
+                    if (!audio_send_group(msg->param1, true)) {
+                        LOG_ERR("uToxAv", "Not sending audio to group call %u, only listening.", msg->param1);
+                    }
                     postmessage_audio(UTOXAUDIO_GROUPCHAT_START, msg->param1, msg->param2, NULL);
                     break;
                 }
 
                 case UTOXAV_GROUPCALL_END: {
+                    audio_send_group(msg->param1, false);
+
                     GROUPCHAT *g = get_group(msg->param1);
                     if (!g) {
                         LOG_ERR("uToxAv", "Could not get group %u", msg->param1);
@@ -275,13 +280,16 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
                 }
             }
         }
-        toxav_thread_msg = false;
+
+        if (kill) {
+            break;
+        }
 
         if (av) {
             toxav_iterate(av);
-            yieldcpu(toxav_iteration_interval(av));
+            msg_queue_wait(&utoxav_queue, toxav_iteration_interval(av));
         } else {
-            yieldcpu(10);
+            msg_queue_wait(&utoxav_queue, 10);
         }
     }
 
@@ -312,6 +320,8 @@ static void utox_av_incoming_call(ToxAV *UNUSED(av), uint32_t friend_number,
 
     f->call_state_self   = 0;
     f->call_state_friend = (audio << 2 | video << 3 | audio << 4 | video << 5);
+    video_send_update(friend_number);
+    audio_send_update(friend_number);
     LOG_TRACE("uToxAV", "uTox AV:\tcall friend (%u) state for incoming call: %i" , friend_number, f->call_state_friend);
     postmessage_utoxav(UTOXAV_INCOMING_CALL_PENDING, friend_number, 0, NULL);
     postmessage_utox(AV_CALL_INCOMING, friend_number, video, NULL);
@@ -328,6 +338,13 @@ static void utox_av_remote_disconnect(ToxAV *UNUSED(av), int32_t friend_number)
     postmessage_utoxav(UTOXAV_CALL_END, friend_number, 0, NULL);
     f->call_state_self   = 0;
     f->call_state_friend = 0;
+    video_send_update(friend_number);
+    audio_send_update(friend_number);
+
+    if (f->video_frames) {
+        frame_pool_log_stats(f->video_frames, "Incoming video");
+        frame_pool_trim(f->video_frames);
+    }
     postmessage_utox(AV_CLOSE_WINDOW, friend_number + 1, 0, NULL);
     postmessage_utox(AV_CALL_DISCONNECTED, friend_number, 0, NULL);
 }
@@ -373,6 +390,8 @@ void utox_av_local_disconnect(ToxAV *av, int32_t friend_number) {
 
     f->call_state_self   = 0;
     f->call_state_friend = 0;
+    video_send_update(friend_number);
+    audio_send_update(friend_number);
     postmessage_utox(AV_CLOSE_WINDOW, friend_number + 1, 0, NULL); /* TODO move all of this into a static function in that
                                                                  file !*/
     postmessage_utox(AV_CALL_DISCONNECTED, friend_number, 0, NULL);
@@ -399,6 +418,7 @@ void utox_av_local_call_control(ToxAV *av, uint32_t friend_number, TOXAV_CALL_CO
             toxav_video_set_bit_rate(av, friend_number, 0, &bitrate_err);
             postmessage_utoxav(UTOXAV_STOP_VIDEO, friend_number, 0, NULL);
             f->call_state_self &= (0xFF ^ TOXAV_FRIEND_CALL_STATE_SENDING_V);
+            video_send_update(friend_number);
             break;
         }
 
@@ -406,6 +426,7 @@ void utox_av_local_call_control(ToxAV *av, uint32_t friend_number, TOXAV_CALL_CO
             toxav_video_set_bit_rate(av, friend_number, UTOX_DEFAULT_BITRATE_V, &bitrate_err);
             postmessage_utoxav(UTOXAV_START_VIDEO, friend_number, 0, NULL);
             f->call_state_self |= TOXAV_FRIEND_CALL_STATE_SENDING_V;
+            video_send_set_bitrate(friend_number, 0);
             break;
         }
 
@@ -451,34 +472,28 @@ static void utox_av_incoming_frame_v(ToxAV *UNUSED(toxAV), uint32_t friend_numbe
     }
     f->video_width  = width;
     f->video_height = height;
-    size_t size     = width * height * 4;
-
-    UTOX_FRAME_PKG *frame = calloc(1, sizeof(UTOX_FRAME_PKG));
 
-    if (!frame) {
-        LOG_ERR("uToxAV", "Can't malloc for incoming frame.");
-        return;
+    if (!f->video_frames) {
+        f->video_frames = frame_pool_new();
+        if (!f->video_frames) {
+            return;
+        }
     }
 
-    frame->w    = width;
-    frame->h    = height;
-    frame->size = size;
-    frame->img  = malloc(size);
-    if (!frame->img) {
-        LOG_TRACE("uToxAV", "Could not allocate memory for image.");
-        free(frame);
+    /* NULL when the UI's fallen behind, in which case the frame's dropped. */
+    UTOX_FRAME_PKG *frame = frame_pool_get(f->video_frames, width, height);
+    if (!frame) {
         return;
     }
 
     yuv420tobgr(width, height, y, u, v, ystride, ustride, vstride, frame->img);
     if (f->video_inline) {
-        if (!inline_set_frame(width, height, size, frame->img)) {
+        if (!inline_set_frame(width, height, frame->size, frame->img)) {
             LOG_ERR("uToxAV", "Error setting frame for inline video.");
         }
 
         postmessage_utox(AV_INLINE_FRAME, friend_number, 0, NULL);
-        free(frame->img);
-        free(frame);
+        frame_release(frame);
     } else {
         postmessage_utox(AV_VIDEO_FRAME, friend_number, 0, (void *)frame);
     }
@@ -492,6 +507,8 @@ static void utox_audio_friend_accepted(ToxAV *av, uint32_t friend_number, uint32
         LOG_FATAL_ERR(EXIT_FAILURE, "uToxAV", "Unable to get friend when A/V call accepted %u", friend_number);
     }
     f->call_state_friend = state;
+    video_send_update(friend_number);
+    audio_send_update(friend_number);
     if (SELF_SEND_VIDEO(friend_number) && !FRIEND_ACCEPTING_VIDEO(friend_number)) {
         utox_av_local_call_control(av, friend_number, TOXAV_CALL_CONTROL_HIDE_VIDEO);
     }
@@ -550,6 +567,8 @@ static void utox_callback_av_change_state(ToxAV *av, uint32_t friend_number, uin
     }
 
     f->call_state_friend = state;
+    video_send_update(friend_number);
+    audio_send_update(friend_number);
 }
 
 static void utox_incoming_video_rate_change(ToxAV *AV, uint32_t f_num, uint32_t v_bitrate, void *UNUSED(ud)) {
@@ -561,6 +580,7 @@ static void utox_incoming_video_rate_change(ToxAV *AV, uint32_t f_num, uint32_t
             LOG_ERR("ToxAV", "Setting new Video bitrate has failed with error #%u" , error);
         } else {
             LOG_NOTE("uToxAV", "Video bitrate changed to %u" , v_bitrate);
+            video_send_set_bitrate(f_num, v_bitrate);
         }
     } else {
         LOG_NOTE("uToxAV", "Video bitrate unchanged %u is less than %u" , v_bitrate, UTOX_MIN_BITRATE_VIDEO);
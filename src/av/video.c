@@ -1,16 +1,17 @@
 #include "video.h"
 
 #include "utox_av.h"
+#include "video_send.h"
+#include "video_synthetic.h"
 
-#include "../friend.h"
 #include "../debug.h"
 #include "../macros.h"
-#include "../self.h"
 #include "../settings.h"
 #include "../tox.h"
 #include "../utox.h"
 
 #include "../native/thread.h"
+#include "../native/time.h"
 #include "../native/video.h"
 
 #include <pthread.h>
@@ -28,17 +29,28 @@ static uint32_t video_device_current = 0;
 static bool     video_active         = false;
 
 static utox_av_video_frame utox_video_frame;
+static FRAME_POOL *        preview_frames;
+
+/* Only changed by the video thread, and with video_thread_lock held, so the stats can be read from any thread. */
+static VIDEO_PACER pacer;
+static bool        pacing = false;
 
 static bool video_device_status = false;
 
 static vpx_image_t input;
 
 static pthread_mutex_t video_thread_lock;
+/* Held while a frame's read from the device and used, so it's not swapped out from under the video thread. */
+static pthread_mutex_t video_device_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 static bool video_device_init(void *handle) {
     // initialize video (will populate video_width and video_height)
-    if (handle == (void *)1) {
+    if (handle && handle == video_synthetic_device()) {
+        if (!video_synthetic_open(&video_width, &video_height)) {
+            return false;
+        }
+    } else if (handle == (void *)1) {
         if (!native_video_init((void *)1)) {
             LOG_TRACE("uToxVideo", "native_video_init() failed for desktop" );
             return false;
@@ -63,16 +75,39 @@ static bool video_device_init(void *handle) {
 }
 
 static void close_video_device(void *handle) {
-    if (handle >= (void *)2) {
+    if (handle && handle == video_synthetic_device()) {
+        video_synthetic_close();
+        vpx_img_free(&input);
+    } else if (handle >= (void *)2) {
         native_video_close(*(void **)handle);
         vpx_img_free(&input);
     }
     video_device_status = false;
 }
 
+static bool video_device_synthetic(void) {
+    return video_device[video_device_current] && video_device[video_device_current] == video_synthetic_device();
+}
+
+static int video_device_getframe(void) {
+    if (video_device_synthetic()) {
+        return video_synthetic_getframe(utox_video_frame.y, utox_video_frame.u, utox_video_frame.v,
+                                        utox_video_frame.w, utox_video_frame.h);
+    }
+
+    return native_video_getframe(utox_video_frame.y, utox_video_frame.u, utox_video_frame.v, utox_video_frame.w,
+                                 utox_video_frame.h);
+}
+
+static bool video_device_wait(uint32_t timeout_ms) {
+    return video_device_synthetic() ? video_synthetic_wait(timeout_ms) : native_video_wait(timeout_ms);
+}
+
 static bool video_device_start(void) {
     if (video_device_status) {
-        native_video_startread();
+        if (!video_device_synthetic()) {
+            native_video_startread();
+        }
         video_active = true;
         return true;
     }
@@ -82,7 +117,9 @@ static bool video_device_start(void) {
 
 static bool video_device_stop(void) {
     if (video_device_status) {
-        native_video_endread();
+        if (!video_device_synthetic()) {
+            native_video_endread();
+        }
         video_active = false;
         return true;
     }
@@ -114,7 +151,7 @@ void utox_video_append_device(void *device, bool localized, void *name, bool def
 }
 
 bool utox_video_change_device(uint16_t device_number) {
-    pthread_mutex_lock(&video_thread_lock);
+    pthread_mutex_lock(&video_device_lock);
 
     static bool _was_active = false;
 
@@ -164,11 +201,11 @@ bool utox_video_change_device(uint16_t device_number) {
         goto mutex_unlock;
     }
 
-    pthread_mutex_unlock(&video_thread_lock);
+    pthread_mutex_unlock(&video_device_lock);
     return true;
 
     mutex_unlock:
-    pthread_mutex_unlock(&video_thread_lock);
+    pthread_mutex_unlock(&video_device_lock);
     return false;
 }
 
@@ -187,11 +224,14 @@ bool utox_video_start(bool preview) {
         settings.video_preview = true;
     }
 
+    pthread_mutex_lock(&video_device_lock);
     if (video_device_init(video_device[video_device_current]) && video_device_start()) {
         video_active = true;
+        pthread_mutex_unlock(&video_device_lock);
         LOG_NOTE("uToxVideo", "started video" );
         return true;
     }
+    pthread_mutex_unlock(&video_device_lock);
 
     LOG_ERR("uToxVideo", "Unable to start video.");
     return false;
@@ -203,28 +243,31 @@ bool utox_video_stop(bool UNUSED(preview)) {
         return false;
     }
 
+    /* Not while the video thread's in the middle of grabbing a frame from it. */
+    pthread_mutex_lock(&video_device_lock);
     video_active           = false;
     settings.video_preview = false;
-    postmessage_utox(AV_CLOSE_WINDOW, 0, 0, NULL);
-
     video_device_stop();
     close_video_device(video_device[video_device_current]);
+    pthread_mutex_unlock(&video_device_lock);
+
+    postmessage_utox(AV_CLOSE_WINDOW, 0, 0, NULL);
+    frame_pool_log_stats(preview_frames, "Video preview");
+    frame_pool_trim(preview_frames);
     LOG_TRACE("uToxVideo", "stopped video" );
     return true;
 }
 
-static TOX_MSG video_msg;
-void postmessage_video(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (video_thread_msg) {
-        yieldcpu(1);
-    }
+void utox_video_stats(VIDEO_PACER_STATS *stats) {
+    pthread_mutex_lock(&video_thread_lock);
+    *stats = pacer.stats;
+    pthread_mutex_unlock(&video_thread_lock);
+}
 
-    video_msg.msg    = msg;
-    video_msg.param1 = param1;
-    video_msg.param2 = param2;
-    video_msg.data   = data;
+static MSG_QUEUE video_queue = MSG_QUEUE_INIT;
 
-    video_thread_msg = true;
+void postmessage_video(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    msg_queue_post(&video_queue, NULL, msg, param1, param2, data);
 }
 
 // Populates the video device dropdown.
@@ -235,6 +278,12 @@ static void init_video_devices(void) {
     // select a video device (autodectect)
     video_device_current = native_video_detect();
 
+    // The test pattern takes over as the default when asked for.
+    if (video_synthetic_enabled()) {
+        video_device_current = video_device_count;
+        utox_video_append_device(video_synthetic_device(), 0, (void *)video_synthetic_name(), 1);
+    }
+
     if (video_device_current) {
         // open the video device to get some info e.g. frame size
         // close it afterwards to not block the device while it is not used
@@ -251,77 +300,93 @@ void utox_video_thread(void *args) {
 
     init_video_devices();
 
+    preview_frames = frame_pool_new();
+
     utox_video_thread_init = 1;
 
     while (1) {
-        if (video_thread_msg) {
-            if (!video_msg.msg || video_msg.msg == UTOXVIDEO_KILL) {
+        TOX_MSG msg;
+        bool    kill = false;
+        while (msg_queue_pop(&video_queue, &msg)) {
+            if (!msg.msg || msg.msg == UTOXVIDEO_KILL) {
+                kill = true;
                 break;
             }
 
-            switch (video_msg.msg) {
+            switch (msg.msg) {
                 case UTOXVIDEO_NEW_AV_INSTANCE: {
-                    av = video_msg.data;
+                    av = msg.data;
                     init_video_devices();
                     break;
                 }
             }
-            video_thread_msg = false;
+        }
+
+        if (kill) {
+            break;
         }
 
         if (video_active) {
-            pthread_mutex_lock(&video_thread_lock);
+            if (!pacing) {
+                pthread_mutex_lock(&video_thread_lock);
+                video_pacer_start(&pacer, settings.video_fps, get_time());
+                pacing = true;
+                pthread_mutex_unlock(&video_thread_lock);
+            } else if (pacer.fps != settings.video_fps) {
+                pthread_mutex_lock(&video_thread_lock);
+                video_pacer_set_fps(&pacer, settings.video_fps);
+                pthread_mutex_unlock(&video_thread_lock);
+            }
+
+            /* Sleep off whatever's left of the slot, waking up for messages. Up to a ms early is close enough. */
+            const uint64_t wait = video_pacer_wait(&pacer, get_time());
+            if (wait >= 1000 * 1000) {
+                msg_queue_wait(&video_queue, wait / (1000 * 1000));
+                continue;
+            }
+
+            pthread_mutex_lock(&video_device_lock);
+            if (!video_active) {
+                /* Stopped while we were waiting for the lock, the device is already closed. */
+                pthread_mutex_unlock(&video_device_lock);
+                continue;
+            }
+
             // capturing is enabled, capture frames
-            const int r = native_video_getframe(utox_video_frame.y, utox_video_frame.u, utox_video_frame.v,
-                                                utox_video_frame.w, utox_video_frame.h);
-            if (r == 1) {
-                if (settings.video_preview) {
-                    /* Make a copy of the video frame for uTox to display */
-                    UTOX_FRAME_PKG *frame = malloc(sizeof(UTOX_FRAME_PKG));
-                    frame->w              = utox_video_frame.w;
-                    frame->h              = utox_video_frame.h;
-                    frame->img            = malloc(utox_video_frame.w * utox_video_frame.h * 4);
-
-                    yuv420tobgr(utox_video_frame.w, utox_video_frame.h, utox_video_frame.y, utox_video_frame.u,
-                                utox_video_frame.v, utox_video_frame.w, (utox_video_frame.w / 2),
-                                (utox_video_frame.w / 2), frame->img);
-
-                    postmessage_utox(AV_VIDEO_FRAME, UINT16_MAX, 1, (void *)frame);
+            uint64_t stage_times[VIDEO_STAGE_COUNT] = { 0 };
+            uint64_t start = get_time(), now;
+
+            /* If the device hasn't got the frame yet, wait for it instead of giving up on the slot. */
+            const uint64_t slot_end = pacer.deadline + pacer.interval / 2;
+            int            r;
+            while (!(r = video_device_getframe()) && (now = get_time()) < slot_end) {
+                if (!video_device_wait((slot_end - now) / (1000 * 1000) + 1)) {
+                    yieldcpu(1);
                 }
+            }
+            now                              = get_time();
+            stage_times[VIDEO_STAGE_CAPTURE] = now - start;
 
-                size_t active_video_count = 0;
-                for (size_t i = 0; i < self.friend_list_count; i++) {
-                    if (SEND_VIDEO_FRAME(i)) {
-                        LOG_TRACE("uToxVideo", "sending video frame to friend %lu" , i);
-                        active_video_count++;
-                        TOXAV_ERR_SEND_FRAME error = 0;
-
-                        FRIEND *f = get_friend(i);
-                        if (!f) {
-                            LOG_ERR("uToxVideo", "Could not get friend to send him video frame %lu", i);
-                            continue;
-                        }
-
-                        toxav_video_send_frame(av, f->number, utox_video_frame.w, utox_video_frame.h,
-                                               utox_video_frame.y, utox_video_frame.u, utox_video_frame.v, &error);
-                        // LOG_TRACE("uToxVideo", "Sent video frame to friend %u" , i);
-                        if (error) {
-                            if (error == TOXAV_ERR_SEND_FRAME_SYNC) {
-                                LOG_ERR("uToxVideo", "Vid Frame sync error: w=%u h=%u", utox_video_frame.w, utox_video_frame.h);
-                            } else if (error == TOXAV_ERR_SEND_FRAME_PAYLOAD_TYPE_DISABLED) {
-                                LOG_ERR("uToxVideo", "ToxAV disagrees with our AV state for friend %lu, self %u, friend %u",
-                                        i, f->call_state_self, f->call_state_friend);
-                            } else {
-                                LOG_ERR("uToxVideo", "toxav_send_video error friend: %i error: %u", f->number, error);
-                            }
-                        } else {
-                            if (active_video_count >= UTOX_MAX_CALLS) {
-                                LOG_ERR("uToxVideo", "Trying to send video frame to too many peers. Please report this bug!");
-                                break;
-                            }
-                        }
+            if (r == 1) {
+                start = now;
+                if (settings.video_preview && preview_frames) {
+                    /* Make a copy of the video frame for uTox to display, unless it's still behind on the last few */
+                    UTOX_FRAME_PKG *frame = frame_pool_get(preview_frames, utox_video_frame.w, utox_video_frame.h);
+                    if (frame) {
+                        yuv420tobgr(utox_video_frame.w, utox_video_frame.h, utox_video_frame.y, utox_video_frame.u,
+                                    utox_video_frame.v, utox_video_frame.w, (utox_video_frame.w / 2),
+                                    (utox_video_frame.w / 2), frame->img);
+
+                        postmessage_utox(AV_VIDEO_FRAME, UINT16_MAX, 1, (void *)frame);
                     }
                 }
+                now                              = get_time();
+                stage_times[VIDEO_STAGE_CONVERT] = now - start;
+
+                start = now;
+                video_send_frame(av, &utox_video_frame);
+                now                           = get_time();
+                stage_times[VIDEO_STAGE_SEND] = now - start;
             } else if (r == -1) {
                 LOG_ERR("uToxVideo", "Err... something really bad happened trying to get this frame, I'm just going "
                             "to plots now!");
@@ -329,12 +394,20 @@ void utox_video_thread(void *args) {
                 close_video_device(video_device);
             }
 
+            pthread_mutex_unlock(&video_device_lock);
+
+            pthread_mutex_lock(&video_thread_lock);
+            video_pacer_done(&pacer, r == 1, stage_times, now);
             pthread_mutex_unlock(&video_thread_lock);
-            yieldcpu(1000 / settings.video_fps); /* 60fps = 16.666ms || 25 fps = 40ms || the data quality is SO much better at 25... */
             continue;     /* We're running video, so don't sleep for an extra 100 ms */
         }
 
-        yieldcpu(100);
+        if (pacing) {
+            video_pacer_log_stats(&pacer.stats, "Video capture");
+            pacing = false;
+        }
+
+        msg_queue_wait(&video_queue, 100);
     }
 
     video_device_count   = 0;
@@ -345,154 +418,15 @@ void utox_video_thread(void *args) {
         video_device[i] = NULL;
     }
 
-    video_thread_msg       = 0;
+    frame_pool_log_stats(preview_frames, "Video preview");
+    frame_pool_free(preview_frames);
+    preview_frames = NULL;
+    video_send_free();
+
     utox_video_thread_init = 0;
     LOG_TRACE("uToxVideo", "Clean thread exit!");
 }
 
-void yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v,
-                 unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out) {
-    for (unsigned long int i = 0; i < height; ++i) {
-        for (unsigned long int j = 0; j < width; ++j) {
-            uint8_t *point = out + 4 * ((i * width) + j);
-            int       t_y   = y[((i * ystride) + j)];
-            const int t_u   = u[(((i / 2) * ustride) + (j / 2))];
-            const int t_v   = v[(((i / 2) * vstride) + (j / 2))];
-            t_y            = t_y < 16 ? 16 : t_y;
-
-            const int r = (298 * (t_y - 16) + 409 * (t_v - 128) + 128) >> 8;
-            const int g = (298 * (t_y - 16) - 100 * (t_u - 128) - 208 * (t_v - 128) + 128) >> 8;
-            const int b = (298 * (t_y - 16) + 516 * (t_u - 128) + 128) >> 8;
-
-            point[2] = r > 255 ? 255 : r < 0 ? 0 : r;
-            point[1] = g > 255 ? 255 : g < 0 ? 0 : g;
-            point[0] = b > 255 ? 255 : b < 0 ? 0 : b;
-            point[3] = ~0;
-        }
-    }
-}
-
-void yuv422to420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width, uint16_t height) {
-    const uint8_t *end = input + width * height * 2;
-    while (input != end) {
-        uint8_t *line_end = input + width * 2;
-        while (input != line_end) {
-            *plane_y++ = *input++;
-            *plane_v++ = *input++;
-            *plane_y++ = *input++;
-            *plane_u++ = *input++;
-        }
-
-        line_end = input + width * 2;
-        while (input != line_end) {
-            *plane_y++ = *input++;
-            input++; // u
-            *plane_y++ = *input++;
-            input++; // v
-        }
-    }
-}
-
-static uint8_t rgb_to_y(int r, int g, int b) {
-    const int y = ((9798 * r + 19235 * g + 3736 * b) >> 15);
-    return y > 255 ? 255 : y < 0 ? 0 : y;
-}
-
-static uint8_t rgb_to_u(int r, int g, int b) {
-    const int u = ((-5538 * r + -10846 * g + 16351 * b) >> 15) + 128;
-    return u > 255 ? 255 : u < 0 ? 0 : u;
-}
-
-static uint8_t rgb_to_v(int r, int g, int b) {
-    const int v = ((16351 * r + -13697 * g + -2664 * b) >> 15) + 128;
-    return v > 255 ? 255 : v < 0 ? 0 : v;
-}
-
-void bgrtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height) {
-    uint8_t *p;
-    uint8_t  r, g, b;
-
-    for (uint16_t y = 0; y != height; y += 2) {
-        p = rgb;
-        for (uint16_t x = 0; x != width; x++) {
-            b          = *rgb++;
-            g          = *rgb++;
-            r          = *rgb++;
-            *plane_y++ = rgb_to_y(r, g, b);
-        }
-
-        for (uint16_t x = 0; x != width / 2; x++) {
-            b          = *rgb++;
-            g          = *rgb++;
-            r          = *rgb++;
-            *plane_y++ = rgb_to_y(r, g, b);
-
-            b          = *rgb++;
-            g          = *rgb++;
-            r          = *rgb++;
-            *plane_y++ = rgb_to_y(r, g, b);
-
-            b = ((int)b + (int)*(rgb - 6) + (int)*p + (int)*(p + 3) + 2) / 4;
-            p++;
-            g = ((int)g + (int)*(rgb - 5) + (int)*p + (int)*(p + 3) + 2) / 4;
-            p++;
-            r = ((int)r + (int)*(rgb - 4) + (int)*p + (int)*(p + 3) + 2) / 4;
-            p++;
-
-            *plane_u++ = rgb_to_u(r, g, b);
-            *plane_v++ = rgb_to_v(r, g, b);
-
-            p += 3;
-        }
-    }
-}
-
-void bgrxtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height) {
-    uint8_t *p;
-    uint8_t  r, g, b;
-
-    for (uint16_t y = 0; y != height; y += 2) {
-        p = rgb;
-        for (uint16_t x = 0; x != width; x++) {
-            b = *rgb++;
-            g = *rgb++;
-            r = *rgb++;
-            rgb++;
-
-            *plane_y++ = rgb_to_y(r, g, b);
-        }
-
-        for (uint16_t x = 0; x != width / 2; x++) {
-            b = *rgb++;
-            g = *rgb++;
-            r = *rgb++;
-            rgb++;
-
-            *plane_y++ = rgb_to_y(r, g, b);
-
-            b = *rgb++;
-            g = *rgb++;
-            r = *rgb++;
-            rgb++;
-
-            *plane_y++ = rgb_to_y(r, g, b);
-
-            b = ((int)b + (int)*(rgb - 8) + (int)*p + (int)*(p + 4) + 2) / 4;
-            p++;
-            g = ((int)g + (int)*(rgb - 7) + (int)*p + (int)*(p + 4) + 2) / 4;
-            p++;
-            r = ((int)r + (int)*(rgb - 6) + (int)*p + (int)*(p + 4) + 2) / 4;
-            p++;
-            p++;
-
-            *plane_u++ = rgb_to_u(r, g, b);
-            *plane_v++ = rgb_to_v(r, g, b);
-
-            p += 4;
-        }
-    }
-}
-
 void scale_rgbx_image(uint8_t *old_rgbx, uint16_t old_width, uint16_t old_height, uint8_t *new_rgbx, uint16_t new_width,
                       uint16_t new_height) {
     for (int y = 0; y != new_height; y++) {
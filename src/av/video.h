@@ -5,6 +5,10 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "colorspace.h"
+#include "frame_pool.h"
+#include "video_pacer.h"
+
 extern uint16_t video_width, video_height, max_video_width, max_video_height;
 
 extern bool utox_video_thread_init;
@@ -30,13 +34,6 @@ typedef struct UTOX_AV_VIDEO_FRAME {
     uint8_t *y, *u, *v;
 } utox_av_video_frame;
 
-typedef struct utox_frame_pkg {
-    uint16_t w, h;
-    size_t size;
-
-    void *img;
-} UTOX_FRAME_PKG;
-
 void utox_video_append_device(void *device, bool localized, void *name, bool default_);
 
 bool utox_video_change_device(uint16_t i);
@@ -44,19 +41,14 @@ bool utox_video_change_device(uint16_t i);
 bool utox_video_start(bool preview);
 bool utox_video_stop(bool preview);
 
+/* Copies out the capture stats since video was last started. Any thread. */
+void utox_video_stats(VIDEO_PACER_STATS *stats);
+
 void utox_video_thread(void *args);
 
 void postmessage_video(uint8_t msg, uint32_t param1, uint32_t param2, void *data);
 
 
-// Color format conversion functions
-
-void yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v,
-                 unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out);
-void yuv422to420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width, uint16_t height);
-void bgrtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height);
-void bgrxtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height);
-
 // TODO: Documentation.
 void scale_rgbx_image(uint8_t *old_rgbx, uint16_t old_width, uint16_t old_height, uint8_t *new_rgbx, uint16_t new_width,
                       uint16_t new_height);
@@ -0,0 +1,71 @@
+#include "video_pacer.h"
+
+#include "../debug.h"
+
+#include <string.h>
+
+void video_pacer_start(VIDEO_PACER *pacer, uint8_t fps, uint64_t now) {
+    memset(pacer, 0, sizeof(*pacer));
+    video_pacer_set_fps(pacer, fps);
+    pacer->deadline = now;
+}
+
+void video_pacer_set_fps(VIDEO_PACER *pacer, uint8_t fps) {
+    pacer->fps      = fps;
+    pacer->interval = (uint64_t)1000 * 1000 * 1000 / (fps ? fps : 1);
+}
+
+void video_pacer_done(VIDEO_PACER *pacer, bool captured, const uint64_t stage_times[VIDEO_STAGE_COUNT], uint64_t now) {
+    VIDEO_PACER_STATS *stats = &pacer->stats;
+
+    if (captured) {
+        stats->frames++;
+
+        for (int i = 0; i < VIDEO_STAGE_COUNT; ++i) {
+            stats->stages[i].total += stage_times[i];
+            if (stage_times[i] > stats->stages[i].max) {
+                stats->stages[i].max = stage_times[i];
+            }
+        }
+
+        /* Waiting on the device doesn't hold anything up, it's the rest that decides if we can keep up. */
+        const uint64_t work = stage_times[VIDEO_STAGE_CONVERT] + stage_times[VIDEO_STAGE_SEND];
+        pacer->work         = pacer->work ? (pacer->work * 7 + work) / 8 : work;
+    } else {
+        stats->empty++;
+    }
+
+    uint64_t slots = 1;
+    if (pacer->work > pacer->interval) {
+        slots = (pacer->work + pacer->interval - 1) / pacer->interval;
+    }
+
+    /* A little late is fine, the frame goes out straight away. Any later and the slot's missed. */
+    uint64_t deadline = pacer->deadline + slots * pacer->interval;
+    if (now > deadline + pacer->interval / 2) {
+        const uint64_t missed = (now - deadline + pacer->interval / 2) / pacer->interval;
+        deadline += missed * pacer->interval;
+        slots += missed;
+    }
+
+    stats->dropped += slots - 1;
+    pacer->deadline = deadline;
+}
+
+uint64_t video_pacer_wait(const VIDEO_PACER *pacer, uint64_t now) {
+    return now < pacer->deadline ? pacer->deadline - now : 0;
+}
+
+void video_pacer_log_stats(const VIDEO_PACER_STATS *stats, const char *name) {
+    const uint64_t frames = stats->frames ? stats->frames : 1;
+
+    LOG_INFO("Video Pacer", "%s: %lu frames, %lu dropped, %lu slots without a frame", name,
+             (unsigned long)stats->frames, (unsigned long)stats->dropped, (unsigned long)stats->empty);
+    LOG_INFO("Video Pacer", "%s: capture %lu/%lu us, convert %lu/%lu us, send %lu/%lu us (average/max)", name,
+             (unsigned long)(stats->stages[VIDEO_STAGE_CAPTURE].total / frames / 1000),
+             (unsigned long)(stats->stages[VIDEO_STAGE_CAPTURE].max / 1000),
+             (unsigned long)(stats->stages[VIDEO_STAGE_CONVERT].total / frames / 1000),
+             (unsigned long)(stats->stages[VIDEO_STAGE_CONVERT].max / 1000),
+             (unsigned long)(stats->stages[VIDEO_STAGE_SEND].total / frames / 1000),
+             (unsigned long)(stats->stages[VIDEO_STAGE_SEND].max / 1000));
+}
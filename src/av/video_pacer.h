@@ -0,0 +1,55 @@
+#ifndef VIDEO_PACER_H
+#define VIDEO_PACER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Where the time for a captured frame goes, in the order it's spent. */
+typedef enum {
+    VIDEO_STAGE_CAPTURE, // waiting for and reading the frame off the device
+    VIDEO_STAGE_CONVERT, // converting it for the preview
+    VIDEO_STAGE_SEND,    // scaling, encoding and sending it, toxav does the last two in one go
+    VIDEO_STAGE_COUNT,
+} VIDEO_STAGE;
+
+typedef struct {
+    uint64_t frames;  // frames captured and sent
+    uint64_t dropped; // frame slots skipped because sending fell behind
+    uint64_t empty;   // frame slots the device had nothing for
+
+    struct {
+        uint64_t total, max; // ns
+    } stages[VIDEO_STAGE_COUNT];
+} VIDEO_PACER_STATS;
+
+/* Paces capture off absolute deadlines, one every 1/fps seconds from when it starts, so the time spent on a frame
+ * doesn't push the next one back and sleeping late doesn't add up.
+ *
+ * When a frame takes longer than a slot to get out, on average, slots are skipped to keep up rather than falling
+ * further and further behind. All times are get_time() nanoseconds, passed in so it can be driven by a fake clock. */
+typedef struct {
+    uint8_t  fps;
+    uint64_t interval; // ns between frame slots
+    uint64_t deadline; // when the next frame is due
+    uint64_t work;     // moving average of the time frames take to get out, ns
+
+    VIDEO_PACER_STATS stats;
+} VIDEO_PACER;
+
+/* Starts pacing at fps frames a second, the first frame being due now. */
+void video_pacer_start(VIDEO_PACER *pacer, uint8_t fps, uint64_t now);
+
+/* Changes the frame rate from the next slot on, keeping the stats. */
+void video_pacer_set_fps(VIDEO_PACER *pacer, uint8_t fps);
+
+/* Accounts for a frame slot that's been dealt with, with the time each stage of it took, and moves the deadline on to
+ * the next slot worth capturing in. Pass captured as false if the device had no frame. */
+void video_pacer_done(VIDEO_PACER *pacer, bool captured, const uint64_t stage_times[VIDEO_STAGE_COUNT], uint64_t now);
+
+/* How long until the next frame is due, 0 if it already is. */
+uint64_t video_pacer_wait(const VIDEO_PACER *pacer, uint64_t now);
+
+/* Logs a summary of the stats under name. */
+void video_pacer_log_stats(const VIDEO_PACER_STATS *stats, const char *name);
+
+#endif
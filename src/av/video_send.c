@@ -0,0 +1,206 @@
+#include "video_send.h"
+
+#include "../debug.h"
+#include "../friend.h"
+#include "../macros.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tox/toxav.h>
+
+typedef struct {
+    uint32_t friend_number;
+    uint32_t bitrate; // kbit/s, 0 for the default
+} VIDEO_CALL;
+
+static VIDEO_CALL      video_calls[UTOX_MAX_CALLS];
+static size_t          video_call_count;
+static pthread_mutex_t video_calls_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Calls at or above each bitrate in kbit/s get sent frames up to that height, 0 being whatever's captured. */
+static const struct {
+    uint32_t bitrate;
+    uint16_t height;
+} video_levels[] = {
+    { 2000, 0 },
+    { 1000, 720 },
+    { 600, 480 },
+    { 0, 360 },
+};
+
+/* Each level's frame, scaled down from the captured one. Only touched by the video thread. */
+static struct {
+    uint8_t *planes;
+    size_t   size;
+} video_scaled[COUNTOF(video_levels)];
+
+static size_t video_level(uint32_t bitrate) {
+    if (!bitrate) {
+        bitrate = UTOX_DEFAULT_BITRATE_V;
+    }
+
+    size_t level = 0;
+    while (level < COUNTOF(video_levels) - 1 && bitrate < video_levels[level].bitrate) {
+        level++;
+    }
+    return level;
+}
+
+void video_send_set(uint32_t friend_number, bool sending, uint32_t bitrate) {
+    pthread_mutex_lock(&video_calls_lock);
+
+    size_t i = 0;
+    while (i < video_call_count && video_calls[i].friend_number != friend_number) {
+        i++;
+    }
+
+    if (sending) {
+        if (i < video_call_count) {
+            video_calls[i].bitrate = bitrate;
+        } else if (video_call_count < COUNTOF(video_calls)) {
+            video_calls[video_call_count++] = (VIDEO_CALL){ .friend_number = friend_number, .bitrate = bitrate };
+            LOG_INFO("uToxVideo", "Sending video to friend %u, %lu video calls now.", friend_number,
+                     (unsigned long)video_call_count);
+        } else {
+            LOG_ERR("uToxVideo", "Trying to send video to more than %u friends, not sending to %u.", UTOX_MAX_CALLS,
+                    friend_number);
+        }
+    } else if (i < video_call_count) {
+        video_calls[i] = video_calls[--video_call_count];
+        LOG_INFO("uToxVideo", "Stopped sending video to friend %u, %lu video calls left.", friend_number,
+                 (unsigned long)video_call_count);
+    }
+
+    pthread_mutex_unlock(&video_calls_lock);
+}
+
+void video_send_update(uint32_t friend_number) {
+    FRIEND *f = get_friend(friend_number);
+    if (!f) {
+        video_send_set(friend_number, false, 0);
+        return;
+    }
+
+    video_send_set(friend_number, SEND_VIDEO_FRAME(friend_number), f->video_bitrate);
+}
+
+void video_send_set_bitrate(uint32_t friend_number, uint32_t bitrate) {
+    FRIEND *f = get_friend(friend_number);
+    if (!f) {
+        return;
+    }
+
+    f->video_bitrate = bitrate;
+    video_send_update(friend_number);
+}
+
+void video_send_size(uint32_t bitrate, uint16_t width, uint16_t height, uint16_t *send_width, uint16_t *send_height) {
+    const uint16_t max_height = video_levels[video_level(bitrate)].height;
+    if (!max_height || height <= max_height) {
+        *send_width  = width;
+        *send_height = height;
+        return;
+    }
+
+    /* Even, so the chroma planes come out exactly half the size. */
+    *send_height = max_height & ~1;
+    *send_width  = MAX(((uint32_t)width * max_height / height) & ~1u, 2);
+}
+
+/* Nearest neighbour, which is what the Xlib preview scales with too. */
+static void scale_plane(const uint8_t *src, uint16_t src_width, uint16_t src_height, uint8_t *dst, uint16_t dst_width,
+                        uint16_t dst_height) {
+    const uint32_t step = ((uint32_t)src_width << 16) / dst_width;
+
+    for (uint32_t y = 0; y < dst_height; ++y) {
+        const uint8_t *row = src + (size_t)(y * src_height / dst_height) * src_width;
+
+        uint32_t from = step / 2;
+        for (uint32_t x = 0; x < dst_width; ++x, from += step) {
+            *dst++ = row[from >> 16];
+        }
+    }
+}
+
+size_t video_send_frame(ToxAV *av, const utox_av_video_frame *frame) {
+    VIDEO_CALL calls[UTOX_MAX_CALLS];
+
+    pthread_mutex_lock(&video_calls_lock);
+    const size_t count = video_call_count;
+    memcpy(calls, video_calls, count * sizeof(VIDEO_CALL));
+    pthread_mutex_unlock(&video_calls_lock);
+
+    struct {
+        bool           ready;
+        uint16_t       w, h;
+        const uint8_t *y, *u, *v;
+    } levels[COUNTOF(video_levels)] = { { 0 } };
+
+    size_t sent = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t l = video_level(calls[i].bitrate);
+
+        if (!levels[l].ready) {
+            levels[l].ready = true;
+            video_send_size(calls[i].bitrate, frame->w, frame->h, &levels[l].w, &levels[l].h);
+
+            if (levels[l].w == frame->w && levels[l].h == frame->h) {
+                levels[l].y = frame->y;
+                levels[l].u = frame->u;
+                levels[l].v = frame->v;
+            } else {
+                const size_t luma = (size_t)levels[l].w * levels[l].h;
+                if (video_scaled[l].size < luma * 3 / 2) {
+                    free(video_scaled[l].planes);
+                    video_scaled[l].planes = malloc(luma * 3 / 2);
+                    video_scaled[l].size   = video_scaled[l].planes ? luma * 3 / 2 : 0;
+                    if (!video_scaled[l].planes) {
+                        LOG_ERR("uToxVideo", "Unable to allocate a %ux%u frame to send.", levels[l].w, levels[l].h);
+                        levels[l].y = NULL;
+                        continue;
+                    }
+                }
+
+                uint8_t *y = video_scaled[l].planes, *u = y + luma, *v = u + luma / 4;
+                scale_plane(frame->y, frame->w, frame->h, y, levels[l].w, levels[l].h);
+                scale_plane(frame->u, frame->w / 2, frame->h / 2, u, levels[l].w / 2, levels[l].h / 2);
+                scale_plane(frame->v, frame->w / 2, frame->h / 2, v, levels[l].w / 2, levels[l].h / 2);
+
+                levels[l].y = y;
+                levels[l].u = u;
+                levels[l].v = v;
+            }
+        }
+
+        if (!levels[l].y) {
+            continue;
+        }
+
+        TOXAV_ERR_SEND_FRAME error = 0;
+        toxav_video_send_frame(av, calls[i].friend_number, levels[l].w, levels[l].h, levels[l].y, levels[l].u,
+                               levels[l].v, &error);
+        if (error) {
+            if (error == TOXAV_ERR_SEND_FRAME_SYNC) {
+                LOG_ERR("uToxVideo", "Vid Frame sync error: w=%u h=%u", levels[l].w, levels[l].h);
+            } else if (error == TOXAV_ERR_SEND_FRAME_PAYLOAD_TYPE_DISABLED) {
+                LOG_ERR("uToxVideo", "ToxAV disagrees with our AV state for friend %u", calls[i].friend_number);
+            } else {
+                LOG_ERR("uToxVideo", "toxav_send_video error friend: %u error: %u", calls[i].friend_number, error);
+            }
+            continue;
+        }
+
+        sent++;
+    }
+
+    return sent;
+}
+
+void video_send_free(void) {
+    for (size_t i = 0; i < COUNTOF(video_scaled); ++i) {
+        free(video_scaled[i].planes);
+        video_scaled[i].planes = NULL;
+        video_scaled[i].size   = 0;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef VIDEO_SEND_H
+#define VIDEO_SEND_H
+
+#include "utox_av.h"
+#include "video.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fanning captured video out to calls.
+ *
+ * Whoever changes a friend's call state calls video_send_update(), which keeps a set of the calls we're sending video
+ * to. The video thread then only ever looks at that set, instead of every friend every frame.
+ *
+ * Calls are grouped by the size their bitrate calls for. Each group's frame is scaled down once, and the same planes
+ * go to every call in it. */
+
+/* Adds or removes the call from the set depending on whether we should be sending it video. Any thread. */
+void video_send_update(uint32_t friend_number);
+
+/* Remembers the bitrate toxav has been told to use for the call, 0 for the default. Any thread. */
+void video_send_set_bitrate(uint32_t friend_number, uint32_t bitrate);
+
+/* Same as video_send_update(), for when the caller's already worked out what the friend's state is. */
+void video_send_set(uint32_t friend_number, bool sending, uint32_t bitrate);
+
+/* The size a frame of width by height gets sent at for a call at bitrate. */
+void video_send_size(uint32_t bitrate, uint16_t width, uint16_t height, uint16_t *send_width, uint16_t *send_height);
+
+/* Sends the frame to every call in the set. Returns how many calls it went to. Video thread only. */
+size_t video_send_frame(ToxAV *av, const utox_av_video_frame *frame);
+
+/* Frees the scaled frames, for when capture stops. Video thread only. */
+void video_send_free(void);
+
+#endif
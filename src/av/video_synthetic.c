@@ -0,0 +1,214 @@
+#include "video_synthetic.h"
+
+#include "colorspace.h"
+
+#include "../debug.h"
+
+#include "../native/thread.h"
+#include "../native/time.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+    char *handle; // what the device list gets, as for the V4L2 devices
+    char  name[48];
+
+    bool     enabled;
+    uint16_t width, height;
+    uint8_t  fps;
+
+    uint8_t *bgrx;
+    uint64_t start;
+    uint32_t next; // the frame number to hand out next
+} synthetic = {
+    .width  = VIDEO_SYNTHETIC_DEFAULT_WIDTH,
+    .height = VIDEO_SYNTHETIC_DEFAULT_HEIGHT,
+    .fps    = VIDEO_SYNTHETIC_DEFAULT_FPS,
+};
+
+/* 75% colour bars, as BGRX. */
+static const uint8_t bars[8][4] = {
+    { 191, 191, 191, 0 }, { 0, 191, 191, 0 }, { 191, 191, 0, 0 }, { 0, 191, 0, 0 },
+    { 191, 0, 191, 0 },   { 0, 0, 191, 0 },   { 191, 0, 0, 0 },   { 0, 0, 0, 0 },
+};
+
+/* The frame number's drawn as a row of black and white squares this size, most significant bit first. */
+static uint16_t counter_block(uint16_t width) {
+    return (width / VIDEO_SYNTHETIC_COUNTER_BITS) & ~1;
+}
+
+bool video_synthetic_configure(const char *spec) {
+    unsigned long width = VIDEO_SYNTHETIC_DEFAULT_WIDTH, height = VIDEO_SYNTHETIC_DEFAULT_HEIGHT,
+                  fps   = VIDEO_SYNTHETIC_DEFAULT_FPS;
+
+    if (spec && *spec) {
+        char *end;
+        width = strtoul(spec, &end, 10);
+        if (*end != 'x') {
+            return false;
+        }
+        height = strtoul(end + 1, &end, 10);
+        if (*end == '@') {
+            fps = strtoul(end + 1, &end, 10);
+        }
+        if (*end) {
+            return false;
+        }
+    }
+
+    if (width > UINT16_MAX || height > UINT16_MAX || width % 2 || height % 2 || !fps || fps > UINT8_MAX
+        || counter_block(width) < 4 || height < counter_block(width) * 2u) {
+        return false;
+    }
+
+    synthetic.width   = width;
+    synthetic.height  = height;
+    synthetic.fps     = fps;
+    synthetic.enabled = true;
+    synthetic.handle  = synthetic.name;
+    snprintf(synthetic.name, sizeof(synthetic.name), "Test pattern %lux%lu@%lu", width, height, fps);
+    return true;
+}
+
+bool video_synthetic_enabled(void) {
+    return synthetic.enabled;
+}
+
+void *video_synthetic_device(void) {
+    return &synthetic.handle;
+}
+
+const char *video_synthetic_name(void) {
+    return synthetic.name;
+}
+
+bool video_synthetic_open(uint16_t *width, uint16_t *height) {
+    free(synthetic.bgrx);
+    synthetic.bgrx = malloc((size_t)synthetic.width * synthetic.height * 4);
+    if (!synthetic.bgrx) {
+        LOG_ERR("Synthetic Video", "Unable to allocate a %ux%u frame.", synthetic.width, synthetic.height);
+        return false;
+    }
+
+    synthetic.start = get_time();
+    synthetic.next  = 0;
+
+    *width  = synthetic.width;
+    *height = synthetic.height;
+    LOG_NOTE("Synthetic Video", "Opened %s", synthetic.name);
+    return true;
+}
+
+void video_synthetic_close(void) {
+    free(synthetic.bgrx);
+    synthetic.bgrx = NULL;
+}
+
+static uint64_t synthetic_due(uint32_t frame) {
+    return synthetic.start + (uint64_t)frame * 1000 * 1000 * 1000 / synthetic.fps;
+}
+
+int video_synthetic_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, uint16_t height) {
+    if (!synthetic.bgrx || width != synthetic.width || height != synthetic.height) {
+        LOG_TRACE("Synthetic Video", "width/height mismatch %u %u != %u %u", width, height, synthetic.width,
+                  synthetic.height);
+        return 0;
+    }
+
+    /* Like a camera, the frames that were due while nobody was asking are gone. */
+    const uint64_t now   = get_time();
+    const uint32_t frame = (now - synthetic.start) * synthetic.fps / (1000 * 1000 * 1000);
+    if (frame < synthetic.next) {
+        return 0;
+    }
+    synthetic.next = frame + 1;
+
+    video_synthetic_draw(synthetic.bgrx, width, height, frame);
+    bgrxtoyuv420(y, u, v, synthetic.bgrx, width, height);
+    return 1;
+}
+
+bool video_synthetic_wait(uint32_t timeout_ms) {
+    const uint64_t due = synthetic_due(synthetic.next), now = get_time();
+    if (due > now) {
+        const uint64_t ms = (due - now + 999999) / (1000 * 1000);
+        yieldcpu(ms < timeout_ms ? ms : timeout_ms);
+    }
+
+    return true;
+}
+
+static void fill(uint8_t *row, uint32_t from, uint32_t to, const uint8_t colour[4]) {
+    for (uint32_t x = from; x < to; ++x) {
+        memcpy(row + x * 4, colour, 4);
+    }
+}
+
+void video_synthetic_draw(uint8_t *bgrx, uint16_t width, uint16_t height, uint32_t frame) {
+    static const uint8_t black[4] = { 0, 0, 0, 0 }, white[4] = { 255, 255, 255, 0 }, grey[4] = { 128, 128, 128, 0 };
+
+    const size_t   stride = (size_t)width * 4;
+    const uint16_t block  = counter_block(width);
+
+    /* The frame number. */
+    for (uint32_t i = 0; i < VIDEO_SYNTHETIC_COUNTER_BITS; ++i) {
+        const bool set = frame >> (VIDEO_SYNTHETIC_COUNTER_BITS - 1 - i) & 1;
+        fill(bgrx, i * block, (i + 1) * block, set ? white : black);
+    }
+    fill(bgrx, VIDEO_SYNTHETIC_COUNTER_BITS * block, width, grey);
+    for (uint32_t y = 1; y < block; ++y) {
+        memcpy(bgrx + y * stride, bgrx, stride);
+    }
+
+    /* Colour bars scrolling left, over a grey ramp that scrolls right. */
+    const uint32_t ramp = height - (height - block) / 4;
+
+    uint8_t *row = bgrx + block * stride;
+    for (uint32_t x = 0; x < width; ++x) {
+        memcpy(row + x * 4, bars[(x + frame * 2) % width * 8 / width], 4);
+    }
+    for (uint32_t y = block + 1; y < ramp; ++y) {
+        memcpy(bgrx + y * stride, row, stride);
+    }
+
+    row = bgrx + ramp * stride;
+    for (uint32_t x = 0; x < width; ++x) {
+        const uint8_t level = ((x + width - frame * 2 % width) % width) * 255 / width;
+        row[x * 4] = row[x * 4 + 1] = row[x * 4 + 2] = level;
+        row[x * 4 + 3]                              = 0;
+    }
+    for (uint32_t y = ramp + 1; y < height; ++y) {
+        memcpy(bgrx + y * stride, row, stride);
+    }
+
+    /* And a white box bouncing around under the frame number. */
+    const uint32_t size = (height - block) / 8 ? (height - block) / 8 : 1;
+    const uint32_t xs = width - size, ys = height - block - size;
+    uint32_t       bx = xs ? frame * 3 % (2 * xs) : 0, by = ys ? frame * 2 % (2 * ys) : 0;
+    bx = bx < xs ? bx : 2 * xs - bx;
+    by = block + (by < ys ? by : 2 * ys - by);
+    for (uint32_t y = by; y < by + size; ++y) {
+        fill(bgrx + y * stride, bx, bx + size, white);
+    }
+}
+
+int64_t video_synthetic_frame_number(const uint8_t *y, uint32_t stride, uint16_t width, uint16_t height) {
+    const uint16_t block = counter_block(width);
+    if (block < 4 || height < block) {
+        return -1;
+    }
+
+    int64_t frame = 0;
+    for (uint32_t i = 0; i < VIDEO_SYNTHETIC_COUNTER_BITS; ++i) {
+        const uint8_t luma = y[(size_t)(block / 2) * stride + i * block + block / 2];
+
+        /* The squares are black or white, 16 or 235, anything in the middle isn't one of them. */
+        if (luma > 64 && luma < 187) {
+            return -1;
+        }
+        frame = frame << 1 | (luma >= 187);
+    }
+    return frame;
+}
@@ -0,0 +1,50 @@
+#ifndef VIDEO_SYNTHETIC_H
+#define VIDEO_SYNTHETIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A capture device that draws a test pattern instead of reading a camera, so video calls can be tried out and
+ * measured on machines without one. Turned on with --synthetic-video, it then shows up in the video device list.
+ *
+ * Frames come at the configured rate, like a camera's would, whatever rate they're asked for at. The pattern only
+ * depends on the frame number, which is drawn along the top of the frame too, so it can be read back on the other
+ * end of a call to tell which frame made it there. */
+
+#define VIDEO_SYNTHETIC_DEFAULT_WIDTH 640
+#define VIDEO_SYNTHETIC_DEFAULT_HEIGHT 480
+#define VIDEO_SYNTHETIC_DEFAULT_FPS 25
+
+/* Bits of the frame number drawn along the top. */
+#define VIDEO_SYNTHETIC_COUNTER_BITS 24
+
+/* Turns the device on from a spec of WIDTHxHEIGHT[@FPS], or an empty one for the defaults. Returns false if the spec
+ * can't be parsed, or the size is odd or too small to draw the frame number in. */
+bool video_synthetic_configure(const char *spec);
+
+bool video_synthetic_enabled(void);
+
+/* The device's handle, to add to the device list with utox_video_append_device() and recognise when it's picked. */
+void *video_synthetic_device(void);
+
+/* The device's name, for the device list. */
+const char *video_synthetic_name(void);
+
+/* Opens the device, setting the size frames will be. Frame 0 is due straight away. */
+bool video_synthetic_open(uint16_t *width, uint16_t *height);
+
+void video_synthetic_close(void);
+
+/* Same as native_video_getframe(), 1 if there's a new frame, 0 if the next one isn't due yet. */
+int video_synthetic_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, uint16_t height);
+
+/* Same as native_video_wait(), sleeps until the next frame's due or timeout_ms is up. */
+bool video_synthetic_wait(uint32_t timeout_ms);
+
+/* Draws frame number frame of the pattern as width by height BGRX pixels. */
+void video_synthetic_draw(uint8_t *bgrx, uint16_t width, uint16_t height, uint32_t frame);
+
+/* Reads the frame number back out of the Y plane of a frame, or returns -1 if it isn't a frame of the pattern. */
+int64_t video_synthetic_frame_number(const uint8_t *y, uint32_t stride, uint16_t width, uint16_t height);
+
+#endif
@@ -3,13 +3,32 @@
 #include "filesys.h"
 // TODO including native.h files should never be needed, refactor filesys.h to provide necessary API
 #include "debug.h"
+#include "macros.h"
 #include "messages.h"
 #include "text.h"
 
 #include "native/filesys.h"
+#include "native/thread.h"
 
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if !(defined __WIN32__ || defined _WIN32 || defined __CYGWIN__)
+#define CHATLOG_HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/* Whether utox_load_chatlog() should try to map the log before falling back to reading it. */
+static bool chatlog_mmap = true;
+
+/* Serialises read-modify-write of the index files between the log writer and utox_load_chatlog(). */
+static pthread_mutex_t chatlog_index_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static FILE* chatlog_get_file(char hex[TOX_PUBLIC_KEY_SIZE * 2], bool append) {
     char name[TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".new.txt")];
@@ -30,51 +49,774 @@ static FILE* chatlog_get_file(char hex[TOX_PUBLIC_KEY_SIZE * 2], bool append) {
     return file;
 }
 
-size_t utox_save_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint8_t *data, size_t length) {
-    FILE *fp = chatlog_get_file(hex, true);
-    if (!fp) {
-        LOG_ERR("uTox", "Error getting a file handle for this chatlog!");
-        return 0;
+static FILE *chatlog_get_index_file(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    char name[TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".new.idx")];
+    snprintf(name, sizeof(name), "%.*s.new.idx", TOX_PUBLIC_KEY_SIZE * 2, hex);
+
+    return utox_get_file(name, NULL, UTOX_FILE_OPTS_READ | UTOX_FILE_OPTS_WRITE | UTOX_FILE_OPTS_MKDIR);
+}
+
+static bool chatlog_stat(FILE *log, uint64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (fstat(fileno(log), &st) != 0) {
+        return false;
     }
-    // Seek to the beginning of the file first because grayhatter has had issues with this on Windows.
-    // (and he really doesn't want uTox eating people's chat logs)
-    fseeko(fp, 0, SEEK_SET);
-    fseeko(fp, 0, SEEK_END);
-    off_t offset = ftello(fp);
-    fwrite(data, length, 1, fp);
-    fclose(fp);
 
-    return offset;
+    /* In ns where there's more than the second, so a log rewritten to the same size within it still shows up. */
+    *size = st.st_size;
+#if defined __APPLE__
+    *mtime = st.st_mtimespec.tv_sec * INT64_C(1000000000) + st.st_mtimespec.tv_nsec;
+#elif !(defined __WIN32__ || defined _WIN32 || defined __CYGWIN__)
+    *mtime = st.st_mtim.tv_sec * INT64_C(1000000000) + st.st_mtim.tv_nsec;
+#else
+    *mtime = st.st_mtime * INT64_C(1000000000);
+#endif
+    return true;
 }
 
-static size_t utox_count_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
-    FILE *file = chatlog_get_file(hex, false);
+static bool chatlog_index_read_header(FILE *index, LOG_FILE_INDEX_HEADER *header) {
+    fseeko(index, 0, SEEK_SET);
+    if (fread(header, sizeof(*header), 1, index) != 1) {
+        return false;
+    }
 
-    if (!file) {
+    return !memcmp(header->magic, "UTXI", 4) && header->version == LOGFILE_INDEX_VERSION;
+}
+
+static bool chatlog_index_write_header(FILE *index, LOG_FILE_INDEX_HEADER *header) {
+    memcpy(header->magic, "UTXI", 4);
+    header->version = LOGFILE_INDEX_VERSION;
+
+    fseeko(index, 0, SEEK_SET);
+    return fwrite(header, sizeof(*header), 1, index) == 1;
+}
+
+static bool chatlog_index_write_offset(FILE *index, uint64_t record, uint64_t offset) {
+    fseeko(index, sizeof(LOG_FILE_INDEX_HEADER) + record * sizeof(uint64_t), SEEK_SET);
+    return fwrite(&offset, sizeof(offset), 1, index) == 1;
+}
+
+/* Returns the offset just past the record starting at offset, or 0 if there's no complete record there. */
+static uint64_t chatlog_record_end(FILE *log, uint64_t offset, uint64_t log_size) {
+    LOG_FILE_MSG_HEADER header;
+    if (fseeko(log, offset, SEEK_SET) || fread(&header, sizeof(header), 1, log) != 1) {
         return 0;
     }
 
-    LOG_FILE_MSG_HEADER header;
-    size_t records_count = 0;
+    uint64_t end = offset + sizeof(header) + header.author_length + header.msg_length + 1;
+    return end <= log_size ? end : 0;
+}
 
-    while (fread(&header, sizeof(header), 1, file) == 1) {
-        fseeko(file, header.author_length + header.msg_length + 1, SEEK_CUR);
-        records_count++;
+/* Brings the index up to date with the log and returns the number of records in it.
+ *
+ * If the index covers a prefix of the log that still checks out, only the new tail of the log is scanned,
+ * otherwise the whole index is rebuilt. */
+static size_t chatlog_index_sync(char hex[TOX_PUBLIC_KEY_SIZE * 2], FILE *log, FILE *index, uint64_t *covered) {
+    uint64_t log_size;
+    int64_t  log_mtime;
+    if (!chatlog_stat(log, &log_size, &log_mtime)) {
+        return 0;
     }
 
+    LOG_FILE_INDEX_HEADER header;
+    if (chatlog_index_read_header(index, &header)) {
+        if (header.log_size == log_size && header.log_mtime == log_mtime) {
+            *covered = header.log_size;
+            return header.records;
+        }
 
-    if (ferror(file) || !feof(file)) {
+        if (header.log_size > log_size) {
+            LOG_NOTE("Chatlog", "Log for friend %.*s shrank, rebuilding index.", TOX_PUBLIC_KEY_SIZE * 2, hex);
+            memset(&header, 0, sizeof(header));
+        } else if (header.log_size == log_size) {
+            /* Same size but not the same log, it was rewritten where checking the last record can't tell. */
+            LOG_NOTE("Chatlog", "Log for friend %.*s was rewritten, rebuilding index.", TOX_PUBLIC_KEY_SIZE * 2, hex);
+            memset(&header, 0, sizeof(header));
+        } else if (header.records) {
+            /* Make sure the last record we know about still ends where the index thinks it does. */
+            uint64_t last;
+            fseeko(index, sizeof(header) + (header.records - 1) * sizeof(uint64_t), SEEK_SET);
+            if (fread(&last, sizeof(last), 1, index) != 1
+                || chatlog_record_end(log, last, log_size) != header.log_size) {
+                LOG_NOTE("Chatlog", "Index for friend %.*s is stale, rebuilding.", TOX_PUBLIC_KEY_SIZE * 2, hex);
+                memset(&header, 0, sizeof(header));
+            }
+        }
+    } else {
+        memset(&header, 0, sizeof(header));
+    }
+
+    uint64_t offset = header.log_size;
+    uint64_t end;
+    while ((end = chatlog_record_end(log, offset, log_size))) {
+        if (!chatlog_index_write_offset(index, header.records, offset)) {
+            LOG_ERR("Chatlog", "Unable to write index for friend %.*s", TOX_PUBLIC_KEY_SIZE * 2, hex);
+            break;
+        }
+        header.records++;
+        offset = end;
+    }
+
+    if (offset != log_size) {
         /* TODO: consider removing or truncating the log file.
-         * If !feof() this means that the file has an incomplete record,
-         * which would prevent it from loading forever, even though
-         * new records will keep being appended as usual. */
-        LOG_ERR("Chatlog", "Log read err; trying to count history for friend %.*s", TOX_PUBLIC_KEY_SIZE * 2, hex);
-        fclose(file);
-        return 0;
+         * An incomplete record at the end of the log is left out of the index, new records will keep
+         * being appended after it as usual. */
+        LOG_ERR("Chatlog", "Log read err; incomplete record at %" PRIu64 " in history for friend %.*s",
+                offset, TOX_PUBLIC_KEY_SIZE * 2, hex);
     }
 
-    fclose(file);
-    return records_count;
+    header.log_size  = offset;
+    header.log_mtime = (offset == log_size) ? log_mtime : 0;
+    chatlog_index_write_header(index, &header);
+    fflush(index);
+
+    *covered = offset;
+    return header.records;
+}
+
+/* Keeps the index in step with writes we just made to the log.
+ *
+ * before_size and before_mtime are the log's stamp from before the writes, appended lists the offsets of any
+ * records that were added. The index is only touched if it was in sync with exactly that state, otherwise it's
+ * left for chatlog_index_sync() to fix up on the next load.
+ *
+ * Returns false if the writes to the log couldn't be flushed, the index is left alone then too. */
+static bool chatlog_index_update(char hex[TOX_PUBLIC_KEY_SIZE * 2], FILE *log, uint64_t before_size,
+                                 int64_t before_mtime, const uint64_t *appended, size_t appended_count)
+{
+    if (fflush(log)) {
+        return false;
+    }
+
+    uint64_t log_size;
+    int64_t  log_mtime;
+    if (!chatlog_stat(log, &log_size, &log_mtime)) {
+        return true;
+    }
+
+    pthread_mutex_lock(&chatlog_index_lock);
+    FILE *index = chatlog_get_index_file(hex);
+    if (!index) {
+        pthread_mutex_unlock(&chatlog_index_lock);
+        return true;
+    }
+
+    LOG_FILE_INDEX_HEADER header;
+    if (!chatlog_index_read_header(index, &header)
+        || header.log_size != before_size || header.log_mtime != before_mtime) {
+        fclose(index);
+        pthread_mutex_unlock(&chatlog_index_lock);
+        return true;
+    }
+
+    for (size_t i = 0; i < appended_count; ++i) {
+        if (!chatlog_index_write_offset(index, header.records, appended[i])) {
+            fclose(index);
+            pthread_mutex_unlock(&chatlog_index_lock);
+            return true;
+        }
+        header.records++;
+    }
+
+    header.log_size  = log_size;
+    header.log_mtime = log_mtime;
+    chatlog_index_write_header(index, &header);
+    fclose(index);
+    pthread_mutex_unlock(&chatlog_index_lock);
+    return true;
+}
+
+struct chatlog_map {
+    void  *base;
+    size_t length;
+
+    uint8_t *window;
+    uint32_t refs;
+
+    MSG_HEADER headers[];
+};
+
+#ifdef CHATLOG_HAVE_MMAP
+/* Maps the bytes [first, last) of the log along with room for count message headers. */
+static CHATLOG_MAP *chatlog_map_window(FILE *file, uint64_t first, uint64_t last, size_t count) {
+    const uint64_t page    = sysconf(_SC_PAGESIZE);
+    const uint64_t aligned = first - first % page;
+
+    void *base = mmap(NULL, last - aligned, PROT_READ, MAP_PRIVATE, fileno(file), aligned);
+    if (base == MAP_FAILED) {
+        LOG_WARN("Chatlog", "Unable to map history, falling back to reading it.");
+        return NULL;
+    }
+
+    CHATLOG_MAP *map = calloc(1, sizeof(CHATLOG_MAP) + count * sizeof(MSG_HEADER));
+    if (!map) {
+        munmap(base, last - aligned);
+        return NULL;
+    }
+
+    map->base   = base;
+    map->length = last - aligned;
+    map->window = (uint8_t *)base + (first - aligned);
+
+    return map;
+}
+#else
+static CHATLOG_MAP *chatlog_map_window(FILE *UNUSED(file), uint64_t UNUSED(first), uint64_t UNUSED(last),
+                                       size_t UNUSED(count)) {
+    return NULL;
+}
+#endif
+
+static void chatlog_window_free(CHATLOG_MAP *map, uint8_t *window) {
+    if (!map) {
+        free(window);
+        return;
+    }
+
+#ifdef CHATLOG_HAVE_MMAP
+    munmap(map->base, map->length);
+#endif
+    free(map);
+}
+
+void utox_chatlog_map_release(CHATLOG_MAP *map) {
+    if (map && !--map->refs) {
+        chatlog_window_free(map, NULL);
+    }
+}
+
+/* The chatlog writer.
+ *
+ * While it's running, utox_save_chatlog() and utox_update_chatlog() only queue their writes. The writer thread
+ * picks the queue up once enough has piled up, or the oldest write has waited long enough, and writes the whole
+ * batch out through log files it keeps open, flushing and updating the index once per file per batch.
+ *
+ * The offset of an appended record is reserved when it's queued, so utox_save_chatlog() can still return it
+ * straight away. Updates go through the same queue as appends, so a receipt can never overtake its message.
+ *
+ * If a log turns out not to end where the writer expected, or a write or flush to it fails, the offsets handed out
+ * for it can't be trusted any more. The rest of the batch and everything still queued for that log is dropped, and
+ * the handle's closed, so the next write reopens it and reserves offsets from the file's real size again.
+ *
+ * Those dropped offsets get handed out again, so every failure is remembered along with the first offset it dropped.
+ * utox_save_chatlog() hands back how many failures there had been when it reserved its offset, and
+ * utox_update_chatlog() refuses to write to an offset that a later failure dropped, instead of landing on top of
+ * whatever record took its place. */
+#define CHATLOG_MAX_OPEN    8           // log files the writer keeps open at once
+#define CHATLOG_FLUSH_BYTES (64 << 10)  // write the queue out once this much is waiting...
+#define CHATLOG_FLUSH_MS    50          // ...or once the oldest write has waited this long
+
+typedef struct chatlog_log {
+    char     hex[TOX_PUBLIC_KEY_SIZE * 2];
+    FILE    *file;
+    uint64_t end;       // where the next append goes, counting the ones still queued
+    uint32_t pending;   // queued writes that aren't on disk yet
+    uint64_t last_used;
+
+    /* Only touched by the writer thread while it works through a batch. */
+    bool      touched, stamped, at_end, failed;
+    uint64_t  before_size, write_pos;
+    uint64_t  batch_from, dropped_from; // first append in this batch, and the first one dropped
+    int64_t   before_mtime;
+    uint32_t  written, dropped;
+    uint64_t *appended;
+    size_t    appended_count, appended_size;
+} CHATLOG_LOG;
+
+typedef struct chatlog_write {
+    struct chatlog_write *next;
+    CHATLOG_LOG *log;
+
+    uint64_t offset;
+    bool     append;
+    size_t   length;
+    uint8_t  data[];
+} CHATLOG_WRITE;
+
+typedef struct chatlog_failure {
+    char     hex[TOX_PUBLIC_KEY_SIZE * 2];
+    uint64_t from; // every offset from here on that was handed out before the failure was dropped
+} CHATLOG_FAILURE;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  queued, written;
+
+    CHATLOG_WRITE  *head, *tail;
+    size_t          queued_bytes;
+    struct timespec oldest;
+
+    bool     flush_now, kill;
+    uint64_t use_count;
+
+    CHATLOG_LOG logs[CHATLOG_MAX_OPEN];
+
+    /* Never shrinks, the generations handed out are indices into it. */
+    CHATLOG_FAILURE *failures;
+    uint32_t         failure_count, failure_size;
+} writer = {
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
+    .queued  = PTHREAD_COND_INITIALIZER,
+    .written = PTHREAD_COND_INITIALIZER,
+};
+
+bool utox_chatlog_writer_init = false;
+
+/* Must be called with writer.lock held. */
+static CHATLOG_LOG *chatlog_writer_find(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    for (size_t i = 0; i < CHATLOG_MAX_OPEN; ++i) {
+        if (writer.logs[i].file && !memcmp(writer.logs[i].hex, hex, TOX_PUBLIC_KEY_SIZE * 2)) {
+            return &writer.logs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Whether an earlier failure dropped the record this offset was handed out for. Must be called with writer.lock
+ * held. */
+static bool chatlog_writer_dropped(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint64_t offset, uint32_t generation) {
+    for (uint32_t i = generation; i < writer.failure_count; ++i) {
+        CHATLOG_FAILURE *f = &writer.failures[i];
+        if (offset >= f->from && !memcmp(f->hex, hex, TOX_PUBLIC_KEY_SIZE * 2)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Waits until the writer has nothing queued for this friend, returns with writer.lock still held. */
+static CHATLOG_LOG *chatlog_writer_wait(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    CHATLOG_LOG *log;
+    while ((log = chatlog_writer_find(hex)) && log->pending) {
+        writer.flush_now = true;
+        pthread_cond_signal(&writer.queued);
+        pthread_cond_wait(&writer.written, &writer.lock);
+    }
+
+    return log;
+}
+
+/* Finds or opens the writer's handle for this friend's log, evicting the least recently used idle one if all the
+ * slots are taken. Must be called with writer.lock held. */
+static CHATLOG_LOG *chatlog_writer_get_log(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    CHATLOG_LOG *log;
+    while (!(log = chatlog_writer_find(hex))) {
+        CHATLOG_LOG *lru = NULL;
+        for (size_t i = 0; i < CHATLOG_MAX_OPEN; ++i) {
+            CHATLOG_LOG *l = &writer.logs[i];
+            if (!l->file) {
+                lru = l;
+                break;
+            }
+
+            if (!l->pending && (!lru || l->last_used < lru->last_used)) {
+                lru = l;
+            }
+        }
+
+        if (!lru) {
+            /* Every open log still has writes in flight, let the writer get through some of them. */
+            writer.flush_now = true;
+            pthread_cond_signal(&writer.queued);
+            pthread_cond_wait(&writer.written, &writer.lock);
+            continue;
+        }
+
+        if (lru->file) {
+            fclose(lru->file);
+            lru->file = NULL;
+        }
+
+        char name[TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".new.txt")];
+        snprintf(name, sizeof(name), "%.*s.new.txt", TOX_PUBLIC_KEY_SIZE * 2, hex);
+
+        FILE *file = utox_get_file(name, NULL, UTOX_FILE_OPTS_READ | UTOX_FILE_OPTS_WRITE | UTOX_FILE_OPTS_MKDIR);
+        if (!file) {
+            return NULL;
+        }
+
+        /* Big enough that a whole batch for one friend usually goes out in a single write. */
+        setvbuf(file, NULL, _IOFBF, CHATLOG_FLUSH_BYTES);
+        fseeko(file, 0, SEEK_END);
+
+        memcpy(lru->hex, hex, TOX_PUBLIC_KEY_SIZE * 2);
+        lru->file    = file;
+        lru->end     = ftello(file);
+        lru->pending = 0;
+        log = lru;
+    }
+
+    log->last_used = ++writer.use_count;
+    return log;
+}
+
+/* Returns false if the writer isn't running and the caller has to write it out itself, otherwise sets ok to
+ * whether the write was queued. Appends get the generation of their offset back, updates have to pass it in. */
+static bool chatlog_writer_queue(char hex[TOX_PUBLIC_KEY_SIZE * 2], bool append, uint64_t *offset,
+                                 uint32_t *generation, uint8_t *data, size_t length, bool *ok)
+{
+    *ok = false;
+
+    CHATLOG_WRITE *w = malloc(sizeof(CHATLOG_WRITE) + length);
+    if (!w) {
+        LOG_ERR("Chatlog", "Unable to malloc a chatlog write.");
+        return true;
+    }
+
+    w->next   = NULL;
+    w->append = append;
+    w->length = length;
+    memcpy(w->data, data, length);
+
+    pthread_mutex_lock(&writer.lock);
+    if (append) {
+        *generation = writer.failure_count;
+    } else if (chatlog_writer_dropped(hex, *offset, *generation)) {
+        pthread_mutex_unlock(&writer.lock);
+        LOG_WARN("Chatlog", "Not updating the history for friend %.*s at %" PRIu64 ", that record was dropped.",
+                 TOX_PUBLIC_KEY_SIZE * 2, hex, *offset);
+        free(w);
+        return true;
+    }
+
+    if (!utox_chatlog_writer_init) {
+        pthread_mutex_unlock(&writer.lock);
+        free(w);
+        return false;
+    }
+
+    CHATLOG_LOG *log = chatlog_writer_get_log(hex);
+    if (!log) {
+        pthread_mutex_unlock(&writer.lock);
+        LOG_ERR("Chatlog", "Error getting a file handle for this chatlog!");
+        free(w);
+        return true;
+    }
+
+    if (append) {
+        *offset   = log->end;
+        log->end += length;
+    }
+    w->offset = *offset;
+    w->log    = log;
+    log->pending++;
+
+    if (writer.tail) {
+        writer.tail->next = w;
+    } else {
+        writer.head = w;
+        clock_gettime(CLOCK_REALTIME, &writer.oldest);
+    }
+    writer.tail = w;
+
+    writer.queued_bytes += length;
+    if (writer.queued_bytes >= CHATLOG_FLUSH_BYTES) {
+        pthread_cond_signal(&writer.queued);
+    }
+    pthread_mutex_unlock(&writer.lock);
+
+    *ok = true;
+    return true;
+}
+
+static void chatlog_writer_append_offset(CHATLOG_LOG *log, uint64_t offset) {
+    if (log->appended_count == log->appended_size) {
+        size_t    size     = log->appended_size ? log->appended_size * 2 : 64;
+        uint64_t *appended = realloc(log->appended, size * sizeof(uint64_t));
+        if (!appended) {
+            /* The index can't follow this batch, it'll get caught up on the next load instead. */
+            log->stamped = false;
+            return;
+        }
+        log->appended      = appended;
+        log->appended_size = size;
+    }
+
+    log->appended[log->appended_count++] = offset;
+}
+
+/* Writes out a batch taken off the queue, without holding writer.lock. */
+static void chatlog_writer_write(CHATLOG_WRITE *batch) {
+    for (CHATLOG_WRITE *w = batch; w; w = w->next) {
+        CHATLOG_LOG *log = w->log;
+        if (!log->touched) {
+            log->touched        = true;
+            log->at_end         = false;
+            log->appended_count = 0;
+            log->stamped        = chatlog_stat(log->file, &log->before_size, &log->before_mtime);
+            log->batch_from     = log->dropped_from = UINT64_MAX;
+        }
+
+        log->written++;
+        if (w->append && log->batch_from == UINT64_MAX) {
+            log->batch_from = w->offset;
+        }
+
+        if (log->failed) {
+            log->dropped++;
+            if (w->append && w->offset < log->dropped_from) {
+                log->dropped_from = w->offset;
+            }
+            continue;
+        }
+
+        if (w->append) {
+            /* Consecutive appends don't seek, so stdio can hand them to the OS in one go. */
+            if (!log->at_end) {
+                fseeko(log->file, 0, SEEK_END);
+                log->write_pos = ftello(log->file);
+                log->at_end    = true;
+            }
+
+            if (log->write_pos != w->offset) {
+                LOG_ERR("Chatlog", "Log for friend %.*s ends at %" PRIu64 ", but this record was given offset %"
+                        PRIu64 ".", TOX_PUBLIC_KEY_SIZE * 2, log->hex, log->write_pos, w->offset);
+                log->failed = true;
+            } else if (fwrite(w->data, w->length, 1, log->file) != 1) {
+                LOG_ERR("Chatlog", "Unable to write history for friend %.*s", TOX_PUBLIC_KEY_SIZE * 2, log->hex);
+                log->failed = true;
+            } else {
+                chatlog_writer_append_offset(log, log->write_pos);
+                log->write_pos += w->length;
+            }
+        } else {
+            log->at_end = false;
+            if (fseeko(log->file, w->offset, SEEK_SET)) {
+                LOG_ERR("Chatlog", "History:\tUnable to seek to position %" PRIu64 " in file provided.", w->offset);
+                log->failed = true;
+            } else if (fwrite(w->data, w->length, 1, log->file) != 1) {
+                LOG_ERR("Chatlog", "Unable to update history for friend %.*s", TOX_PUBLIC_KEY_SIZE * 2, log->hex);
+                log->failed = true;
+            }
+        }
+
+        if (log->failed) {
+            log->dropped++;
+            if (w->append && w->offset < log->dropped_from) {
+                log->dropped_from = w->offset;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < CHATLOG_MAX_OPEN; ++i) {
+        CHATLOG_LOG *log = &writer.logs[i];
+        if (!log->touched) {
+            continue;
+        }
+        log->touched = false;
+
+        /* Don't let the index take in a batch that didn't all make it. */
+        if (log->failed) {
+            continue;
+        }
+
+        bool flushed;
+        if (log->stamped) {
+            flushed = chatlog_index_update(log->hex, log->file, log->before_size, log->before_mtime, log->appended,
+                                           log->appended_count);
+        } else {
+            flushed = !fflush(log->file);
+        }
+
+        if (!flushed) {
+            LOG_ERR("Chatlog", "Unable to flush history for friend %.*s", TOX_PUBLIC_KEY_SIZE * 2, log->hex);
+            log->failed = true;
+            /* None of this batch' appends can be counted on to have made it. */
+            log->dropped_from = log->batch_from;
+        }
+    }
+
+    while (batch) {
+        CHATLOG_WRITE *next = batch->next;
+        free(batch);
+        batch = next;
+    }
+}
+
+/* Drops everything still queued for a log that failed, and closes it so the next write starts over from the file's
+ * real size. Must be called with writer.lock held. */
+static void chatlog_writer_fail(CHATLOG_LOG *log) {
+    CHATLOG_WRITE **link = &writer.head;
+    writer.tail          = NULL;
+    while (*link) {
+        CHATLOG_WRITE *w = *link;
+        if (w->log != log) {
+            writer.tail = w;
+            link        = &w->next;
+            continue;
+        }
+
+        *link                = w->next;
+        writer.queued_bytes -= w->length;
+        log->pending--;
+        log->dropped++;
+        if (w->append && w->offset < log->dropped_from) {
+            log->dropped_from = w->offset;
+        }
+        free(w);
+    }
+
+    LOG_ERR("Chatlog", "Dropped %u writes to the history for friend %.*s", log->dropped, TOX_PUBLIC_KEY_SIZE * 2,
+            log->hex);
+
+    if (log->dropped_from != UINT64_MAX) {
+        if (writer.failure_count == writer.failure_size) {
+            uint32_t         size     = writer.failure_size ? writer.failure_size * 2 : 8;
+            CHATLOG_FAILURE *failures = realloc(writer.failures, size * sizeof(CHATLOG_FAILURE));
+            if (!failures) {
+                LOG_FATAL_ERR(EXIT_MALLOC, "Chatlog", "Unable to remember which writes were dropped.");
+            }
+            writer.failures     = failures;
+            writer.failure_size = size;
+        }
+
+        CHATLOG_FAILURE *f = &writer.failures[writer.failure_count++];
+        memcpy(f->hex, log->hex, TOX_PUBLIC_KEY_SIZE * 2);
+        f->from = log->dropped_from;
+    }
+
+    /* Whatever's left in the buffer goes wherever it goes, the next open takes the file as it finds it. */
+    fclose(log->file);
+    log->file    = NULL;
+    log->failed  = false;
+    log->dropped = 0;
+}
+
+static void chatlog_writer_thread(void *UNUSED(args)) {
+    pthread_mutex_lock(&writer.lock);
+    while (writer.head || !writer.kill) {
+        if (!writer.head) {
+            pthread_cond_wait(&writer.queued, &writer.lock);
+            continue;
+        }
+
+        /* Give the batch a chance to fill up before writing it. */
+        struct timespec deadline = writer.oldest;
+        deadline.tv_nsec += CHATLOG_FLUSH_MS * 1000 * 1000;
+        if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000 * 1000 * 1000;
+        }
+
+        while (!writer.kill && !writer.flush_now && writer.queued_bytes < CHATLOG_FLUSH_BYTES) {
+            if (pthread_cond_timedwait(&writer.queued, &writer.lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        CHATLOG_WRITE *batch = writer.head;
+        writer.head         = writer.tail = NULL;
+        writer.queued_bytes = 0;
+        writer.flush_now    = false;
+        pthread_mutex_unlock(&writer.lock);
+
+        chatlog_writer_write(batch);
+
+        pthread_mutex_lock(&writer.lock);
+        for (size_t i = 0; i < CHATLOG_MAX_OPEN; ++i) {
+            writer.logs[i].pending -= writer.logs[i].written;
+            writer.logs[i].written  = 0;
+
+            if (writer.logs[i].failed) {
+                chatlog_writer_fail(&writer.logs[i]);
+            }
+        }
+        pthread_cond_broadcast(&writer.written);
+    }
+
+    for (size_t i = 0; i < CHATLOG_MAX_OPEN; ++i) {
+        CHATLOG_LOG *log = &writer.logs[i];
+        if (log->file) {
+            fclose(log->file);
+        }
+        free(log->appended);
+        memset(log, 0, sizeof(*log));
+    }
+
+    writer.kill = false;
+    utox_chatlog_writer_init = false;
+    pthread_cond_broadcast(&writer.written);
+    pthread_mutex_unlock(&writer.lock);
+}
+
+void utox_chatlog_writer_start(void) {
+    pthread_mutex_lock(&writer.lock);
+    if (utox_chatlog_writer_init) {
+        pthread_mutex_unlock(&writer.lock);
+        return;
+    }
+
+    utox_chatlog_writer_init = true;
+    pthread_mutex_unlock(&writer.lock);
+
+    thread(chatlog_writer_thread, NULL);
+}
+
+void utox_chatlog_writer_stop(void) {
+    pthread_mutex_lock(&writer.lock);
+    if (!utox_chatlog_writer_init) {
+        pthread_mutex_unlock(&writer.lock);
+        return;
+    }
+
+    writer.kill = true;
+    pthread_cond_signal(&writer.queued);
+    while (utox_chatlog_writer_init) {
+        pthread_cond_wait(&writer.written, &writer.lock);
+    }
+    pthread_mutex_unlock(&writer.lock);
+}
+
+/* Makes sure nothing queued for this friend is still waiting to be written before we go read their log. Returns
+ * the generation of the records that are on disk now. */
+static uint32_t chatlog_writer_sync(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    pthread_mutex_lock(&writer.lock);
+    if (utox_chatlog_writer_init) {
+        chatlog_writer_wait(hex);
+    }
+    uint32_t generation = writer.failure_count;
+    pthread_mutex_unlock(&writer.lock);
+
+    return generation;
+}
+
+size_t utox_save_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint8_t *data, size_t length, uint32_t *generation) {
+    uint64_t offset;
+    uint32_t reserved;
+    bool     ok;
+    bool     queued = chatlog_writer_queue(hex, true, &offset, &reserved, data, length, &ok);
+    if (generation) {
+        *generation = reserved;
+    }
+
+    if (queued) {
+        return ok ? offset : UTOX_CHATLOG_OFFSET_NONE;
+    }
+
+    FILE *fp = chatlog_get_file(hex, true);
+    if (!fp) {
+        LOG_ERR("uTox", "Error getting a file handle for this chatlog!");
+        return UTOX_CHATLOG_OFFSET_NONE;
+    }
+    // Seek to the beginning of the file first because grayhatter has had issues with this on Windows.
+    // (and he really doesn't want uTox eating people's chat logs)
+    fseeko(fp, 0, SEEK_SET);
+    fseeko(fp, 0, SEEK_END);
+    offset = ftello(fp);
+
+    uint64_t before_size;
+    int64_t  before_mtime;
+    bool     stamped = chatlog_stat(fp, &before_size, &before_mtime);
+
+    fwrite(data, length, 1, fp);
+    if (stamped) {
+        chatlog_index_update(hex, fp, before_size, before_mtime, &offset, 1);
+    }
+    fclose(fp);
+
+    return offset;
 }
 
 /* TODO create fxn that will try to recover a corrupt chat history.
@@ -87,122 +829,182 @@ MSG_HEADER **utox_load_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t *size,
     /* Because every platform is different, we have to ask them to open the file for us.
      * However once we have it, every platform does the same thing, this should prevent issues
      * from occurring on a single platform. */
+    uint32_t generation = chatlog_writer_sync(hex);
 
-    size_t records_count = utox_count_chatlog(hex);
+    FILE *file = chatlog_get_file(hex, false);
+    if (!file) {
+        LOG_INFO("Chatlog", "No log exists.");
+        return NULL;
+    }
+
+    FILE *index = chatlog_get_index_file(hex);
+    if (!index) {
+        /* We can still read history without a writable profile dir, we just have to redo the scan every time. */
+        LOG_WARN("Chatlog", "Unable to open history index, using a scratch one.");
+        index = tmpfile();
+        if (!index) {
+            LOG_ERR("Chatlog", "Log read:\tUnable to create history index.");
+            fclose(file);
+            return NULL;
+        }
+    }
+
+    uint64_t covered;
+    pthread_mutex_lock(&chatlog_index_lock);
+    size_t records_count = chatlog_index_sync(hex, file, index, &covered);
+    pthread_mutex_unlock(&chatlog_index_lock);
     if (skip >= records_count) {
         if (skip > 0) {
             LOG_ERR("Chatlog", "Error, skipped all records");
         } else {
             LOG_INFO("Chatlog", "No log exists.");
         }
+        fclose(index);
+        fclose(file);
         return NULL;
     }
 
-    FILE *file = chatlog_get_file(hex, false);
-    if (!file) {
-        LOG_TRACE("Chatlog", "Log read:\tUnable to access file provided.");
+    if (count > (records_count - skip)) {
+        count = records_count - skip;
+    }
+
+    size_t start_at = records_count - count - skip;
+
+    /* The window we want is contiguous in the log, so find where it starts and ends and read it in one go. */
+    uint64_t first, last;
+    fseeko(index, sizeof(LOG_FILE_INDEX_HEADER) + start_at * sizeof(uint64_t), SEEK_SET);
+    if (fread(&first, sizeof(first), 1, index) != 1) {
+        LOG_ERR("Chatlog", "Log read:\tUnable to read history index for friend %.*s", TOX_PUBLIC_KEY_SIZE * 2, hex);
+        fclose(index);
+        fclose(file);
         return NULL;
     }
 
-    if (count > (records_count - skip)) {
-        count = records_count - skip;
+    if (skip == 0 || fseeko(index, (count - 1) * sizeof(uint64_t), SEEK_CUR) || fread(&last, sizeof(last), 1, index) != 1) {
+        last = covered;
+    }
+    fclose(index);
+
+    /* Map the window when we can so message text can point straight into the page cache, instead of being
+     * copied onto the heap one message at a time. */
+    CHATLOG_MAP *map = chatlog_mmap ? chatlog_map_window(file, first, last, count) : NULL;
+    uint8_t *window;
+    if (map) {
+        window = map->window;
+    } else {
+        window = malloc(last - first);
+        if (!window) {
+            LOG_ERR("Chatlog", "Log read:\tCouldn't allocate memory for log window.");
+            fclose(file);
+            return NULL;
+        }
+
+        if (fseeko(file, first, SEEK_SET) || fread(window, last - first, 1, file) != 1) {
+            LOG_ERR("Chatlog", "Log read:\tUnable to read history for friend %.*s", TOX_PUBLIC_KEY_SIZE * 2, hex);
+            free(window);
+            fclose(file);
+            return NULL;
+        }
     }
+    fclose(file);
 
     MSG_HEADER **data = calloc(count + 1, sizeof(MSG_HEADER *));
     MSG_HEADER **start = data;
 
     if (!data) {
         LOG_ERR("Chatlog", "Log read:\tCouldn't allocate memory for log entries.");
-        fclose(file);
+        chatlog_window_free(map, window);
         return NULL;
     }
 
-    size_t start_at = records_count - count - skip;
     size_t actual_count = 0;
-
-    size_t file_offset = 0;
+    size_t pos          = 0;
+    bool   too_large    = false;
 
     LOG_FILE_MSG_HEADER header;
-    while (fread(&header, sizeof(header), 1, file) == 1) {
-        if (start_at) {
-            fseeko(file, header.author_length, SEEK_CUR); /* Skip the recorded author */
-            fseeko(file, header.msg_length, SEEK_CUR);    /* Skip the message */
-            fseeko(file, 1, SEEK_CUR);                    /* Skip the newline char */
-            start_at--;
-            file_offset = ftello(file);
-            continue;
+    while (count && pos + sizeof(header) <= last - first) {
+        memcpy(&header, window + pos, sizeof(header));
+
+        if (header.msg_length > 1 << 16) {
+            LOG_ERR("Chatlog", "Can't malloc that much, you'll probably have to move or delete your"
+                        " history for this peer.\n\t\tFriend number %.*s, count %u,"
+                        " actual_count %zu, start at %zu, error size %zu.\n",
+                        TOX_PUBLIC_KEY_SIZE * 2, hex, count, actual_count, start_at, header.msg_length);
+            too_large = true;
+            break;
         }
 
-        if (count) {
-            /* we have to skip the author name for now, it's left here for group chats support in the future */
-            fseeko(file, header.author_length, SEEK_CUR);
-            if (header.msg_length > 1 << 16) {
-                LOG_ERR("Chatlog", "Can't malloc that much, you'll probably have to move or delete your"
-                            " history for this peer.\n\t\tFriend number %.*s, count %u,"
-                            " actual_count %lu, start at %lu, error size %lu.\n",
-                            TOX_PUBLIC_KEY_SIZE * 2, hex, count, actual_count, start_at, header.msg_length);
-                if (size) {
-                    *size = 0;
-                }
+        /* we have to skip the author name for now, it's left here for group chats support in the future */
+        size_t text = pos + sizeof(header) + header.author_length;
+        if (text + header.msg_length > last - first) {
+            LOG_ERR("Chatlog", "Log read:\tError reading record %u of length %zu at offset %" PRIu64 ": stopping.",
+                        count, header.msg_length, first + pos);
+            break;
+        }
 
-                fclose(file);
-                return start;
-            }
+        MSG_HEADER *msg = map ? &map->headers[actual_count] : calloc(1, sizeof(MSG_HEADER));
+        if (!msg) {
+            LOG_ERR("Chatlog", "Unable to malloc... sorry!");
+            free(start);
+            free(window);
+            return NULL;
+        }
 
-            MSG_HEADER *msg = calloc(1, sizeof(MSG_HEADER));
-            if (!msg) {
-                LOG_ERR("Chatlog", "Unable to malloc... sorry!");
-                free(start);
-                fclose(file);
-                return NULL;
-            }
+        msg->our_msg       = header.author;
+        msg->receipt_time  = header.receipt;
+        msg->time          = header.time;
+        msg->msg_type      = header.msg_type;
+        msg->disk_offset   = first + pos;
+        msg->disk_generation = generation;
 
-            msg->our_msg       = header.author;
-            msg->receipt_time  = header.receipt;
-            msg->time          = header.time;
-            msg->msg_type      = header.msg_type;
-            msg->disk_offset   = file_offset;
+        msg->via.txt.author_length = header.author_length;
+        msg->via.txt.length        = header.msg_length;
 
-            msg->via.txt.length        = header.msg_length;
+        if (map) {
+            /* Read only, anything that wants to change the text has to make its own copy first. */
+            msg->via.txt.msg = (char *)window + text;
+            msg->log_map     = map;
+        } else {
             msg->via.txt.msg = calloc(1, msg->via.txt.length);
             if (!msg->via.txt.msg) {
                 LOG_ERR("Chatlog", "Unable to malloc for via.txt.msg... sorry!");
                 free(start);
                 free(msg);
-                fclose(file);
+                free(window);
                 return NULL;
             }
+            memcpy(msg->via.txt.msg, window + text, msg->via.txt.length);
+        }
+
+        msg->via.txt.length = utf8_validate((uint8_t *)msg->via.txt.msg, msg->via.txt.length);
+        pos = text + header.msg_length + 1; /* skip the extra \n char */
+
+        *data++ = msg;
+        --count;
+        ++actual_count;
+    }
 
-            msg->via.txt.author_length = header.author_length;
-            // TODO: msg->via.txt.author used to be allocated but left empty. Commented out for now.
-            // msg->via.txt.author = calloc(1, msg->via.txt.author_length);
-            // if (!msg->via.txt.author) {
-            //     LOG_ERR("Chatlog", "Unable to malloc for via.txt.author... sorry!");
-            //     free(msg->via.txt.msg);
-            //     free(msg);
-            //     fclose(file);
-            //     return NULL;
-            // }
-
-            if (fread(msg->via.txt.msg, msg->via.txt.length, 1, file) != 1) {
-                LOG_ERR("Chatlog", "Log read:\tError reading record %u of length %u at offset %lu: stopping.",
-                            count, msg->via.txt.length, msg->disk_offset);
-                // free(msg->via.txt.author);
+    if (too_large) {
+        /* Don't hand out half a backlog, the caller wouldn't know to free it. */
+        while (actual_count) {
+            MSG_HEADER *msg = start[--actual_count];
+            start[actual_count] = NULL;
+            if (!map) {
                 free(msg->via.txt.msg);
                 free(msg);
-                break;
             }
-
-            msg->via.txt.length = utf8_validate((uint8_t *)msg->via.txt.msg, msg->via.txt.length);
-            *data++ = msg;
-            --count;
-            ++actual_count;
-            fseeko(file, 1, SEEK_CUR); /* seek an extra \n char */
-            file_offset = ftello(file);
         }
     }
 
-    fclose(file);
+    if (map) {
+        /* Every message keeps the mapping alive, it goes away with the last of them. */
+        map->refs = actual_count;
+        if (!actual_count) {
+            chatlog_window_free(map, NULL);
+        }
+    } else {
+        free(window);
+    }
 
     if (size) {
         *size = actual_count;
@@ -211,7 +1013,69 @@ MSG_HEADER **utox_load_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t *size,
     return start;
 }
 
-bool utox_update_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t offset, uint8_t *data, size_t length) {
+uint64_t utox_scan_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint64_t offset, chatlog_scan_cb *func, void *ctx) {
+    chatlog_writer_sync(hex);
+
+    FILE *file = chatlog_get_file(hex, false);
+    if (!file) {
+        return offset;
+    }
+
+    if (fseeko(file, offset, SEEK_SET)) {
+        fclose(file);
+        return offset;
+    }
+
+    uint8_t *record = NULL;
+    size_t   size   = 0;
+
+    LOG_FILE_MSG_HEADER header;
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        if (header.msg_length > 1 << 16 || header.author_length > 1 << 16) {
+            LOG_ERR("Chatlog", "Scan:\tRecord at %" PRIu64 " for friend %.*s is too large, stopping.", offset,
+                    TOX_PUBLIC_KEY_SIZE * 2, hex);
+            break;
+        }
+
+        size_t length = header.author_length + header.msg_length + 1;
+        if (length > size) {
+            uint8_t *tmp = realloc(record, length);
+            if (!tmp) {
+                LOG_ERR("Chatlog", "Scan:\tUnable to realloc for record.");
+                break;
+            }
+            record = tmp;
+            size   = length;
+        }
+
+        if (fread(record, length, 1, file) != 1) {
+            break; /* incomplete record at the end of the log */
+        }
+
+        if (!func(ctx, offset, sizeof(header) + length, &header, (char *)record + header.author_length)) {
+            break;
+        }
+        offset += sizeof(header) + length;
+    }
+
+    free(record);
+    fclose(file);
+    return offset;
+}
+
+bool utox_update_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t offset, uint32_t generation, uint8_t *data,
+                         size_t length)
+{
+    if (offset == UTOX_CHATLOG_OFFSET_NONE) {
+        return false;
+    }
+
+    uint64_t at = offset;
+    bool     ok;
+    if (chatlog_writer_queue(hex, false, &at, &generation, data, length, &ok)) {
+        return ok;
+    }
+
     FILE *file = chatlog_get_file(hex, true);
 
     if (!file) {
@@ -220,20 +1084,41 @@ bool utox_update_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t offset, uint8
     }
 
     if (fseeko(file, offset, SEEK_SET)) {
-        LOG_ERR("Chatlog", "History:\tUnable to seek to position %lu in file provided.", offset);
+        LOG_ERR("Chatlog", "History:\tUnable to seek to position %zu in file provided.", offset);
         fclose(file);
         return false;
     }
 
+    uint64_t before_size;
+    int64_t  before_mtime;
+    bool     stamped = chatlog_stat(file, &before_size, &before_mtime);
+
     fwrite(data, length, 1, file);
+    if (stamped) {
+        chatlog_index_update(hex, file, before_size, before_mtime, NULL, 0);
+    }
     fclose(file);
 
     return true;
 }
 
 bool utox_remove_friend_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    /* Let anything still queued land first, and drop the writer's handle so the next save starts a new file. */
+    pthread_mutex_lock(&writer.lock);
+    if (utox_chatlog_writer_init) {
+        CHATLOG_LOG *log = chatlog_writer_wait(hex);
+        if (log) {
+            fclose(log->file);
+            log->file = NULL;
+        }
+    }
+    pthread_mutex_unlock(&writer.lock);
+
     char name[TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".new.txt")];
 
+    snprintf(name, sizeof(name), "%.*s.new.idx", TOX_PUBLIC_KEY_SIZE * 2, hex);
+    utox_remove_file((uint8_t*)name, sizeof(name));
+
     snprintf(name, sizeof(name), "%.*s.new.txt", TOX_PUBLIC_KEY_SIZE * 2, hex);
 
     return utox_remove_file((uint8_t*)name, sizeof(name));
@@ -248,6 +1133,8 @@ void utox_export_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], FILE *dest_file) {
         return;
     }
 
+    chatlog_writer_sync(hex);
+
     LOG_FILE_MSG_HEADER header;
     FILE *file = chatlog_get_file(hex, false);
 
@@ -3,7 +3,9 @@
 
 #include <tox/tox.h>
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <time.h>
 
@@ -26,26 +28,83 @@ typedef struct {
     uint8_t zeroes[2];
 } LOG_FILE_MSG_HEADER;
 
+/* Sidecar index kept next to every <id>.new.txt as <id>.new.idx.
+ *
+ * The header is followed by one uint64_t byte offset per record in the log. log_size and log_mtime (in ns) describe
+ * the state of the log the index was last synced with; if they don't match the log on disk the index is caught up (or
+ * rebuilt) the next time the log is loaded. */
+#define LOGFILE_INDEX_VERSION 2
+typedef struct {
+    uint8_t  magic[4];
+    uint32_t version;
+
+    uint64_t log_size;
+    int64_t  log_mtime;
+
+    uint64_t records;
+} LOG_FILE_INDEX_HEADER;
+
 
 typedef struct msg_header MSG_HEADER;
 
+/* Backing store for a backlog loaded by utox_load_chatlog() straight from a mapping of the log. */
+typedef struct chatlog_map CHATLOG_MAP;
+
+/* Set while the chatlog writer thread is running. */
+extern bool utox_chatlog_writer_init;
+
+/* Starts the thread that utox_save_chatlog() and utox_update_chatlog() hand their writes to. Until it's started
+ * they write to disk themselves. */
+void utox_chatlog_writer_start(void);
+
+/* Writes out everything that's still queued and stops the writer thread. */
+void utox_chatlog_writer_stop(void);
+
+/* Returned by utox_save_chatlog() for a record that didn't make it to the log. */
+#define UTOX_CHATLOG_OFFSET_NONE SIZE_MAX
+
 /**
  * Saves chat log for friend with id hex
  *
  * Returns the offset on success
- * Returns 0 on failure
+ * Returns UTOX_CHATLOG_OFFSET_NONE on failure
+ *
+ * When the writer thread is running the record is only queued, but its offset is already reserved. If the writer
+ * later has to drop it, the offset can be handed out again, so generation is set to what has to be passed to
+ * utox_update_chatlog() along with it.
  */
-size_t utox_save_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint8_t *data, size_t length);
+size_t utox_save_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint8_t *data, size_t length, uint32_t *generation);
 
-// This one actually does the work of reading the logfile information.
+/** This one actually does the work of reading the logfile information.
+ *
+ * Where the platform allows it the log is mapped, and the returned messages have msg->log_map set. Their text
+ * points into the (read only) mapping and the headers themselves are owned by it, so they must be released with
+ * utox_chatlog_map_release() rather than free()d. message_free() takes care of that. */
 MSG_HEADER **utox_load_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t *size, uint32_t count, uint32_t skip);
 
+/* Drops one message's reference to the mapping it was loaded from, unmapping it once none are left. */
+void utox_chatlog_map_release(CHATLOG_MAP *map);
+
+/* Called by utox_scan_chatlog() for every record, return false to stop the scan before the next one. */
+typedef bool chatlog_scan_cb(void *ctx, uint64_t offset, size_t length, const LOG_FILE_MSG_HEADER *header,
+                             const char *msg);
+
+/* Hands every complete record in the log for friend with id hex, from offset onwards, to func without loading the
+ * log into memory.
+ *
+ * Returns the offset just past the last record func accepted. */
+uint64_t utox_scan_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint64_t offset, chatlog_scan_cb *func, void *ctx);
+
 /** utox_update_chatlog Updates the data for this friend's history.
  *
  * When given a friend_number and offset, utox_update_chatlog will overwrite the file, with
  * the supplied data * length. It makes no attempt to verify the data or length, it'll just
- * write blindly. */
-bool utox_update_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t offset, uint8_t *data, size_t length);
+ * write blindly.
+ *
+ * generation is the one utox_save_chatlog() gave for the offset, or MSG_HEADER.disk_generation for loaded
+ * messages. Nothing's written if the record at offset was dropped, or never saved in the first place. */
+bool utox_update_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t offset, uint32_t generation, uint8_t *data,
+                         size_t length);
 
 /**
  * Deletes the chat log file for the friend with id hex
@@ -0,0 +1,1033 @@
+#include "chatlog_search.h"
+
+#include "chatlog.h"
+#include "debug.h"
+#include "filesys.h"
+#include "macros.h"
+
+#include "native/thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SEARCH_INDEX_VERSION 1
+#define SEARCH_INDEX_NAME    "chatlog_search.idx"
+#define SEARCH_INDEX_TEMP    "chatlog_search.idx.tmp"
+
+#define SEARCH_TOKEN_MAX     64   // longer words are indexed by their first 64 bytes
+#define SEARCH_QUERY_WORDS   16
+#define SEARCH_UNSORTED_MAX  1024 // new terms a query scans one by one before they're all sorted in again
+#define SEARCH_SAVE_INTERVAL 300  // seconds
+
+/* A hit is packed into a single integer while searching so the sets can be sorted and intersected cheaply. */
+#define SEARCH_OFFSET_BITS 44
+#define SEARCH_KEY(friend, offset) (((uint64_t)(friend) << SEARCH_OFFSET_BITS) | (offset))
+
+typedef struct {
+    char     id_str[TOX_PUBLIC_KEY_SIZE * 2]; // all zeroes once the friend's history was removed
+    uint64_t covered;                         // how much of the start of the log is in the index
+    bool     behind;                          // the log has records past covered that still need indexing
+} SEARCH_FRIEND;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t token; // offset into search.tokens
+    uint16_t length;
+
+    /* Postings are varint (friend, offset) pairs, where offset is relative to the previous pair if that was for
+     * the same friend. */
+    uint32_t last_friend;
+    uint64_t last_offset;
+
+    uint8_t *postings;
+    uint32_t postings_length, postings_size;
+} SEARCH_TERM;
+
+typedef struct {
+    uint8_t  magic[4];
+    uint32_t version;
+    uint32_t friend_count;
+    uint32_t term_count;
+} SEARCH_INDEX_HEADER;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+    SEARCH_FRIEND *friends;
+    uint32_t       friend_count, friend_size, last_friend;
+
+    SEARCH_TERM *terms;
+    uint32_t     term_count, term_size;
+
+    uint32_t *table; // term + 1, or 0 for an empty slot
+    uint32_t  table_size;
+
+    uint8_t *tokens;
+    size_t   tokens_length, tokens_size;
+
+    uint32_t *sorted; // terms [0, sorted_count) in token order
+    uint32_t  sorted_count;
+
+    bool   running, kill, dirty;
+    time_t saved;
+} search = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+bool chatlog_search_thread_init = false;
+
+static uint32_t search_hash(const uint8_t *token, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ token[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static bool search_is_word(uint8_t c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+/* Finds the next word in text starting at *pos and copies it, folded to lower case, into token. */
+static size_t search_next_token(const char *text, size_t length, size_t *pos, uint8_t token[SEARCH_TOKEN_MAX]) {
+    size_t i = *pos;
+    while (i < length && !search_is_word(text[i])) {
+        ++i;
+    }
+
+    size_t token_length = 0;
+    while (i < length && search_is_word(text[i])) {
+        uint8_t c = text[i++];
+        if (token_length < SEARCH_TOKEN_MAX) {
+            token[token_length++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        }
+    }
+
+    *pos = i;
+    return token_length;
+}
+
+static uint8_t *search_put_varint(uint8_t *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = value | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+
+    return p;
+}
+
+static const uint8_t *search_get_varint(const uint8_t *p, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        *value |= (uint64_t)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80)) {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+static void search_free(void) {
+    for (uint32_t i = 0; i < search.term_count; ++i) {
+        free(search.terms[i].postings);
+    }
+
+    free(search.friends);
+    free(search.terms);
+    free(search.table);
+    free(search.tokens);
+    free(search.sorted);
+
+    search.friends       = NULL;
+    search.friend_count  = search.friend_size = search.last_friend = 0;
+    search.terms         = NULL;
+    search.term_count    = search.term_size = 0;
+    search.table         = NULL;
+    search.table_size    = 0;
+    search.tokens        = NULL;
+    search.tokens_length = search.tokens_size = 0;
+    search.sorted        = NULL;
+    search.sorted_count  = 0;
+    search.dirty         = false;
+}
+
+/* Returns the friend's slot, or UINT32_MAX if they aren't in the index and create isn't set. */
+static uint32_t search_friend(const char id_str[TOX_PUBLIC_KEY_SIZE * 2], bool create) {
+    /* Messages tend to come in bursts from the same friend. */
+    if (search.last_friend < search.friend_count
+        && !memcmp(search.friends[search.last_friend].id_str, id_str, TOX_PUBLIC_KEY_SIZE * 2)) {
+        return search.last_friend;
+    }
+
+    for (uint32_t i = 0; i < search.friend_count; ++i) {
+        if (!memcmp(search.friends[i].id_str, id_str, TOX_PUBLIC_KEY_SIZE * 2)) {
+            return search.last_friend = i;
+        }
+    }
+
+    if (!create) {
+        return UINT32_MAX;
+    }
+
+    if (search.friend_count == search.friend_size) {
+        uint32_t       size    = search.friend_size ? search.friend_size * 2 : 64;
+        SEARCH_FRIEND *friends = realloc(search.friends, size * sizeof(SEARCH_FRIEND));
+        if (!friends) {
+            LOG_ERR("Search", "Unable to realloc for friends.");
+            return UINT32_MAX;
+        }
+        search.friends     = friends;
+        search.friend_size = size;
+    }
+
+    SEARCH_FRIEND *f = &search.friends[search.friend_count];
+    memcpy(f->id_str, id_str, TOX_PUBLIC_KEY_SIZE * 2);
+    f->covered = 0;
+    f->behind  = false;
+
+    return search.last_friend = search.friend_count++;
+}
+
+static bool search_table_grow(void) {
+    uint32_t  size  = search.table_size ? search.table_size * 2 : 4096;
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if (!table) {
+        LOG_ERR("Search", "Unable to calloc for the term table.");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < search.term_count; ++i) {
+        uint32_t slot = search.terms[i].hash & (size - 1);
+        while (table[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i + 1;
+    }
+
+    free(search.table);
+    search.table      = table;
+    search.table_size = size;
+    return true;
+}
+
+/* Adds a term to the table without checking whether it's already there. */
+static SEARCH_TERM *search_term_new(const uint8_t *token, uint16_t length, uint32_t hash) {
+    if ((search.term_count + 1) * 2 > search.table_size && !search_table_grow()) {
+        return NULL;
+    }
+
+    if (search.term_count == search.term_size) {
+        uint32_t     size  = search.term_size ? search.term_size * 2 : 4096;
+        SEARCH_TERM *terms = realloc(search.terms, size * sizeof(SEARCH_TERM));
+        if (!terms) {
+            LOG_ERR("Search", "Unable to realloc for terms.");
+            return NULL;
+        }
+        search.terms     = terms;
+        search.term_size = size;
+    }
+
+    if (search.tokens_length + length > search.tokens_size) {
+        size_t   size   = MAX(search.tokens_size * 2, 64 * 1024);
+        uint8_t *tokens = realloc(search.tokens, size);
+        if (!tokens) {
+            LOG_ERR("Search", "Unable to realloc for tokens.");
+            return NULL;
+        }
+        search.tokens      = tokens;
+        search.tokens_size = size;
+    }
+
+    SEARCH_TERM *term = &search.terms[search.term_count];
+    memset(term, 0, sizeof(*term));
+    term->hash        = hash;
+    term->token       = search.tokens_length;
+    term->length      = length;
+    term->last_friend = UINT32_MAX;
+
+    memcpy(search.tokens + search.tokens_length, token, length);
+    search.tokens_length += length;
+
+    uint32_t slot = hash & (search.table_size - 1);
+    while (search.table[slot]) {
+        slot = (slot + 1) & (search.table_size - 1);
+    }
+    search.table[slot] = ++search.term_count;
+
+    return term;
+}
+
+static SEARCH_TERM *search_term(const uint8_t *token, uint16_t length) {
+    uint32_t hash = search_hash(token, length);
+
+    if (search.table_size) {
+        uint32_t slot = hash & (search.table_size - 1);
+        while (search.table[slot]) {
+            SEARCH_TERM *term = &search.terms[search.table[slot] - 1];
+            if (term->hash == hash && term->length == length
+                && !memcmp(search.tokens + term->token, token, length)) {
+                return term;
+            }
+            slot = (slot + 1) & (search.table_size - 1);
+        }
+    }
+
+    return search_term_new(token, length, hash);
+}
+
+static void search_term_add(SEARCH_TERM *term, uint32_t friend, uint64_t offset) {
+    if (term->last_friend == friend && term->last_offset == offset) {
+        return; /* the same word twice in one message */
+    }
+
+    if (term->postings_size - term->postings_length < 20) {
+        uint32_t size     = MAX(term->postings_size * 2, term->postings_length + 32);
+        uint8_t *postings = realloc(term->postings, size);
+        if (!postings) {
+            LOG_ERR("Search", "Unable to realloc for postings.");
+            return;
+        }
+        term->postings      = postings;
+        term->postings_size = size;
+    }
+
+    uint8_t *p = term->postings + term->postings_length;
+    p = search_put_varint(p, friend);
+    p = search_put_varint(p, term->last_friend == friend ? offset - term->last_offset : offset);
+    term->postings_length = p - term->postings;
+
+    term->last_friend = friend;
+    term->last_offset = offset;
+}
+
+static void search_index_text(uint32_t friend, uint64_t offset, const char *text, size_t length) {
+    uint8_t token[SEARCH_TOKEN_MAX];
+    size_t  token_length, pos = 0;
+    while ((token_length = search_next_token(text, length, &pos, token))) {
+        SEARCH_TERM *term = search_term(token, token_length);
+        if (term) {
+            search_term_add(term, friend, offset);
+        }
+    }
+
+    search.dirty = true;
+}
+
+static bool search_sort_terms(void);
+
+static uint8_t *search_put(uint8_t *p, const void *data, size_t length) {
+    memcpy(p, data, length);
+    return p + length;
+}
+
+/* Returns the whole index laid out the way it's saved, which the caller has to free. Must be called with
+ * search.lock held. */
+static uint8_t *search_snapshot(size_t *length) {
+    *length = sizeof(SEARCH_INDEX_HEADER) + search.friend_count * (TOX_PUBLIC_KEY_SIZE * 2 + sizeof(uint64_t));
+    for (uint32_t i = 0; i < search.term_count; ++i) {
+        const SEARCH_TERM *term = &search.terms[i];
+        *length += sizeof(term->length) + sizeof(term->last_friend) + sizeof(term->last_offset)
+                   + sizeof(term->postings_length) + term->length + term->postings_length;
+    }
+
+    uint8_t *data = malloc(*length);
+    if (!data) {
+        return NULL;
+    }
+
+    SEARCH_INDEX_HEADER header = {
+        .version      = SEARCH_INDEX_VERSION,
+        .friend_count = search.friend_count,
+        .term_count   = search.term_count,
+    };
+    memcpy(header.magic, "UTXS", 4);
+
+    uint8_t *p = search_put(data, &header, sizeof(header));
+    for (uint32_t i = 0; i < search.friend_count; ++i) {
+        p = search_put(p, search.friends[i].id_str, TOX_PUBLIC_KEY_SIZE * 2);
+        p = search_put(p, &search.friends[i].covered, sizeof(uint64_t));
+    }
+
+    for (uint32_t i = 0; i < search.term_count; ++i) {
+        const SEARCH_TERM *term = &search.terms[i];
+        p = search_put(p, &term->length, sizeof(term->length));
+        p = search_put(p, &term->last_friend, sizeof(term->last_friend));
+        p = search_put(p, &term->last_offset, sizeof(term->last_offset));
+        p = search_put(p, &term->postings_length, sizeof(term->postings_length));
+        p = search_put(p, search.tokens + term->token, term->length);
+        p = search_put(p, term->postings, term->postings_length);
+    }
+
+    return data;
+}
+
+/* Saves a copy of the index, dropping search.lock while it's written so messages can still be added. Must be
+ * called with search.lock held.
+ *
+ * It's written to a temporary file that then replaces the old index, so a save that fails part way leaves the last
+ * one as it was. */
+static bool search_save(void) {
+    size_t   length;
+    uint8_t *data = search_snapshot(&length);
+    if (!data) {
+        LOG_ERR("Search", "Unable to allocate to save the search index.");
+        return false;
+    }
+
+    search.dirty = false;
+    search.saved = time(NULL);
+    pthread_mutex_unlock(&search.lock);
+
+    bool  ok   = false;
+    FILE *file = utox_get_file(SEARCH_INDEX_TEMP, NULL, UTOX_FILE_OPTS_WRITE | UTOX_FILE_OPTS_MKDIR);
+    if (file) {
+        ok = fwrite(data, length, 1, file) == 1;
+        ok = !fclose(file) && ok;
+        ok = ok && utox_replace_file(SEARCH_INDEX_TEMP, SEARCH_INDEX_NAME);
+    }
+    free(data);
+
+    pthread_mutex_lock(&search.lock);
+    if (!ok) {
+        LOG_ERR("Search", "Unable to save the search index.");
+        search.dirty = true;
+        return false;
+    }
+
+    return true;
+}
+
+static bool search_load_terms(FILE *file, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        uint16_t length;
+        uint32_t last_friend, postings_length;
+        uint64_t last_offset;
+        uint8_t  token[SEARCH_TOKEN_MAX];
+
+        if (fread(&length, sizeof(length), 1, file) != 1 || fread(&last_friend, sizeof(last_friend), 1, file) != 1
+            || fread(&last_offset, sizeof(last_offset), 1, file) != 1
+            || fread(&postings_length, sizeof(postings_length), 1, file) != 1 || !length || length > SEARCH_TOKEN_MAX
+            || fread(token, length, 1, file) != 1) {
+            return false;
+        }
+
+        SEARCH_TERM *term = search_term_new(token, length, search_hash(token, length));
+        if (!term) {
+            return false;
+        }
+
+        term->last_friend = last_friend;
+        term->last_offset = last_offset;
+        if (postings_length) {
+            term->postings = malloc(postings_length);
+            if (!term->postings || fread(term->postings, postings_length, 1, file) != 1) {
+                return false;
+            }
+            term->postings_length = term->postings_size = postings_length;
+        }
+    }
+
+    return true;
+}
+
+static void search_load(void) {
+    FILE *file = utox_get_file(SEARCH_INDEX_NAME, NULL, UTOX_FILE_OPTS_READ);
+    if (!file) {
+        LOG_INFO("Search", "No search index yet, it'll be built from the logs.");
+        return;
+    }
+
+    SEARCH_INDEX_HEADER header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && !memcmp(header.magic, "UTXS", 4)
+              && header.version == SEARCH_INDEX_VERSION;
+
+    if (ok && header.friend_count) {
+        search.friends = calloc(header.friend_count, sizeof(SEARCH_FRIEND));
+        ok = search.friends != NULL;
+        if (ok) {
+            search.friend_size = header.friend_count;
+        }
+    }
+
+    for (uint32_t i = 0; ok && i < header.friend_count; ++i) {
+        SEARCH_FRIEND *f = &search.friends[search.friend_count++];
+        ok = fread(f->id_str, TOX_PUBLIC_KEY_SIZE * 2, 1, file) == 1
+             && fread(&f->covered, sizeof(f->covered), 1, file) == 1;
+    }
+
+    ok = ok && search_load_terms(file, header.term_count);
+    fclose(file);
+
+    if (!ok) {
+        LOG_WARN("Search", "Search index is unreadable, rebuilding it from the logs.");
+        search_free();
+        return;
+    }
+
+    search.saved = time(NULL);
+    LOG_INFO("Search", "Loaded search index with %u terms.", search.term_count);
+}
+
+typedef struct {
+    uint32_t friend;
+    char     id_str[TOX_PUBLIC_KEY_SIZE * 2];
+} SEARCH_SCAN;
+
+static bool search_scan_record(void *ctx, uint64_t offset, size_t length, const LOG_FILE_MSG_HEADER *header,
+                               const char *msg)
+{
+    SEARCH_SCAN *scan = ctx;
+
+    pthread_mutex_lock(&search.lock);
+    SEARCH_FRIEND *f = &search.friends[scan->friend];
+    if (search.kill || memcmp(f->id_str, scan->id_str, TOX_PUBLIC_KEY_SIZE * 2)) {
+        /* Shutting down, or the history was removed out from under us. */
+        pthread_mutex_unlock(&search.lock);
+        return false;
+    }
+
+    /* Records that were logged while we were scanning are already in. */
+    if (offset == f->covered) {
+        search_index_text(scan->friend, offset, msg, header->msg_length);
+        f->covered += length;
+    }
+    pthread_mutex_unlock(&search.lock);
+
+    return true;
+}
+
+static void search_thread(void *UNUSED(args)) {
+    LOG_INFO("Search", "Thread starting");
+
+    pthread_mutex_lock(&search.lock);
+    while (!search.kill) {
+        uint32_t friend = UINT32_MAX;
+        for (uint32_t i = 0; i < search.friend_count; ++i) {
+            if (search.friends[i].behind) {
+                friend = i;
+                break;
+            }
+        }
+
+        if (friend == UINT32_MAX) {
+            /* Sort new terms in while there's nothing else to do, so queries don't have to. */
+            if (search.term_count - search.sorted_count > SEARCH_UNSORTED_MAX && search_sort_terms()) {
+                continue;
+            }
+
+            if (search.dirty && time(NULL) - search.saved >= SEARCH_SAVE_INTERVAL) {
+                search_save();
+                continue;
+            }
+
+            struct timespec deadline = { .tv_sec = time(NULL) + SEARCH_SAVE_INTERVAL };
+            pthread_cond_timedwait(&search.wake, &search.lock, &deadline);
+            continue;
+        }
+
+        SEARCH_SCAN scan = { .friend = friend };
+        memcpy(scan.id_str, search.friends[friend].id_str, TOX_PUBLIC_KEY_SIZE * 2);
+        uint64_t covered = search.friends[friend].covered;
+        search.friends[friend].behind = false;
+        pthread_mutex_unlock(&search.lock);
+
+        utox_scan_chatlog(scan.id_str, covered, search_scan_record, &scan);
+
+        pthread_mutex_lock(&search.lock);
+    }
+
+    if (search.dirty) {
+        search_save();
+    }
+
+    chatlog_search_thread_init = false;
+    pthread_cond_broadcast(&search.wake);
+    pthread_mutex_unlock(&search.lock);
+
+    LOG_INFO("Search", "Thread exited cleanly");
+}
+
+void chatlog_search_start(void) {
+    pthread_mutex_lock(&search.lock);
+    if (search.running) {
+        pthread_mutex_unlock(&search.lock);
+        return;
+    }
+
+    search_load();
+    search.running = true;
+    search.kill    = false;
+    chatlog_search_thread_init = true;
+    pthread_mutex_unlock(&search.lock);
+
+    thread(search_thread, NULL);
+}
+
+void chatlog_search_stop(void) {
+    pthread_mutex_lock(&search.lock);
+    if (!search.running) {
+        pthread_mutex_unlock(&search.lock);
+        return;
+    }
+
+    search.kill = true;
+    pthread_cond_broadcast(&search.wake);
+    while (chatlog_search_thread_init) {
+        pthread_cond_wait(&search.wake, &search.lock);
+    }
+
+    search_free();
+    search.running = false;
+    pthread_mutex_unlock(&search.lock);
+}
+
+void chatlog_search_catch_up(char id_str[TOX_PUBLIC_KEY_SIZE * 2]) {
+    pthread_mutex_lock(&search.lock);
+    uint32_t friend;
+    if (search.running && (friend = search_friend(id_str, true)) != UINT32_MAX) {
+        search.friends[friend].behind = true;
+        pthread_cond_signal(&search.wake);
+    }
+    pthread_mutex_unlock(&search.lock);
+}
+
+void chatlog_search_forget(char id_str[TOX_PUBLIC_KEY_SIZE * 2]) {
+    pthread_mutex_lock(&search.lock);
+    uint32_t friend = search.running ? search_friend(id_str, false) : UINT32_MAX;
+    if (friend != UINT32_MAX) {
+        /* The slot's postings stay behind, but nothing will match them any more. A new log starts a new slot. */
+        memset(&search.friends[friend], 0, sizeof(SEARCH_FRIEND));
+        search.dirty = true;
+    }
+    pthread_mutex_unlock(&search.lock);
+}
+
+void chatlog_search_add(char id_str[TOX_PUBLIC_KEY_SIZE * 2], uint64_t offset, size_t length, const char *text,
+                        size_t text_length)
+{
+    pthread_mutex_lock(&search.lock);
+    uint32_t friend = search.running ? search_friend(id_str, true) : UINT32_MAX;
+    if (friend != UINT32_MAX) {
+        SEARCH_FRIEND *f = &search.friends[friend];
+        if (offset == f->covered) {
+            search_index_text(friend, offset, text, text_length);
+            f->covered += length;
+        } else if (offset > f->covered) {
+            /* There's a gap only the log itself can fill. */
+            f->behind = true;
+            pthread_cond_signal(&search.wake);
+        }
+    }
+    pthread_mutex_unlock(&search.lock);
+}
+
+typedef struct {
+    uint32_t term, token;
+    uint16_t length;
+} SEARCH_SORT_TERM;
+
+/* The copy of search.tokens being sorted, only the search thread sorts. */
+static const uint8_t *search_sort_tokens;
+
+static int search_compare_terms(const void *a, const void *b) {
+    const SEARCH_SORT_TERM *x = a, *y = b;
+
+    int cmp = memcmp(search_sort_tokens + x->token, search_sort_tokens + y->token, MIN(x->length, y->length));
+    return cmp ? cmp : x->length - y->length;
+}
+
+/* Sorts every term in so far, dropping search.lock while it sorts a copy of them. Must be called with search.lock
+ * held, from the search thread. Terms are only ever added, so the copy's still good to put in afterwards.
+ * Returns false if out of memory. */
+static bool search_sort_terms(void) {
+    const uint32_t count = search.term_count;
+
+    SEARCH_SORT_TERM *terms  = malloc(count * sizeof(SEARCH_SORT_TERM));
+    uint8_t *         tokens = malloc(search.tokens_length);
+    uint32_t *        sorted = malloc(count * sizeof(uint32_t));
+    if (!count || !terms || !tokens || !sorted) {
+        free(terms);
+        free(tokens);
+        free(sorted);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        terms[i] = (SEARCH_SORT_TERM){ i, search.terms[i].token, search.terms[i].length };
+    }
+    memcpy(tokens, search.tokens, search.tokens_length);
+    pthread_mutex_unlock(&search.lock);
+
+    search_sort_tokens = tokens;
+    qsort(terms, count, sizeof(SEARCH_SORT_TERM), search_compare_terms);
+    for (uint32_t i = 0; i < count; ++i) {
+        sorted[i] = terms[i].term;
+    }
+    free(terms);
+    free(tokens);
+
+    pthread_mutex_lock(&search.lock);
+    free(search.sorted);
+    search.sorted       = sorted;
+    search.sorted_count = count;
+    return true;
+}
+
+static bool search_term_has_prefix(uint32_t term, const uint8_t *prefix, size_t length) {
+    const SEARCH_TERM *t = &search.terms[term];
+    return t->length >= length && !memcmp(search.tokens + t->token, prefix, length);
+}
+
+/* A word of the query, and the terms it's a prefix of. */
+typedef struct {
+    uint8_t  token[SEARCH_TOKEN_MAX];
+    size_t   length;
+    uint32_t first, last; // range of search.sorted
+    uint64_t cost;        // bytes of postings to go through
+
+    /* The postings of every term it matches copied out of the index, so they can be gone through without
+     * search.lock. Each term's are preceded by their length as a varint. */
+    uint8_t *postings;
+    size_t   postings_length;
+} SEARCH_WORD;
+
+/* The friends' ids as they were when the query's postings were copied, all zeroes for removed histories. */
+typedef struct {
+    char (*ids)[TOX_PUBLIC_KEY_SIZE * 2];
+    uint32_t count;
+} SEARCH_IDS;
+
+static void search_word_terms(SEARCH_WORD *word) {
+    /* Binary search for the first sorted term that's not less than the prefix. */
+    uint32_t lo = 0, hi = search.sorted_count;
+    while (lo < hi) {
+        uint32_t           mid = lo + (hi - lo) / 2;
+        const SEARCH_TERM *t   = &search.terms[search.sorted[mid]];
+
+        int cmp = memcmp(search.tokens + t->token, word->token, MIN(t->length, word->length));
+        if (cmp < 0 || (!cmp && t->length < word->length)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    word->first = lo;
+    word->cost  = 0;
+    while (lo < search.sorted_count && search_term_has_prefix(search.sorted[lo], word->token, word->length)) {
+        word->cost += search.terms[search.sorted[lo++]].postings_length;
+    }
+    word->last = lo;
+
+    for (uint32_t i = search.sorted_count; i < search.term_count; ++i) {
+        if (search_term_has_prefix(i, word->token, word->length)) {
+            word->cost += search.terms[i].postings_length;
+        }
+    }
+}
+
+/* Appends the term's postings to word's copy. Must be called with search.lock held. */
+static void search_word_copy_term(SEARCH_WORD *word, uint32_t term) {
+    const SEARCH_TERM *t = &search.terms[term];
+
+    uint8_t *p = search_put_varint(word->postings + word->postings_length, t->postings_length);
+    memcpy(p, t->postings, t->postings_length);
+    word->postings_length = p + t->postings_length - word->postings;
+}
+
+/* Copies the postings of every term matching word, after search_word_terms(). Must be called with search.lock
+ * held. Returns false if out of memory. */
+static bool search_word_copy(SEARCH_WORD *word) {
+    const uint32_t terms = word->last - word->first + search.term_count - search.sorted_count;
+
+    word->postings_length = 0;
+    word->postings        = malloc(word->cost + (uint64_t)terms * 10 + 1);
+    if (!word->postings) {
+        return false;
+    }
+
+    for (uint32_t i = word->first; i < word->last; ++i) {
+        search_word_copy_term(word, search.sorted[i]);
+    }
+
+    for (uint32_t i = search.sorted_count; i < search.term_count; ++i) {
+        if (search_term_has_prefix(i, word->token, word->length)) {
+            search_word_copy_term(word, i);
+        }
+    }
+
+    return true;
+}
+
+/* Must be called with search.lock held. Returns false if out of memory. */
+static bool search_ids_copy(SEARCH_IDS *ids) {
+    ids->count = search.friend_count;
+    ids->ids   = malloc(MAX(ids->count, 1) * sizeof(*ids->ids));
+    if (!ids->ids) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < ids->count; ++i) {
+        memcpy(ids->ids[i], search.friends[i].id_str, sizeof(*ids->ids));
+    }
+    return true;
+}
+
+/* Calls func with the key of every posting of every term matching word, from its copy. */
+static bool search_word_postings(const SEARCH_WORD *word, const SEARCH_IDS *ids, bool func(void *ctx, uint64_t key),
+                                 void *ctx) {
+    const uint8_t *p   = word->postings;
+    const uint8_t *end = word->postings + word->postings_length;
+
+    while (p < end) {
+        uint64_t length;
+        if (!(p = search_get_varint(p, end, &length)) || length > (uint64_t)(end - p)) {
+            LOG_ERR("Search", "Corrupt postings for a term, skipping the rest.");
+            break;
+        }
+        const uint8_t *term_end = p + length;
+
+        uint64_t friend, offset, last_friend = UINT64_MAX, last_offset = 0;
+        while (p < term_end) {
+            if (!(p = search_get_varint(p, term_end, &friend)) || !(p = search_get_varint(p, term_end, &offset))) {
+                LOG_ERR("Search", "Corrupt postings for a term, skipping the rest.");
+                break;
+            }
+
+            if (friend == last_friend) {
+                offset += last_offset;
+            }
+            last_friend = friend;
+            last_offset = offset;
+
+            /* Skip what's left of removed histories. */
+            if (friend < ids->count && ids->ids[friend][0] && !func(ctx, SEARCH_KEY(friend, offset))) {
+                return false;
+            }
+        }
+        p = term_end;
+    }
+
+    return true;
+}
+
+typedef struct {
+    uint64_t *keys;
+    size_t    count, size;
+} SEARCH_KEYS;
+
+static bool search_keys_push(void *ctx, uint64_t key) {
+    SEARCH_KEYS *keys = ctx;
+    if (keys->count == keys->size) {
+        size_t    size = keys->size ? keys->size * 2 : 256;
+        uint64_t *tmp  = realloc(keys->keys, size * sizeof(uint64_t));
+        if (!tmp) {
+            return false;
+        }
+        keys->keys = tmp;
+        keys->size = size;
+    }
+
+    keys->keys[keys->count++] = key;
+    return true;
+}
+
+/* LSD radix sort, a lot quicker than qsort() for the millions of keys a short prefix can turn up. */
+static bool search_keys_sort(SEARCH_KEYS *keys) {
+    uint64_t max = 0;
+    for (size_t i = 0; i < keys->count; ++i) {
+        max |= keys->keys[i];
+    }
+
+    uint64_t *tmp = malloc(keys->count * sizeof(uint64_t));
+    if (!tmp) {
+        return false;
+    }
+
+    uint64_t *from = keys->keys, *to = tmp;
+    for (int shift = 0; shift < 64 && (max >> shift); shift += 11) {
+        size_t buckets[2048] = { 0 };
+        for (size_t i = 0; i < keys->count; ++i) {
+            buckets[(from[i] >> shift) & 2047]++;
+        }
+
+        size_t total = 0;
+        for (size_t b = 0; b < 2048; ++b) {
+            size_t count = buckets[b];
+            buckets[b]   = total;
+            total       += count;
+        }
+
+        for (size_t i = 0; i < keys->count; ++i) {
+            to[buckets[(from[i] >> shift) & 2047]++] = from[i];
+        }
+
+        uint64_t *swap = from;
+        from = to;
+        to   = swap;
+    }
+
+    if (from != keys->keys) {
+        memcpy(keys->keys, from, keys->count * sizeof(uint64_t));
+    }
+    free(tmp);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < keys->count; ++i) {
+        if (!unique || keys->keys[unique - 1] != keys->keys[i]) {
+            keys->keys[unique++] = keys->keys[i];
+        }
+    }
+    keys->count = unique;
+
+    return true;
+}
+
+/* An open addressing set over the current result, used to mark the records the next word also matches. */
+typedef struct {
+    const SEARCH_KEYS *result;
+    uint32_t          *slots; // result index + 1
+    uint32_t           mask;
+    bool              *found;
+} SEARCH_FILTER;
+
+static uint32_t search_key_hash(uint64_t key) {
+    key *= 0x9E3779B97F4A7C15ull;
+    return key >> 32;
+}
+
+static bool search_filter_mark(void *ctx, uint64_t key) {
+    SEARCH_FILTER *filter = ctx;
+    for (uint32_t slot = search_key_hash(key) & filter->mask; filter->slots[slot]; slot = (slot + 1) & filter->mask) {
+        if (filter->result->keys[filter->slots[slot] - 1] == key) {
+            filter->found[filter->slots[slot] - 1] = true;
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* Keeps only the records in result that word matches as well. */
+static bool search_filter(SEARCH_KEYS *result, const SEARCH_WORD *word, const SEARCH_IDS *ids) {
+    uint32_t size = 16;
+    while (size < result->count * 2) {
+        size *= 2;
+    }
+
+    SEARCH_FILTER filter = {
+        .result = result,
+        .slots  = calloc(size, sizeof(uint32_t)),
+        .mask   = size - 1,
+        .found  = calloc(result->count, sizeof(bool)),
+    };
+
+    if (!filter.slots || !filter.found) {
+        free(filter.slots);
+        free(filter.found);
+        return false;
+    }
+
+    for (size_t i = 0; i < result->count; ++i) {
+        uint32_t slot = search_key_hash(result->keys[i]) & filter.mask;
+        while (filter.slots[slot]) {
+            slot = (slot + 1) & filter.mask;
+        }
+        filter.slots[slot] = i + 1;
+    }
+
+    search_word_postings(word, ids, search_filter_mark, &filter);
+
+    size_t count = 0;
+    for (size_t i = 0; i < result->count; ++i) {
+        if (filter.found[i]) {
+            result->keys[count++] = result->keys[i];
+        }
+    }
+    result->count = count;
+
+    free(filter.slots);
+    free(filter.found);
+    return true;
+}
+
+static int search_compare_words(const void *a, const void *b) {
+    const SEARCH_WORD *x = a, *y = b;
+    return (x->cost > y->cost) - (x->cost < y->cost);
+}
+
+CHATLOG_SEARCH_HIT *chatlog_search(const char *query, size_t length, size_t *count) {
+    *count = 0;
+
+    SEARCH_WORD words[SEARCH_QUERY_WORDS];
+    size_t      word_count = 0, pos = 0;
+    while (word_count < SEARCH_QUERY_WORDS
+           && (words[word_count].length = search_next_token(query, length, &pos, words[word_count].token))) {
+        ++word_count;
+    }
+
+    if (!word_count) {
+        return NULL;
+    }
+
+    SEARCH_KEYS result = { 0 };
+    SEARCH_IDS  ids    = { 0 };
+
+    /* Only what the query needs is copied out under the lock, so logging new messages isn't held up while it's
+     * worked through. */
+    pthread_mutex_lock(&search.lock);
+    if (search.term_count - search.sorted_count > SEARCH_UNSORTED_MAX) {
+        /* Scanning them one by one still works, have the thread sort them in for next time. */
+        pthread_cond_signal(&search.wake);
+    }
+
+    bool ok = search_ids_copy(&ids);
+    for (size_t i = 0; i < word_count; ++i) {
+        words[i].postings = NULL;
+        search_word_terms(&words[i]);
+        ok = ok && search_word_copy(&words[i]);
+    }
+    pthread_mutex_unlock(&search.lock);
+
+    /* Start from the rarest word, every other one then only has to be checked against what's left. */
+    qsort(words, word_count, sizeof(SEARCH_WORD), search_compare_words);
+
+    ok = ok && search_word_postings(&words[0], &ids, search_keys_push, &result) && search_keys_sort(&result);
+    for (size_t i = 1; ok && result.count && i < word_count; ++i) {
+        ok = search_filter(&result, &words[i], &ids);
+    }
+
+    CHATLOG_SEARCH_HIT *hits = NULL;
+    if (ok && result.count) {
+        hits = calloc(result.count, sizeof(CHATLOG_SEARCH_HIT));
+    }
+
+    if (hits) {
+        /* Keys sort by friend then offset, so walking them backwards puts the newest records first. */
+        for (size_t i = 0; i < result.count; ++i) {
+            uint64_t key = result.keys[result.count - 1 - i];
+            memcpy(hits[i].id_str, ids.ids[key >> SEARCH_OFFSET_BITS], TOX_PUBLIC_KEY_SIZE * 2);
+            hits[i].offset = key & (((uint64_t)1 << SEARCH_OFFSET_BITS) - 1);
+        }
+        *count = result.count;
+    }
+
+    if (!ok) {
+        LOG_ERR("Search", "Ran out of memory searching history.");
+    }
+
+    for (size_t i = 0; i < word_count; ++i) {
+        free(words[i].postings);
+    }
+    free(ids.ids);
+    free(result.keys);
+    return hits;
+}
@@ -0,0 +1,49 @@
+#ifndef CHATLOG_SEARCH_H
+#define CHATLOG_SEARCH_H
+
+#include <tox/tox.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Full text search over the chat history of the current profile.
+ *
+ * Every word of every logged message is kept in an inverted index, mapping it to the friend and log offset of the
+ * records it appears in, and saved to chatlog_search.idx next to the logs. Messages are added as they're logged,
+ * and a background thread catches the index up with whatever it hasn't seen of the logs yet. Matching ignores
+ * ASCII case, and every word of a query matches any indexed word that starts with it. */
+
+typedef struct {
+    char     id_str[TOX_PUBLIC_KEY_SIZE * 2];
+    uint64_t offset; // of the record in the friend's log, same as MSG_HEADER.disk_offset
+} CHATLOG_SEARCH_HIT;
+
+extern bool chatlog_search_thread_init;
+
+/* Loads the saved index for the current profile and starts the thread that keeps it up to date. */
+void chatlog_search_start(void);
+
+/* Saves the index, stops the thread and drops the index from memory. */
+void chatlog_search_stop(void);
+
+/* Has the background thread index anything in this friend's log it hasn't seen yet. */
+void chatlog_search_catch_up(char id_str[TOX_PUBLIC_KEY_SIZE * 2]);
+
+/* Drops this friend's history from the index, for when their log is removed. */
+void chatlog_search_forget(char id_str[TOX_PUBLIC_KEY_SIZE * 2]);
+
+/* Adds the text of a record that was just appended to this friend's log at offset. length is the size of the whole
+ * record. */
+void chatlog_search_add(char id_str[TOX_PUBLIC_KEY_SIZE * 2], uint64_t offset, size_t length, const char *text,
+                        size_t text_length);
+
+/**
+ * Finds the records that contain every word of query.
+ *
+ * Returns an array of count hits, grouped by friend and newest first, which the caller has to free.
+ * Returns NULL if nothing matched.
+ */
+CHATLOG_SEARCH_HIT *chatlog_search(const char *query, size_t length, size_t *count);
+
+#endif
@@ -923,15 +923,15 @@ void native_export_chatlog_init(uint32_t fid) {
     }
 }
 
-void native_select_dir_ft(uint32_t fid, uint32_t num, FILE_TRANSFER *file) {
+void native_select_dir_ft(uint32_t fid, uint32_t num, const char *name, size_t name_length) {
     NSSavePanel *picker = [NSSavePanel savePanel];
-    NSString    *fname  = [[NSString alloc] initWithBytesNoCopy:file->name
-                                                         length:file->name_length
+    NSString    *fname  = [[NSString alloc] initWithBytesNoCopy:(void *)name
+                                                         length:name_length
                                                        encoding:NSUTF8StringEncoding
                                                    freeWhenDone:NO];
     picker.message = [NSString stringWithFormat:NSSTRING_FROM_LOCALIZED(WHERE_TO_SAVE_FILE_PROMPT),
-                               file->name_length,
-                               file->name];
+                               name_length,
+                               name];
     picker.nameFieldStringValue = fname;
     [fname release];
     int ret = [picker runModal];
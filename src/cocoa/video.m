@@ -279,6 +279,10 @@ int native_video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, ui
         return [active_video_session getCurrentFrameIntoChannelsY:y U:u V:v:width:height];
 }
 
+bool native_video_wait(uint32_t timeout_ms) {
+    return false;
+}
+
 uint16_t native_video_detect(void) {
     uToxAppDelegate *ad = (uToxAppDelegate *)[NSApp delegate];
     return [ad storeVideoDevicesList];
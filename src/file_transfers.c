@@ -2,6 +2,9 @@
 
 #include "avatar.h"
 #include "friend.h"
+#include "ft_journal.h"
+#include "ft_reader.h"
+#include "ft_writer.h"
 #include "debug.h"
 #include "macros.h"
 #include "self.h"
@@ -45,15 +48,9 @@ static FILE_TRANSFER *get_file_transfer(uint32_t friend_number, uint32_t file_nu
     }
 
     if (is_incoming_ft(file_number)) {
-        file_number = detox_incoming_file_number(file_number);
-        if (f->ft_incoming_size && f->ft_incoming_size >= file_number) {
-            return &f->ft_incoming[file_number];
-        }
-    } else if (f->ft_outgoing_size && f->ft_outgoing_size >= file_number) {
-        return &f->ft_outgoing[file_number];
+        return ft_table_get(&f->ft_incoming, detox_incoming_file_number(file_number));
     }
-
-    return NULL;
+    return ft_table_get(&f->ft_outgoing, file_number);
 }
 
 static FILE_TRANSFER *make_file_transfer(uint32_t friend_number, uint32_t file_number) {
@@ -63,37 +60,9 @@ static FILE_TRANSFER *make_file_transfer(uint32_t friend_number, uint32_t file_n
     }
 
     if (is_incoming_ft(file_number)) {
-        file_number = detox_incoming_file_number(file_number);
-        if (f->ft_incoming_size <= file_number) {
-            LOG_TRACE("FileTransfer", "Realloc incoming %u|%u" , friend_number, file_number + 1);
-
-            FILE_TRANSFER *new_ftlist = realloc(f->ft_incoming, sizeof(FILE_TRANSFER) * (file_number + 1));
-            if (!new_ftlist) {
-                LOG_ERR("FileTransfer", "Unable to allocate memory for new incoming file transfer.");
-                return NULL;
-            }
-
-            f->ft_incoming = new_ftlist;
-            f->ft_incoming_size = file_number + 1;
-        }
-
-        return &f->ft_incoming[file_number];
+        return ft_table_make(&f->ft_incoming, detox_incoming_file_number(file_number));
     }
-
-    if (f->ft_outgoing_size <= file_number) {
-        LOG_TRACE("FileTransfer", "Realloc outgoing %u|%u" , friend_number, file_number + 1);
-
-        FILE_TRANSFER *new_ftlist = realloc(f->ft_outgoing, sizeof(FILE_TRANSFER) * (file_number + 1));
-        if (!new_ftlist) {
-            LOG_ERR("FileTransfer", "Unable to allocate memory for new outgoing file transfer.");
-            return NULL;
-        }
-
-        f->ft_outgoing = new_ftlist;
-        f->ft_outgoing_size = file_number + 1;
-    }
-
-    return &f->ft_outgoing[file_number];
+    return ft_table_make(&f->ft_outgoing, file_number);
 }
 
 /* Calculate the transfer speed for the UI. */
@@ -158,11 +127,31 @@ static void ft_decon(uint32_t friend_number, uint32_t file_number) {
         } else if (ft->avatar) {
             // free(ft->via.avatar)?
         } else if (ft->via.file) {
+            if (ft->writer) {
+                ft_writer_flush(ft->writer);
+                ft_writer_log_stats(ft->writer, (char *)ft->path);
+                ft_writer_free(ft->writer);
+            }
+            if (ft->reader) {
+                ft_reader_log_stats(ft->reader, (char *)ft->path);
+                ft_reader_free(ft->reader);
+            }
             fclose(ft->via.file);
         }
+
+        if (ft->resume_file) {
+            fclose(ft->resume_file);
+        }
     }
     /* When decon is called we always want to reset the struct. */
     memset(ft, 0, sizeof(FILE_TRANSFER));
+
+    FRIEND *f = get_friend(friend_number);
+    if (is_incoming_ft(file_number)) {
+        ft_table_release(&f->ft_incoming, detox_incoming_file_number(file_number));
+    } else {
+        ft_table_release(&f->ft_outgoing, file_number);
+    }
 }
 
 static bool resumeable_name(FILE_TRANSFER *ft, char *name) {
@@ -189,31 +178,35 @@ static bool resumeable_name(FILE_TRANSFER *ft, char *name) {
     return true;
 }
 
+/* Records how much more of an incoming file has made it to disk. */
 static bool ft_update_resumable(FILE_TRANSFER *ft) {
     if (!ft->resume_file) {
         LOG_ERR("FileTransfer", "Unable to save filetransfer info. Got NULL file pointer.");
         return false;
     }
 
-    // This file pointer has a tendency of being both invalid and non-null so we use fstat to check it.
-    struct stat buffer;
-    if (fstat(fileno(ft->resume_file), &buffer) != 0) {
-        LOG_ERR("FileTransfer", "Unable to save file info. Invalid filepointer.");
-        return false;
+    if (!ft->incoming || !ft->writer) {
+        return true;
     }
 
-    fseeko(ft->resume_file, SEEK_SET, 0);
-    if (fwrite(ft, sizeof(FILE_TRANSFER), 1, ft->resume_file) != 1) {
+    /* Only what's made it to disk can be resumed from. */
+    uint64_t durable;
+    ft_writer_durable(ft->writer, &durable);
+    if (durable <= ft->resume_offset) {
+        return true;
+    }
+
+    if (!ft_journal_add_range(ft->resume_file, ft->resume_offset, durable)) {
         LOG_ERR("FileTransfer", "Unable to save file info... uTox can't resume file %.*s",
-                ft->name_length, ft->name);
+                (uint32_t)ft->name_length, ft->name);
         return false;
     }
 
-    fflush(ft->resume_file);
+    ft->resume_offset = durable;
     return true;
 }
 
-/* Create the file transfer resume info file. */
+/* Create the file transfer resume journal, with everything known about the file so far. */
 static bool ft_init_resumable(FILE_TRANSFER *ft) {
     char name[UTOX_FILE_NAME_LENGTH];
     if (!resumeable_name(ft, name)) {
@@ -225,8 +218,21 @@ static bool ft_init_resumable(FILE_TRANSFER *ft) {
         return false;
     }
 
+    ft->resume_offset = ft->incoming ? ft->current_size : 0;
+
+    const size_t path_length = strlen((char *)ft->path);
+    if (!ft_journal_start(ft->resume_file, ft->incoming, ft->data_hash, ft->target_size)
+        || (path_length && !ft_journal_add_path(ft->resume_file, ft->path, path_length))
+        || (ft->resume_offset && !ft_journal_add_range(ft->resume_file, 0, ft->resume_offset))) {
+        LOG_ERR("FileTransfer", "Unable to save file info... uTox can't resume file %.*s",
+                (uint32_t)ft->name_length, ft->name);
+        fclose(ft->resume_file);
+        ft->resume_file = NULL;
+        return false;
+    }
+
     LOG_INFO("FileTransfer", ".ftinfo for file %.*s set; ready to resume!" , (uint32_t)ft->name_length, ft->name);
-    return ft_update_resumable(ft);
+    return true;
 }
 
 /* Free/Remove/Unlink the file transfer resume info file. */
@@ -236,6 +242,11 @@ static void ft_decon_resumable(FILE_TRANSFER *ft) {
         return;
     }
 
+    if (ft->resume_file) {
+        fclose(ft->resume_file);
+        ft->resume_file = NULL;
+    }
+
     LOG_INFO("FileTransfer", "Going to decon file %s." , name);
     FILE *file = utox_get_file(name, NULL, UTOX_FILE_OPTS_READ | UTOX_FILE_OPTS_WRITE);
     if (!file) {
@@ -252,8 +263,7 @@ static bool ft_find_resumeable(FILE_TRANSFER *ft) {
         return false;
     }
 
-    size_t size = 0;
-    FILE *resume_disk = utox_get_file(resume_name, &size, UTOX_FILE_OPTS_READ);
+    FILE *resume_disk = utox_get_file(resume_name, NULL, UTOX_FILE_OPTS_READ);
 
     if (!resume_disk) {
         if (ft->incoming) {
@@ -264,14 +274,8 @@ static bool ft_find_resumeable(FILE_TRANSFER *ft) {
         return false;
     }
 
-    if (size != sizeof(FILE_TRANSFER)) {
-        LOG_ERR("FileTransfer", "Unable to resume this file, size mismatch");
-        fclose(resume_disk);
-        return false;
-    }
-
-    FILE_TRANSFER resume_file;
-    bool read_resumeable = fread(&resume_file, size, 1, resume_disk);
+    FT_JOURNAL journal;
+    bool read_resumeable = ft_journal_read(resume_disk, &journal);
     fclose(resume_disk);
 
     if (!read_resumeable) {
@@ -279,24 +283,35 @@ static bool ft_find_resumeable(FILE_TRANSFER *ft) {
         return false;
     }
 
-    if (!resume_file.resumeable
-        || !resume_file.in_use
-        || resume_file.in_memory
-        || resume_file.avatar
-        || resume_file.inline_img) {
+    if (journal.incoming != ft->incoming || !journal.path || journal.path_length >= UTOX_FILE_NAME_LENGTH) {
+        ft_journal_free(&journal);
+        return false;
+    }
+
+    if (ft->incoming
+        && (memcmp(journal.file_id, ft->data_hash, TOX_HASH_LENGTH) || journal.size != ft->target_size)) {
+        LOG_ERR("FileTransfer", "Unable to resume this file, it's not the one we were getting before");
+        ft_journal_free(&journal);
         return false;
     }
 
-    memcpy(ft, &resume_file, sizeof(FILE_TRANSFER));
+    memcpy(ft->data_hash, journal.file_id, TOX_HASH_LENGTH);
+    memcpy(ft->path, journal.path, journal.path_length + 1);
+    ft->target_size   = journal.size;
+    ft->current_size  = ft->incoming ? ft_journal_resume_offset(&journal) : 0;
+    ft->resume_offset = ft->current_size;
+    ft->resumeable    = true;
 
-    ft->name_length = 0;
-    uint8_t *p = ft->path + strlen((char *)ft->path);
-    while (*--p != '/' && *p != '\\') {
-        ++ft->name_length;
+    const size_t journal_path_length = journal.path_length;
+    ft_journal_free(&journal);
+
+    const uint8_t *p = ft->path + journal_path_length;
+    while (p > ft->path && p[-1] != '/' && p[-1] != '\\') {
+        --p;
     }
-    ++p;
-    ++ft->name_length;
+    ft->name_length = ft->path + journal_path_length - p;
 
+    free(ft->name);
     ft->name = calloc(1, ft->name_length + 1);
     if (!ft->name) {
         LOG_FATAL_ERR(EXIT_MALLOC, "FileTransfer", "Could not alloc for file name (%uB)",
@@ -304,10 +319,6 @@ static bool ft_find_resumeable(FILE_TRANSFER *ft) {
     }
     snprintf((char *)ft->name, ft->name_length + 1, "%s", p);
 
-    ft->via.file = NULL;
-    ft->resume_file = NULL;
-    ft->ui_data = NULL;
-
     return true;
 }
 
@@ -364,6 +375,10 @@ static void break_file(FILE_TRANSFER *file) {
     file->status = FILE_TRANSFER_STATUS_BROKEN;
     postmessage_utox(FILE_STATUS_DONE, file->status, 0, file->ui_data);
 
+    if (file->writer) {
+        ft_writer_flush(file->writer);
+    }
+
     if (file->resumeable) {
         ft_update_resumable(file);
     }
@@ -456,7 +471,7 @@ static void run_file_local(FILE_TRANSFER *file) {
     switch (file->status) {
         case FILE_TRANSFER_STATUS_NONE: {
             file->status = FILE_TRANSFER_STATUS_ACTIVE;
-            if (!file->resumeable && file->incoming) {
+            if (!file->resumeable && file->incoming && !file->in_memory && !file->avatar) {
                 file->resumeable = ft_init_resumable(file);
             }
             break;
@@ -608,6 +623,7 @@ void ft_friend_online(Tox *tox, uint32_t friend_number) {
             utox_get_file(name, NULL, UTOX_FILE_OPTS_DELETE);
         }
 
+        free(file->name);
         free(file);
     }
 }
@@ -621,12 +637,18 @@ void ft_friend_offline(Tox *UNUSED(tox), uint32_t friend_number) {
         return;
     }
 
-    for (uint16_t i = 0; i < f->ft_outgoing_size; ++i) {
-        break_file(&f->ft_outgoing[i]);
+    for (uint32_t i = 0; i < f->ft_outgoing.index_size; ++i) {
+        FILE_TRANSFER *ft = ft_table_get(&f->ft_outgoing, i);
+        if (ft) {
+            break_file(ft);
+        }
     }
 
-    for (uint16_t i = 0; i < f->ft_incoming_size; ++i) {
-        break_file(&f->ft_incoming[i]);
+    for (uint32_t i = 0; i < f->ft_incoming.index_size; ++i) {
+        FILE_TRANSFER *ft = ft_table_get(&f->ft_incoming, i);
+        if (ft) {
+            break_file(ft);
+        }
     }
 }
 
@@ -643,7 +665,7 @@ void ft_local_control(Tox *tox, uint32_t friend_number, uint32_t file_number, TO
     switch (control) {
         case TOX_FILE_CONTROL_RESUME: {
             if (info->status != FILE_TRANSFER_STATUS_ACTIVE) {
-                if (get_friend(friend_number)->ft_outgoing_size < MAX_FILE_TRANSFERS) {
+                if (get_friend(friend_number)->ft_outgoing.count <= MAX_FILE_TRANSFERS) {
                     if (tox_file_control(tox, friend_number, file_number, control, &error)) {
                         LOG_INFO("FileTransfer", "We just resumed file (%u & %u)" , friend_number, file_number);
                     } else {
@@ -910,6 +932,7 @@ static void incoming_file_callback_request(Tox *tox, uint32_t friend_number, uin
     ft->friend_number = friend_number;
     ft->file_number   = file_number;
     ft->incoming      = true;
+    ft->target_size   = size;
     tox_file_get_file_id(tox, friend_number, file_number, ft->data_hash, NULL);
     ft->name = calloc(1, name_length + 1);
     if (!ft->name) {
@@ -994,6 +1017,11 @@ static void incoming_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
     }
 
     if (length == 0) {
+        if (ft->writer && !ft_writer_flush(ft->writer)) {
+            LOG_ERR("FileTransfer", "Unable to finish writing file (%u & %u)", friend_number, file_number);
+            ft_local_control(tox, friend_number, file_number, TOX_FILE_CONTROL_CANCEL);
+            return;
+        }
         utox_complete_file(ft);
         return;
     }
@@ -1012,21 +1040,11 @@ static void incoming_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
     } else if (ft->avatar && ft->via.avatar) {
         memcpy(ft->via.avatar + position, data, length);
     } else if (ft->via.file) {
-        uint8_t count = 10;
-        while (!file_lock(ft->via.file, position, length)) {
-            LOG_ERR("FileTransfer", "Can't get lock, sleeping...");
-            yieldcpu(10);
-            if (count == 0) {
-                break;
-            }
-            count--;
-            // If you get a bug report about this hanging utox, just disable it, it's unlikely to be needed!
+        if (!ft->writer) {
+            ft->writer = ft_writer_new(ft->via.file, position);
         }
-        fseeko(ft->via.file, position, SEEK_SET);
-        size_t write_size = fwrite(data, 1, length, ft->via.file);
-        fflush(ft->via.file);
-        file_unlock(ft->via.file, position, length);
-        if (write_size != length) {
+
+        if (!ft->writer || !ft_writer_push(ft->writer, position, data, length)) {
             LOG_ERR("FileTransfer", "\n\nFileTransfer:\tERROR WRITING DATA TO FILE! (%u & %u)\n\n", friend_number, file_number);
             ft_local_control(tox, friend_number, file_number, TOX_FILE_CONTROL_CANCEL);
             return;
@@ -1039,14 +1057,12 @@ static void incoming_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
     }
 
     ft->current_size += length;
-    if (ft->resume_update) {
-        --ft->resume_update;
-    } else {
+
+    /* Save where to resume from whenever more of the file's safely on disk. */
+    uint64_t durable;
+    if (ft->writer && ft->resumeable && ft_writer_durable(ft->writer, &durable)) {
         ft_update_resumable(ft);
-        ft->resume_update = 20; // every 20 packets we update
     }
-    // TODO dirty hack, this needs to be replaced
-    // moved it cal_speed() // ft_update_resumable(ft);
 }
 
 uint32_t ft_send_avatar(Tox *tox, uint32_t friend_number) {
@@ -1351,9 +1367,12 @@ static void outgoing_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
         }
     } else { // File
         if (ft->via.file) {
-            uint8_t buffer[length];
-            fseeko(ft->via.file, position, SEEK_SET);
-            if (fread(buffer, length, 1, ft->via.file) != 1) {
+            if (!ft->reader) {
+                ft->reader = ft_reader_new(ft->via.file, ft->target_size);
+            }
+
+            const uint8_t *chunk = ft->reader ? ft_reader_chunk(ft->reader, position, length) : NULL;
+            if (!chunk) {
                 LOG_ERR("FileTransfer", "ERROR READING FILE! (%u & %u)", friend_number, file_number);
                 LOG_INFO("FileTransfer", "Size (%lu), Position (%lu), Length(%lu), size_transferred (%lu).",
                          ft->target_size, position, length, ft->current_size);
@@ -1361,7 +1380,7 @@ static void outgoing_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
                 return;
             }
 
-            tox_file_send_chunk(tox, friend_number, file_number, position, buffer, length, &error);
+            tox_file_send_chunk(tox, friend_number, file_number, position, chunk, length, &error);
             if (error) {
                 LOG_ERR("FileTransfer", "Outgoing chunk error on file (%u)", error);
             }
@@ -1389,6 +1408,11 @@ bool utox_file_start_write(uint32_t friend_number, uint32_t file_number, const c
         return false;
     }
 
+    if (ft->resume_file && !ft_journal_add_path(ft->resume_file, ft->path, strlen((char *)ft->path))) {
+        LOG_WARN("FileTransfer", "Unable to save where file %.*s is going, it won't be resumable.",
+                 (uint32_t)ft->name_length, ft->name);
+    }
+
     return true;
 }
 
@@ -7,6 +7,8 @@
 #include <tox/tox.h>
 
 typedef struct msg_header MSG_HEADER;
+typedef struct ft_reader FT_READER;
+typedef struct ft_writer FT_WRITER;
 
 #define MAX_FILE_TRANSFERS 32
 
@@ -24,6 +26,7 @@ typedef enum {
 typedef struct {
     FILE *file;
     uint8_t *name;
+    uint8_t hash[TOX_HASH_LENGTH]; // filled in by ft_hash_queue()
 } UTOX_MSG_FT;
 
 typedef struct file_transfer {
@@ -60,7 +63,10 @@ typedef struct file_transfer {
     uint64_t last_check_time, last_check_transferred;
 
     FILE    *resume_file;
-    uint8_t  resume_update;
+    uint64_t resume_offset; // how much of an incoming file the resume journal has recorded as on disk
+
+    FT_READER *reader; // outgoing files only, made on the first chunk toxcore asks for
+    FT_WRITER *writer; // incoming files only, made on the first chunk that arrives
 
     MSG_HEADER *ui_data;
     bool decon_wait; // Used to pause decon/file cleanup, for the UI thread to copy the data;
@@ -22,6 +22,27 @@ bool utox_move_file(const uint8_t *current_name, const uint8_t *new_name) {
     return native_move_file(current_name, new_name);
 }
 
+bool utox_replace_file(const char *name, const char *new_name) {
+    char *from = utox_get_filepath(name);
+    char *to   = utox_get_filepath(new_name);
+
+    bool ok = from && to;
+#if defined __WIN32__ || defined _WIN32 || defined __CYGWIN__
+    /* rename() won't replace a file that's already there on Windows. */
+    if (ok) {
+        remove(to);
+    }
+#endif
+    ok = ok && !rename(from, to);
+    if (!ok) {
+        LOG_ERR("Filesys", "Unable to move %s over %s.", name, new_name);
+    }
+
+    free(from);
+    free(to);
+    return ok;
+}
+
 char *utox_get_filepath(const char *name) {
     return native_get_filepath(name);
 }
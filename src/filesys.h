@@ -47,6 +47,18 @@ bool utox_remove_file(const uint8_t *full_name, size_t length);
 
 bool utox_move_file(const uint8_t *current_name, const uint8_t *new_name);
 
+/**
+ * @brief Moves a file in the utox storage folder over another one, replacing it.
+ *
+ * Used to save a file by writing it out under a temporary name first, so a save that fails part way never leaves a
+ * half written file behind.
+ *
+ * @param name file name of the new version, relative to utox storage folder.
+ * @param new_name file name it replaces, relative to utox storage folder.
+ * @return true if the file was moved.
+ */
+bool utox_replace_file(const char *name, const char *new_name);
+
 /**
  * Takes a null-terminated utf8 filepath and creates it with permissions 0700
  * (in posix environments) if it doesn't already exist. In Windows environments
@@ -3,6 +3,7 @@
 // TODO: Separate from UI or include in UI.
 
 #include "avatar.h"
+#include "chatlog_search.h"
 #include "friend.h"
 #include "groups.h"
 #include "debug.h"
@@ -57,6 +58,10 @@ static uint32_t showncount;
 static char *  search_string;
 static uint8_t filter;
 
+// friends whose history matches the search string, one hit each
+static CHATLOG_SEARCH_HIT *search_history;
+static size_t              search_history_count;
+
 static ITEM *mouseover_item;
 static ITEM *nitem; // item that selected_item is being dragged over
 static ITEM *selected_item = &item_add;
@@ -252,6 +257,16 @@ void flist_re_scale(void) {
     }
 }
 
+static bool friend_history_matches_search(FRIEND *f) {
+    for (size_t i = 0; i < search_history_count; ++i) {
+        if (!memcmp(search_history[i].id_str, f->id_str, TOX_PUBLIC_KEY_SIZE * 2)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool friend_matches_search_string(FRIEND *f, char *str) {
     return !str
            || strstr_case(f->name, str)
@@ -269,7 +284,7 @@ void flist_update_shown_list(void) {
         }
         FRIEND *f = get_friend(it->id_number);
         if (search_string) {
-            if (friend_matches_search_string(f, search_string)) {
+            if (friend_matches_search_string(f, search_string) || friend_history_matches_search(f)) {
                 shown_list[j++] = i;
             }
         } else if ((!filter || f->online || f->unread_msg || it == selected_item)) {
@@ -351,8 +366,32 @@ void flist_set_filter(uint8_t new_filter) {
     flist_update_shown_list();
 }
 
+/* Looks the search string up in the chat history too, keeping one hit per friend. */
+static void flist_search_history(void) {
+    free(search_history);
+    search_history       = NULL;
+    search_history_count = 0;
+
+    /* A letter or two matches most of the history, and the list can't show where anyway. */
+    if (!search_string || strlen(search_string) < 3) {
+        return;
+    }
+
+    size_t count;
+    search_history = chatlog_search(search_string, strlen(search_string), &count);
+
+    /* Hits come grouped by friend. */
+    for (size_t i = 0; i < count; ++i) {
+        if (!search_history_count || memcmp(search_history[i].id_str, search_history[search_history_count - 1].id_str,
+                                            TOX_PUBLIC_KEY_SIZE * 2)) {
+            search_history[search_history_count++] = search_history[i];
+        }
+    }
+}
+
 void flist_search(char *str) {
     search_string = str;
+    flist_search_history();
     flist_update_shown_list();
 }
 
@@ -683,6 +722,7 @@ void flist_start(void) {
     i->id_number = UINT32_MAX;
 
     search_string = NULL;
+    flist_search_history();
     flist_update_shown_list();
 }
 
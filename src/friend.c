@@ -2,6 +2,7 @@
 
 #include "avatar.h"
 #include "chatlog.h"
+#include "chatlog_search.h"
 #include "debug.h"
 #include "filesys.h"
 #include "flist.h"
@@ -13,6 +14,7 @@
 #include "utox.h"
 
 #include "av/audio.h"
+#include "av/frame_pool.h"
 
 #include "layout/friend.h"  // TODO, remove this and sent the name differently
 
@@ -290,6 +292,7 @@ void utox_friend_init(Tox *tox, uint32_t friend_number) {
     f->msg.panel.width          = -SCROLL_WIDTH;
     // Get the chat backlog
     messages_read_from_log(friend_number);
+    chatlog_search_catch_up(f->id_str);
 
     // Load the meta data, if it exists.
     friend_meta_data_read(f);
@@ -512,6 +515,7 @@ void friend_history_clear(FRIEND *f) {
     }
     messages_clear_all(&f->msg);
     utox_remove_friend_chatlog(f->id_str);
+    chatlog_search_forget(f->id_str);
 }
 
 void friend_free(FRIEND *f) {
@@ -527,12 +531,19 @@ void friend_free(FRIEND *f) {
     free(f->typed);
     free(f->avatar);
 
-    for (uint32_t i = 0; i < f->msg.number; ++i) {
-        MSG_HEADER *msg = f->msg.data[i];
+    for (uint32_t i = f->msg.first; i != f->msg.first + f->msg.number; ++i) {
+        MSG_HEADER *msg = message_get(&f->msg, i);
         message_free(msg);
     }
     free(f->msg.data);
 
+    frame_pool_free(f->video_frames);
+    f->video_frames = NULL;
+    utox_audio_jitter_release(&f->audio_jitter);
+
+    ft_table_free(&f->ft_incoming);
+    ft_table_free(&f->ft_outgoing);
+
     if (f->call_state_self) {
         // postmessage_audio(AUDIO_END, f->number, 0, NULL);
         /* TODO end a video call too!
@@ -1,6 +1,7 @@
 #ifndef FRIEND_H
 #define FRIEND_H
 
+#include "ft_table.h"
 #include "messages.h"
 
 #include <tox/tox.h>
@@ -8,9 +9,14 @@
 typedef struct avatar AVATAR;
 typedef struct edit_change EDIT_CHANGE;
 typedef struct file_transfer FILE_TRANSFER;
+typedef struct frame_pool FRAME_POOL;
+typedef struct audio_jitter AUDIO_JITTER;
 typedef uint8_t *UTOX_IMAGE;
 typedef unsigned int ALuint;
 
+/* How many frames of a call's audio can be waiting to play at once. */
+#define UTOX_FRIEND_AUDIO_BUFFERS 4
+
 typedef enum {
     ADDF_NONE,
     ADDF_SENT,
@@ -88,19 +94,22 @@ typedef struct utox_friend {
     /* Audio / Video */
     int32_t  call_state_self, call_state_friend;
     uint16_t video_width, video_height;
+    uint32_t video_bitrate; // what toxav was last told to send video at, 0 for the default
+    FRAME_POOL *video_frames; // made with the first incoming frame
     ALuint   audio_dest;
+    AUDIO_JITTER *audio_jitter; // made when the first call starts
+    ALuint   audio_buffers[UTOX_FRIEND_AUDIO_BUFFERS], audio_free[UTOX_FRIEND_AUDIO_BUFFERS];
+    uint8_t  audio_free_count;
     time_t call_started;
 
     /* File transfers */
     bool ft_autoaccept;
 
-    FILE_TRANSFER  *ft_incoming;
-    uint16_t        ft_incoming_size;
-    uint16_t        ft_incoming_active_count;
+    FT_TABLE ft_incoming;
+    uint16_t ft_incoming_active_count;
 
-    FILE_TRANSFER  *ft_outgoing;
-    uint16_t        ft_outgoing_size;
-    uint16_t        ft_outgoing_active_count;
+    FT_TABLE ft_outgoing;
+    uint16_t ft_outgoing_active_count;
 } FRIEND;
 
 typedef struct utox_friend_request {
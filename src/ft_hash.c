@@ -0,0 +1,508 @@
+#include "ft_hash.h"
+
+#include "debug.h"
+#include "filesys.h"
+#include "ft_reader.h"
+#include "macros.h"
+#include "tox.h"
+
+#include "native/thread.h"
+#include "native/time.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define FT_HASH_CACHE_NAME "ft_hashes"
+#define FT_HASH_CACHE_TEMP "ft_hashes.tmp"
+#define FT_HASH_CACHE_VERSION 2
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t  block[64];
+    size_t   used;
+} FT_SHA256;
+
+typedef struct {
+    uint8_t *path;
+    uint16_t path_length;
+    uint64_t size;
+    int64_t  mtime; // in ns
+    uint64_t inode;
+    uint8_t  hash[TOX_HASH_LENGTH];
+} FT_HASH_ENTRY;
+
+typedef struct {
+    uint8_t  magic[4];
+    uint32_t version;
+    uint32_t count;
+} FT_HASH_CACHE_HEADER;
+
+typedef struct ft_hash_job {
+    struct ft_hash_job *next;
+    uint32_t            friend_number;
+    UTOX_MSG_FT *       msg;
+} FT_HASH_JOB;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+    FT_HASH_JOB *first, *last;
+
+    /* Only touched by the thread once it's started, oldest first. */
+    FT_HASH_ENTRY cache[FT_HASH_CACHE_MAX];
+    uint32_t      cache_count;
+    bool          cache_loaded;
+    bool          cache_reordered; // only the order changed since the last save, see ft_hash_file()
+
+    bool running, kill, thread_init;
+} hasher = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static const uint32_t ft_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+static void ft_sha256_block(uint32_t state[8], const uint8_t *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        const uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        const uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + ft_sha256_k[i] + w[i];
+        const uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void ft_sha256_init(FT_SHA256 *sha) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used   = 0;
+}
+
+static void ft_sha256_update(FT_SHA256 *sha, const uint8_t *data, size_t length) {
+    sha->length += length;
+
+    if (sha->used) {
+        const size_t count = MIN(length, sizeof(sha->block) - sha->used);
+        memcpy(sha->block + sha->used, data, count);
+        sha->used += count;
+        data += count;
+        length -= count;
+        if (sha->used < sizeof(sha->block)) {
+            return;
+        }
+        ft_sha256_block(sha->state, sha->block);
+        sha->used = 0;
+    }
+
+    for (; length >= sizeof(sha->block); data += sizeof(sha->block), length -= sizeof(sha->block)) {
+        ft_sha256_block(sha->state, data);
+    }
+
+    memcpy(sha->block, data, length);
+    sha->used = length;
+}
+
+static void ft_sha256_final(FT_SHA256 *sha, uint8_t hash[TOX_HASH_LENGTH]) {
+    const uint64_t bits = sha->length * 8;
+
+    sha->block[sha->used++] = 0x80;
+    if (sha->used > 56) {
+        memset(sha->block + sha->used, 0, sizeof(sha->block) - sha->used);
+        ft_sha256_block(sha->state, sha->block);
+        sha->used = 0;
+    }
+    memset(sha->block + sha->used, 0, 56 - sha->used);
+    for (int i = 0; i < 8; ++i) {
+        sha->block[56 + i] = bits >> (56 - i * 8);
+    }
+    ft_sha256_block(sha->state, sha->block);
+
+    for (int i = 0; i < 8; ++i) {
+        hash[i * 4]     = sha->state[i] >> 24;
+        hash[i * 4 + 1] = sha->state[i] >> 16;
+        hash[i * 4 + 2] = sha->state[i] >> 8;
+        hash[i * 4 + 3] = sha->state[i];
+    }
+}
+
+static void ft_hash_cache_free(void) {
+    for (uint32_t i = 0; i < hasher.cache_count; ++i) {
+        free(hasher.cache[i].path);
+    }
+    hasher.cache_count     = 0;
+    hasher.cache_loaded    = false;
+    hasher.cache_reordered = false;
+}
+
+/* Written to a temporary file that then replaces the old cache, so a save that fails part way leaves the last one
+ * as it was. */
+static bool ft_hash_cache_save(void) {
+    FILE *file = utox_get_file(FT_HASH_CACHE_TEMP, NULL, UTOX_FILE_OPTS_WRITE | UTOX_FILE_OPTS_MKDIR);
+    if (!file) {
+        LOG_ERR("FileTransfer", "Unable to open " FT_HASH_CACHE_TEMP " for writing.");
+        return false;
+    }
+
+    FT_HASH_CACHE_HEADER header = {
+        .version = FT_HASH_CACHE_VERSION,
+        .count   = hasher.cache_count,
+    };
+    memcpy(header.magic, "UTXH", 4);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (uint32_t i = 0; ok && i < hasher.cache_count; ++i) {
+        const FT_HASH_ENTRY *entry = &hasher.cache[i];
+        ok = fwrite(&entry->path_length, sizeof(entry->path_length), 1, file) == 1
+             && fwrite(&entry->size, sizeof(entry->size), 1, file) == 1
+             && fwrite(&entry->mtime, sizeof(entry->mtime), 1, file) == 1
+             && fwrite(&entry->inode, sizeof(entry->inode), 1, file) == 1
+             && fwrite(entry->hash, TOX_HASH_LENGTH, 1, file) == 1
+             && fwrite(entry->path, entry->path_length, 1, file) == 1;
+    }
+
+    ok = !fclose(file) && ok;
+    if (!ok || !utox_replace_file(FT_HASH_CACHE_TEMP, FT_HASH_CACHE_NAME)) {
+        LOG_ERR("FileTransfer", "Unable to save the file id cache.");
+        return false;
+    }
+
+    hasher.cache_reordered = false;
+    return true;
+}
+
+static void ft_hash_cache_load(void) {
+    hasher.cache_loaded = true;
+
+    FILE *file = utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_READ);
+    if (!file) {
+        return;
+    }
+
+    FT_HASH_CACHE_HEADER header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && !memcmp(header.magic, "UTXH", 4)
+              && header.version == FT_HASH_CACHE_VERSION && header.count <= FT_HASH_CACHE_MAX;
+
+    for (uint32_t i = 0; ok && i < header.count; ++i) {
+        FT_HASH_ENTRY *entry = &hasher.cache[i];
+        ok = fread(&entry->path_length, sizeof(entry->path_length), 1, file) == 1
+             && fread(&entry->size, sizeof(entry->size), 1, file) == 1
+             && fread(&entry->mtime, sizeof(entry->mtime), 1, file) == 1
+             && fread(&entry->inode, sizeof(entry->inode), 1, file) == 1
+             && fread(entry->hash, TOX_HASH_LENGTH, 1, file) == 1 && entry->path_length;
+        if (ok) {
+            entry->path = malloc(entry->path_length);
+            ok = entry->path && fread(entry->path, entry->path_length, 1, file) == 1;
+            if (entry->path) {
+                hasher.cache_count++;
+            }
+        }
+    }
+    fclose(file);
+
+    if (!ok) {
+        LOG_WARN("FileTransfer", "Unable to read the file id cache, files will be hashed again.");
+        ft_hash_cache_free();
+        hasher.cache_loaded = true;
+    }
+}
+
+/* Returns the entry for path, however old, or NULL. */
+static FT_HASH_ENTRY *ft_hash_cache_find(const uint8_t *path, size_t path_length) {
+    for (uint32_t i = 0; i < hasher.cache_count; ++i) {
+        FT_HASH_ENTRY *entry = &hasher.cache[i];
+        if (entry->path_length == path_length && !memcmp(entry->path, path, path_length)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Takes the entry out of the cache, its path is left for the caller to free or keep. */
+static void ft_hash_cache_remove(FT_HASH_ENTRY *entry) {
+    const uint32_t index = entry - hasher.cache;
+    memmove(entry, entry + 1, (hasher.cache_count - index - 1) * sizeof(FT_HASH_ENTRY));
+    hasher.cache_count--;
+}
+
+static void ft_hash_cache_add(const uint8_t *path, size_t path_length, uint64_t size, int64_t mtime, uint64_t inode,
+                              const uint8_t hash[TOX_HASH_LENGTH]) {
+    if (path_length > UINT16_MAX) {
+        return;
+    }
+
+    uint8_t *copy = malloc(path_length);
+    if (!copy) {
+        LOG_ERR("FileTransfer", "Unable to allocate for the file id cache.");
+        return;
+    }
+    memcpy(copy, path, path_length);
+
+    if (hasher.cache_count == FT_HASH_CACHE_MAX) {
+        free(hasher.cache[0].path);
+        ft_hash_cache_remove(&hasher.cache[0]);
+    }
+
+    FT_HASH_ENTRY *entry = &hasher.cache[hasher.cache_count++];
+    entry->path          = copy;
+    entry->path_length   = path_length;
+    entry->size          = size;
+    entry->mtime         = mtime;
+    entry->inode         = inode;
+    memcpy(entry->hash, hash, TOX_HASH_LENGTH);
+
+    ft_hash_cache_save();
+}
+
+static bool ft_hash_killed(void) {
+    pthread_mutex_lock(&hasher.lock);
+    const bool kill = hasher.kill;
+    pthread_mutex_unlock(&hasher.lock);
+    return kill;
+}
+
+/* The mtime is in ns where there's more than the second, so a file rewritten to the same size within it, or
+ * swapped for another one, isn't taken for the one that was hashed. */
+static bool ft_hash_stat(FILE *file, uint64_t *size, int64_t *mtime, uint64_t *inode) {
+    struct stat info;
+    if (fstat(fileno(file), &info)) {
+        return false;
+    }
+
+    *size  = info.st_size;
+    *inode = info.st_ino;
+#if defined __APPLE__
+    *mtime = info.st_mtimespec.tv_sec * INT64_C(1000000000) + info.st_mtimespec.tv_nsec;
+#elif !(defined __WIN32__ || defined _WIN32 || defined __CYGWIN__)
+    *mtime = info.st_mtim.tv_sec * INT64_C(1000000000) + info.st_mtim.tv_nsec;
+#else
+    *mtime = info.st_mtime * INT64_C(1000000000);
+#endif
+    return true;
+}
+
+/* Hashes the file, or looks it up if it hasn't changed since it was last hashed. */
+static bool ft_hash_file(UTOX_MSG_FT *msg) {
+    uint64_t size, inode;
+    int64_t  mtime;
+    if (!ft_hash_stat(msg->file, &size, &mtime, &inode)) {
+        LOG_ERR("FileTransfer", "Unable to stat %s to hash it.", msg->name);
+        return false;
+    }
+
+    const size_t path_length = strlen((char *)msg->name);
+
+    FT_HASH_ENTRY *entry = ft_hash_cache_find(msg->name, path_length);
+    if (entry && entry->size == size && entry->mtime == mtime && entry->inode == inode) {
+        memcpy(msg->hash, entry->hash, TOX_HASH_LENGTH);
+        if (entry != &hasher.cache[hasher.cache_count - 1]) {
+            /* Not worth writing the whole cache out for, it's saved with the next new entry or when we stop. */
+            FT_HASH_ENTRY found = *entry;
+            ft_hash_cache_remove(entry);
+            hasher.cache[hasher.cache_count++] = found;
+            hasher.cache_reordered             = true;
+        }
+        LOG_INFO("FileTransfer", "%s hasn't changed since it was last sent, using the same id.", msg->name);
+        return true;
+    }
+
+    if (entry) {
+        free(entry->path);
+        ft_hash_cache_remove(entry);
+    }
+
+    FT_READER *reader = ft_reader_new(msg->file, size);
+    if (!reader) {
+        return false;
+    }
+
+    FT_SHA256 sha;
+    ft_sha256_init(&sha);
+
+    const uint64_t begin = get_time();
+    bool           ok    = true;
+    for (uint64_t position = 0; ok && position < size; position += FT_READER_BLOCK) {
+        const size_t   length = MIN(FT_READER_BLOCK, size - position);
+        const uint8_t *block  = ft_reader_chunk(reader, position, length);
+        ok = block && !ft_hash_killed();
+        if (ok) {
+            ft_sha256_update(&sha, block, length);
+        }
+    }
+    ft_reader_free(reader);
+
+    if (!ok) {
+        return false;
+    }
+
+    ft_sha256_final(&sha, msg->hash);
+    LOG_INFO("FileTransfer", "Hashed %lu KiB of %s in %lu ms.", (unsigned long)(size >> 10), msg->name,
+             (unsigned long)((get_time() - begin) / 1000 / 1000));
+
+    ft_hash_cache_add(msg->name, path_length, size, mtime, inode, msg->hash);
+    return true;
+}
+
+static void ft_hash_drop(FT_HASH_JOB *job) {
+    fclose(job->msg->file);
+    free(job->msg->name);
+    free(job->msg);
+    free(job);
+}
+
+static void ft_hash_thread(void *UNUSED(args)) {
+    LOG_INFO("FileTransfer", "Hash thread starting");
+
+    pthread_mutex_lock(&hasher.lock);
+    while (!hasher.kill) {
+        FT_HASH_JOB *job = hasher.first;
+        if (!job) {
+            pthread_cond_wait(&hasher.wake, &hasher.lock);
+            continue;
+        }
+
+        hasher.first = job->next;
+        if (!hasher.first) {
+            hasher.last = NULL;
+        }
+        pthread_mutex_unlock(&hasher.lock);
+
+        if (!hasher.cache_loaded) {
+            ft_hash_cache_load();
+        }
+
+        const bool hashed = ft_hash_file(job->msg);
+        if (ft_hash_killed()) {
+            ft_hash_drop(job);
+        } else {
+            /* Without an id toxcore makes one up, it can still be sent, just not resumed later. */
+            postmessage_toxcore(TOX_FILE_SEND_HASHED, job->friend_number, hashed, job->msg);
+            free(job);
+        }
+
+        pthread_mutex_lock(&hasher.lock);
+    }
+    pthread_mutex_unlock(&hasher.lock);
+
+    if (hasher.cache_reordered) {
+        ft_hash_cache_save();
+    }
+
+    pthread_mutex_lock(&hasher.lock);
+    hasher.thread_init = false;
+    pthread_cond_broadcast(&hasher.wake);
+    pthread_mutex_unlock(&hasher.lock);
+
+    LOG_INFO("FileTransfer", "Hash thread exited cleanly");
+}
+
+void ft_hash_start(void) {
+    pthread_mutex_lock(&hasher.lock);
+    if (hasher.running) {
+        pthread_mutex_unlock(&hasher.lock);
+        return;
+    }
+
+    hasher.running     = true;
+    hasher.kill        = false;
+    hasher.thread_init = true;
+    pthread_mutex_unlock(&hasher.lock);
+
+    thread(ft_hash_thread, NULL);
+}
+
+void ft_hash_stop(void) {
+    pthread_mutex_lock(&hasher.lock);
+    if (!hasher.running) {
+        pthread_mutex_unlock(&hasher.lock);
+        return;
+    }
+
+    hasher.kill = true;
+    pthread_cond_broadcast(&hasher.wake);
+    while (hasher.thread_init) {
+        pthread_cond_wait(&hasher.wake, &hasher.lock);
+    }
+
+    while (hasher.first) {
+        FT_HASH_JOB *job = hasher.first;
+        hasher.first     = job->next;
+        ft_hash_drop(job);
+    }
+    hasher.last = NULL;
+
+    ft_hash_cache_free();
+    hasher.running = false;
+    pthread_mutex_unlock(&hasher.lock);
+}
+
+bool ft_hash_queue(uint32_t friend_number, UTOX_MSG_FT *msg) {
+    FT_HASH_JOB *job = calloc(1, sizeof(FT_HASH_JOB));
+    if (!job) {
+        LOG_ERR("FileTransfer", "Unable to allocate to hash %s.", msg->name);
+        return false;
+    }
+    job->friend_number = friend_number;
+    job->msg           = msg;
+
+    pthread_mutex_lock(&hasher.lock);
+    if (!hasher.running) {
+        pthread_mutex_unlock(&hasher.lock);
+        free(job);
+        return false;
+    }
+
+    if (hasher.last) {
+        hasher.last->next = job;
+    } else {
+        hasher.first = job;
+    }
+    hasher.last = job;
+    pthread_cond_signal(&hasher.wake);
+    pthread_mutex_unlock(&hasher.lock);
+
+    return true;
+}
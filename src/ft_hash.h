@@ -0,0 +1,29 @@
+#ifndef FT_HASH_H
+#define FT_HASH_H
+
+#include "file_transfers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Works out the file id of outgoing files off the toxcore thread.
+ *
+ * The id is the SHA-256 of the file's contents, the same as tox_hash() would give for it, so a file sent again, or
+ * after a restart, has the same id and the friend can pick up where they left off. Files are streamed through an
+ * FT_READER, so big files get read ahead the same as when they're sent. Ids are cached by path, size and modification
+ * time in ft_hashes next to the profile, so sending the same file again doesn't read it again. */
+
+/* How many files' ids are remembered, the least recently sent are forgotten first. */
+#define FT_HASH_CACHE_MAX 256
+
+/* Starts the thread that hashes outgoing files. */
+void ft_hash_start(void);
+
+/* Stops the thread, dropping any files still waiting to be hashed. */
+void ft_hash_stop(void);
+
+/* Fills in msg->hash in the background, then posts TOX_FILE_SEND_HASHED to the toxcore thread with msg so it can
+ * be sent. Returns false, leaving msg with the caller, if the thread isn't running. */
+bool ft_hash_queue(uint32_t friend_number, UTOX_MSG_FT *msg);
+
+#endif
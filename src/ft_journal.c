@@ -0,0 +1,215 @@
+#include "ft_journal.h"
+
+#include "debug.h"
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t ft_journal_magic[4] = { 'u', 'T', 'F', 'J' };
+
+#define HEADER_LENGTH (sizeof(ft_journal_magic) + 2 + TOX_FILE_ID_LENGTH + 8)
+#define RECORD_HEADER_LENGTH 3 // type, then the length of what follows
+
+enum {
+    FT_JOURNAL_RECORD_PATH  = 'P',
+    FT_JOURNAL_RECORD_RANGE = 'R',
+};
+
+#define FT_JOURNAL_FLAG_INCOMING 1
+
+/* Everything's stored little endian, whatever it is in memory. */
+static uint8_t *put_u64(uint8_t *dest, uint64_t value) {
+    for (size_t i = 0; i < 8; ++i) {
+        *dest++ = value >> (i * 8);
+    }
+    return dest;
+}
+
+static uint64_t get_u64(const uint8_t *src) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        value |= (uint64_t)src[i] << (i * 8);
+    }
+    return value;
+}
+
+static bool ft_journal_append(FILE *journal, const uint8_t *data, size_t length) {
+    if (fseeko(journal, 0, SEEK_END) || fwrite(data, length, 1, journal) != 1 || fflush(journal)) {
+        LOG_ERR("FileTransfer", "Unable to write to resume journal.");
+        return false;
+    }
+    return true;
+}
+
+static bool ft_journal_record(FILE *journal, uint8_t type, const uint8_t *payload, uint16_t length) {
+    uint8_t *record = malloc(RECORD_HEADER_LENGTH + length);
+    if (!record) {
+        LOG_ERR("FileTransfer", "Unable to allocate a resume journal record.");
+        return false;
+    }
+
+    record[0] = type;
+    record[1] = length;
+    record[2] = length >> 8;
+    memcpy(record + RECORD_HEADER_LENGTH, payload, length);
+
+    const bool ok = ft_journal_append(journal, record, RECORD_HEADER_LENGTH + length);
+    free(record);
+    return ok;
+}
+
+bool ft_journal_start(FILE *journal, bool incoming, const uint8_t file_id[TOX_FILE_ID_LENGTH], uint64_t size) {
+    uint8_t header[HEADER_LENGTH], *p = header;
+
+    memcpy(p, ft_journal_magic, sizeof(ft_journal_magic));
+    p += sizeof(ft_journal_magic);
+    *p++ = FT_JOURNAL_VERSION;
+    *p++ = incoming ? FT_JOURNAL_FLAG_INCOMING : 0;
+    memcpy(p, file_id, TOX_FILE_ID_LENGTH);
+    p += TOX_FILE_ID_LENGTH;
+    put_u64(p, size);
+
+    return ft_journal_append(journal, header, sizeof(header));
+}
+
+bool ft_journal_add_path(FILE *journal, const uint8_t *path, size_t length) {
+    if (length > UINT16_MAX) {
+        LOG_ERR("FileTransfer", "Path too long for resume journal.");
+        return false;
+    }
+    return ft_journal_record(journal, FT_JOURNAL_RECORD_PATH, path, length);
+}
+
+bool ft_journal_add_range(FILE *journal, uint64_t start, uint64_t end) {
+    uint8_t range[16];
+    put_u64(put_u64(range, start), end);
+    return ft_journal_record(journal, FT_JOURNAL_RECORD_RANGE, range, sizeof(range));
+}
+
+/* Adds the range, joining it up with any it overlaps or touches. */
+static bool ft_journal_merge(FT_JOURNAL *journal, uint64_t start, uint64_t end) {
+    if (start >= end) {
+        return true;
+    }
+
+    /* The first range that doesn't end before this one starts, and the first that starts after it ends. */
+    size_t first = 0;
+    while (first < journal->range_count && journal->ranges[first].end < start) {
+        first++;
+    }
+    size_t last = first;
+    while (last < journal->range_count && journal->ranges[last].start <= end) {
+        start = MIN(start, journal->ranges[last].start);
+        end   = MAX(end, journal->ranges[last].end);
+        last++;
+    }
+
+    if (first == last) {
+        FT_JOURNAL_RANGE *ranges = realloc(journal->ranges, (journal->range_count + 1) * sizeof(FT_JOURNAL_RANGE));
+        if (!ranges) {
+            LOG_ERR("FileTransfer", "Unable to allocate resume journal ranges.");
+            return false;
+        }
+        journal->ranges = ranges;
+        memmove(&ranges[first + 1], &ranges[first], (journal->range_count - first) * sizeof(FT_JOURNAL_RANGE));
+        journal->range_count++;
+    } else {
+        memmove(&journal->ranges[first + 1], &journal->ranges[last],
+                (journal->range_count - last) * sizeof(FT_JOURNAL_RANGE));
+        journal->range_count -= last - first - 1;
+    }
+
+    journal->ranges[first] = (FT_JOURNAL_RANGE){ .start = start, .end = end };
+    return true;
+}
+
+static bool ft_journal_parse(const uint8_t *data, size_t length, FT_JOURNAL *journal) {
+    if (length < HEADER_LENGTH || memcmp(data, ft_journal_magic, sizeof(ft_journal_magic))) {
+        LOG_WARN("FileTransfer", "Not a resume journal.");
+        return false;
+    }
+
+    const uint8_t *p = data + sizeof(ft_journal_magic);
+    if (*p != FT_JOURNAL_VERSION) {
+        LOG_WARN("FileTransfer", "Resume journal is version %u, only version %u can be read.", *p,
+                 FT_JOURNAL_VERSION);
+        return false;
+    }
+    p++;
+
+    journal->incoming = *p++ & FT_JOURNAL_FLAG_INCOMING;
+    memcpy(journal->file_id, p, TOX_FILE_ID_LENGTH);
+    p += TOX_FILE_ID_LENGTH;
+    journal->size = get_u64(p);
+    p += 8;
+
+    const uint8_t *end = data + length;
+    while (end - p >= RECORD_HEADER_LENGTH) {
+        const uint8_t  type   = p[0];
+        const uint16_t size   = p[1] | p[2] << 8;
+        const uint8_t *record = p + RECORD_HEADER_LENGTH;
+        if (end - record < size) {
+            LOG_WARN("FileTransfer", "Resume journal was cut short.");
+            break;
+        }
+        p = record + size;
+
+        if (type == FT_JOURNAL_RECORD_PATH) {
+            uint8_t *path = realloc(journal->path, size + 1);
+            if (!path) {
+                LOG_ERR("FileTransfer", "Unable to allocate resume journal path.");
+                return false;
+            }
+            memcpy(path, record, size);
+            path[size]           = 0;
+            journal->path        = path;
+            journal->path_length = size;
+        } else if (type == FT_JOURNAL_RECORD_RANGE && size >= 16) {
+            if (!ft_journal_merge(journal, get_u64(record), get_u64(record + 8))) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool ft_journal_read(FILE *file, FT_JOURNAL *journal) {
+    memset(journal, 0, sizeof(*journal));
+
+    if (fseeko(file, 0, SEEK_END)) {
+        return false;
+    }
+    const off_t length = ftello(file);
+    if (length <= 0 || fseeko(file, 0, SEEK_SET)) {
+        return false;
+    }
+
+    uint8_t *data = malloc(length);
+    if (!data) {
+        LOG_ERR("FileTransfer", "Unable to allocate %lu bytes to read resume journal.", (unsigned long)length);
+        return false;
+    }
+
+    const bool ok = fread(data, length, 1, file) == 1 && ft_journal_parse(data, length, journal);
+    free(data);
+
+    if (!ok) {
+        ft_journal_free(journal);
+    }
+    return ok;
+}
+
+void ft_journal_free(FT_JOURNAL *journal) {
+    free(journal->path);
+    free(journal->ranges);
+    memset(journal, 0, sizeof(*journal));
+}
+
+uint64_t ft_journal_resume_offset(const FT_JOURNAL *journal) {
+    if (!journal->range_count || journal->ranges[0].start) {
+        return 0;
+    }
+    return MIN(journal->ranges[0].end, journal->size);
+}
@@ -0,0 +1,53 @@
+#ifndef FT_JOURNAL_H
+#define FT_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <tox/tox.h>
+
+/* What a file transfer needs to pick up where it left off, kept in an append only journal.
+ *
+ * The journal starts with a fixed header, the file's id, size, and which way it's going. After that come records,
+ * each with its type and length up front, so records a later version adds can be skipped over. The path's recorded
+ * once it's known, and every time more of an incoming file is safely on disk the range that's been added is
+ * recorded. Ranges can come in any order. A record cut short by a crash is ignored, along with anything after it. */
+
+#define FT_JOURNAL_VERSION 1
+
+typedef struct {
+    uint64_t start, end;
+} FT_JOURNAL_RANGE;
+
+typedef struct {
+    bool     incoming;
+    uint8_t  file_id[TOX_FILE_ID_LENGTH];
+    uint64_t size;
+
+    uint8_t *path; // NULL terminated, NULL until it's been recorded
+    size_t   path_length;
+
+    FT_JOURNAL_RANGE *ranges; // sorted, with overlapping and touching ranges joined up
+    size_t            range_count;
+} FT_JOURNAL;
+
+/* Writes the header to a new, empty journal. */
+bool ft_journal_start(FILE *journal, bool incoming, const uint8_t file_id[TOX_FILE_ID_LENGTH], uint64_t size);
+
+/* Records where the file is. A later path replaces an earlier one. */
+bool ft_journal_add_path(FILE *journal, const uint8_t *path, size_t length);
+
+/* Records that the bytes [start, end) of the file are on disk. */
+bool ft_journal_add_range(FILE *journal, uint64_t start, uint64_t end);
+
+/* Reads a journal from the start. Returns false if it isn't one, or is a version this can't read. */
+bool ft_journal_read(FILE *file, FT_JOURNAL *journal);
+
+/* Frees what ft_journal_read() allocated. */
+void ft_journal_free(FT_JOURNAL *journal);
+
+/* How much of the file, from the start, is on disk with no gaps. */
+uint64_t ft_journal_resume_offset(const FT_JOURNAL *journal);
+
+#endif
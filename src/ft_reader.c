@@ -0,0 +1,239 @@
+#include "ft_reader.h"
+
+#include "debug.h"
+#include "macros.h"
+
+#include "native/thread.h"
+#include "native/time.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !(defined __WIN32__ || defined _WIN32 || defined __CYGWIN__)
+#define FT_READER_HAVE_PREAD
+#include <unistd.h>
+#endif
+
+static bool ft_reader_read(FILE *file, uint8_t *data, uint64_t start, size_t length) {
+#ifdef FT_READER_HAVE_PREAD
+    const int fd   = fileno(file);
+    size_t    done = 0;
+    while (done < length) {
+        const ssize_t got = pread(fd, data + done, length - done, start + done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        done += got;
+    }
+    return true;
+#else
+    /* Only the reader thread touches the file, so seeking it is safe. */
+    return !fseeko(file, start, SEEK_SET) && fread(data, length, 1, file) == 1;
+#endif
+}
+
+/* The next block in the window ahead of toxcore that isn't read yet, NULL if they all are. Sets number to the block
+ * it should hold. */
+static FT_READER_SLOT *ft_reader_next(FT_READER *reader, uint64_t *number) {
+    const uint64_t last = MIN(reader->wanted + FT_READER_BLOCKS, reader->blocks);
+    for (uint64_t n = reader->wanted; n < last; ++n) {
+        FT_READER_SLOT *slot = &reader->slots[n % FT_READER_BLOCKS];
+        if (slot->number != n) {
+            *number = n;
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+static void ft_reader_thread(void *args) {
+    FT_READER *reader = args;
+
+    pthread_mutex_lock(&reader->lock);
+    while (!reader->kill) {
+        uint64_t        number;
+        FT_READER_SLOT *slot = ft_reader_next(reader, &number);
+        if (!slot) {
+            pthread_cond_wait(&reader->wake, &reader->lock);
+            continue;
+        }
+
+        /* Whatever the slot held is behind toxcore now, or too far ahead of it after a seek back. */
+        slot->number = number;
+        slot->ready  = false;
+        pthread_mutex_unlock(&reader->lock);
+
+        const uint64_t start  = number * FT_READER_BLOCK;
+        const size_t   length = MIN(reader->size - start, FT_READER_BLOCK);
+
+        const uint64_t begin = get_time();
+        const bool     read  = ft_reader_read(reader->file, slot->data, start, length);
+        const uint64_t end   = get_time();
+
+        pthread_mutex_lock(&reader->lock);
+        if (!read) {
+            LOG_ERR("FileTransfer", "Unable to read %lu bytes at %lu from outgoing file.", (unsigned long)length,
+                    (unsigned long)start);
+        }
+        slot->ready = true;
+        slot->error = !read;
+        reader->stats.read_ns += end - begin;
+        reader->stats.reads++;
+        pthread_cond_broadcast(&reader->done);
+    }
+
+    reader->running = false;
+    pthread_cond_broadcast(&reader->done);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+static void ft_reader_free_slots(FT_READER *reader) {
+    for (size_t i = 0; i < FT_READER_BLOCKS; ++i) {
+        free(reader->slots[i].data);
+    }
+    free(reader->straddle);
+}
+
+FT_READER *ft_reader_new(FILE *file, uint64_t size) {
+    FT_READER *reader = calloc(1, sizeof(FT_READER));
+    if (!reader) {
+        LOG_ERR("FileTransfer", "Unable to allocate a file reader.");
+        return NULL;
+    }
+
+    reader->straddle = malloc(FT_READER_BLOCK);
+    bool allocated   = reader->straddle;
+    for (size_t i = 0; i < FT_READER_BLOCKS; ++i) {
+        reader->slots[i].data   = malloc(FT_READER_BLOCK);
+        reader->slots[i].number = UINT64_MAX;
+        allocated               = allocated && reader->slots[i].data;
+    }
+
+    if (!allocated) {
+        LOG_ERR("FileTransfer", "Unable to allocate %u byte read buffers.", FT_READER_BLOCK);
+        ft_reader_free_slots(reader);
+        free(reader);
+        return NULL;
+    }
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->wake, NULL);
+    pthread_cond_init(&reader->done, NULL);
+
+    reader->file    = file;
+    reader->size    = size;
+    reader->blocks  = (size + FT_READER_BLOCK - 1) / FT_READER_BLOCK;
+    reader->running = true;
+
+    thread(ft_reader_thread, reader);
+    return reader;
+}
+
+void ft_reader_free(FT_READER *reader) {
+    if (!reader) {
+        return;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    reader->kill = true;
+    pthread_cond_signal(&reader->wake);
+    while (reader->running) {
+        pthread_cond_wait(&reader->done, &reader->lock);
+    }
+    pthread_mutex_unlock(&reader->lock);
+
+    pthread_cond_destroy(&reader->wake);
+    pthread_cond_destroy(&reader->done);
+    pthread_mutex_destroy(&reader->lock);
+    ft_reader_free_slots(reader);
+    free(reader);
+}
+
+/* Waits for the reader thread to get to this block, returns NULL if it couldn't be read. Must be called with
+ * reader->lock held. */
+static const FT_READER_SLOT *ft_reader_wait(FT_READER *reader, uint64_t number) {
+    const FT_READER_SLOT *slot = &reader->slots[number % FT_READER_BLOCKS];
+    if (slot->number == number && slot->ready) {
+        return slot->error ? NULL : slot;
+    }
+
+    const uint64_t begin = get_time();
+    while (slot->number != number || !slot->ready) {
+        pthread_cond_wait(&reader->done, &reader->lock);
+    }
+    reader->stats.stall_ns += get_time() - begin;
+    reader->stats.stalls++;
+
+    return slot->error ? NULL : slot;
+}
+
+const uint8_t *ft_reader_chunk(FT_READER *reader, uint64_t position, size_t length) {
+    if (position > reader->size || length > reader->size - position || length > FT_READER_BLOCK) {
+        LOG_ERR("FileTransfer", "Chunk of %lu bytes at %lu is outside the file.", (unsigned long)length,
+                (unsigned long)position);
+        return NULL;
+    }
+
+    const uint64_t now = get_time();
+    if (!reader->stats.started) {
+        reader->stats.started = now;
+    }
+    reader->stats.last = now;
+
+    if (!length) {
+        return reader->straddle;
+    }
+
+    const uint64_t first = position / FT_READER_BLOCK;
+    const uint64_t last  = (position + length - 1) / FT_READER_BLOCK;
+
+    pthread_mutex_lock(&reader->lock);
+    if (reader->wanted != first) {
+        reader->wanted = first;
+        pthread_cond_signal(&reader->wake);
+    }
+
+    /* Both are in the window the thread's reading ahead, so neither gets reused until toxcore moves on. */
+    const FT_READER_SLOT *head = ft_reader_wait(reader, first);
+    const FT_READER_SLOT *tail = head && last != first ? ft_reader_wait(reader, last) : head;
+    pthread_mutex_unlock(&reader->lock);
+
+    if (!head || !tail) {
+        return NULL;
+    }
+
+    const size_t   offset = position - first * FT_READER_BLOCK;
+    const uint8_t *chunk;
+    if (head == tail) {
+        chunk = head->data + offset;
+    } else {
+        const size_t split = FT_READER_BLOCK - offset;
+        memcpy(reader->straddle, head->data + offset, split);
+        memcpy(reader->straddle + split, tail->data, length - split);
+        chunk = reader->straddle;
+    }
+
+    reader->stats.bytes += length;
+    reader->stats.chunks++;
+    return chunk;
+}
+
+void ft_reader_log_stats(FT_READER *reader, const char *name) {
+    if (!reader) {
+        return;
+    }
+
+    const FT_READER_STATS *stats   = &reader->stats;
+    const double           seconds = (stats->last - stats->started) / 1e9;
+
+    LOG_INFO("FileTransfer",
+             "%s: %lu KiB in %u chunks, %.1f KiB/s, %u reads taking %lu ms, waited on %u times for %lu ms", name,
+             (unsigned long)(stats->bytes >> 10), stats->chunks, seconds > 0 ? stats->bytes / 1024.0 / seconds : 0.0,
+             stats->reads, (unsigned long)(stats->read_ns / 1000 / 1000), stats->stalls,
+             (unsigned long)(stats->stall_ns / 1000 / 1000));
+}
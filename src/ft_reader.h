@@ -0,0 +1,67 @@
+#ifndef FT_READER_H
+#define FT_READER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* How much of the file is read at once. */
+#define FT_READER_BLOCK (256 << 10)
+/* How many blocks are kept read ahead of the chunk toxcore's asked for. */
+#define FT_READER_BLOCKS 8
+
+typedef struct {
+    uint64_t bytes;  // handed to toxcore
+    uint32_t chunks;
+    uint32_t reads;   // blocks read by the reader thread
+    uint64_t read_ns; // time the reader thread spent reading
+    uint32_t stalls;   // times toxcore had to wait for a block that wasn't read yet
+    uint64_t stall_ns; // time toxcore spent waiting
+    uint64_t started, last; // when the first and latest chunks were asked for, in ns
+} FT_READER_STATS;
+
+typedef struct {
+    uint8_t *data;
+    uint64_t number; // which block of the file this holds
+    bool     ready;  // done reading, check error to see if it worked
+    bool     error;
+} FT_READER_SLOT;
+
+/* Reads an outgoing file for toxcore's chunk requests from its own thread, so toxcore never waits on the disk
+ * unless it's caught up with it.
+ *
+ * The reader thread keeps a ring of blocks read ahead from the one toxcore's on, using pread() where there is one,
+ * and chunks are served straight out of them. Nothing's mapped, so a file that's truncated or replaced while it's
+ * being sent only makes the chunks that can't be read any more fail. */
+typedef struct ft_reader {
+    pthread_mutex_t lock;
+    pthread_cond_t  wake, done; // for the reader thread, and for whoever is waiting on it
+
+    FILE *   file;
+    uint64_t size, blocks;
+
+    FT_READER_SLOT slots[FT_READER_BLOCKS]; // block n lives in slot n % FT_READER_BLOCKS
+    uint64_t       wanted;                  // the block toxcore's on, the thread reads ahead from here
+
+    uint8_t *straddle; // a chunk that runs over the end of a block is put together here
+
+    bool running, kill;
+
+    FT_READER_STATS stats;
+} FT_READER;
+
+/* Returns NULL if the reader couldn't be started. The file stays the caller's to close, after freeing the reader. */
+FT_READER *ft_reader_new(FILE *file, uint64_t size);
+
+void ft_reader_free(FT_READER *reader);
+
+/* Returns the length bytes at position, valid until the next call, or NULL if they couldn't be read. length can't
+ * be more than FT_READER_BLOCK. */
+const uint8_t *ft_reader_chunk(FT_READER *reader, uint64_t position, size_t length);
+
+/* Logs how fast the file was read, and how long toxcore spent waiting on the disk. */
+void ft_reader_log_stats(FT_READER *reader, const char *name);
+
+#endif
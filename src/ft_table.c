@@ -0,0 +1,110 @@
+#include "ft_table.h"
+
+#include "debug.h"
+#include "file_transfers.h"
+#include "macros.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* How many slots the first count slabs hold between them. */
+static uint32_t ft_table_capacity(uint8_t count) {
+    return FT_TABLE_SLAB_FIRST * ((1u << count) - 1);
+}
+
+static bool ft_table_grow_index(FT_TABLE *table, uint32_t number) {
+    uint32_t size = MAX(table->index_size * 2, FT_TABLE_SLAB_FIRST * 2);
+    while (size <= number) {
+        size *= 2;
+    }
+
+    FILE_TRANSFER **index = realloc(table->index, size * sizeof(FILE_TRANSFER *));
+    if (!index) {
+        LOG_ERR("FileTransfer", "Unable to grow file transfer index to %u.", size);
+        return false;
+    }
+
+    memset(index + table->index_size, 0, (size - table->index_size) * sizeof(FILE_TRANSFER *));
+    table->index      = index;
+    table->index_size = size;
+    return true;
+}
+
+static bool ft_table_add_slab(FT_TABLE *table) {
+    if (table->slab_count == FT_TABLE_SLABS) {
+        LOG_ERR("FileTransfer", "Too many file transfers.");
+        return false;
+    }
+
+    const uint32_t slots = FT_TABLE_SLAB_FIRST << table->slab_count;
+
+    const uint32_t  capacity  = ft_table_capacity(table->slab_count + 1);
+    FILE_TRANSFER **free_list = realloc(table->free, capacity * sizeof(FILE_TRANSFER *));
+    if (!free_list) {
+        LOG_ERR("FileTransfer", "Unable to allocate for %u more file transfers.", slots);
+        return false;
+    }
+    table->free = free_list;
+
+    FILE_TRANSFER *slab = calloc(slots, sizeof(FILE_TRANSFER));
+    if (!slab) {
+        LOG_ERR("FileTransfer", "Unable to allocate for %u more file transfers.", slots);
+        return false;
+    }
+    table->slabs[table->slab_count++] = slab;
+
+    /* Backwards, so the first slot's the first handed out. */
+    for (uint32_t i = slots; i--;) {
+        table->free[table->free_count++] = &slab[i];
+    }
+
+    return true;
+}
+
+FILE_TRANSFER *ft_table_get(const FT_TABLE *table, uint32_t number) {
+    if (number >= table->index_size) {
+        return NULL;
+    }
+    return table->index[number];
+}
+
+FILE_TRANSFER *ft_table_make(FT_TABLE *table, uint32_t number) {
+    FILE_TRANSFER *ft = ft_table_get(table, number);
+    if (ft) {
+        return ft;
+    }
+
+    if (number >= table->index_size && !ft_table_grow_index(table, number)) {
+        return NULL;
+    }
+
+    if (!table->free_count && !ft_table_add_slab(table)) {
+        return NULL;
+    }
+
+    ft = table->free[--table->free_count];
+    memset(ft, 0, sizeof(FILE_TRANSFER));
+    table->index[number] = ft;
+    table->count++;
+    return ft;
+}
+
+void ft_table_release(FT_TABLE *table, uint32_t number) {
+    FILE_TRANSFER *ft = ft_table_get(table, number);
+    if (!ft) {
+        return;
+    }
+
+    table->index[number]             = NULL;
+    table->free[table->free_count++] = ft;
+    table->count--;
+}
+
+void ft_table_free(FT_TABLE *table) {
+    for (uint8_t i = 0; i < table->slab_count; ++i) {
+        free(table->slabs[i]);
+    }
+    free(table->index);
+    free(table->free);
+    memset(table, 0, sizeof(FT_TABLE));
+}
@@ -0,0 +1,45 @@
+#ifndef FT_TABLE_H
+#define FT_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct file_transfer FILE_TRANSFER;
+
+/* How many transfers the first slab holds, each slab after it holds twice as many as the one before. */
+#define FT_TABLE_SLAB_FIRST 4
+/* Enough slabs for every file number toxcore can hand out. */
+#define FT_TABLE_SLABS 15
+
+/* A friend's file transfers going one way, by file number.
+ *
+ * Transfers live in slabs that don't move or get freed until the table does, so a pointer to one stays good however
+ * many more are started. Slots come off a free list, and go back on it once the transfer's done with. The index from
+ * file number to slot doubles in size whenever a bigger number than it can hold turns up. */
+typedef struct ft_table {
+    FILE_TRANSFER *slabs[FT_TABLE_SLABS];
+    uint8_t        slab_count;
+
+    FILE_TRANSFER **index; // by file number, NULL where there isn't a transfer
+    uint32_t        index_size;
+
+    FILE_TRANSFER **free; // slots not in use, room for every slot in the slabs
+    uint32_t        free_count;
+
+    uint32_t count; // transfers in the table
+} FT_TABLE;
+
+/* Returns the transfer with this file number, or NULL. */
+FILE_TRANSFER *ft_table_get(const FT_TABLE *table, uint32_t number);
+
+/* Returns the transfer with this file number, giving it a zeroed slot if it doesn't have one yet. Returns NULL if
+ * out of memory. */
+FILE_TRANSFER *ft_table_make(FT_TABLE *table, uint32_t number);
+
+/* Puts the transfer's slot back on the free list, for the next transfer to use. */
+void ft_table_release(FT_TABLE *table, uint32_t number);
+
+/* Frees the table and every transfer in it. */
+void ft_table_free(FT_TABLE *table);
+
+#endif
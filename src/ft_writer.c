@@ -0,0 +1,308 @@
+#include "ft_writer.h"
+
+#include "debug.h"
+#include "macros.h"
+
+#include "native/thread.h"
+#include "native/time.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !(defined __WIN32__ || defined _WIN32 || defined __CYGWIN__)
+#define FT_WRITER_HAVE_PWRITE
+#include <unistd.h>
+#endif
+
+#define NS_PER_MS (1000 * 1000)
+
+static bool ft_writer_write(FILE *file, const FT_WRITER_BLOCK *block) {
+#ifdef FT_WRITER_HAVE_PWRITE
+    const int fd   = fileno(file);
+    size_t    done = 0;
+    while (done < block->length) {
+        const ssize_t wrote = pwrite(fd, block->data + done, block->length - done, block->start + done);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote <= 0) {
+            return false;
+        }
+        done += wrote;
+    }
+    return true;
+#else
+    return !fseeko(file, block->start, SEEK_SET) && fwrite(block->data, block->length, 1, file) == 1
+           && !fflush(file);
+#endif
+}
+
+static bool ft_writer_sync(FILE *file) {
+#if defined FT_WRITER_HAVE_PWRITE && defined __APPLE__
+    return !fsync(fileno(file));
+#elif defined FT_WRITER_HAVE_PWRITE
+    return !fdatasync(fileno(file));
+#else
+    return !fflush(file);
+#endif
+}
+
+/* The block chunks are going into, NULL if they're all waiting to be written. */
+static FT_WRITER_BLOCK *ft_writer_filling(FT_WRITER *writer) {
+    if (writer->queued == FT_WRITER_BUFFERS) {
+        return NULL;
+    }
+    return &writer->blocks[(writer->first + writer->queued) % FT_WRITER_BUFFERS];
+}
+
+static void ft_writer_wait(FT_WRITER *writer, uint64_t ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * NS_PER_MS;
+    if (deadline.tv_nsec >= 1000 * NS_PER_MS) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000 * NS_PER_MS;
+    }
+
+    pthread_cond_timedwait(&writer->wake, &writer->lock, &deadline);
+}
+
+static void ft_writer_thread(void *args) {
+    FT_WRITER *writer = args;
+
+    pthread_mutex_lock(&writer->lock);
+    while (true) {
+        const uint64_t   now     = get_time();
+        FT_WRITER_BLOCK *filling = ft_writer_filling(writer);
+        const bool       finish  = writer->flush_now || writer->kill;
+
+        /* Don't let a part filled block wait for ever, toxcore might not be sending any more for a while. */
+        if (!writer->queued && filling->length
+            && (finish || now - writer->filling_since >= FT_WRITER_SYNC_MS * NS_PER_MS)) {
+            writer->queued++;
+            continue;
+        }
+
+        const bool sync_due = writer->unsynced >= FT_WRITER_SYNC_BYTES
+                              || (!writer->queued && writer->unsynced
+                                  && (finish || now - writer->last_sync >= FT_WRITER_SYNC_MS * NS_PER_MS));
+        if (sync_due) {
+            const uint64_t written_to = writer->written_to;
+            pthread_mutex_unlock(&writer->lock);
+
+            const uint64_t begin  = get_time();
+            const bool     synced = ft_writer_sync(writer->file);
+            const uint64_t end    = get_time();
+
+            pthread_mutex_lock(&writer->lock);
+            if (synced) {
+                writer->durable = written_to;
+            } else {
+                LOG_ERR("FileTransfer", "Unable to sync incoming file to disk.");
+                writer->error = true;
+            }
+            writer->unsynced  = 0;
+            writer->last_sync = end;
+            writer->stats.write_ns += end - begin;
+            writer->stats.syncs++;
+            continue;
+        }
+
+        if (writer->queued) {
+            FT_WRITER_BLOCK *block = &writer->blocks[writer->first];
+            pthread_mutex_unlock(&writer->lock);
+
+            const uint64_t begin = get_time();
+            const bool     wrote = ft_writer_write(writer->file, block);
+            const uint64_t end   = get_time();
+
+            pthread_mutex_lock(&writer->lock);
+            if (wrote) {
+                if (block->start <= writer->written_to) {
+                    writer->written_to = MAX(writer->written_to, block->start + block->length);
+                }
+                writer->unsynced += block->length;
+                writer->stats.bytes += block->length;
+            } else {
+                LOG_ERR("FileTransfer", "Unable to write %lu bytes at %lu to incoming file.",
+                        (unsigned long)block->length, (unsigned long)block->start);
+                writer->error = true;
+            }
+            writer->stats.write_ns += end - begin;
+            writer->stats.writes++;
+
+            block->length = 0;
+            writer->first = (writer->first + 1) % FT_WRITER_BUFFERS;
+            writer->queued--;
+            pthread_cond_broadcast(&writer->done);
+            continue;
+        }
+
+        /* Everything's written and synced. */
+        if (writer->flush_now) {
+            writer->flush_now = false;
+            pthread_cond_broadcast(&writer->done);
+        }
+
+        if (writer->kill) {
+            break;
+        }
+
+        /* Sleep until there's something to write, or whatever's waiting is due. */
+        if (filling->length) {
+            ft_writer_wait(writer, FT_WRITER_SYNC_MS - MIN((now - writer->filling_since) / NS_PER_MS,
+                                                           FT_WRITER_SYNC_MS - 1));
+        } else if (writer->unsynced) {
+            ft_writer_wait(writer, FT_WRITER_SYNC_MS - MIN((now - writer->last_sync) / NS_PER_MS,
+                                                           FT_WRITER_SYNC_MS - 1));
+        } else {
+            pthread_cond_wait(&writer->wake, &writer->lock);
+        }
+    }
+
+    writer->running = false;
+    pthread_cond_broadcast(&writer->done);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+FT_WRITER *ft_writer_new(FILE *file, uint64_t start) {
+    FT_WRITER *writer = calloc(1, sizeof(FT_WRITER));
+    if (!writer) {
+        LOG_ERR("FileTransfer", "Unable to allocate a file writer.");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < FT_WRITER_BUFFERS; ++i) {
+        writer->blocks[i].data = malloc(FT_WRITER_BUFFER);
+        if (!writer->blocks[i].data) {
+            LOG_ERR("FileTransfer", "Unable to allocate %u byte write buffers.", FT_WRITER_BUFFER);
+            while (i--) {
+                free(writer->blocks[i].data);
+            }
+            free(writer);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->wake, NULL);
+    pthread_cond_init(&writer->done, NULL);
+
+    writer->file         = file;
+    writer->written_to   = start;
+    writer->durable      = start;
+    writer->checkpointed = start;
+    writer->last_sync    = get_time();
+    writer->running      = true;
+
+    thread(ft_writer_thread, writer);
+    return writer;
+}
+
+bool ft_writer_free(FT_WRITER *writer) {
+    if (!writer) {
+        return true;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->kill = true;
+    pthread_cond_signal(&writer->wake);
+    while (writer->running) {
+        pthread_cond_wait(&writer->done, &writer->lock);
+    }
+    const bool ok = !writer->error;
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_cond_destroy(&writer->wake);
+    pthread_cond_destroy(&writer->done);
+    pthread_mutex_destroy(&writer->lock);
+    for (size_t i = 0; i < FT_WRITER_BUFFERS; ++i) {
+        free(writer->blocks[i].data);
+    }
+    free(writer);
+
+    return ok;
+}
+
+bool ft_writer_push(FT_WRITER *writer, uint64_t position, const uint8_t *data, size_t length) {
+    pthread_mutex_lock(&writer->lock);
+
+    while (length && !writer->error) {
+        FT_WRITER_BLOCK *block = ft_writer_filling(writer);
+        if (!block) {
+            /* The disk can't keep up, nothing for it but to wait. */
+            const uint64_t begin = get_time();
+            pthread_cond_wait(&writer->done, &writer->lock);
+            writer->stats.stall_ns += get_time() - begin;
+            writer->stats.stalls++;
+            continue;
+        }
+
+        if (block->length && (position != block->start + block->length || block->length == FT_WRITER_BUFFER)) {
+            writer->queued++;
+            pthread_cond_signal(&writer->wake);
+            continue;
+        }
+
+        if (!block->length) {
+            block->start          = position;
+            writer->filling_since = get_time();
+        }
+
+        const size_t count = MIN(length, FT_WRITER_BUFFER - block->length);
+        memcpy(block->data + block->length, data, count);
+        block->length += count;
+        position += count;
+        data += count;
+        length -= count;
+
+        if (block->length == FT_WRITER_BUFFER) {
+            writer->queued++;
+            pthread_cond_signal(&writer->wake);
+        }
+    }
+
+    const bool ok = !writer->error;
+    pthread_mutex_unlock(&writer->lock);
+    return ok;
+}
+
+bool ft_writer_flush(FT_WRITER *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->flush_now = true;
+    pthread_cond_signal(&writer->wake);
+    while (writer->flush_now && writer->running) {
+        pthread_cond_wait(&writer->done, &writer->lock);
+    }
+    const bool ok = !writer->error;
+    pthread_mutex_unlock(&writer->lock);
+
+    return ok;
+}
+
+bool ft_writer_durable(FT_WRITER *writer, uint64_t *offset) {
+    pthread_mutex_lock(&writer->lock);
+    *offset             = writer->durable;
+    const bool advanced = writer->durable != writer->checkpointed;
+    writer->checkpointed = writer->durable;
+    pthread_mutex_unlock(&writer->lock);
+
+    return advanced;
+}
+
+void ft_writer_log_stats(FT_WRITER *writer, const char *name) {
+    if (!writer) {
+        return;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    const FT_WRITER_STATS stats = writer->stats;
+    pthread_mutex_unlock(&writer->lock);
+
+    LOG_INFO("FileTransfer", "%s: %lu KiB in %u writes and %u syncs taking %lu ms, toxcore waited %u times for %lu ms",
+             name, (unsigned long)(stats.bytes >> 10), stats.writes, stats.syncs,
+             (unsigned long)(stats.write_ns / NS_PER_MS), stats.stalls, (unsigned long)(stats.stall_ns / NS_PER_MS));
+}
@@ -0,0 +1,77 @@
+#ifndef FT_WRITER_H
+#define FT_WRITER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Chunks are gathered up into writes this big. */
+#define FT_WRITER_BUFFER (1 << 20)
+/* How many writes can be waiting on the disk before toxcore has to wait too. */
+#define FT_WRITER_BUFFERS 4
+/* Written data's synced to disk once this much is waiting to be... */
+#define FT_WRITER_SYNC_BYTES (16 << 20)
+/* ...or it's been waiting this long. Also how long a part filled write waits for more chunks. */
+#define FT_WRITER_SYNC_MS 1000
+
+typedef struct {
+    uint64_t bytes;
+    uint32_t writes, syncs;
+    uint64_t write_ns; // time the writer thread spent writing and syncing
+    uint64_t stall_ns; // time the toxcore thread spent waiting for the writer to catch up
+    uint32_t stalls;
+} FT_WRITER_STATS;
+
+typedef struct {
+    uint8_t *data;
+    uint64_t start;
+    size_t   length;
+} FT_WRITER_BLOCK;
+
+/* Writes an incoming file from its own thread, so toxcore never waits on the disk unless it's far behind.
+ *
+ * Chunks are copied into a buffer as they arrive. Once it's full, or the next chunk doesn't follow on from the last,
+ * it's handed to the writer thread, which writes it in one go and syncs every so often. Only what's been synced
+ * counts as durable, and that's what resuming starts from. */
+typedef struct ft_writer {
+    pthread_mutex_t lock;
+    pthread_cond_t  wake, done; // for the writer thread, and for whoever is waiting on it
+
+    FILE *file;
+
+    FT_WRITER_BLOCK blocks[FT_WRITER_BUFFERS]; // ring, queued for writing from first, then the one being filled
+    size_t          first, queued;
+
+    uint64_t filling_since; // when the first chunk went into the block being filled
+
+    uint64_t written_to; // the end of what's been written with no gaps before it
+    uint64_t durable, checkpointed;
+    size_t   unsynced;
+    uint64_t last_sync;
+
+    bool running, kill, flush_now, error;
+
+    FT_WRITER_STATS stats;
+} FT_WRITER;
+
+/* Starts writing file from start, where what's already there ends. Returns NULL if the writer couldn't be started.
+ * The file stays the caller's to close, after freeing the writer. */
+FT_WRITER *ft_writer_new(FILE *file, uint64_t start);
+
+/* Writes out everything that's left, then stops the writer. Returns false if anything couldn't be written. */
+bool ft_writer_free(FT_WRITER *writer);
+
+/* Queues the chunk to be written at position. Returns false if an earlier write failed. */
+bool ft_writer_push(FT_WRITER *writer, uint64_t position, const uint8_t *data, size_t length);
+
+/* Waits for everything queued to be written and synced. Returns false if anything couldn't be written. */
+bool ft_writer_flush(FT_WRITER *writer);
+
+/* Sets offset to how much of the file is safely on disk. Returns true if that's moved on since the last time. */
+bool ft_writer_durable(FT_WRITER *writer, uint64_t *offset);
+
+void ft_writer_log_stats(FT_WRITER *writer, const char *name);
+
+#endif
@@ -8,6 +8,7 @@
 #include "text.h"
 
 #include "av/audio.h"
+#include "av/group_mixer.h"
 #include "av/utox_av.h"
 
 #include "native/notify.h"
@@ -96,6 +97,9 @@ void group_init(GROUPCHAT *g, uint32_t group_number, bool av_group, const char *
     g->number   = group_number;
     g->notify   = settings.group_notifications;
     g->av_group = av_group;
+    if (av_group && !g->mixer) {
+        g->mixer = group_mixer_new();
+    }
     pthread_mutex_unlock(&messages_lock);
     self.groups_list_count++;
 }
@@ -185,7 +189,7 @@ void group_peer_add(GROUPCHAT *g, uint32_t peer_id, bool UNUSED(our_peer_number)
     g->peer_count++;
 
     if (g->av_group) {
-        group_av_peer_add(g, peer_id); //add a source for the peer
+        group_av_peer_add(g, peer_id); // start mixing the peer in afresh
     }
 
     pthread_mutex_unlock(&messages_lock);
@@ -291,17 +295,20 @@ void group_free(GROUPCHAT *g) {
 
     group_reset_peerlist(g);
 
-    for (size_t i = 0; i < g->msg.number; ++i) {
-        free(g->msg.data[i]->via.grp.author);
+    for (uint32_t i = g->msg.first; i != g->msg.first + g->msg.number; ++i) {
+        MSG_HEADER *msg = message_get(&g->msg, i);
+        free(msg->via.grp.author);
 
         // Freeing this here was causing a double free.
         // TODO: Is it needed to prevent a memory leak in some cases?
-        // free(g->msg.data[i]->via.grp.msg);
+        // free(msg->via.grp.msg);
 
-        message_free(g->msg.data[i]);
+        message_free(msg);
     }
     free(g->msg.data);
 
+    utox_audio_group_release(g);
+
     memset(g, 0, sizeof(GROUPCHAT));
 
     self.groups_list_count--;
@@ -7,9 +7,13 @@
 
 typedef unsigned int ALuint;
 typedef struct edit_change EDIT_CHANGE;
+typedef struct group_mixer GROUP_MIXER;
 
 #define UTOX_MAX_GROUP_PEERS 256
 
+/* How many mixed 20ms frames can be waiting to play at once. */
+#define UTOX_GROUP_AUDIO_BUFFERS 8
+
 /*  UTOX_SAVE limits 8 as the max */
 typedef enum {
     GNOTIFY_NEVER,      /* 0: never send notifications, */
@@ -35,8 +39,11 @@ typedef struct groupchat {
     bool active_call;
     bool muted;
     ALuint audio_dest;
-    /* Audio sources */
-    unsigned int source[UTOX_MAX_GROUP_PEERS];
+    /* Everyone's audio is mixed down to play through audio_dest, out of these buffers. */
+    GROUP_MIXER *mixer;
+    ALuint audio_buffers[UTOX_GROUP_AUDIO_BUFFERS];
+    ALuint audio_free[UTOX_GROUP_AUDIO_BUFFERS];
+    uint8_t audio_free_count;
     /* TODO: thread safety (This should work fine but it isn't very clean.) */
     volatile uint64_t last_recv_audio[UTOX_MAX_GROUP_PEERS];
 
@@ -25,7 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-static UTOX_FRAME_PKG current_frame = { 0, 0, 0, 0 };
+static UTOX_FRAME_PKG current_frame = { 0 };
 
 bool inline_set_frame(uint16_t w, uint16_t h, size_t size, void *img) {
     current_frame.w    = w;
@@ -7,6 +7,7 @@
 #include "../theme.h"
 #include "../tox.h"
 
+#include "../av/audio.h"
 #include "../av/video.h"
 
 #include "../native/clipboard.h"
@@ -990,7 +991,10 @@ static void switchfxn_push_to_talk(void) {
     }
 }
 
-static void switchfxn_audio_filtering(void) { settings.audio_filtering_enabled = !settings.audio_filtering_enabled; }
+static void switchfxn_audio_filtering(void) {
+    settings.audio_filtering_enabled = !settings.audio_filtering_enabled;
+    postmessage_audio(UTOXAUDIO_CHANGE_FILTERING, 0, 0, NULL);
+}
 
 static void switchfxn_status_notifications(void) { settings.status_notifications = !settings.status_notifications; }
 
@@ -1,5 +1,6 @@
 #include "main.h"
 
+#include "chatlog.h"
 #include "debug.h"
 #include "settings.h"
 #include "theme.h"
@@ -9,6 +10,7 @@
 #include "native/thread.h"
 
 #include "av/utox_av.h"
+#include "av/video_synthetic.h"
 
 #include <getopt.h>
 #include <stdlib.h>
@@ -122,6 +124,7 @@ void parse_args(int argc, char *argv[],
         { "version", no_argument, NULL, 0 },            { "silent", no_argument, NULL, 'S' },
         { "verbose", no_argument, NULL, 'v' },          { "help", no_argument, NULL, 'h' },
         { "debug", required_argument, NULL, 1 },        { "allow-root", no_argument, NULL, 2 },
+        { "synthetic-video", optional_argument, NULL, 3 },
         { 0, 0, 0, 0 }
     };
 
@@ -226,6 +229,14 @@ void parse_args(int argc, char *argv[],
                 break;
             }
 
+            case 3: {
+                if (!video_synthetic_configure(optarg)) {
+                    LOG_NORM("Invalid synthetic video %s, expected WIDTHxHEIGHT[@FPS] with an even size.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+
             case 'h': {
                 LOG_NORM("µTox - Lightweight Tox client version %s.\n\n", VERSION);
                 LOG_NORM("The following options are available:\n");
@@ -241,6 +252,8 @@ void parse_args(int argc, char *argv[],
                 LOG_NORM("  --version                Print the version and exit.\n");
                 LOG_NORM("  --silent                 Set the verbosity level to 0, disable all debugging output.\n");
                 LOG_NORM("  --debug=<file>           Set a file for utox to log errors to.\n");
+                LOG_NORM("  --synthetic-video[=<WxH@fps>]  Add a test pattern to the video devices, and use it "
+                            "by default. Defaults to 640x480@25.\n");
                 exit(EXIT_SUCCESS);
             }
 
@@ -270,9 +283,13 @@ void utox_init(void) {
         settings.show_splash = true;
         settings.utox_last_version = settings.last_version;
     }
+
+    utox_chatlog_writer_start();
 }
 
 void utox_raze(void) {
+    utox_chatlog_writer_stop();
+
     LOG_WARN("uTox", "Clean exit.");
     if (settings.debug_file != stdout) {
         fclose(settings.debug_file);
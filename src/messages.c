@@ -1,6 +1,7 @@
 #include "messages.h"
 
 #include "chatlog.h"
+#include "chatlog_search.h"
 #include "file_transfers.h"
 #include "filesys.h"
 #include "flist.h"
@@ -36,6 +37,9 @@
 
 #define UTOX_MAX_BACKLOG_MESSAGES 256
 
+// How many messages with estimated heights to lay out per frame
+#define MESSAGES_REFINE_BATCH 64
+
 pthread_mutex_t messages_lock;
 
 /** Appends a messages from self or friend to the message list;
@@ -50,7 +54,47 @@ static int get_time_width() {
     return SCALE(settings.use_long_time_msg ? TIME_WIDTH_LONG : TIME_WIDTH);
 }
 
-static int msgheight(MSG_HEADER *msg, int width) {
+/* Bumped whenever the fonts change, so layouts from before then aren't reused. */
+static uint16_t layout_font = 1;
+
+void messages_fonts_changed(void) {
+    layout_font++;
+}
+
+/* Height of a text message, reusing its last layout while the width is in the range that layout holds for. Otherwise,
+ * if estimate is set, the height is guessed from the last layout and left for messages_refine() to lay out. */
+static int msgheight_text(MSG_HEADER *msg, char *str, uint16_t length, int width, bool estimate) {
+    int      right  = abs(width - SCALE(MESSAGES_X) - get_time_width());
+    uint32_t lines  = msg->layout_lines;
+    bool     cached = msg->layout_font == layout_font;
+
+    if (cached && right >= msg->layout_low && right < msg->layout_high) {
+        msg->height_estimated = false;
+    } else if (estimate) {
+        if (cached) {
+            // The same text takes up the same area, near enough.
+            uint32_t known = (right < msg->layout_low) ? msg->layout_low : msg->layout_high;
+            lines          = MAX(1, (lines * known + right - 1) / MAX(right, 1));
+        } else {
+            // Never been laid out, assume glyphs are about half as wide as lines are high.
+            lines = 1 + length * (font_small_lineheight / 2) / MAX(right, 1);
+        }
+        msg->height_estimated = true;
+    } else {
+        int low, high;
+        lines = text_height_range(right, font_small_lineheight, str, length, &low, &high) / font_small_lineheight;
+
+        msg->layout_lines     = lines;
+        msg->layout_low       = MAX(low, 0);
+        msg->layout_high      = MIN(high, UINT16_MAX);
+        msg->layout_font      = layout_font;
+        msg->height_estimated = false;
+    }
+
+    return lines ? lines * font_small_lineheight + MESSAGES_SPACING : 0;
+}
+
+static int msgheight(MSG_HEADER *msg, int width, bool estimate) {
     switch (msg->msg_type) {
         case MSG_TYPE_NULL: {
             LOG_ERR("Messages", "Invalid message type in msgheight.");
@@ -61,9 +105,7 @@ static int msgheight(MSG_HEADER *msg, int width) {
         case MSG_TYPE_ACTION_TEXT:
         case MSG_TYPE_NOTICE:
         case MSG_TYPE_NOTICE_DAY_CHANGE: {
-            int  theight = text_height(abs(width - SCALE(MESSAGES_X) - get_time_width()), font_small_lineheight,
-                                       msg->via.txt.msg, msg->via.txt.length);
-            return (theight == 0) ? 0 : theight + MESSAGES_SPACING;
+            return msgheight_text(msg, msg->via.txt.msg, msg->via.txt.length, width, estimate);
         }
 
         case MSG_TYPE_IMAGE: {
@@ -83,15 +125,13 @@ static int msgheight(MSG_HEADER *msg, int width) {
     return 0;
 }
 
-static int msgheight_group(MSG_HEADER *msg, int width) {
+static int msgheight_group(MSG_HEADER *msg, int width, bool estimate) {
     switch (msg->msg_type) {
         case MSG_TYPE_TEXT:
         case MSG_TYPE_ACTION_TEXT:
         case MSG_TYPE_NOTICE:
         case MSG_TYPE_NOTICE_DAY_CHANGE: {
-            int theight = text_height(abs(width - SCALE(MESSAGES_X) - get_time_width()), font_small_lineheight,
-                                      msg->via.grp.msg, msg->via.grp.length);
-            return (theight == 0) ? 0 : theight + MESSAGES_SPACING;
+            return msgheight_text(msg, msg->via.grp.msg, msg->via.grp.length, width, estimate);
         }
 
         default: {
@@ -102,94 +142,173 @@ static int msgheight_group(MSG_HEADER *msg, int width) {
     return 0;
 }
 
-static int message_setheight(MESSAGES *m, MSG_HEADER *msg) {
+static int message_setheight(MESSAGES *m, MSG_HEADER *msg, bool estimate) {
     if (m->width == 0) {
         return 0;
     }
 
     setfont(FONT_TEXT);
 
+    bool estimated = msg->height_estimated;
     if (m->is_groupchat) {
-        msg->height    = msgheight_group(msg, m->width);
+        msg->height    = msgheight_group(msg, m->width, estimate);
     } else {
-        msg->height = msgheight(msg, m->width);
+        msg->height = msgheight(msg, m->width, estimate);
     }
+    m->estimates += msg->height_estimated - estimated;
 
     return msg->height;
 }
 
-static void message_updateheight(MESSAGES *m, MSG_HEADER *msg) {
+/* Unchecked, n has to be in the backlog. */
+#define MSG_AT(m, n) ((m)->data[(n) & ((m)->size - 1)])
+
+/* m->heights is a Fenwick tree over the slots of m->data, holding the height of the message in each slot, or 0 for
+ * an empty one. It finds the message at a given height without walking every message above it. */
+static void heights_add(MESSAGES *m, uint32_t slot, uint32_t delta) {
+    for (uint32_t i = slot + 1; i <= m->size; i += i & -i) {
+        m->heights[i - 1] += delta;
+    }
+}
+
+/* Height of the slots before slot. */
+static uint32_t heights_prefix(const MESSAGES *m, uint32_t slot) {
+    uint32_t sum = 0;
+    for (uint32_t i = slot; i; i &= i - 1) {
+        sum += m->heights[i - 1];
+    }
+    return sum;
+}
+
+/* First slot whose bottom is below y, or size if they all end above it. */
+static uint32_t heights_search(const MESSAGES *m, uint32_t y) {
+    uint32_t slot = 0;
+    for (uint32_t step = m->size; step; step >>= 1) {
+        if (slot + step <= m->size && m->heights[slot + step - 1] <= y) {
+            slot += step;
+            y -= m->heights[slot - 1];
+        }
+    }
+    return slot;
+}
+
+static void heights_rebuild(MESSAGES *m) {
+    memset(m->heights, 0, m->size * sizeof(uint32_t));
+    for (uint32_t n = m->first; n != m->first + m->number; ++n) {
+        m->heights[n & (m->size - 1)] = MSG_AT(m, n)->height;
+    }
+
+    for (uint32_t i = 1; i <= m->size; ++i) {
+        uint32_t parent = i + (i & -i);
+        if (parent <= m->size) {
+            m->heights[parent - 1] += m->heights[i - 1];
+        }
+    }
+}
+
+/* Height of the messages before message n. */
+static uint32_t messages_height_before(const MESSAGES *m, uint32_t n) {
+    uint32_t first = m->first & (m->size - 1), slot = n & (m->size - 1);
+    if (slot >= first) {
+        return heights_prefix(m, slot) - heights_prefix(m, first);
+    }
+
+    // Wrapped round the end of the ring.
+    return heights_prefix(m, m->size) - heights_prefix(m, first) + heights_prefix(m, slot);
+}
+
+/* First message whose bottom is below y, or first + number if there's none. */
+static uint32_t messages_find(const MESSAGES *m, uint32_t y) {
+    if (!m->data) {
+        return m->first + m->number;
+    }
+
+    uint32_t first = m->first & (m->size - 1), base = heights_prefix(m, first);
+    uint32_t tail  = heights_prefix(m, m->size) - base; // the messages from first to the end of the ring
+
+    uint32_t n;
+    if (y < tail) {
+        n = m->first + heights_search(m, y + base) - first;
+    } else {
+        n = m->first + (m->size - first) + heights_search(m, y - tail);
+    }
+
+    return (n - m->first < m->number) ? n : m->first + m->number;
+}
+
+static void message_updateheight(MESSAGES *m, uint32_t n) {
     if (m->width == 0) {
         return;
     }
 
     setfont(FONT_TEXT);
 
+    MSG_HEADER *msg    = MSG_AT(m, n);
+    uint32_t    height = msg->height;
+
     m->height   -= msg->height;
-    msg->height  = message_setheight(m, msg);
+    msg->height  = message_setheight(m, msg, false);
     m->height   += msg->height;
+
+    heights_add(m, n & (m->size - 1), msg->height - height);
 }
 
-static uint32_t message_add(MESSAGES *m, MSG_HEADER *msg) {
-    pthread_mutex_lock(&messages_lock);
+MSG_HEADER *message_get(const MESSAGES *m, uint32_t n) {
+    if (!m->data || n - m->first >= m->number) {
+        return NULL;
+    }
 
-    if (m->number < UTOX_MAX_BACKLOG_MESSAGES) {
-        if (!m->data || m->extra <= 0) {
-            if (m->data) {
-                m->data = realloc(m->data, (m->number + 10) * sizeof(void *));
-                m->extra += 10;
-            } else {
-                m->number = 0;
-                m->data = calloc(20, sizeof(void *));
-                m->extra = 20;
-            }
+    return MSG_AT(m, n);
+}
 
-            if (!m->data) {
-                LOG_FATAL_ERR(EXIT_MALLOC, "Messages", "\n\n\nFATAL ERROR TRYING TO REALLOC FOR MESSAGES.\nTHIS IS A BUG, PLEASE REPORT!\n\n\n");
-            }
-        }
-        m->data[m->number++] = msg;
-        m->extra--;
-    } else {
-        m->height -= m->data[0]->height;
-        message_free(m->data[0]);
-        memmove(m->data, m->data + 1, (UTOX_MAX_BACKLOG_MESSAGES - 1) * sizeof(MSG_HEADER *));
-        m->data[UTOX_MAX_BACKLOG_MESSAGES - 1] = msg;
-
-        // Scroll selection up so that it stays over the same messages.
-        if (m->sel_start_msg != UINT32_MAX) {
-            if (0 < m->sel_start_msg) {
-                m->sel_start_msg--;
-            } else {
-                m->sel_start_position = 0;
-            }
-        }
+/* Doubles the ring, moving every message to where its number puts it in the new one. */
+static bool messages_grow(MESSAGES *m) {
+    uint32_t     size = m->size ? m->size * 2 : 32;
+    MSG_HEADER **data = calloc(size, sizeof(MSG_HEADER *) + sizeof(uint32_t));
+    if (!data) {
+        return false;
+    }
 
-        if (m->sel_end_msg != UINT32_MAX) {
-            if (0 < m->sel_end_msg) {
-                m->sel_end_msg--;
-            } else {
-                m->sel_end_position = 0;
-            }
-        }
+    for (uint32_t n = m->first; n != m->first + m->number; ++n) {
+        data[n & (size - 1)] = MSG_AT(m, n);
+    }
 
-        if (m->cursor_down_msg != UINT32_MAX) {
-            if (0 < m->cursor_down_msg) {
-                m->cursor_down_msg--;
-            } else {
-                m->cursor_down_position = 0;
-            }
-        }
-        if (m->cursor_over_msg != UINT32_MAX) {
-            if (0 < m->cursor_over_msg) {
-                m->cursor_over_msg--;
-            } else {
-                m->cursor_over_position = 0;
-            }
-        }
+    free(m->data);
+    m->data    = data;
+    m->heights = (uint32_t *)(data + size);
+    m->size    = size;
+
+    heights_rebuild(m);
+    return true;
+}
+
+static uint32_t message_add(MESSAGES *m, MSG_HEADER *msg) {
+    pthread_mutex_lock(&messages_lock);
+
+    if (!m->data) {
+        m->number = 0;
+        m->size   = 0;
+    }
+
+    if (m->number >= UTOX_MAX_BACKLOG_MESSAGES) {
+        /* Drop the oldest message. Anything still pointing at it is left with a number that's no longer in the
+         * backlog, and everything else keeps its number. */
+        MSG_HEADER *oldest = MSG_AT(m, m->first);
+        m->height -= oldest->height;
+        heights_add(m, m->first & (m->size - 1), -oldest->height);
+        m->estimates -= oldest->height_estimated;
+        message_free(oldest);
+        m->first++;
+        m->number--;
+    } else if (m->number == m->size && !messages_grow(m)) {
+        LOG_FATAL_ERR(EXIT_MALLOC, "Messages", "\n\n\nFATAL ERROR TRYING TO REALLOC FOR MESSAGES.\nTHIS IS A BUG, PLEASE REPORT!\n\n\n");
     }
 
-    message_updateheight(m, msg);
+    uint32_t n = m->first + m->number++;
+    MSG_AT(m, n) = msg;
+    heights_add(m, n & (m->size - 1), msg->height);
+
+    message_updateheight(m, n);
 
     if (m->is_groupchat) {
         const GROUPCHAT *groupchat = flist_get_sel_group();
@@ -291,8 +410,8 @@ uint32_t message_add_type_text(MESSAGES *m, bool auth, const char *msgtxt, uint1
         msg->via.txt.author_length = f->name_length;
     }
 
-    if (m->data && m->number) {
-        MSG_HEADER *day_msg = m->data[m->number ? m->number - 1 : 0];
+    const MSG_HEADER *day_msg = message_get(m, m->first + m->number - 1);
+    if (day_msg) {
         msg_add_day_notice(m, day_msg->time, msg->time);
     }
 
@@ -499,7 +618,10 @@ bool message_log_to_disk(MESSAGES *m, MSG_HEADER *msg) {
             memcpy(data + sizeof(header) + author_length, msg->via.txt.msg, msg->via.txt.length);
             strcpy2(data + length - 1, "\n");
 
-            msg->disk_offset = utox_save_chatlog(f->id_str, data, length);
+            msg->disk_offset = utox_save_chatlog(f->id_str, data, length, &msg->disk_generation);
+            if (msg->disk_offset != UTOX_CHATLOG_OFFSET_NONE) {
+                chatlog_search_add(f->id_str, msg->disk_offset, length, msg->via.txt.msg, msg->via.txt.length);
+            }
 
             free(data);
             return true;
@@ -548,7 +670,7 @@ bool messages_read_from_log(uint32_t friend_number) {
 }
 
 void messages_send_from_queue(MESSAGES *m, uint32_t friend_number) {
-    uint32_t start    = m->number;
+    uint32_t start    = m->first + m->number;
     uint8_t  seek_num = 3; /* this magic number is the number of messages we'll skip looking for the first unsent */
 
     pthread_mutex_lock(&messages_lock);
@@ -556,15 +678,15 @@ void messages_send_from_queue(MESSAGES *m, uint32_t friend_number) {
     int queue_count = 0;
     /* seek back to find first queued message
      * I hate this nest too, but it's readable */
-    while (start) {
+    while (start != m->first) {
         --start;
 
         if (++queue_count > 25) {
             break;
         }
 
-        if (m->data[start]) {
-            MSG_HEADER *msg = m->data[start];
+        if (MSG_AT(m, start)) {
+            MSG_HEADER *msg = MSG_AT(m, start);
             if (msg->msg_type == MSG_TYPE_TEXT || msg->msg_type == MSG_TYPE_ACTION_TEXT) {
                 if (msg->our_msg) {
                     if (msg->receipt_time) {
@@ -579,9 +701,9 @@ void messages_send_from_queue(MESSAGES *m, uint32_t friend_number) {
 
     int sent_count = 0;
     /* start sending messages, hopefully in order */
-    while (start < m->number && sent_count <= 25) {
-        if (m->data[start]) {
-            MSG_HEADER *msg = m->data[start];
+    while (start != m->first + m->number && sent_count <= 25) {
+        if (MSG_AT(m, start)) {
+            MSG_HEADER *msg = MSG_AT(m, start);
             if (msg->msg_type == MSG_TYPE_TEXT || msg->msg_type == MSG_TYPE_ACTION_TEXT) {
                 if (msg->our_msg && !msg->receipt_time) {
                     postmessage_toxcore((msg->msg_type == MSG_TYPE_TEXT ? TOX_SEND_MESSAGE : TOX_SEND_ACTION),
@@ -598,13 +720,13 @@ void messages_send_from_queue(MESSAGES *m, uint32_t friend_number) {
 void messages_clear_receipt(MESSAGES *m, uint32_t receipt_number) {
     pthread_mutex_lock(&messages_lock);
 
-    uint32_t start = m->number;
-    while (start--) {
-        if (!m->data[start]) {
+    uint32_t start = m->first + m->number;
+    while (start-- != m->first) {
+        if (!MSG_AT(m, start)) {
             continue;
         }
 
-        MSG_HEADER *msg = m->data[start];
+        MSG_HEADER *msg = MSG_AT(m, start);
         if (msg->msg_type != MSG_TYPE_TEXT &&
             msg->msg_type != MSG_TYPE_ACTION_TEXT) {
             continue;
@@ -638,13 +760,13 @@ void messages_clear_receipt(MESSAGES *m, uint32_t receipt_number) {
         char *hex = get_friend(m->id)->id_str;
         if (msg->disk_offset) {
             LOG_TRACE("Messages", "Updating message -> disk_offset is %lu" , msg->disk_offset);
-            utox_update_chatlog(hex, msg->disk_offset, data, length);
-        } else if (msg->disk_offset == 0 && start <= 1 && receipt_number == 1) {
+            utox_update_chatlog(hex, msg->disk_offset, msg->disk_generation, data, length);
+        } else if (msg->disk_offset == 0 && start - m->first <= 1 && receipt_number == 1) {
             /* This could get messy if receipt is 1, msg position is 0, and the offset is actually wrong,
              * But I couldn't come up with any other way to verify the rare case of a bad offset
              * start <= 1 to offset for the day change notification                                    */
             LOG_TRACE("Messages", "Updating first message -> disk_offset is %lu" , msg->disk_offset);
-            utox_update_chatlog(hex, msg->disk_offset, data, length);
+            utox_update_chatlog(hex, msg->disk_offset, msg->disk_generation, data, length);
         } else {
             LOG_ERR("Messages",
                     "Messages:\tUnable to update this message...\n"
@@ -1053,6 +1175,36 @@ static int messages_time_change(MESSAGES *m, MSG_HEADER *msg, size_t index, int
                               h1, h2, x + SCALE(MESSAGES_X), y, width - get_time_width() - SCALE(MESSAGES_X), height);
 }
 
+/* Lays out a batch of the messages that only have estimated heights, newest first. Returns true if there are more
+ * left to do. */
+static bool messages_refine(MESSAGES *m) {
+    if (!m->width) {
+        return false;
+    }
+
+    /* Never more than one pass over the backlog, in case the count's gone out of step with the messages. */
+    uint32_t visited = 0;
+    for (uint32_t done = 0; m->estimates && done < MESSAGES_REFINE_BATCH && visited < m->number; ++visited) {
+        if (m->refine_next - m->first >= m->number) {
+            m->refine_next = m->first + m->number - 1;
+        }
+
+        uint32_t n = m->refine_next--;
+        if (MSG_AT(m, n)->height_estimated) {
+            message_updateheight(m, n);
+            done++;
+        }
+    }
+
+    if (visited == m->number && m->estimates) {
+        /* Went over every message, so whatever the count still says is left isn't there. */
+        LOG_WARN("Messages", "Lost track of the estimated heights, %u left over.", m->estimates);
+        m->estimates = 0;
+    }
+
+    return m->estimates;
+}
+
 /** Formats all messages from self and friends, and then call draw functions
  * to write them to the UI.
  *
@@ -1069,19 +1221,36 @@ void messages_draw(PANEL *panel, int x, int y, int width, int height) {
     // Do not draw author name next to every message
     uint8_t lastauthor = 0xFF;
 
-    // Message iterator
-    MSG_HEADER **p = m->data;
-    uint32_t n = m->number;
-
     if (m->width != width) {
         m->width = width;
         messages_updateheight(m, width - SCALE(MESSAGES_X) + get_time_width());
         y -= scroll_gety(panel->content_scroll, height);
     }
 
+    // Work through the estimates from the last resize a batch at a time, and fix the scroll height as they land
+    if (m->estimates) {
+        if (messages_refine(m)) {
+            postmessage_utox(FRIEND_MESSAGE_UPDATE, 0, 0, NULL);
+        }
+        panel->content_scroll->content_height = m->height;
+    }
+
+    // Skip straight to the first message that reaches into the window
+    uint32_t curr_msg_i = m->first;
+    if (y < SCALE(MAIN_TOP)) {
+        curr_msg_i = messages_find(m, SCALE(MAIN_TOP) - y);
+        y += messages_height_before(m, curr_msg_i);
+    }
+
     // Go through messages
-    for (size_t curr_msg_i = 0; curr_msg_i != n; curr_msg_i++) {
-        MSG_HEADER *msg = *p++;
+    for (; curr_msg_i != m->first + m->number; curr_msg_i++) {
+        MSG_HEADER *msg = MSG_AT(m, curr_msg_i);
+
+        if (msg->height_estimated) {
+            // Estimates are fine off screen, but this one might be about to be drawn.
+            message_updateheight(m, curr_msg_i);
+            panel->content_scroll->content_height = m->height;
+        }
 
         /* Decide if we should even bother drawing this message. */
         if (msg->height == 0) {
@@ -1298,9 +1467,10 @@ bool messages_mmove(PANEL *panel, int UNUSED(px), int UNUSED(py), int width, int
 
     m->cursor_over_time = inrect(mx, my, width - get_time_width(), 0, get_time_width(), m->height);
 
-    if (m->cursor_down_msg < m->number) {
+    MSG_HEADER *down_msg = message_get(m, m->cursor_down_msg);
+    if (down_msg) {
         uint32_t maxwidth = width - SCALE(MESSAGES_X) - get_time_width();
-        MSG_HEADER *msg = m->data[m->cursor_down_msg];
+        MSG_HEADER *msg = down_msg;
         if ((msg->msg_type == MSG_TYPE_IMAGE) && (msg->via.img.w > maxwidth)) {
             msg->via.img.position -= (double)dx / (double)(msg->via.img.w - maxwidth);
             if (msg->via.img.position > 1.0) {
@@ -1323,12 +1493,13 @@ bool messages_mmove(PANEL *panel, int UNUSED(px), int UNUSED(py), int width, int
 
     setfont(FONT_TEXT);
 
-    MSG_HEADER **p = m->data;
-    uint32_t i = 0;
+    // Find the message under the mouse
+    uint32_t i = messages_find(m, my);
     bool     need_redraw = false;
 
-    while (i < m->number) {
-        MSG_HEADER *msg = *p++;
+    if (i != m->first + m->number) {
+        MSG_HEADER *msg = MSG_AT(m, i);
+        my -= messages_height_before(m, i);
 
         int dy = msg->height; /* dy is the wrong name here, you should change it! */
 
@@ -1376,7 +1547,7 @@ bool messages_mmove(PANEL *panel, int UNUSED(px), int UNUSED(py), int width, int
             }
 
             if (i != m->cursor_over_msg && m->cursor_over_msg != UINT32_MAX
-                && (msg->msg_type == MSG_TYPE_FILE || m->data[m->cursor_over_msg]->msg_type == MSG_TYPE_FILE)) {
+                && (msg->msg_type == MSG_TYPE_FILE || MSG_AT(m, m->cursor_over_msg)->msg_type == MSG_TYPE_FILE)) {
                 need_redraw = true; // Redraw file on hover-in/out.
             }
 
@@ -1404,10 +1575,6 @@ bool messages_mmove(PANEL *panel, int UNUSED(px), int UNUSED(py), int width, int
 
             return need_redraw;
         }
-
-        my -= dy;
-
-        i++;
     }
 
     return false;
@@ -1417,8 +1584,8 @@ bool messages_mdown(PANEL *panel) {
     MESSAGES *m        = panel->object;
     m->cursor_down_msg = UINT32_MAX;
 
-    if (m->cursor_over_msg != UINT32_MAX) {
-        MSG_HEADER *msg = m->data[m->cursor_over_msg];
+    MSG_HEADER *msg = message_get(m, m->cursor_over_msg);
+    if (msg) {
         switch (msg->msg_type) {
             case MSG_TYPE_NULL: {
                 LOG_ERR("Messages", "Invalid message type in messages_mdown.");
@@ -1443,7 +1610,7 @@ bool messages_mdown(PANEL *panel) {
                 if (m->cursor_over_position) {
                     if (!msg->via.img.zoom) {
                         msg->via.img.zoom = 1;
-                        message_updateheight(m, msg);
+                        message_updateheight(m, m->cursor_over_msg);
                     } else {
                         m->cursor_down_msg = m->cursor_over_msg;
                     }
@@ -1460,9 +1627,9 @@ bool messages_mdown(PANEL *panel) {
                 FILE_TRANSFER *ft;
                 uint32_t ft_number = msg->via.ft.file_number;
                 if (ft_number >= (1 << 16)) {
-                    ft = &f->ft_incoming[(ft_number >> 16) - 1]; // TODO, abstraction needed
+                    ft = ft_table_get(&f->ft_incoming, (ft_number >> 16) - 1); // TODO, abstraction needed
                 } else {
-                    ft = &f->ft_outgoing[ft_number]; // TODO, abstraction needed
+                    ft = ft_table_get(&f->ft_outgoing, ft_number); // TODO, abstraction needed
                 }
 
                 if (msg->via.ft.file_status == FILE_TRANSFER_STATUS_COMPLETED) {
@@ -1477,19 +1644,26 @@ bool messages_mdown(PANEL *panel) {
                     return true;
                 }
 
+                /* The transfer's already done with, there's nothing left to control. */
+                if (!ft) {
+                    return true;
+                }
+
+                /* Only the friend and file number go to toxcore, the transfer's looked up again there. */
                 if (m->cursor_over_position == 2) { // Right button, should be accept/pause/resume
                     if (!msg->our_msg && msg->via.ft.file_status == FILE_TRANSFER_STATUS_NONE) {
-                        native_select_dir_ft(m->id, msg->via.ft.file_number, ft);
+                        native_select_dir_ft(m->id, msg->via.ft.file_number, msg->via.ft.name,
+                                             msg->via.ft.name_length);
                         return true;
                     }
 
                     if (msg->via.ft.file_status == FILE_TRANSFER_STATUS_ACTIVE) {
-                        postmessage_toxcore(TOX_FILE_PAUSE, m->id, msg->via.ft.file_number, ft);
+                        postmessage_toxcore(TOX_FILE_PAUSE, m->id, msg->via.ft.file_number, NULL);
                     } else {
-                        postmessage_toxcore(TOX_FILE_RESUME, m->id, msg->via.ft.file_number, ft);
+                        postmessage_toxcore(TOX_FILE_RESUME, m->id, msg->via.ft.file_number, NULL);
                     }
                 } else if (m->cursor_over_position == 1) { // Should be cancel
-                    postmessage_toxcore(TOX_FILE_CANCEL, m->id, msg->via.ft.file_number, ft);
+                    postmessage_toxcore(TOX_FILE_CANCEL, m->id, msg->via.ft.file_number, NULL);
                 }
 
                 return true;
@@ -1517,11 +1691,10 @@ bool messages_dclick(PANEL *panel, bool triclick) {
         return true;
     }
 
-    if (m->cursor_over_msg == UINT32_MAX) {
+    MSG_HEADER *msg = message_get(m, m->cursor_over_msg);
+    if (!msg) {
         return false;
     }
-
-    MSG_HEADER *msg = m->data[m->cursor_over_msg];
     switch (msg->msg_type) {
         case MSG_TYPE_NULL: {
             LOG_ERR("Messages", "Invalid message type in messages_dclick.");
@@ -1563,7 +1736,7 @@ bool messages_dclick(PANEL *panel, bool triclick) {
             if (m->cursor_over_position) {
                 if (msg->via.img.zoom) {
                     msg->via.img.zoom = 0;
-                    message_updateheight(m, msg);
+                    message_updateheight(m, m->cursor_over_msg);
                 }
             }
 
@@ -1581,12 +1754,11 @@ static void contextmenu_messages_onselect(uint8_t i) {
 bool messages_mright(PANEL *panel) {
     const MESSAGES *m = panel->object;
 
-    if (m->cursor_over_msg == UINT32_MAX) {
+    const MSG_HEADER *msg = message_get(m, m->cursor_over_msg);
+    if (!msg) {
         return false;
     }
 
-    const MSG_HEADER *msg = m->data[m->cursor_over_msg];
-
     switch (msg->msg_type) {
         case MSG_TYPE_NULL: {
             LOG_ERR("Messages", "Invalid message type in messages_mdown.");
@@ -1622,8 +1794,8 @@ bool messages_mup(PANEL *panel) {
         return false;
     }
 
-    if (m->cursor_over_msg != UINT32_MAX) {
-        MSG_HEADER *msg = m->data[m->cursor_over_msg];
+    MSG_HEADER *msg = message_get(m, m->cursor_over_msg);
+    if (msg) {
         if (msg->msg_type == MSG_TYPE_TEXT) {
             if (m->cursor_over_uri != UINT32_MAX
                 && m->cursor_down_uri == m->cursor_over_uri
@@ -1669,15 +1841,24 @@ int messages_selection(PANEL *panel, char *buffer, uint32_t len, bool names) {
         return 0;
     }
 
-    uint32_t i = m->sel_start_msg, n = m->sel_end_msg + 1;
-    MSG_HEADER **dp = &m->data[i];
+    /* Messages dropped from the backlog leave the selection starting at the oldest one still there. */
+    uint32_t start = m->sel_start_msg, start_position = m->sel_start_position;
+    if (start < m->first) {
+        start          = m->first;
+        start_position = 0;
+    }
+
+    uint32_t i = start, n = m->sel_end_msg + 1;
 
     char *p = buffer;
 
     while (i != UINT32_MAX && i != n) {
-        const MSG_HEADER *msg = *dp++;
+        const MSG_HEADER *msg = message_get(m, i);
+        if (!msg) {
+            break;
+        }
 
-        if (names && (i != m->sel_start_msg || m->sel_start_position == 0)) {
+        if (names && (i != start || start_position == 0)) {
             if (m->is_groupchat) {
                 memcpy(p, msg->via.grp.author, msg->via.grp.author_length);
                 p += msg->via.grp.author_length;
@@ -1723,13 +1904,13 @@ int messages_selection(PANEL *panel, char *buffer, uint32_t len, bool names) {
             case MSG_TYPE_ACTION_TEXT: {
                 char *data;
                 uint16_t length;
-                if (i == m->sel_start_msg) {
+                if (i == start) {
                     if (i == m->sel_end_msg) {
-                        data   = msg->via.txt.msg + m->sel_start_position;
-                        length = m->sel_end_position - m->sel_start_position;
+                        data   = msg->via.txt.msg + start_position;
+                        length = m->sel_end_position - start_position;
                     } else {
-                        data   = msg->via.txt.msg + m->sel_start_position;
-                        length = msg->via.txt.length - m->sel_start_position;
+                        data   = msg->via.txt.msg + start_position;
+                        length = msg->via.txt.length - start_position;
                     }
                 } else if (i == m->sel_end_msg) {
                     data   = msg->via.txt.msg;
@@ -1790,9 +1971,11 @@ void messages_updateheight(MESSAGES *m, int width) {
     setfont(FONT_TEXT);
 
     uint32_t height = 0;
-    for (uint32_t i = 0; i < m->number; ++i) {
-        height += message_setheight(m, (void *)m->data[i]);
+    // Only lays out the messages that need it on the next draw, the rest get estimates for messages_refine()
+    for (uint32_t i = m->first; i != m->first + m->number; ++i) {
+        height += message_setheight(m, MSG_AT(m, i), true);
     }
+    heights_rebuild(m);
     m->panel.content_scroll->content_height = m->height = height;
 }
 
@@ -1853,10 +2036,8 @@ void messages_init(MESSAGES *m, uint32_t friend_number) {
 
     memset(m, 0, sizeof(*m));
 
-    m->id    = friend_number;
-    m->extra = 20;
-    m->data  = calloc(20, sizeof(void *));
-    if (!m->data) {
+    m->id = friend_number;
+    if (!messages_grow(m)) {
         LOG_FATAL_ERR(EXIT_MALLOC, "Messages", "\n\n\nFATAL ERROR TRYING TO CALLOC FOR MESSAGES.\nTHIS IS A BUG, PLEASE REPORT!\n\n\n");
     }
 
@@ -1864,6 +2045,12 @@ void messages_init(MESSAGES *m, uint32_t friend_number) {
 }
 
 void message_free(MSG_HEADER *msg) {
+    if (msg->log_map) {
+        // Both the text and the header itself belong to the mapped chatlog.
+        utox_chatlog_map_release(msg->log_map);
+        return;
+    }
+
     // The group messages are free()d in groups.c (group_free(GROUPCHAT *g))
     switch (msg->msg_type) {
         case MSG_TYPE_NULL: {
@@ -1910,15 +2097,20 @@ void message_free(MSG_HEADER *msg) {
 void messages_clear_all(MESSAGES *m) {
     pthread_mutex_lock(&messages_lock);
 
-    for (uint32_t i = 0; i < m->number; i++) {
-        message_free(m->data[i]);
+    for (uint32_t i = m->first; i != m->first + m->number; i++) {
+        message_free(MSG_AT(m, i));
     }
 
     free(m->data);
-    m->data   = NULL;
-    m->number = 0;
-    m->extra  = 0;
-    m->height = 0;
+    m->data    = NULL;
+    m->heights = NULL;
+    m->first   = 0;
+    m->number  = 0;
+    m->size    = 0;
+    m->height  = 0;
+
+    m->estimates   = 0;
+    m->refine_next = 0;
 
     m->sel_start_msg = m->sel_end_msg = m->sel_start_position = m->sel_end_position = 0;
 
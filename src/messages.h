@@ -83,12 +83,23 @@ typedef struct msg_header {
     uint32_t height;
     time_t   time;
 
+    /* The last time a text message was laid out: how many lines it took, and the range of text widths that would
+     * give the same lines. Saves laying it out again on every resize. */
+    uint16_t layout_lines, layout_low, layout_high;
+    uint16_t layout_font; // which fonts it was laid out with, see messages_fonts_changed()
+    // The height is only a guess from the last layout, to be laid out properly when it's in view.
+    bool     height_estimated;
+
 
     uint64_t disk_offset;
+    uint32_t disk_generation; // see utox_save_chatlog()
 
     uint32_t receipt;
     time_t   receipt_time;
 
+    // Set if this message was loaded from a mapped chatlog, see utox_load_chatlog().
+    struct chatlog_map *log_map;
+
     union {
         MSG_TEXT txt;
         MSG_TEXT action;
@@ -127,18 +138,28 @@ typedef struct messages {
     bool selecting_text;
     bool cursor_over_time;
 
-    // Number of messages in data array.
-    uint32_t number;
-    // Number of extra to speedup realloc.
-    int8_t extra;
+    /* Messages are numbered in the order they're added, and keep their number for as long as they're in the
+     * backlog, so the cursor and selection above don't move when old messages are dropped. The backlog holds
+     * messages first up to first + number. */
+    uint32_t first, number;
 
-    // Pointers at various message structs, at most MAX_BACKLOG_MESSAGES.
+    // Ring of pointers at message structs, at most MAX_BACKLOG_MESSAGES. Message n is at data[n & (size - 1)].
     MSG_HEADER **data;
+    uint32_t     size; // always a power of two
+
+    // Running totals of message heights, to find what's at a given height. Shares data's allocation.
+    uint32_t *heights;
+
+    // How many messages have an estimated height, and where to carry on laying them out from.
+    uint32_t estimates, refine_next;
 
     // Field for preserving position of text scroll
     double scroll;
 } MESSAGES;
 
+/* Returns message n, or NULL if it isn't in the backlog. */
+MSG_HEADER *message_get(const MESSAGES *m, uint32_t n);
+
 uint32_t message_add_group(MESSAGES *m, MSG_HEADER *msg);
 
 uint32_t message_add_type_text(MESSAGES *m, bool auth, const char *msgtxt, uint16_t length, bool log, bool send);
@@ -178,6 +199,9 @@ int messages_selection(PANEL *panel, char *buffer, uint32_t len, bool names);
 
 void messages_updateheight(MESSAGES *m, int width);
 
+/* Throws away every message's cached layout. Call when the fonts change. */
+void messages_fonts_changed(void);
+
 
 void messages_init(MESSAGES *m, uint32_t friend_number);
 void message_free(MSG_HEADER *msg);
@@ -0,0 +1,276 @@
+#include "msg_queue.h"
+
+#include "debug.h"
+
+#include "native/thread.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#if !(defined __WIN32__ || defined _WIN32 || defined __CYGWIN__)
+#define MSG_QUEUE_HAVE_FD
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+
+/* Cells start out zeroed, so sequences count from the start of the lap the cell is on rather than from its own
+ * position. A cell is free for the push at pos when its sequence is lap, filled when it's lap + 1, and freed again
+ * for the next lap by setting it to lap + MSG_QUEUE_SIZE. */
+#define MSG_QUEUE_LAP(pos) ((pos) & ~(size_t)(MSG_QUEUE_SIZE - 1))
+
+static uint64_t msg_queue_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 * 1000 + now.tv_nsec / 1000;
+}
+
+static unsigned msg_queue_bucket(uint64_t us) {
+    unsigned bucket = 0;
+    while (us && bucket < MSG_QUEUE_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void msg_queue_signal(MSG_QUEUE *queue) {
+#ifdef MSG_QUEUE_HAVE_FD
+    if (atomic_load_explicit(&queue->have_fd, memory_order_acquire)) {
+        /* A full pipe is already readable, so there's nothing to do if this fails. */
+        uint64_t one = 1;
+        if (write(queue->fd[1], &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            LOG_WARN("Msg Queue", "Unable to write to the wake fd: %s", strerror(errno));
+        }
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&queue->lock);
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+bool msg_queue_push(MSG_QUEUE *queue, uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    while (1) {
+        size_t    lap  = MSG_QUEUE_LAP(pos);
+        size_t    seq  = atomic_load_explicit(&queue->cells[pos % MSG_QUEUE_SIZE].sequence, memory_order_acquire);
+
+        if (seq == lap) {
+            /* The cell's free, try to claim it. On failure pos is reloaded and we go again. */
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (seq < lap) {
+            /* Still holds a message from the last lap, the worker hasn't caught up. */
+            return false;
+        } else {
+            /* Somebody else pushed here first. */
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    TOX_MSG *cell = &queue->cells[pos % MSG_QUEUE_SIZE].msg;
+    cell->msg    = msg;
+    cell->param1 = param1;
+    cell->param2 = param2;
+    cell->data   = data;
+    queue->cells[pos % MSG_QUEUE_SIZE].pushed = msg_queue_now();
+    atomic_store_explicit(&queue->cells[pos % MSG_QUEUE_SIZE].sequence, MSG_QUEUE_LAP(pos) + 1,
+                          memory_order_release);
+
+    /* Pairs with the store to waiting in msg_queue_wait(), one of us is bound to see the other. Only the push that
+     * clears waiting has to signal, anything pushed after it will be found anyway. */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->waiting, memory_order_relaxed)
+        && atomic_exchange_explicit(&queue->waiting, false, memory_order_acq_rel)) {
+        msg_queue_signal(queue);
+    }
+
+    return true;
+}
+
+void msg_queue_post(MSG_QUEUE *queue, const bool *running, uint8_t msg, uint32_t param1, uint32_t param2,
+                    void *data)
+{
+    while (!msg_queue_push(queue, msg, param1, param2, data)) {
+        if (running && !*running) {
+            LOG_WARN("Msg Queue", "Queue is full and its thread isn't running, dropping message %u.", msg);
+            return;
+        }
+        yieldcpu(1);
+    }
+}
+
+static bool msg_queue_ready(MSG_QUEUE *queue) {
+    size_t seq = atomic_load_explicit(&queue->cells[queue->tail % MSG_QUEUE_SIZE].sequence, memory_order_acquire);
+    return seq == MSG_QUEUE_LAP(queue->tail) + 1;
+}
+
+bool msg_queue_pop(MSG_QUEUE *queue, TOX_MSG *msg) {
+    if (!msg_queue_ready(queue)) {
+        return false;
+    }
+
+    size_t pos = queue->tail++;
+    *msg = queue->cells[pos % MSG_QUEUE_SIZE].msg;
+
+    uint64_t now = msg_queue_now(), pushed = queue->cells[pos % MSG_QUEUE_SIZE].pushed;
+    queue->stats.latency[msg_queue_bucket(now > pushed ? now - pushed : 0)]++;
+
+    atomic_store_explicit(&queue->cells[pos % MSG_QUEUE_SIZE].sequence, MSG_QUEUE_LAP(pos) + MSG_QUEUE_SIZE,
+                          memory_order_release);
+
+    return true;
+}
+
+static void msg_queue_count_wait(MSG_QUEUE *queue, uint64_t deadline) {
+    if (msg_queue_ready(queue)) {
+        queue->stats.wakeups++;
+        return;
+    }
+
+    uint64_t now = msg_queue_now();
+    queue->stats.timeouts++;
+    queue->stats.oversleep[msg_queue_bucket(now > deadline ? now - deadline : 0)]++;
+}
+
+#ifdef MSG_QUEUE_HAVE_FD
+static void msg_queue_wait_fd(MSG_QUEUE *queue, uint64_t deadline) {
+    atomic_store_explicit(&queue->waiting, true, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint64_t now;
+    while (!msg_queue_ready(queue) && (now = msg_queue_now()) < deadline) {
+        /* Round up, so we don't wake just short of the deadline and spin. */
+        struct pollfd fd = { .fd = queue->fd[0], .events = POLLIN };
+        int ready = poll(&fd, 1, (deadline - now + 999) / 1000);
+        if (ready < 0 && errno != EINTR) {
+            LOG_ERR("Msg Queue", "Unable to poll the wake fd: %s", strerror(errno));
+            break;
+        }
+
+        if (ready > 0) {
+            uint64_t count[8];
+            while (read(queue->fd[0], count, sizeof(count)) > 0) {
+                continue;
+            }
+        }
+    }
+
+    atomic_store_explicit(&queue->waiting, false, memory_order_relaxed);
+}
+#endif
+
+void msg_queue_wait(MSG_QUEUE *queue, uint32_t ms) {
+    uint64_t until = msg_queue_now() + (uint64_t)ms * 1000;
+
+#ifdef MSG_QUEUE_HAVE_FD
+    if (atomic_load_explicit(&queue->have_fd, memory_order_relaxed)) {
+        msg_queue_wait_fd(queue, until);
+        msg_queue_count_wait(queue, until);
+        return;
+    }
+#endif
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    atomic_store_explicit(&queue->waiting, true, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (!msg_queue_ready(queue)) {
+        if (pthread_cond_timedwait(&queue->wake, &queue->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    atomic_store_explicit(&queue->waiting, false, memory_order_relaxed);
+    pthread_mutex_unlock(&queue->lock);
+
+    msg_queue_count_wait(queue, until);
+}
+
+bool msg_queue_open_fd(MSG_QUEUE *queue) {
+#ifdef MSG_QUEUE_HAVE_FD
+    if (atomic_load_explicit(&queue->have_fd, memory_order_relaxed)) {
+        return true;
+    }
+
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd >= 0) {
+        queue->fd[0] = queue->fd[1] = fd;
+        atomic_store_explicit(&queue->have_fd, true, memory_order_release);
+        return true;
+    }
+    LOG_WARN("Msg Queue", "Unable to create an eventfd, trying a pipe: %s", strerror(errno));
+#endif
+
+    if (pipe(queue->fd)) {
+        LOG_ERR("Msg Queue", "Unable to create a wake pipe: %s", strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        fcntl(queue->fd[i], F_SETFL, fcntl(queue->fd[i], F_GETFL) | O_NONBLOCK);
+        fcntl(queue->fd[i], F_SETFD, FD_CLOEXEC);
+    }
+    atomic_store_explicit(&queue->have_fd, true, memory_order_release);
+    return true;
+#else
+    (void)queue;
+    return false;
+#endif
+}
+
+/* Upper bound of the bucket the given share of the histogram falls in, in microseconds. */
+static uint64_t msg_queue_percentile(const uint64_t histogram[MSG_QUEUE_BUCKETS], uint64_t total, unsigned percent) {
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < MSG_QUEUE_BUCKETS; ++i) {
+        seen += histogram[i];
+        if (seen * 100 >= total * percent) {
+            return (uint64_t)1 << i;
+        }
+    }
+    return (uint64_t)1 << (MSG_QUEUE_BUCKETS - 1);
+}
+
+void msg_queue_log_stats(const MSG_QUEUE *queue, const char *name) {
+    const MSG_QUEUE_STATS *stats = &queue->stats;
+
+    uint64_t popped = 0;
+    for (unsigned i = 0; i < MSG_QUEUE_BUCKETS; ++i) {
+        popped += stats->latency[i];
+    }
+
+    LOG_INFO("Msg Queue", "%s: %lu messages, %lu wakeups by push, %lu by deadline", name, (unsigned long)popped,
+             (unsigned long)stats->wakeups, (unsigned long)stats->timeouts);
+
+    if (popped) {
+        LOG_INFO("Msg Queue", "%s: push to pop latency p50 < %luus, p90 < %luus, p99 < %luus", name,
+                 (unsigned long)msg_queue_percentile(stats->latency, popped, 50),
+                 (unsigned long)msg_queue_percentile(stats->latency, popped, 90),
+                 (unsigned long)msg_queue_percentile(stats->latency, popped, 99));
+    }
+
+    if (stats->timeouts) {
+        LOG_INFO("Msg Queue", "%s: oversleep past deadline p50 < %luus, p90 < %luus, p99 < %luus", name,
+                 (unsigned long)msg_queue_percentile(stats->oversleep, stats->timeouts, 50),
+                 (unsigned long)msg_queue_percentile(stats->oversleep, stats->timeouts, 90),
+                 (unsigned long)msg_queue_percentile(stats->oversleep, stats->timeouts, 99));
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef MSG_QUEUE_H
+#define MSG_QUEUE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint8_t  msg;
+    uint32_t param1, param2;
+    void *   data;
+} TOX_MSG;
+
+#define MSG_QUEUE_SIZE 256 // must be a power of two
+
+/* Histogram buckets, bucket 0 counts anything under a microsecond and bucket n anything from 2^(n-1) up to 2^n
+ * microseconds. The last bucket also takes everything longer. */
+#define MSG_QUEUE_BUCKETS 20
+
+/* Counters for how a worker's queue behaves, so changes to its loop can be measured. Only the worker writes them. */
+typedef struct {
+    uint64_t wakeups;  // waits cut short by a push
+    uint64_t timeouts; // waits that slept until their deadline
+
+    uint64_t latency[MSG_QUEUE_BUCKETS];   // from push to pop
+    uint64_t oversleep[MSG_QUEUE_BUCKETS]; // how late timed out waits returned
+} MSG_QUEUE_STATS;
+
+/* Bounded multi producer, single consumer queue of messages for a worker thread.
+ *
+ * Any thread can push without taking a lock, only the worker thread itself may pop. The worker sleeps in
+ * msg_queue_wait() instead of yieldcpu(), so a push wakes it straight away instead of waiting out the interval.
+ *
+ * Queues have to be initialised with MSG_QUEUE_INIT, but need no other setup or cleanup. A worker can also call
+ * msg_queue_open_fd() to be woken through an eventfd or pipe, instead of a condition variable. */
+typedef struct msg_queue {
+    struct {
+        /* Which lap around the ring the cell is on, and whether it's been filled on that lap. */
+        atomic_size_t sequence;
+        TOX_MSG       msg;
+        uint64_t      pushed; // microseconds, for the latency histogram
+    } cells[MSG_QUEUE_SIZE];
+
+    atomic_size_t head; // next cell to push to
+    size_t        tail; // next cell to pop from, only touched by the worker
+
+    atomic_bool     waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+    atomic_bool have_fd;
+    int  fd[2]; // read and write ends, the same eventfd on Linux
+
+    MSG_QUEUE_STATS stats;
+} MSG_QUEUE;
+
+#define MSG_QUEUE_INIT { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER }
+
+/* Returns false if the queue is full. */
+bool msg_queue_push(MSG_QUEUE *queue, uint8_t msg, uint32_t param1, uint32_t param2, void *data);
+
+/* Pushes a message, waiting for the worker to make room if the queue is full. If running is given, the message is
+ * dropped instead once it goes false, as nobody would ever make room. */
+void msg_queue_post(MSG_QUEUE *queue, const bool *running, uint8_t msg, uint32_t param1, uint32_t param2,
+                    void *data);
+
+/* Takes the oldest message off the queue. Returns false if it's empty. Worker thread only. */
+bool msg_queue_pop(MSG_QUEUE *queue, TOX_MSG *msg);
+
+/* Sleeps for up to ms milliseconds, returning early as soon as there's a message to pop. Worker thread only. */
+void msg_queue_wait(MSG_QUEUE *queue, uint32_t ms);
+
+/* Switches the queue over to waking its worker by writing to an eventfd, or a pipe where there are no eventfds, and
+ * sleeping in poll(). Returns false and keeps using the condition variable if that isn't possible. The fd stays open
+ * for as long as the process does. */
+bool msg_queue_open_fd(MSG_QUEUE *queue);
+
+/* Logs a summary of the queue's stats under name. */
+void msg_queue_log_stats(const MSG_QUEUE *queue, const char *name);
+
+#endif
@@ -31,7 +31,9 @@ bool native_save_image_png(const char *name, const uint8_t *image, const int ima
 
 typedef struct file_transfer FILE_TRANSFER;
 void native_autoselect_dir_ft(uint32_t fid, FILE_TRANSFER *file);
-void native_select_dir_ft(uint32_t fid, uint32_t num, FILE_TRANSFER *file);
+/* Asks where to save the incoming file, then accepts it. Only the name is used, the transfer itself is the toxcore
+ * thread's and may be gone by the time the user picks. */
+void native_select_dir_ft(uint32_t fid, uint32_t num, const char *name, size_t name_length);
 
 /**
  * @brief Get full path of the file in the Tox profile folder.
@@ -29,6 +29,13 @@ uint16_t native_video_detect(void);
 bool native_video_init(void *handle);
 void native_video_close(void *handle);
 int native_video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, uint16_t height);
+/**
+ * Waits up to timeout_ms for the device to have a frame ready for native_video_getframe()
+ *
+ * @return false if there's no way to wait on the device, the caller has to
+ *         poll native_video_getframe() instead
+ */
+bool native_video_wait(uint32_t timeout_ms);
 bool native_video_startread(void);
 bool native_video_endread(void);
 
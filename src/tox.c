@@ -1,9 +1,11 @@
 #include "tox.h"
 
 #include "avatar.h"
+#include "chatlog_search.h"
 #include "file_transfers.h"
 #include "flist.h"
 #include "friend.h"
+#include "ft_hash.h"
 #include "groups.h"
 #include "debug.h"
 #include "macros.h"
@@ -17,6 +19,7 @@
 #include "av/audio.h"
 #include "av/utox_av.h"
 #include "av/video.h"
+#include "av/video_send.h"
 
 #include "ui/edit.h"     // FIXME the toxcore thread shouldn't be interacting directly with the UI
 #include "ui/switch.h"   // FIXME the toxcore thread shouldn't be interacting directly with the UI
@@ -38,8 +41,7 @@
 
 UTOX_TOX_THREAD_INIT tox_thread_init;
 
-TOX_MSG       tox_msg, audio_msg, toxav_msg;
-volatile bool tox_thread_msg, audio_thread_msg, video_thread_msg;
+static MSG_QUEUE tox_queue = MSG_QUEUE_INIT;
 
 bool tox_connected;
 
@@ -62,21 +64,12 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
                                void *data);
 
 void postmessage_toxcore(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (tox_thread_msg) {
-        yieldcpu(1);
-    }
-
     if (!tox_thread_init) {
         /* Tox is not yet active, drop message (Probably a mistake) */
         return;
     }
 
-    tox_msg.msg    = msg;
-    tox_msg.param1 = param1;
-    tox_msg.param2 = param2;
-    tox_msg.data   = data;
-
-    tox_thread_msg = 1;
+    msg_queue_post(&tox_queue, NULL, msg, param1, param2, data);
 }
 
 static int utox_encrypt_data(void *clear_text, size_t clear_length, uint8_t *cypher_data) {
@@ -154,6 +147,8 @@ static void set_callbacks(Tox *tox) {
 }
 
 void tox_after_load(Tox *tox) {
+    chatlog_search_start();
+    ft_hash_start();
     utox_friend_list_init(tox);
     init_groups(tox);
 
@@ -445,6 +440,21 @@ static int init_toxcore(Tox **tox) {
 }
 
 
+/* Closes the files still waiting in the queue to be sent. */
+static void tox_thread_drop_files(void) {
+    TOX_MSG msg;
+    while (msg_queue_pop(&tox_queue, &msg)) {
+        const bool new_file = (msg.msg == TOX_FILE_SEND_NEW || msg.msg == TOX_FILE_SEND_NEW_SLASH) && !msg.param2;
+        if (new_file || msg.msg == TOX_FILE_SEND_HASHED) {
+            UTOX_MSG_FT *ft = msg.data;
+            LOG_INFO("Toxcore", "Dropping %s, it was never sent.", ft->name);
+            fclose(ft->file);
+            free(ft->name);
+            free(ft);
+        }
+    }
+}
+
 /** void toxcore_thread(void)
  *
  * Main tox function, starts a new toxcore for utox to use, and then spawns its
@@ -457,6 +467,9 @@ void *toxcore_thread(void *UNUSED(args)) {
     bool   reconfig         = 1;
     int    toxcore_init_err = 0;
 
+    /* Sleep on an eventfd rather than a condition variable where we can. */
+    msg_queue_open_fd(&tox_queue);
+
     while (reconfig) {
         reconfig = 0;
 
@@ -471,17 +484,15 @@ void *toxcore_thread(void *UNUSED(args)) {
             while (!reconfig) {
                 // Waiting for a message triggering the next reconfigure
                 // avoid trying the creation of thousands of tox instances before user changes the settings
-                if (tox_thread_msg) {
-                    TOX_MSG *msg = &tox_msg;
-
-                    if (msg->msg == TOX_KILL) {
-                        reconfig = (bool) msg->param1;
+                TOX_MSG msg;
+                if (msg_queue_pop(&tox_queue, &msg)) {
+                    if (msg.msg == TOX_KILL) {
+                        reconfig = (bool) msg.param1;
                         tox_thread_init = UTOX_TOX_THREAD_INIT_NONE;
                     }
                     // tox is not configured at this point ignore all other messages
-                    tox_thread_msg = 0;
                 } else {
-                    yieldcpu(300);
+                    msg_queue_wait(&tox_queue, 300);
                 }
             }
             continue;
@@ -490,7 +501,10 @@ void *toxcore_thread(void *UNUSED(args)) {
             yieldcpu(300);
             tox_thread_init = UTOX_TOX_THREAD_INIT_NONE;
             // ignore all messages in this stage
-            tox_thread_msg = 0;
+            TOX_MSG msg;
+            while (msg_queue_pop(&tox_queue, &msg)) {
+                continue;
+            }
             reconfig = 1;
             continue;
         } else {
@@ -543,19 +557,25 @@ void *toxcore_thread(void *UNUSED(args)) {
                 }
             }
 
-            // If there's a message, load it, and send to the tox message thread
-            if (tox_thread_msg) {
-                TOX_MSG *msg = &tox_msg;
+            // Work through everything that was posted since the last iteration
+            TOX_MSG msg;
+            bool    kill = false;
+            while (msg_queue_pop(&tox_queue, &msg)) {
+                if (msg.msg == TOX_KILL) {
+                    /* Stop the hasher while it can still post to us, so no file it hands back gets dropped. */
+                    ft_hash_stop();
 
-                if (msg->msg == TOX_KILL) {
-                    reconfig        = msg->param1; // reconfig if needed
-                    tox_thread_msg  = 0;
+                    reconfig        = msg.param1; // reconfig if needed
                     tox_thread_init = UTOX_TOX_THREAD_INIT_NONE;
+                    kill            = true;
                     break;
                 }
-                tox_thread_message(tox, av, time, msg->msg, msg->param1, msg->param2, msg->data);
-                tox_thread_msg = 0;
-                typing_state.sent = (msg->msg == TOX_SEND_MESSAGE || msg->msg == TOX_SEND_ACTION);
+                tox_thread_message(tox, av, time, msg.msg, msg.param1, msg.param2, msg.data);
+                typing_state.sent = (msg.msg == TOX_SEND_MESSAGE || msg.msg == TOX_SEND_ACTION);
+            }
+
+            if (kill) {
+                break;
             }
 
             if (!settings.no_typing_notifications) {
@@ -563,9 +583,15 @@ void *toxcore_thread(void *UNUSED(args)) {
                 utox_thread_work_for_typing_notifications(tox, time);
             }
 
-            /* Ask toxcore how many ms to wait, then wait at the most 20ms */
-            uint32_t interval = tox_iteration_interval(tox);
-            yieldcpu((interval > 20) ? 20 : interval);
+            /* Sleep until toxcore wants to iterate again, one of our own timers is due, or something is posted. */
+            uint64_t wake = time + (uint64_t)tox_iteration_interval(tox) * 1000 * 1000;
+            wake = MIN(wake, last_connection + (uint64_t)10 * 1000 * 1000 * 1000);
+            if (typing_state.sent_value && typing_state.time < UINT64_MAX - UTOX_TYPING_NOTIFICATION_TIMEOUT) {
+                wake = MIN(wake, typing_state.time + UTOX_TYPING_NOTIFICATION_TIMEOUT);
+            }
+
+            time = get_time();
+            msg_queue_wait(&tox_queue, (wake > time) ? (wake - time + 999999) / (1000 * 1000) : 0);
         }
 
         /* If for anyreason, we exit, write the save, and clear the password */
@@ -577,7 +603,14 @@ void *toxcore_thread(void *UNUSED(args)) {
             yieldcpu(1);
         }
         LOG_TRACE("Toxcore", "tox thread ending");
+        msg_queue_log_stats(&tox_queue, "Toxcore");
         tox_kill(tox);
+        chatlog_search_stop();
+
+        if (!reconfig) {
+            /* A new instance would have sent these, this time there isn't going to be one. */
+            tox_thread_drop_files();
+        }
     }
 
     tox_thread_init = UTOX_TOX_THREAD_INIT_NONE;
@@ -859,6 +892,9 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
             if (param2 == 0) {
                 // This is the new default. Where the caller sends an opened file.
                 UTOX_MSG_FT *msg = data;
+                if (ft_hash_queue(param1, msg)) {
+                    break;
+                }
                 ft_send_file(tox, param1, msg->file, msg->name, strlen((char*)msg->name), NULL);
                 free(msg->name);
                 free(msg);
@@ -868,6 +904,18 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
             break;
         }
 
+        case TOX_FILE_SEND_HASHED: {
+            /* param1: friend #
+             * param2: whether the file id was worked out
+             * data: the UTOX_MSG_FT from TOX_FILE_SEND_NEW, with the file id
+             */
+            UTOX_MSG_FT *msg = data;
+            ft_send_file(tox, param1, msg->file, msg->name, strlen((char *)msg->name), param2 ? msg->hash : NULL);
+            free(msg->name);
+            free(msg);
+            break;
+        }
+
         case TOX_FILE_SEND_NEW_INLINE: {
             /* param1: friend id
                data: pointer to a TOX_SEND_INLINE_MSG struct
@@ -896,26 +944,20 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
             break;
         }
 
+        /* param1: friend #
+         * param2: file #, as toxcore numbers it
+         * ft_local_control() looks the transfer up, and ignores it if it's gone. */
         case TOX_FILE_RESUME: {
-            if (data) {
-                param2 = ((FILE_TRANSFER*)data)->file_number;
-            }
             ft_local_control(tox, param1, param2, TOX_FILE_CONTROL_RESUME);
             break;
         }
 
         case TOX_FILE_PAUSE: {
-            if (data) {
-                param2 = ((FILE_TRANSFER*)data)->file_number;
-            }
             ft_local_control(tox, param1, param2, TOX_FILE_CONTROL_PAUSE);
             break;
         }
 
         case TOX_FILE_CANCEL: {
-            if (data) {
-                param2 = ((FILE_TRANSFER*)data)->file_number;
-            }
             ft_local_control(tox, param1, param2, TOX_FILE_CONTROL_CANCEL);
             break;
         }
@@ -1025,6 +1067,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
             LOG_TRACE("Toxcore", "Starting video for active call!" );
             utox_av_local_call_control(av, param1, TOXAV_CALL_CONTROL_SHOW_VIDEO);
             get_friend(param1)->call_state_self |= TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V;
+            video_send_update(param1);
             break;
         }
         case TOX_CALL_DISCONNECT: {
@@ -8,6 +8,8 @@ before the main thread receives the message for the old one?
 #ifndef UTOX_TOX_H
 #define UTOX_TOX_H
 
+#include "msg_queue.h"
+
 #include <tox/tox.h>
 
 #include <stdbool.h>
@@ -16,12 +18,6 @@ before the main thread receives the message for the old one?
 
 typedef uint8_t *UTOX_IMAGE;
 
-typedef struct {
-    uint8_t  msg;
-    uint32_t param1, param2;
-    void *   data;
-} TOX_MSG;
-
 typedef enum UTOX_ENC_ERR {
     UTOX_ENC_ERR_NONE,
     UTOX_ENC_ERR_LENGTH,
@@ -67,6 +63,7 @@ enum {
     TOX_FILE_SEND_NEW,
     TOX_FILE_SEND_NEW_INLINE,
     TOX_FILE_SEND_NEW_SLASH,
+    TOX_FILE_SEND_HASHED,
 
     TOX_FILE_RESUME,
     TOX_FILE_PAUSE,
@@ -119,10 +116,6 @@ typedef enum {
 
 extern UTOX_TOX_THREAD_INIT tox_thread_init;
 
-/* Inter-thread communication vars. */
-extern TOX_MSG       tox_msg, audio_msg, toxav_msg;
-extern volatile bool tox_thread_msg, audio_thread_msg, video_thread_msg;
-
 extern bool tox_connected;
 
 void tox_after_load(Tox *tox);
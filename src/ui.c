@@ -183,6 +183,7 @@ void ui_rescale(uint8_t scale) {
 
     flist_re_scale();
     setscale_fonts();
+    messages_fonts_changed();
     setfont(FONT_SELF_NAME);
 
     /* DEFAULT positions */
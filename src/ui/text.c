@@ -3,6 +3,7 @@
 #include "draw.h"
 #include "scrollable.h"
 
+#include "../macros.h"
 #include "../text.h"
 #include "../theme.h"
 
@@ -269,16 +270,35 @@ uint16_t hittextmultiline(int mx, int right, int my, int height, uint16_t linehe
 }
 
 int text_height(int right, uint16_t lineheight, char *str, uint16_t length) {
+    return text_height_range(right, lineheight, str, length, NULL, NULL);
+}
+
+int text_height_range(int right, uint16_t lineheight, char *str, uint16_t length, int *low, int *high) {
+    /* Every width check narrows down the range of rights that would have made the same decision. */
+    int lo = INT_MIN, hi = INT_MAX;
+
     int   x = 0, y = 0;
     char *a = str, *b = a, *end = a + length;
     while (1) {
         if (a == end || *a == ' ' || *a == '\n') {
             int count = a - b, w = textwidth(b, count);
             while (x + w > right) {
+                hi = MIN(hi, x + w);
                 if (x == 0) {
+                    // Where a word gets split depends on the exact width.
+                    lo = right;
+                    hi = right + 1;
+
                     int fit = textfit(b, count, right);
                     count -= fit;
                     if (fit == 0 && (count != 0 || *b == '\n')) {
+                        // Nothing fits at this width.
+                        if (low) {
+                            *low = lo;
+                        }
+                        if (high) {
+                            *high = hi;
+                        }
                         return 0;
                     }
                     b += fit;
@@ -292,6 +312,7 @@ int text_height(int right, uint16_t lineheight, char *str, uint16_t length) {
                 x = 0;
                 w = textwidth(b, count);
             }
+            lo = MAX(lo, x + w);
 
             x += w;
             b = a;
@@ -311,6 +332,13 @@ int text_height(int right, uint16_t lineheight, char *str, uint16_t length) {
 
     y += lineheight;
 
+    if (low) {
+        *low = lo;
+    }
+    if (high) {
+        *high = hi;
+    }
+
     return y;
 }
 
@@ -19,6 +19,10 @@ uint16_t hittextmultiline(int mx, int right, int my, int height, uint16_t linehe
 
 int text_height(int right, uint16_t lineheight, char *str, uint16_t length);
 
+/* Like text_height(), and also gives the range of rights, from low up to but not including high, that would break
+ * the text into the same lines. */
+int text_height_range(int right, uint16_t lineheight, char *str, uint16_t length, int *low, int *high);
+
 uint16_t text_lineup(int width, int height, uint16_t p, uint16_t lineheight, char *str, uint16_t length,
                      SCROLLABLE *scroll);
 uint16_t text_linedown(int width, int height, uint16_t p, uint16_t lineheight, char *str, uint16_t length,
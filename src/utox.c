@@ -585,8 +585,7 @@ void utox_message_dispatch(UTOX_MSG utox_msg_id, uint16_t param1, uint16_t param
             // TODO: Don't try to start a new video session every frame.
             video_begin(param1, s->str, s->length, frame->w, frame->h);
             video_frame(param1, frame->img, frame->w, frame->h, 0);
-            free(frame->img);
-            free(data);
+            frame_release(frame);
             redraw();
             break;
         }
@@ -638,7 +637,7 @@ void utox_message_dispatch(UTOX_MSG utox_msg_id, uint16_t param1, uint16_t param
                 g->last_recv_audio[param2]        = g->last_recv_audio[g->peer_count];
                 g->last_recv_audio[g->peer_count] = 0;
                 group_av_peer_remove(g, param2);
-                g->source[param2] = g->source[g->peer_count];
+                group_av_peer_move(g, g->peer_count, param2);
             }
 
             snprintf((char *)g->topic, sizeof(g->topic), "%u users in chat", g->peer_count);
@@ -108,14 +108,18 @@ void native_export_chatlog_init(uint32_t friend_number) {
     free(path);
 }
 
-void native_select_dir_ft(uint32_t fid, uint32_t num, FILE_TRANSFER *file) {
-    if (!sanitize_filename(file->name)) {
+void native_select_dir_ft(uint32_t fid, uint32_t num, const char *name, size_t name_length) {
+    char filename[UTOX_FILE_NAME_LENGTH] = { 0 };
+    name_length = MIN(name_length, sizeof(filename) - 1);
+    memcpy(filename, name, name_length);
+
+    if (!sanitize_filename((uint8_t *)filename)) {
         LOG_ERR("Windows", "Filename is invalid and could not be sanitized.");
         return;
     }
 
     wchar_t filepath[UTOX_FILE_NAME_LENGTH] = { 0 };
-    utf8_to_nativestr((char *)file->name, filepath, file->name_length * 2);
+    utf8_to_nativestr(filename, filepath, name_length * 2);
 
     OPENFILENAMEW ofn = {
         .lStructSize = sizeof(OPENFILENAMEW),
@@ -7,8 +7,6 @@
 
 #include "../av/video.h"
 
-#include "../native/time.h"
-
 #include "../../langs/i18n_decls.h"
 
 #include <windows.h>
@@ -559,25 +557,20 @@ int native_video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, ui
     }
 
     if (capturedesktop) {
-        static uint64_t lasttime;
-        uint64_t        t = get_time();
-        if (t - lasttime >= (uint64_t)1000 * 1000 * 1000 / 24) {
-            BITMAPINFO info = {.bmiHeader = {
-                                   .biSize        = sizeof(BITMAPINFOHEADER),
-                                   .biWidth       = video_width,
-                                   .biHeight      = -(int)video_height,
-                                   .biPlanes      = 1,
-                                   .biBitCount    = 24,
-                                   .biCompression = BI_RGB,
-                               } };
-
-            BitBlt(capturedc, 0, 0, video_width, video_height, desktopdc, video_x, video_y, SRCCOPY | CAPTUREBLT);
-            GetDIBits(capturedc, capturebitmap, 0, video_height, dibits, &info, DIB_RGB_COLORS);
-            bgrtoyuv420(y, u, v, dibits, video_width, video_height);
-            lasttime = t;
-            return 1;
-        }
-        return 0;
+        /* The video thread paces how often the desktop gets grabbed. */
+        BITMAPINFO info = {.bmiHeader = {
+                               .biSize        = sizeof(BITMAPINFOHEADER),
+                               .biWidth       = video_width,
+                               .biHeight      = -(int)video_height,
+                               .biPlanes      = 1,
+                               .biBitCount    = 24,
+                               .biCompression = BI_RGB,
+                           } };
+
+        BitBlt(capturedc, 0, 0, video_width, video_height, desktopdc, video_x, video_y, SRCCOPY | CAPTUREBLT);
+        GetDIBits(capturedc, capturebitmap, 0, video_height, dibits, &info, DIB_RGB_COLORS);
+        bgrtoyuv420(y, u, v, dibits, video_width, video_height);
+        return 1;
     }
 
     if (newframe) {
@@ -588,6 +581,11 @@ int native_video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, ui
     return 0;
 }
 
+bool native_video_wait(uint32_t UNUSED(timeout_ms)) {
+    /* The sample grabber just sets newframe, there's nothing to wait on. */
+    return false;
+}
+
 bool native_video_startread(void) {
     if (capturedesktop) {
         return 1;
@@ -95,7 +95,54 @@ void drawalpha(int bm, int x, int y, int width, int height, uint32_t color) {
     XRenderFreePicture(display, src);
 }
 
+#define TEXT_RUN_GLYPHS   256
+#define TEXT_RUN_ELEMENTS 16
+
+/* A run of text waiting to go to the server in one request. Each element is a stretch of glyphs from one glyph
+ * set, the first starts at the pen position and the rest carry on from where the one before left off. */
+typedef struct {
+    XGlyphElt32  elts[TEXT_RUN_ELEMENTS];
+    unsigned int glyphs[TEXT_RUN_GLYPHS];
+    int          elt_count, glyph_count;
+} TEXT_RUN;
+
+static void text_run_flush(TEXT_RUN *run) {
+    if (run->glyph_count) {
+        XRenderCompositeText32(display, PictOpOver, curr->colorpic, curr->renderpic, NULL, 0, 0, run->elts[0].xOff,
+                               run->elts[0].yOff, run->elts, run->elt_count);
+    }
+
+    run->elt_count   = 0;
+    run->glyph_count = 0;
+}
+
+static void text_run_add(TEXT_RUN *run, const GLYPH *g, int x, int y) {
+    XGlyphElt32 *elt = run->elt_count ? &run->elts[run->elt_count - 1] : NULL;
+    if (elt && elt->glyphset == g->set && run->glyph_count < TEXT_RUN_GLYPHS) {
+        elt->nchars++;
+        run->glyphs[run->glyph_count++] = g->ucs4;
+        return;
+    }
+
+    if (run->elt_count == TEXT_RUN_ELEMENTS || run->glyph_count == TEXT_RUN_GLYPHS) {
+        text_run_flush(run);
+    }
+
+    elt = &run->elts[run->elt_count];
+    *elt = (XGlyphElt32){
+        .glyphset = g->set,
+        .chars    = &run->glyphs[run->glyph_count],
+        .nchars   = 1,
+        // Only the first element needs placing, the server keeps track of the pen from there.
+        .xOff     = run->elt_count ? 0 : x,
+        .yOff     = run->elt_count ? 0 : y,
+    };
+    run->elt_count++;
+    run->glyphs[run->glyph_count++] = g->ucs4;
+}
+
 static int _drawtext(int x, int xmax, int y, const char *str, uint16_t length) {
+    TEXT_RUN run = { .elt_count = 0 };
     GLYPH *  g;
     uint8_t  len;
     uint32_t ch;
@@ -107,17 +154,16 @@ static int _drawtext(int x, int xmax, int y, const char *str, uint16_t length) {
         g = font_getglyph(sfont, ch);
         if (g) {
             if (x + g->xadvance + SCALE(10) > xmax && length) {
+                text_run_flush(&run);
                 return -x;
             }
 
-            if (g->pic) {
-                XRenderComposite(display, PictOpOver, curr->colorpic, g->pic, curr->renderpic, 0, 0, 0, 0, x + g->x, y + g->y,
-                                 g->width, g->height);
-            }
+            text_run_add(&run, g, x, y);
             x += g->xadvance;
         }
     }
 
+    text_run_flush(&run);
     return x;
 }
 
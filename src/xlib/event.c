@@ -280,6 +280,10 @@ bool doevent(XEvent *event) {
             return true;
         }
 
+        if (video_window_event(event)) {
+            return true;
+        }
+
         if (event->type == ClientMessage) {
             XClientMessageEvent *ev = &event->xclient;
             if ((Atom)event->xclient.data.l[0] == wm_delete_window) {
@@ -175,14 +175,18 @@ bool native_remove_file(const uint8_t *name, size_t length, bool portable_mode)
     return true;
 }
 
-void native_select_dir_ft(uint32_t fid, uint32_t file_number, FILE_TRANSFER *file) {
+void native_select_dir_ft(uint32_t fid, uint32_t file_number, const char *name, size_t name_length) {
     if (libgtk) {
-        ugtk_native_select_dir_ft(fid, file);
+        ugtk_native_select_dir_ft(fid, file_number, name, name_length);
     } else {
         // fall back to working dir
-        char *path = malloc(file->name_length + 1);
-        memcpy(path, file->name, file->name_length);
-        path[file->name_length] = 0;
+        char *path = malloc(name_length + 1);
+        if (!path) {
+            LOG_ERR("Filesys", "Could not allocate memory for path.");
+            return;
+        }
+        memcpy(path, name, name_length);
+        path[name_length] = 0;
 
         postmessage_toxcore(TOX_FILE_ACCEPT, fid, file_number, path);
     }
@@ -7,10 +7,15 @@
 #include "../macros.h"
 #include "../ui.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #define UTOX_FONT_XLIB "Roboto"
 
 FT_Library ftlib;
 FONT       font[16], *sfont;
+
+GLYPH_CACHE_STATS glyph_cache_stats;
 FcCharSet *charset;
 FcFontSet *fs;
 
@@ -18,107 +23,160 @@ bool ft_vert, ft_swap_blue_red;
 
 static void font_info_open(FONT_INFO *i, FcPattern *pattern);
 
-Picture loadglyphpic(uint8_t *data, int width, int height, int pitch, bool no_subpixel, bool vertical,
-                     bool swap_blue_red) {
-    if (!width || !height) {
-        return None;
+static GlyphSet glyph_set(FONT *f, bool no_subpixel) {
+    GlyphSet *set = no_subpixel ? &f->gray : &f->subpixel;
+    if (!*set) {
+        *set = XRenderCreateGlyphSet(display, XRenderFindStandardFormat(display, no_subpixel ? PictStandardA8 :
+                                                                                               PictStandardARGB32));
     }
 
-    Picture picture;
-    GC      legc;
-    Pixmap  pixmap;
-    XImage *img;
+    return *set;
+}
 
-    if (no_subpixel) {
-        pixmap = XCreatePixmap(display, main_window.window, width, height, 8);
-        img    = XCreateImage(display, CopyFromParent, 8, ZPixmap, 0, (char *)data, width, height, 8, 0);
-        legc   = XCreateGC(display, pixmap, 0, NULL);
-        XPutImage(display, pixmap, legc, img, 0, 0, 0, 0, width, height);
-        picture = XRenderCreatePicture(display, pixmap, XRenderFindStandardFormat(display, PictStandardA8), 0, NULL);
-    } else {
+/* Converts the glyph's bitmap to the format of its glyph set and sends it to the server. */
+static GlyphSet glyph_upload(FONT *f, GLYPH *g, uint8_t *data, int pitch, bool no_subpixel, bool vertical,
+                             bool swap_blue_red)
+{
+    GlyphSet set = glyph_set(f, no_subpixel);
+
+    XGlyphInfo info = {
+        .width  = g->width,
+        .height = g->height,
+        .x      = -g->x,
+        .y      = -g->y,
+        .xOff   = g->xadvance,
+        .yOff   = 0,
+    };
+
+    Glyph  id   = g->ucs4;
+    size_t size = 0;
+    char * image = NULL;
+
+    if (g->width && g->height) {
+        if (no_subpixel) {
+            // Rows have to be padded to 4 bytes.
+            int stride = (g->width + 3) & ~3;
+            size       = stride * g->height;
+            image      = calloc(1, size);
+            if (!image) {
+                return None;
+            }
 
-        uint32_t *rgbx, *p, *end;
+            for (int row = 0; row < g->height; ++row) {
+                memcpy(image + row * stride, data + row * pitch, g->width);
+            }
+        } else {
+            size = 4 * g->width * g->height;
+            image = malloc(size);
+            if (!image) {
+                return None;
+            }
 
-        rgbx = malloc(4 * width * height);
-        if (!rgbx) {
-            return None;
+            uint32_t *p = (uint32_t *)image, *end;
+            int       i = g->height;
+            if (!vertical) {
+                do {
+                    end = p + g->width;
+                    while (p != end) {
+                        uint32_t rgb = swap_blue_red ? RGB(data[2], data[1], data[0]) : RGB(data[0], data[1], data[2]);
+                        // Component alpha, the alpha channel is only used where there's no subpixel order.
+                        *p++ = rgb | (uint32_t)data[1] << 24;
+                        data += 3;
+                    }
+                    data += pitch - g->width * 3;
+                } while (--i);
+            } else {
+                do {
+                    end = p + g->width;
+                    while (p != end) {
+                        uint32_t rgb = swap_blue_red ? RGB(data[2 * pitch], data[1 * pitch], data[0]) :
+                                                       RGB(data[0], data[1 * pitch], data[2 * pitch]);
+                        *p++ = rgb | (uint32_t)data[1 * pitch] << 24;
+                        data += 1;
+                    }
+                    data += (pitch - g->width) + (pitch * 2);
+                } while (--i);
+            }
         }
+    }
 
-        p     = rgbx;
-        int i = height;
-        if (!vertical) {
-            do {
-                end = p + width;
-                while (p != end) {
-                    *p++ = swap_blue_red ? RGB(data[2], data[1], data[0]) : RGB(data[0], data[1], data[2]);
-                    data += 3;
-                }
-                data += pitch - width * 3;
-            } while (--i);
-        } else {
-            do {
-                end = p + width;
-                while (p != end) {
-                    *p++ = swap_blue_red ? RGB(data[2 * pitch], data[1 * pitch], data[0]) :
-                                           RGB(data[0], data[1 * pitch], data[2 * pitch]);
-                    data += 1;
-                }
-                data += (pitch - width) + (pitch * 2);
-            } while (--i);
-        }
+    XRenderAddGlyphs(display, set, &id, &info, 1, image, size);
+    glyph_cache_stats.uploaded += size;
+    free(image);
 
-        pixmap = XCreatePixmap(display, main_window.window, width, height, default_depth);
-        img    = XCreateImage(display, CopyFromParent, default_depth, ZPixmap, 0, (char *)rgbx, width, height, 32, 0);
-        legc   = XCreateGC(display, pixmap, 0, NULL);
-        XPutImage(display, pixmap, legc, img, 0, 0, 0, 0, width, height);
+    return set;
+}
 
-        XRenderPictureAttributes attr = {.component_alpha = 1 };
-        picture = XRenderCreatePicture(display, pixmap, XRenderFindStandardFormat(display, PictStandardRGB24),
-                                       CPComponentAlpha, &attr);
+static uint32_t glyph_hash(uint32_t ch) {
+    ch *= 0x9E3779B1u;
+    return ch ^ (ch >> 16);
+}
 
-        free(rgbx);
+static bool glyphs_grow(FONT *f) {
+    uint32_t size   = f->glyphs_size ? f->glyphs_size * 2 : 256;
+    GLYPH *  glyphs = malloc(size * sizeof(GLYPH));
+    if (!glyphs) {
+        return false;
     }
 
-    XFreeGC(display, legc);
-    XFreePixmap(display, pixmap);
+    for (uint32_t i = 0; i < size; ++i) {
+        glyphs[i].ucs4 = ~0u;
+    }
 
-    return picture;
+    for (uint32_t i = 0; i < f->glyphs_size; ++i) {
+        if (f->glyphs[i].ucs4 == ~0u) {
+            continue;
+        }
+
+        uint32_t j = glyph_hash(f->glyphs[i].ucs4) & (size - 1);
+        while (glyphs[j].ucs4 != ~0u) {
+            j = (j + 1) & (size - 1);
+        }
+        glyphs[j] = f->glyphs[i];
+    }
+
+    free(f->glyphs);
+    f->glyphs      = glyphs;
+    f->glyphs_size = size;
+    return true;
 }
 
 GLYPH *font_getglyph(FONT *f, uint32_t ch) {
-    uint32_t hash = ch % 128;
-    GLYPH *  g = f->glyphs[hash], *s = g;
-    if (g) {
-        while (g->ucs4 != ~0u) {
-            if (g->ucs4 == ch) {
-                return g;
+    if (ch == ~0u) {
+        return NULL;
+    }
+
+    uint32_t slot = 0;
+    if (f->glyphs) {
+        for (slot = glyph_hash(ch) & (f->glyphs_size - 1); f->glyphs[slot].ucs4 != ~0u;
+             slot = (slot + 1) & (f->glyphs_size - 1)) {
+            if (f->glyphs[slot].ucs4 == ch) {
+                glyph_cache_stats.hits++;
+                return f->glyphs[slot].exists ? &f->glyphs[slot] : NULL;
             }
-            g++;
         }
+    }
 
-        if (!FcCharSetHasChar(charset, ch)) {
-            return NULL;
-        }
+    glyph_cache_stats.misses++;
 
-        uint32_t count = (uint32_t)(g - s);
-        g              = realloc(s, (count + 2) * sizeof(GLYPH));
-        if (!g) {
+    // Keep the table at most half full.
+    if ((f->glyphs_count + 1) * 2 > f->glyphs_size) {
+        if (!glyphs_grow(f)) {
             return NULL;
         }
 
-        f->glyphs[hash] = g;
-        g += count;
-    } else {
-        if (!FcCharSetHasChar(charset, ch)) {
-            return NULL;
+        for (slot = glyph_hash(ch) & (f->glyphs_size - 1); f->glyphs[slot].ucs4 != ~0u;
+             slot = (slot + 1) & (f->glyphs_size - 1)) {
+            continue;
         }
+    }
 
-        g = malloc(sizeof(GLYPH) * 2);
-        if (!g) {
-            return NULL;
-        }
+    GLYPH *g = &f->glyphs[slot];
+    *g = (GLYPH){ .ucs4 = ch, .exists = false, .set = None };
+    f->glyphs_count++;
 
-        f->glyphs[hash] = g;
+    if (!FcCharSetHasChar(charset, ch)) {
+        return NULL;
     }
 
     // return FcCharSetHasChar (pub->charset, ucs4);
@@ -219,12 +277,10 @@ GLYPH *font_getglyph(FONT *f, uint32_t ch) {
     if (autohint)
         ft_flags |= FT_LOAD_FORCE_AUTOHINT;
 
-    g[1].ucs4 = ~0;
     FT_Load_Char(i->face, ch, ft_flags);
     FT_Render_Glyph(i->face->glyph, ft_render_flags);
     FT_GlyphSlotRec *p = i->face->glyph;
 
-    g->ucs4     = ch;
     g->x        = p->bitmap_left;
     g->y        = PIXELS(i->face->size->metrics.ascender) - p->bitmap_top;
     g->height   = p->bitmap.rows;
@@ -243,6 +299,7 @@ GLYPH *font_getglyph(FONT *f, uint32_t ch) {
         }
         free(p->bitmap.buffer);
         p->bitmap.buffer = mybuf;
+        p->bitmap.pitch  = g->width;
         no_subpixel      = 1;
     } else if (p->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY) {
         g->width    = p->bitmap.width;
@@ -262,8 +319,12 @@ GLYPH *font_getglyph(FONT *f, uint32_t ch) {
     }
 
     // LOG_TRACE("Freetype", "%u %u %u %u %C" , PIXELS(i->face->size->metrics.height), g->width, g->height, p->bitmap.pitch, ch);
-    g->pic = loadglyphpic(p->bitmap.buffer, g->width, g->height, p->bitmap.pitch, no_subpixel, vert, ft_swap_blue_red);
+    g->set = glyph_upload(f, g, p->bitmap.buffer, p->bitmap.pitch, no_subpixel, vert, ft_swap_blue_red);
+    if (!g->set) {
+        return NULL;
+    }
 
+    g->exists = true;
     return g;
 }
 
@@ -442,19 +503,22 @@ void freefonts(void) {
             free(f->info);
         }
 
-        for (size_t j = 0; j < COUNTOF(f->glyphs); j++) {
-            GLYPH *g = f->glyphs[j];
-            if (g) {
-                while (g->ucs4 != ~0u) {
-                    if (g->pic) {
-                        XRenderFreePicture(display, g->pic);
-                    }
-                    g++;
-                }
+        free(f->glyphs);
+        f->glyphs       = NULL;
+        f->glyphs_size  = 0;
+        f->glyphs_count = 0;
 
-                free(f->glyphs[j]);
-                f->glyphs[j] = NULL;
-            }
+        if (f->gray) {
+            XRenderFreeGlyphSet(display, f->gray);
+            f->gray = None;
+        }
+        if (f->subpixel) {
+            XRenderFreeGlyphSet(display, f->subpixel);
+            f->subpixel = None;
         }
     }
+
+    LOG_INFO("Freetype", "Glyph cache: %lu hits, %lu misses, %lu bytes uploaded",
+             (unsigned long)glyph_cache_stats.hits, (unsigned long)glyph_cache_stats.misses,
+             (unsigned long)glyph_cache_stats.uploaded);
 }
@@ -16,8 +16,9 @@
 typedef struct {
     uint32_t ucs4;
     int16_t  x, y;
-    uint16_t width, height, xadvance, xxxx;
-    Picture  pic;
+    uint16_t width, height, xadvance;
+    bool     exists; // false if no font has the character, so we don't go looking again
+    GlyphSet set;    // the glyph set it was uploaded to, with ucs4 as its id
 } GLYPH;
 
 typedef struct {
@@ -28,9 +29,23 @@ typedef struct {
 typedef struct {
     FcPattern *pattern;
     FONT_INFO *info;
-    GLYPH *    glyphs[128];
+
+    /* Open addressed on ucs4, glyphs_size is a power of two. */
+    GLYPH *  glyphs;
+    uint32_t glyphs_size, glyphs_count;
+
+    /* Every glyph is uploaded to the server once, into one of these, so a run of text can be drawn with a single
+     * request. Greyscale and subpixel glyphs need different formats. */
+    GlyphSet gray, subpixel;
 } FONT;
 
+typedef struct {
+    uint64_t hits, misses;
+    uint64_t uploaded; // bytes of glyph images sent to the server
+} GLYPH_CACHE_STATS;
+
+extern GLYPH_CACHE_STATS glyph_cache_stats;
+
 extern FT_Library ftlib;
 extern FONT       font[16], *sfont;
 extern FcCharSet *charset;
@@ -38,8 +53,7 @@ extern FcFontSet *fs;
 
 extern bool ft_vert, ft_swap_blue_red;
 
-Picture loadglyphpic(uint8_t *data, int width, int height, int pitch, bool no_subpixel, bool vertical,
-                     bool swap_blue_red);
+/* Returns NULL if no font has the character. The glyph is only valid until the next call. */
 GLYPH *font_getglyph(FONT *f, uint32_t ch);
 void initfonts(void);
 void loadfonts(void);
@@ -231,8 +231,15 @@ void show_messagebox(const char *UNUSED(caption), uint16_t UNUSED(caption_length
     utoxGTK_open = false;
 }
 
+/* What the save dialog needs to know about an incoming file, copied so it doesn't outlive the transfer. */
+typedef struct {
+    uint32_t friend_number, file_number;
+    size_t   name_length;
+    char     name[];
+} UGTK_SAVE_FILE;
+
 static void ugtk_savethread(void *args) {
-    FILE_TRANSFER *file = args;
+    UGTK_SAVE_FILE *file = args;
 
     while (1) { // TODO, save current dir, and filename and preload them to gtk dialog if save fails.
         /* Create a GTK save window */
@@ -296,6 +303,7 @@ static void ugtk_savethread(void *args) {
         utoxGTK_main_iteration();
     }
 
+    free(file);
     utoxGTK_open = false;
 }
 
@@ -428,10 +436,21 @@ void ugtk_openfileavatar(void) {
     thread(ugtk_openavatarthread, NULL);
 }
 
-void ugtk_native_select_dir_ft(uint32_t UNUSED(fid), FILE_TRANSFER *file) {
+void ugtk_native_select_dir_ft(uint32_t fid, uint32_t file_number, const char *name, size_t name_length) {
     if (utoxGTK_open) {
         return;
     }
+
+    UGTK_SAVE_FILE *file = malloc(sizeof(UGTK_SAVE_FILE) + name_length);
+    if (!file) {
+        LOG_ERR("GTK", "Could not allocate memory for the save dialog.");
+        return;
+    }
+    file->friend_number = fid;
+    file->file_number   = file_number;
+    file->name_length   = name_length;
+    memcpy(file->name, name, name_length);
+
     utoxGTK_open = true;
     thread(ugtk_savethread, file);
 }
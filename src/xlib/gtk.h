@@ -1,6 +1,7 @@
 #ifndef UTOX_GTK_H
 #define UTOX_GTK_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct file_transfer FILE_TRANSFER;
@@ -17,7 +18,7 @@ void ugtk_openfilesend(void);
 
 void ugtk_openfileavatar(void);
 
-void ugtk_native_select_dir_ft(uint32_t fid, FILE_TRANSFER *file);
+void ugtk_native_select_dir_ft(uint32_t fid, uint32_t file_number, const char *name, size_t name_length);
 
 void ugtk_file_save_inline(MSG_HEADER *msg);
 
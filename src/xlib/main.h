@@ -83,6 +83,9 @@ void pastedata(void *data, Atom type, size_t len, bool select);
 // Brute Force, the video window we got a close command on (xlib/video.c)
 uint16_t find_video_windows(Window w);
 
+/* Handles ConfigureNotify for video windows and MIT-SHM completions. Returns false for anything else. */
+bool video_window_event(XEvent *event);
+
 
 // video4linux
 bool v4l_init(char *dev_name);
@@ -9,10 +9,10 @@
 
 #include "../av/video.h"
 
-#include "../native/time.h"
-
 #include "../main.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +23,274 @@
 static Window video_win[MAX_VID_WINDOWS]; // TODO we should allocate this dynamically but this'll work for now
 static Window preview;        // Video preview
 
+/* What video_frame() draws through, kept from one frame to the next.
+ *
+ * Frames go into a shared memory XImage, which the server copies into a Pixmap the size of the frame, and XRender
+ * scales that straight onto the window. When MIT-SHM can't be used they're scaled on the CPU and put through the
+ * Pixmap the size of the window instead. */
+typedef struct {
+    Window window;
+    int    width, height; // of the window, kept up to date by ConfigureNotify
+
+    /* MIT-SHM and XRender */
+    XImage *        image;
+    XShmSegmentInfo shm;
+    bool            put_pending; // the server hasn't finished reading the last frame from the image
+    Pixmap          frame;
+    Picture         frame_picture, window_picture;
+    int             scaled_width, scaled_height; // what frame_picture's transform scales to
+
+    /* fallback */
+    Pixmap   pixmap;
+    int      pixmap_width, pixmap_height;
+    uint8_t *scaled;
+    size_t   scaled_size;
+} VIDEO_SURFACE;
+
+static VIDEO_SURFACE video_surface[MAX_VID_WINDOWS];
+static VIDEO_SURFACE preview_surface;
+
+static enum { SHM_UNKNOWN, SHM_USABLE, SHM_UNUSABLE } video_shm;
+static int video_shm_completion;
+static bool video_shm_attach_failed;
+
+static void video_shm_free(VIDEO_SURFACE *surface) {
+    if (surface->window_picture) {
+        XRenderFreePicture(display, surface->window_picture);
+    }
+    if (surface->frame_picture) {
+        XRenderFreePicture(display, surface->frame_picture);
+    }
+    if (surface->frame) {
+        XFreePixmap(display, surface->frame);
+    }
+    if (surface->image) {
+        if (surface->shm.shmaddr) {
+            XShmDetach(display, &surface->shm);
+            shmdt(surface->shm.shmaddr);
+        }
+        surface->image->data = NULL;
+        XDestroyImage(surface->image);
+    }
+
+    surface->image          = NULL;
+    surface->shm            = (XShmSegmentInfo){ 0 };
+    surface->put_pending    = false;
+    surface->frame          = None;
+    surface->frame_picture  = None;
+    surface->window_picture = None;
+    surface->scaled_width   = 0;
+    surface->scaled_height  = 0;
+}
+
+static void video_surface_free(VIDEO_SURFACE *surface) {
+    video_shm_free(surface);
+    if (surface->pixmap) {
+        XFreePixmap(display, surface->pixmap);
+    }
+    free(surface->scaled);
+    *surface = (VIDEO_SURFACE){ 0 };
+}
+
+static VIDEO_SURFACE *video_surface_find(Window w) {
+    if (w == preview_surface.window) {
+        return &preview_surface;
+    }
+
+    for (unsigned i = 0; i < MAX_VID_WINDOWS; ++i) {
+        if (w == video_surface[i].window) {
+            return &video_surface[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int video_shm_attach_error(Display *UNUSED(d), XErrorEvent *UNUSED(event)) {
+    video_shm_attach_failed = true;
+    return 0;
+}
+
+static bool video_shm_usable(void) {
+    if (video_shm == SHM_UNKNOWN) {
+        /* Frames are BGRX, anything else would need converting on the way in anyway. */
+        video_shm = XShmQueryExtension(display) && default_depth == 24 ? SHM_USABLE : SHM_UNUSABLE;
+        video_shm_completion = XShmGetEventBase(display) + ShmCompletion;
+        LOG_INFO("Video", "Presenting video %s MIT-SHM", video_shm == SHM_USABLE ? "with" : "without");
+    }
+
+    return video_shm == SHM_USABLE;
+}
+
+/* (Re)makes the shared image and frame Pixmap for frames of width by height. */
+static bool video_shm_create(VIDEO_SURFACE *surface, uint16_t width, uint16_t height) {
+    video_shm_free(surface);
+
+    surface->image = XShmCreateImage(display, default_visual, default_depth, ZPixmap, NULL, &surface->shm, width,
+                                     height);
+    if (!surface->image || surface->image->bits_per_pixel != 32 || surface->image->byte_order != LSBFirst) {
+        goto unusable;
+    }
+
+    surface->shm.shmid = shmget(IPC_PRIVATE, surface->image->bytes_per_line * height, IPC_CREAT | 0600);
+    if (surface->shm.shmid == -1) {
+        LOG_ERR("Video", "Unable to get a shared memory segment for video.");
+        goto fail;
+    }
+
+    surface->shm.shmaddr = surface->image->data = shmat(surface->shm.shmid, NULL, 0);
+    /* Marked for removal now so it can't outlive us, it stays until everyone's detached. */
+    shmctl(surface->shm.shmid, IPC_RMID, NULL);
+    if (surface->shm.shmaddr == (char *)-1) {
+        surface->shm.shmaddr = NULL;
+        LOG_ERR("Video", "Unable to attach the shared memory segment for video.");
+        goto fail;
+    }
+    surface->shm.readOnly = True;
+
+    /* A remote server only finds out it can't get at our memory when it tries, so catch that here. */
+    XSync(display, False);
+    video_shm_attach_failed = false;
+    XErrorHandler old       = XSetErrorHandler(video_shm_attach_error);
+    XShmAttach(display, &surface->shm);
+    XSync(display, False);
+    XSetErrorHandler(old);
+    if (video_shm_attach_failed) {
+        shmdt(surface->shm.shmaddr);
+        surface->shm.shmaddr = NULL;
+        goto unusable;
+    }
+
+    XRenderPictFormat *format  = XRenderFindVisualFormat(display, default_visual);
+    surface->frame             = XCreatePixmap(display, surface->window, width, height, default_depth);
+    surface->frame_picture     = XRenderCreatePicture(display, surface->frame, format, 0, NULL);
+    surface->window_picture    = XRenderCreatePicture(display, surface->window, format, 0, NULL);
+    XRenderSetPictureFilter(display, surface->frame_picture, FilterBilinear, NULL, 0);
+    return true;
+
+unusable:
+    LOG_WARN("Video", "MIT-SHM isn't usable with this server, video will be scaled and sent the slow way.");
+    video_shm = SHM_UNUSABLE;
+fail:
+    video_shm_free(surface);
+    return false;
+}
+
+static bool video_present_shm(VIDEO_SURFACE *surface, const uint8_t *img_data, uint16_t width, uint16_t height) {
+    if (!surface->image || surface->image->width != width || surface->image->height != height) {
+        if (!video_shm_create(surface, width, height)) {
+            return false;
+        }
+    }
+
+    if (surface->put_pending) {
+        /* The server's still busy with the last frame, this one would only tear it. */
+        return true;
+    }
+
+    if (surface->image->bytes_per_line == width * 4) {
+        memcpy(surface->image->data, img_data, (size_t)width * height * 4);
+    } else {
+        for (int y = 0; y < height; ++y) {
+            memcpy(surface->image->data + y * surface->image->bytes_per_line, img_data + y * width * 4, width * 4);
+        }
+    }
+
+    GC default_gc = DefaultGC(display, def_screen_num);
+    XShmPutImage(display, surface->frame, default_gc, surface->image, 0, 0, 0, 0, width, height, True);
+    surface->put_pending = true;
+
+    if (surface->scaled_width != surface->width || surface->scaled_height != surface->height) {
+        /* Maps window coordinates back onto the frame. */
+        XTransform transform = { { { XDoubleToFixed((double)width / surface->width), 0, 0 },
+                                   { 0, XDoubleToFixed((double)height / surface->height), 0 },
+                                   { 0, 0, XDoubleToFixed(1.0) } } };
+        XRenderSetPictureTransform(display, surface->frame_picture, &transform);
+        surface->scaled_width  = surface->width;
+        surface->scaled_height = surface->height;
+    }
+
+    XRenderComposite(display, PictOpSrc, surface->frame_picture, None, surface->window_picture, 0, 0, 0, 0, 0, 0,
+                     surface->width, surface->height);
+    return true;
+}
+
+static void video_present_copy(VIDEO_SURFACE *surface, uint8_t *img_data, uint16_t width, uint16_t height) {
+    XImage image = {
+        .width            = surface->width,
+        .height           = surface->height,
+        .depth            = 24,
+        .bits_per_pixel   = 32,
+        .format           = ZPixmap,
+        .byte_order       = LSBFirst,
+        .bitmap_unit      = 8,
+        .bitmap_bit_order = LSBFirst,
+        .bytes_per_line   = surface->width * 4,
+        .red_mask         = 0xFF0000,
+        .green_mask       = 0xFF00,
+        .blue_mask        = 0xFF,
+        .data             = (char *)img_data
+    };
+
+    /* scale image if needed */
+    if (surface->width != width || surface->height != height) {
+        const size_t size = surface->width * surface->height * 4;
+        if (surface->scaled_size < size) {
+            free(surface->scaled);
+            surface->scaled      = malloc(size);
+            surface->scaled_size = size;
+            if (!surface->scaled) {
+                LOG_FATAL_ERR(EXIT_MALLOC, "Video", "Could not allocate memory for scaled image.");
+            }
+        }
+
+        scale_rgbx_image(img_data, width, height, surface->scaled, surface->width, surface->height);
+        image.data = (char *)surface->scaled;
+    }
+
+    if (!surface->pixmap || surface->pixmap_width != surface->width || surface->pixmap_height != surface->height) {
+        if (surface->pixmap) {
+            XFreePixmap(display, surface->pixmap);
+        }
+        surface->pixmap        = XCreatePixmap(display, main_window.window, surface->width, surface->height,
+                                               default_depth);
+        surface->pixmap_width  = surface->width;
+        surface->pixmap_height = surface->height;
+    }
+
+    GC default_gc = DefaultGC(display, def_screen_num);
+    XPutImage(display, surface->pixmap, default_gc, &image, 0, 0, 0, 0, surface->width, surface->height);
+    XCopyArea(display, surface->pixmap, surface->window, default_gc, 0, 0, surface->width, surface->height, 0, 0);
+}
+
+bool video_window_event(XEvent *event) {
+    if (event->type == ConfigureNotify) {
+        VIDEO_SURFACE *surface = video_surface_find(event->xconfigure.window);
+        if (!surface) {
+            return false;
+        }
+
+        surface->width  = event->xconfigure.width;
+        surface->height = event->xconfigure.height;
+        return true;
+    }
+
+    if (video_shm == SHM_USABLE && event->type == video_shm_completion) {
+        const Drawable frame = ((XShmCompletionEvent *)event)->drawable;
+        if (preview_surface.frame == frame) {
+            preview_surface.put_pending = false;
+        }
+        for (unsigned i = 0; i < MAX_VID_WINDOWS; ++i) {
+            if (video_surface[i].frame == frame) {
+                video_surface[i].put_pending = false;
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
 uint16_t find_video_windows(Window w)
 {
     if (w == preview) {
@@ -46,9 +314,11 @@ void video_frame(uint16_t id, uint8_t *img_data, uint16_t width, uint16_t height
     }
 
     Window *win = &video_win[id];
+    VIDEO_SURFACE *surface = &video_surface[id];
     if (id == UINT16_MAX) {
         // Preview window
-        win = &preview;
+        win     = &preview;
+        surface = &preview_surface;
     } else if (id >= MAX_VID_WINDOWS) {
         LOG_TRACE("Video", "Window ID too large (>=%d)", MAX_VID_WINDOWS);
         return;
@@ -62,55 +332,29 @@ void video_frame(uint16_t id, uint8_t *img_data, uint16_t width, uint16_t height
     if (resize) {
         XWindowChanges changes = {.width = width, .height = height };
         XConfigureWindow(display, *win, CWWidth | CWHeight, &changes);
+        /* Draw at the new size straight away, ConfigureNotify will correct it if the WM has other ideas. */
+        surface->width  = width;
+        surface->height = height;
     }
 
-    XWindowAttributes attrs;
-    XGetWindowAttributes(display, *win, &attrs);
-
-    XImage image = {
-        .width            = attrs.width,
-        .height           = attrs.height,
-        .depth            = 24,
-        .bits_per_pixel   = 32,
-        .format           = ZPixmap,
-        .byte_order       = LSBFirst,
-        .bitmap_unit      = 8,
-        .bitmap_bit_order = LSBFirst,
-        .bytes_per_line   = attrs.width * 4,
-        .red_mask         = 0xFF0000,
-        .green_mask       = 0xFF00,
-        .blue_mask        = 0xFF,
-        .data             = (char *)img_data
-    };
-
-    /* scale image if needed */
-    uint8_t *new_data = NULL;
-    if (attrs.width != width && attrs.height != height){
-        new_data = malloc(attrs.width * attrs.height * 4);
-        if (!new_data) {
-            LOG_FATAL_ERR(EXIT_MALLOC, "Video", "Could not allocate memory for scaled image.");
-        }
-
-        scale_rgbx_image(img_data, width, height, new_data, attrs.width, attrs.height);
-        image.data = (char *)new_data;
+    if (!surface->width || !surface->height) {
+        return;
     }
 
-    GC     default_gc = DefaultGC(display, def_screen_num);
-    Pixmap pixmap     = XCreatePixmap(display, main_window.window, attrs.width, attrs.height, default_depth);
-    XPutImage(display, pixmap, default_gc, &image, 0, 0, 0, 0, attrs.width, attrs.height);
-    XCopyArea(display, pixmap, *win, default_gc, 0, 0, attrs.width, attrs.height, 0, 0);
-    XFreePixmap(display, pixmap);
-
-    if (new_data) {
-        free(new_data);
+    if (video_shm_usable() && video_present_shm(surface, img_data, width, height)) {
+        return;
     }
+
+    video_present_copy(surface, img_data, width, height);
 }
 
 void video_begin(uint16_t id, char *name, uint16_t name_length, uint16_t width, uint16_t height) {
     Window *win = &video_win[id];
+    VIDEO_SURFACE *surface = &video_surface[id];
     if (id == UINT16_MAX) {
         // Preview window
-        win = &preview;
+        win     = &preview;
+        surface = &preview_surface;
     } else if (id >= MAX_VID_WINDOWS) {
         LOG_TRACE("Video", "Window ID too large (>=%d)", MAX_VID_WINDOWS);
         return;
@@ -134,20 +378,30 @@ void video_begin(uint16_t id, char *name, uint16_t name_length, uint16_t width,
 
     XSetClassHint(display, *win, &hint);
 
+    /* So the size can be tracked without asking the server every frame. */
+    XSelectInput(display, *win, StructureNotifyMask);
+    surface->window = *win;
+    surface->width  = width;
+    surface->height = height;
+
     XMapWindow(display, *win);
     LOG_TRACE("Video", "new window %u" , id);
 }
 
 void video_end(uint16_t id) {
     Window *win = &video_win[id];
+    VIDEO_SURFACE *surface = &video_surface[id];
     if (id == UINT16_MAX) {
         // Preview window
-        win = &preview;
+        win     = &preview;
+        surface = &preview_surface;
     } else if (id >= MAX_VID_WINDOWS) {
         LOG_TRACE("Video", "Window ID too large (>=%d)", MAX_VID_WINDOWS);
         return;
     }
 
+    /* The window's Picture has to go before the window does. */
+    video_surface_free(surface);
     XDestroyWindow(display, *win);
     *win = None;
     LOG_NOTE("Video", "killed window %u" , id);
@@ -287,22 +541,32 @@ bool native_video_endread(void) {
 
 int native_video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, uint16_t height) {
     if (utox_v4l_fd == -1) {
-        static uint64_t lasttime;
-        uint64_t        t = get_time();
-        if (t - lasttime >= (uint64_t)1000 * 1000 * 1000 / 24) {
-            XShmGetImage(deskdisplay, RootWindow(deskdisplay, deskscreen), screen_image, video_x, video_y, AllPlanes);
-            if (width != video_width || height != video_height) {
-                LOG_ERR("v4l", "width/height mismatch %u %u != %u %u", width, height, screen_image->width,
-                      screen_image->height);
-                return 0;
-            }
-
-            bgrxtoyuv420(y, u, v, (uint8_t *)screen_image->data, screen_image->width, screen_image->height);
-            lasttime = t;
-            return 1;
+        /* The video thread paces how often the screen gets grabbed. */
+        XShmGetImage(deskdisplay, RootWindow(deskdisplay, deskscreen), screen_image, video_x, video_y, AllPlanes);
+        if (width != video_width || height != video_height) {
+            LOG_ERR("v4l", "width/height mismatch %u %u != %u %u", width, height, screen_image->width,
+                  screen_image->height);
+            return 0;
         }
-        return 0;
+
+        bgrxtoyuv420(y, u, v, (uint8_t *)screen_image->data, screen_image->width, screen_image->height);
+        return 1;
     }
 
     return v4l_getframe(y, u, v, width, height);
 }
+
+bool native_video_wait(uint32_t timeout_ms) {
+    if (utox_v4l_fd == -1) {
+        /* The screen's grabbed whenever it's asked for, it only fails on a size mismatch, no use waiting on that. */
+        return false;
+    }
+
+    struct pollfd pfd = { .fd = utox_v4l_fd, .events = POLLIN };
+    if (poll(&pfd, 1, timeout_ms) == -1 && errno != EINTR) {
+        LOG_ERR("v4l", "Unable to wait for a frame: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,161 @@
+#include "../src/av/audio_send.c"
+
+#include "../src/groups.h"
+
+#include "test.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Times getting one captured frame of audio out to N calls and group calls, among FRIENDS friends and GROUPS groups.
+ * The old way looks at every friend and every group each frame, the sink list only at the calls that are going.
+ * Half the calls are with friends, half are group calls, spread out over the lists.
+ *
+ * The capture device is faked with a tone, and toxav is stubbed out to just read the frame, its encode isn't what's
+ * measured. What's reported is CPU time per frame, a frame being 20ms of audio.
+ *
+ * Usage: bench_audio_send [frames per measurement] */
+
+#define FRIENDS 500
+#define GROUPS 50
+
+#define FRAME (UTOX_DEFAULT_SAMPLE_RATE_A / 50)
+
+static FRIEND    friends[FRIENDS];
+static GROUPCHAT groups[GROUPS];
+
+FRIEND *get_friend(uint32_t friend_number) {
+    return friend_number < FRIENDS ? &friends[friend_number] : NULL;
+}
+
+GROUPCHAT *get_group(uint32_t group_number) {
+    return group_number < GROUPS ? &groups[group_number] : NULL;
+}
+
+static uint32_t checksum;
+
+static void read_frame(const int16_t *pcm, size_t samples) {
+    for (size_t i = 0; i < samples; i += 16) {
+        checksum = checksum * 31 + pcm[i];
+    }
+}
+
+bool toxav_audio_send_frame(ToxAV *av, uint32_t friend_number, const int16_t *pcm, size_t sample_count,
+                            uint8_t channels, uint32_t sampling_rate, TOXAV_ERR_SEND_FRAME *error) {
+    read_frame(pcm, sample_count * channels);
+    *error = 0;
+    return true;
+}
+
+Tox *toxav_get_tox(const ToxAV *av) {
+    return NULL;
+}
+
+int toxav_group_send_audio(Tox *tox, uint32_t groupnumber, const int16_t *pcm, unsigned int samples, uint8_t channels,
+                           uint32_t sample_rate) {
+    read_frame(pcm, samples * channels);
+    return 0;
+}
+
+static const uint32_t sinks[] = { 0, 1, 2, 4, 8, 16 };
+
+/* The fake capture device, a 440Hz tone that carries on from one frame to the next. */
+static int16_t capture[FRAME];
+
+static void capture_frame(unsigned long frame) {
+    for (size_t i = 0; i < FRAME; ++i) {
+        const double t = (double)(frame * FRAME + i) / UTOX_DEFAULT_SAMPLE_RATE_A;
+        capture[i]     = 8000 * sin(2 * M_PI * 440 * t);
+    }
+}
+
+static void start_calls(uint32_t count) {
+    const uint8_t both = TOXAV_FRIEND_CALL_STATE_SENDING_A | TOXAV_FRIEND_CALL_STATE_ACCEPTING_A;
+
+    for (uint32_t i = 0; i < FRIENDS; ++i) {
+        friends[i].call_state_self   = 0;
+        friends[i].call_state_friend = 0;
+        audio_send_update(i);
+    }
+    for (uint32_t i = 0; i < GROUPS; ++i) {
+        groups[i].active_call = false;
+        audio_send_group(i, false);
+    }
+
+    const uint32_t group_calls = count / 2, friend_calls = count - group_calls;
+    for (uint32_t i = 0; i < friend_calls; ++i) {
+        const uint32_t n             = i * (FRIENDS / friend_calls);
+        friends[n].call_state_self   = both;
+        friends[n].call_state_friend = both;
+        audio_send_update(n);
+    }
+    for (uint32_t i = 0; i < group_calls; ++i) {
+        const uint32_t n      = i * (GROUPS / group_calls);
+        groups[n].active_call = true;
+        audio_send_group(n, true);
+    }
+}
+
+/* What the audio thread used to do with every frame. */
+static void send_scan_all(const int16_t *pcm) {
+    for (uint32_t i = 0; i < FRIENDS; ++i) {
+        if (UTOX_SEND_AUDIO(i)) {
+            TOXAV_ERR_SEND_FRAME error = 0;
+            toxav_audio_send_frame(NULL, get_friend(i)->number, pcm, FRAME, UTOX_DEFAULT_AUDIO_CHANNELS,
+                                   UTOX_DEFAULT_SAMPLE_RATE_A, &error);
+        }
+    }
+
+    for (uint32_t i = 0; i < GROUPS; ++i) {
+        if (get_group(i) && get_group(i)->active_call) {
+            toxav_group_send_audio(NULL, i, pcm, FRAME, UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A);
+        }
+    }
+}
+
+static double cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Returns the CPU time per frame in ns, not counting making up the capture. */
+static double measure(bool sink_list, unsigned long frames) {
+    double spent = 0;
+    for (unsigned long f = 0; f < frames; ++f) {
+        capture_frame(f);
+
+        const double start = cpu_ns();
+        if (sink_list) {
+            audio_send_frame(NULL, capture, FRAME, UTOX_DEFAULT_AUDIO_CHANNELS, UTOX_DEFAULT_SAMPLE_RATE_A);
+        } else {
+            send_scan_all(capture);
+        }
+        spent += cpu_ns() - start;
+    }
+
+    return spent / frames;
+}
+
+int main(int argc, char **argv) {
+    const unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000;
+
+    for (uint32_t i = 0; i < FRIENDS; ++i) {
+        friends[i].number = i;
+    }
+
+    printf("%d friends, %d groups, %lu frames\n", FRIENDS, GROUPS, frames);
+    printf("%6s %12s %12s  (CPU ns/frame)\n", "calls", "scan all", "sink list");
+    for (size_t s = 0; s < COUNTOF(sinks); ++s) {
+        start_calls(sinks[s]);
+        const double scan_all = measure(false, frames), sink_list = measure(true, frames);
+        printf("%6u %12.0f %12.0f\n", sinks[s], scan_all, sink_list);
+    }
+
+    start_calls(0);
+
+    printf("checksum %u\n", checksum);
+    return 0;
+}
@@ -0,0 +1,271 @@
+#include "../src/av/colorspace.c"
+#include "../src/av/colorspace_neon.c"
+#include "../src/av/colorspace_x86.c"
+#include "../src/av/frame_pool.c"
+#include "../src/av/video_send.c"
+#include "../src/av/video_synthetic.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <vpx/vp8cx.h>
+#include <vpx/vp8dx.h>
+#include <vpx/vpx_decoder.h>
+#include <vpx/vpx_encoder.h>
+
+/* Runs the whole video path of a call with no camera, no peer and no network: the synthetic source draws a frame,
+ * it's converted to YUV and handed to video_send_frame(), which sends it to a stand-in ToxAV. That encodes it with
+ * VP8 for each call, like toxav does, decodes it straight back and converts it to BGRX for the UI, the same as
+ * utox_av_incoming_frame_v(). Frames go through as fast as they can, not at any frame rate.
+ *
+ * Prints the throughput, and the spread of how long each stage took per frame, plus the time from drawing a frame to
+ * it being ready to show.
+ *
+ * Usage: bench_av_pipeline [WIDTHxHEIGHT] [calls] [frames] [kbit/s] */
+
+#define MAX_FRAMES 100000
+
+enum {
+    STAGE_CAPTURE,
+    STAGE_CONVERT,
+    STAGE_ENCODE,
+    STAGE_DECODE,
+    STAGE_DISPLAY,
+    STAGE_TOTAL,
+    STAGE_COUNT,
+};
+
+static const char *stage_names[STAGE_COUNT] = { "capture", "bgrxtoyuv420", "encode", "decode", "yuv420tobgr",
+                                                "end to end" };
+
+static struct {
+    uint64_t *samples;
+    size_t    count;
+} stages[STAGE_COUNT];
+
+typedef struct {
+    vpx_codec_ctx_t encoder, decoder;
+    FRAME_POOL *    frames;
+    int64_t         last_frame;
+    uint64_t        lost, bytes;
+} CALL;
+
+static CALL     calls[UTOX_MAX_CALLS];
+static FRIEND   friends[UTOX_MAX_CALLS];
+static uint64_t frame_start[MAX_FRAMES]; // when each frame started being drawn
+static uint32_t frame_number;
+static uint8_t  fps = 25;
+
+uint64_t get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+FRIEND *get_friend(uint32_t friend_number) {
+    return friend_number < UTOX_MAX_CALLS ? &friends[friend_number] : NULL;
+}
+
+static void sample(int stage, uint64_t ns) {
+    stages[stage].samples[stages[stage].count++] = ns;
+}
+
+/* What utox_av_incoming_frame_v() does with a frame, minus handing it to the UI. */
+static void receive_frame(CALL *call, const vpx_image_t *img) {
+    uint64_t start = get_time();
+
+    UTOX_FRAME_PKG *frame = frame_pool_get(call->frames, img->d_w, img->d_h);
+    if (!frame) {
+        return;
+    }
+    yuv420tobgr(img->d_w, img->d_h, img->planes[0], img->planes[1], img->planes[2], img->stride[0], img->stride[1],
+                img->stride[2], frame->img);
+
+    const int64_t number = video_synthetic_frame_number(img->planes[0], img->stride[0], img->d_w, img->d_h);
+    frame_release(frame);
+
+    const uint64_t now = get_time();
+    sample(STAGE_DISPLAY, now - start);
+
+    if (number < 0 || number >= MAX_FRAMES) {
+        call->lost++;
+        return;
+    }
+    if (number > call->last_frame + 1) {
+        call->lost += number - call->last_frame - 1;
+    }
+    call->last_frame = number;
+    sample(STAGE_TOTAL, now - frame_start[number]);
+}
+
+/* The stand-in ToxAV. */
+bool toxav_video_send_frame(ToxAV *av, uint32_t friend_number, uint16_t width, uint16_t height, const uint8_t *y,
+                            const uint8_t *u, const uint8_t *v, TOXAV_ERR_SEND_FRAME *error) {
+    CALL *call = &calls[friend_number];
+    *error     = 0;
+
+    /* video_send_frame() hands the planes out one after another. */
+    vpx_image_t img;
+    vpx_img_wrap(&img, VPX_IMG_FMT_I420, width, height, 1, (uint8_t *)y);
+    img.planes[1] = (uint8_t *)u;
+    img.planes[2] = (uint8_t *)v;
+
+    uint64_t start = get_time();
+    if (vpx_codec_encode(&call->encoder, &img, frame_number, 1, 0, VPX_DL_REALTIME) != VPX_CODEC_OK) {
+        fprintf(stderr, "Encoding failed: %s\n", vpx_codec_error(&call->encoder));
+        *error = TOXAV_ERR_SEND_FRAME_SYNC;
+        return false;
+    }
+    sample(STAGE_ENCODE, get_time() - start);
+
+    vpx_codec_iter_t          iter = NULL;
+    const vpx_codec_cx_pkt_t *packet;
+    while ((packet = vpx_codec_get_cx_data(&call->encoder, &iter))) {
+        if (packet->kind != VPX_CODEC_CX_FRAME_PKT) {
+            continue;
+        }
+        call->bytes += packet->data.frame.sz;
+
+        start = get_time();
+        if (vpx_codec_decode(&call->decoder, packet->data.frame.buf, packet->data.frame.sz, NULL, 0) != VPX_CODEC_OK) {
+            fprintf(stderr, "Decoding failed: %s\n", vpx_codec_error(&call->decoder));
+            continue;
+        }
+
+        vpx_codec_iter_t decoded_iter = NULL;
+        vpx_image_t *    decoded      = vpx_codec_get_frame(&call->decoder, &decoded_iter);
+        sample(STAGE_DECODE, get_time() - start);
+
+        for (; decoded; decoded = vpx_codec_get_frame(&call->decoder, &decoded_iter)) {
+            receive_frame(call, decoded);
+        }
+    }
+
+    return true;
+}
+
+static bool start_call(uint32_t i, uint16_t width, uint16_t height, uint32_t bitrate) {
+    uint16_t send_width, send_height;
+    video_send_size(bitrate, width, height, &send_width, &send_height);
+
+    /* Roughly how toxav sets its encoder up. */
+    vpx_codec_enc_cfg_t cfg;
+    vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &cfg, 0);
+    cfg.g_w               = send_width;
+    cfg.g_h               = send_height;
+    cfg.g_timebase.num    = 1;
+    cfg.g_timebase.den    = fps;
+    cfg.g_lag_in_frames   = 0;
+    cfg.rc_end_usage      = VPX_CBR;
+    cfg.rc_target_bitrate = bitrate;
+    cfg.kf_max_dist       = 48;
+
+    if (vpx_codec_enc_init(&calls[i].encoder, vpx_codec_vp8_cx(), &cfg, 0) != VPX_CODEC_OK
+        || vpx_codec_dec_init(&calls[i].decoder, vpx_codec_vp8_dx(), NULL, 0) != VPX_CODEC_OK) {
+        fprintf(stderr, "Unable to set up VP8 for call %u\n", i);
+        return false;
+    }
+    vpx_codec_control(&calls[i].encoder, VP8E_SET_CPUUSED, 8);
+
+    calls[i].frames     = frame_pool_new();
+    calls[i].last_frame = -1;
+
+    friends[i].call_state_self   = TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V;
+    friends[i].call_state_friend = TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V;
+    video_send_set_bitrate(i, bitrate);
+    return true;
+}
+
+static int compare(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const uint64_t *sorted, size_t count, double p) {
+    return count ? sorted[(size_t)(p * (count - 1))] / 1000.0 : 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned width = 1280, height = 720, call_count = 1, frames = 500, bitrate = UTOX_DEFAULT_BITRATE_V;
+    if ((argc > 1 && sscanf(argv[1], "%ux%u", &width, &height) != 2) || (argc > 2 && !(call_count = atoi(argv[2])))
+        || (argc > 3 && !(frames = atoi(argv[3]))) || (argc > 4 && !(bitrate = atoi(argv[4])))
+        || width > UINT16_MAX || height > UINT16_MAX || call_count > UTOX_MAX_CALLS || frames > MAX_FRAMES) {
+        fprintf(stderr, "Usage: %s [WIDTHxHEIGHT] [calls, up to %u] [frames, up to %u] [kbit/s]\n", argv[0],
+                UTOX_MAX_CALLS, MAX_FRAMES);
+        return 1;
+    }
+
+    char spec[32];
+    snprintf(spec, sizeof(spec), "%ux%u@%u", width, height, fps);
+    if (!video_synthetic_configure(spec)) {
+        fprintf(stderr, "The synthetic source can't draw %ux%u frames\n", width, height);
+        return 1;
+    }
+
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        stages[i].samples = malloc(sizeof(uint64_t) * frames * (i <= STAGE_CONVERT ? 1 : call_count));
+    }
+
+    /* Calls at full size, and as far down the bitrates as asked for. */
+    for (uint32_t i = 0; i < call_count; ++i) {
+        const unsigned lowest = MIN(bitrate, 500);
+        if (!start_call(i, width, height, call_count > 1 ? bitrate - (bitrate - lowest) * i / (call_count - 1) : bitrate)) {
+            return 1;
+        }
+    }
+
+    uint8_t *           bgrx  = malloc((size_t)width * height * 4);
+    uint8_t *           yuv   = malloc((size_t)width * height * 3 / 2);
+    utox_av_video_frame frame = { .w = width, .h = height, .y = yuv };
+    frame.u                   = yuv + width * height;
+    frame.v                   = frame.u + width * height / 4;
+
+    const uint64_t start = get_time();
+    for (frame_number = 0; frame_number < frames; ++frame_number) {
+        uint64_t now = frame_start[frame_number] = get_time();
+        video_synthetic_draw(bgrx, width, height, frame_number);
+        sample(STAGE_CAPTURE, get_time() - now);
+
+        now = get_time();
+        bgrxtoyuv420(frame.y, frame.u, frame.v, bgrx, width, height);
+        sample(STAGE_CONVERT, get_time() - now);
+
+        video_send_frame(NULL, &frame);
+    }
+    const double elapsed = (get_time() - start) / 1e9;
+
+    printf("%ux%u, %u calls, %u frames, %s kernels\n", width, height, call_count, frames, colorspace_kernels_name());
+    printf("%.1f frames/s captured, %.1f frames/s shown over all calls\n\n", frames / elapsed,
+           stages[STAGE_TOTAL].count / elapsed);
+
+    printf("%-14s %10s %10s %10s %10s  (us)\n", "", "p50", "p90", "p99", "max");
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        qsort(stages[i].samples, stages[i].count, sizeof(uint64_t), compare);
+        printf("%-14s %10.1f %10.1f %10.1f %10.1f\n", stage_names[i],
+               percentile(stages[i].samples, stages[i].count, 0.5),
+               percentile(stages[i].samples, stages[i].count, 0.9),
+               percentile(stages[i].samples, stages[i].count, 0.99),
+               percentile(stages[i].samples, stages[i].count, 1));
+        free(stages[i].samples);
+    }
+
+    printf("\n");
+    for (uint32_t i = 0; i < call_count; ++i) {
+        uint16_t w, h;
+        video_send_size(friends[i].video_bitrate, width, height, &w, &h);
+        printf("call %-2u %5u kbit/s %4ux%-4u %8.1f kbit/s encoded at %u fps, %lu frames lost\n", i,
+               friends[i].video_bitrate, w, h, calls[i].bytes * 8.0 * fps / frames / 1000, fps,
+               (unsigned long)calls[i].lost);
+
+        vpx_codec_destroy(&calls[i].encoder);
+        vpx_codec_destroy(&calls[i].decoder);
+        frame_pool_free(calls[i].frames);
+    }
+
+    video_send_free();
+    free(bgrx);
+    free(yuv);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/macros.h"
+#include "../src/chatlog.c"
+#include "../src/chatlog_search.c"
+#include "../src/text.c"
+
+/* Builds a search index over a synthetic history and times it, along with a few queries and a save and reload.
+ *
+ * Usage: bench_chatlog_search [messages] */
+
+#define BENCH_FRIENDS 200
+#define BENCH_WORDS   50000
+
+void native_export_chatlog_init(uint32_t friend_number) {}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Roughly Zipf distributed, so a few words are everywhere and most are rare, like in real chats. */
+static uint32_t rng_word(void) {
+    double u = (double)(rng() >> 11) / (double)(1ull << 53);
+    return (uint32_t)(BENCH_WORDS * u * u * u);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void bench_queries(void) {
+    const char *queries[] = { "w1", "w12", "w123", "w1234 w1", "w7 w8 w9", "w49999", "nothing" };
+
+    for (size_t i = 0; i < COUNTOF(queries); ++i) {
+        size_t count;
+        double start = now_ms();
+        free(chatlog_search(queries[i], strlen(queries[i]), &count));
+        printf("  query %-12s %9lu hits  %9.3f ms\n", queries[i], count, now_ms() - start);
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000 * 1000;
+
+    utox_get_file(SEARCH_INDEX_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+    chatlog_search_start();
+
+    char     ids[BENCH_FRIENDS][TOX_PUBLIC_KEY_SIZE * 2];
+    uint64_t offsets[BENCH_FRIENDS] = { 0 };
+    for (int i = 0; i < BENCH_FRIENDS; ++i) {
+        char id[TOX_PUBLIC_KEY_SIZE * 2 + 1];
+        snprintf(id, sizeof(id), "%064X", i);
+        memcpy(ids[i], id, TOX_PUBLIC_KEY_SIZE * 2);
+    }
+
+    size_t text_bytes = 0;
+    double start      = now_ms();
+    for (size_t i = 0; i < messages; ++i) {
+        char   text[512];
+        size_t length = 0;
+        int    words  = 3 + rng() % 13;
+        for (int w = 0; w < words; ++w) {
+            length += snprintf(text + length, sizeof(text) - length, "%sW%u", w ? " " : "", rng_word());
+        }
+
+        int friend = rng() % BENCH_FRIENDS;
+        size_t record = sizeof(LOG_FILE_MSG_HEADER) + 16 + length + 1;
+        chatlog_search_add(ids[friend], offsets[friend], record, text, length);
+        offsets[friend] += record;
+        text_bytes += length;
+    }
+    double build = now_ms() - start;
+
+    printf("indexed %lu messages (%.1f MiB of text) in %.1f ms, %.0f messages/s\n", messages,
+           text_bytes / (1024.0 * 1024.0), build, messages / (build / 1000.0));
+    printf("  %u terms, %lu bytes of tokens\n", search.term_count, search.tokens_length);
+
+    start = now_ms();
+    pthread_mutex_lock(&search.lock);
+    search_sort_terms();
+    pthread_mutex_unlock(&search.lock);
+    printf("  sorting terms took %.1f ms\n", now_ms() - start);
+
+    bench_queries();
+
+    start = now_ms();
+    chatlog_search_stop();
+    printf("saved in %.1f ms\n", now_ms() - start);
+
+    start = now_ms();
+    chatlog_search_start();
+    printf("loaded in %.1f ms\n", now_ms() - start);
+
+    bench_queries();
+    chatlog_search_stop();
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/macros.h"
+#include "../src/av/colorspace.c"
+#include "../src/av/colorspace_neon.c"
+#include "../src/av/colorspace_x86.c"
+
+/* Times every conversion with each kernel set the CPU supports, at the usual video sizes.
+ *
+ * Usage: bench_colorspace [milliseconds per measurement] */
+
+static const struct {
+    uint16_t width, height;
+} sizes[] = { { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint8_t *in, *out;
+
+static void run(int conversion, uint16_t w, uint16_t h) {
+    const size_t luma = (size_t)w * h;
+
+    switch (conversion) {
+        case 0: yuv420tobgr(w, h, in, in + luma, in + luma * 5 / 4, w, w / 2, w / 2, out); break;
+        case 1: bgrxtoyuv420(out, out + luma, out + luma * 5 / 4, in, w, h); break;
+        case 2: bgrtoyuv420(out, out + luma, out + luma * 5 / 4, in, w, h); break;
+        case 3: yuv422to420(out, out + luma, out + luma * 5 / 4, in, w, h); break;
+    }
+}
+
+int main(int argc, char **argv) {
+    const double duration = argc > 1 ? strtod(argv[1], NULL) : 250;
+    const char * names[]  = { "yuv420tobgr", "bgrxtoyuv420", "bgrtoyuv420", "yuv422to420" };
+
+    in  = malloc(1920 * 1080 * 4);
+    out = malloc(1920 * 1080 * 4);
+    for (size_t i = 0; i < 1920 * 1080 * 4; ++i) {
+        in[i] = i * 2654435761u >> 24;
+    }
+
+    colorspace_get();
+    printf("%-14s %-6s", "", "");
+    for (size_t s = 0; s < COUNTOF(sizes); ++s) {
+        printf(" %5ux%-5u", sizes[s].width, sizes[s].height);
+    }
+    printf("  (Mpixel/s)\n");
+
+    for (int c = 0; c < 4; ++c) {
+        for (size_t k = 0; k < COUNTOF(colorspace_all); ++k) {
+            if (colorspace_all[k]->supported && !colorspace_all[k]->supported()) {
+                continue;
+            }
+            kernels = colorspace_all[k];
+
+            printf("%-14s %-6s", names[c], kernels->name);
+            for (size_t s = 0; s < COUNTOF(sizes); ++s) {
+                unsigned long frames = 0;
+                double        start  = now_ms(), elapsed;
+                do {
+                    run(c, sizes[s].width, sizes[s].height);
+                    frames++;
+                } while ((elapsed = now_ms() - start) < duration);
+
+                printf(" %11.1f", (double)frames * sizes[s].width * sizes[s].height / (elapsed * 1000.0));
+            }
+            printf("\n");
+        }
+    }
+
+    free(in);
+    free(out);
+    return 0;
+}
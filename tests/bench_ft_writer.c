@@ -0,0 +1,124 @@
+#include "../src/ft_writer.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Replays a stream of incoming file chunks, the size toxcore hands them over, into a file the old way, seeking,
+ * writing and flushing every chunk and rewriting the resume info every 20, and through the write-behind writer,
+ * which only checkpoints what's durable. Reports how fast it got to disk, and how long the thread handing the chunks
+ * over, toxcore's in uTox, was held up in total and by the slowest chunk.
+ *
+ * Usage: bench_ft_writer [MiB] [directory] */
+
+#define CHUNK 1371
+#define RESUME_INFO 1200 // about what sizeof(FILE_TRANSFER) is
+
+uint64_t get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+typedef struct {
+    double   seconds;
+    uint64_t stall_ns, worst_ns;
+    uint32_t checkpoints;
+} RESULT;
+
+static uint8_t chunk[CHUNK], resume_info[RESUME_INFO];
+
+static void checkpoint(FILE *resume, uint64_t offset) {
+    memcpy(resume_info, &offset, sizeof(offset));
+    fseeko(resume, 0, SEEK_SET);
+    fwrite(resume_info, RESUME_INFO, 1, resume);
+    fflush(resume);
+}
+
+static RESULT replay(bool behind, FILE *file, FILE *resume, uint64_t size) {
+    RESULT result = { 0 };
+
+    FT_WRITER *writer = behind ? ft_writer_new(file, 0) : NULL;
+    uint8_t    resume_update = 0;
+
+    const uint64_t start = get_time();
+    for (uint64_t position = 0; position < size; position += CHUNK) {
+        const size_t length = MIN(CHUNK, size - position);
+        chunk[0]            = position;
+
+        const uint64_t begin = get_time();
+        if (behind) {
+            ft_writer_push(writer, position, chunk, length);
+
+            uint64_t durable;
+            if (ft_writer_durable(writer, &durable)) {
+                checkpoint(resume, durable);
+                result.checkpoints++;
+            }
+        } else {
+            fseeko(file, position, SEEK_SET);
+            fwrite(chunk, length, 1, file);
+            fflush(file);
+
+            if (resume_update) {
+                --resume_update;
+            } else {
+                checkpoint(resume, position + length);
+                result.checkpoints++;
+                resume_update = 20;
+            }
+        }
+        const uint64_t spent = get_time() - begin;
+
+        result.stall_ns += spent;
+        result.worst_ns = MAX(result.worst_ns, spent);
+    }
+
+    if (behind) {
+        ft_writer_flush(writer);
+        ft_writer_free(writer);
+    } else {
+        fflush(file);
+    }
+    result.seconds = (get_time() - start) / 1e9;
+
+    return result;
+}
+
+static FILE *open_in(const char *directory, const char *name) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+    FILE *file = fopen(path, "wb+");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        exit(1);
+    }
+    remove(path);
+    return file;
+}
+
+int main(int argc, char **argv) {
+    const uint64_t size      = (argc > 1 ? strtoull(argv[1], NULL, 10) : 256) << 20;
+    const char *   directory = argc > 2 ? argv[2] : "/tmp";
+
+    printf("%lu MiB in %u byte chunks, to %s\n", (unsigned long)(size >> 20), CHUNK, directory);
+    printf("%-14s %10s %12s %12s %12s\n", "", "MB/s", "stalled ms", "worst us", "checkpoints");
+
+    for (int behind = 0; behind < 2; ++behind) {
+        FILE *file   = open_in(directory, "bench_ft_writer.data");
+        FILE *resume = open_in(directory, "bench_ft_writer.ftinfo");
+
+        const RESULT r = replay(behind, file, resume, size);
+        printf("%-14s %10.1f %12.1f %12.1f %12u\n", behind ? "write behind" : "every chunk", size / 1e6 / r.seconds,
+               r.stall_ns / 1e6, r.worst_ns / 1e3, r.checkpoints);
+
+        fclose(resume);
+        fclose(file);
+    }
+
+    return 0;
+}
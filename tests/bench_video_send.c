@@ -0,0 +1,162 @@
+#include "../src/av/video_send.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Times getting one captured frame out to N video calls among a friend list of FRIENDS, the old way, looking at every
+ * friend and scaling for each call on its own, and through the send set, where calls at the same size share a frame.
+ * Calls get a spread of bitrates. toxav is stubbed out to just read the planes, its encode isn't what's measured.
+ *
+ * Usage: bench_video_send [milliseconds per measurement] */
+
+#define FRIENDS 500
+#define SOURCE_FRAMES 8
+
+static FRIEND friends[FRIENDS];
+
+FRIEND *get_friend(uint32_t friend_number) {
+    return friend_number < FRIENDS ? &friends[friend_number] : NULL;
+}
+
+static uint32_t checksum;
+
+bool toxav_video_send_frame(ToxAV *av, uint32_t friend_number, uint16_t width, uint16_t height, const uint8_t *y,
+                            const uint8_t *u, const uint8_t *v, TOXAV_ERR_SEND_FRAME *error) {
+    const size_t luma = (size_t)width * height;
+    for (size_t i = 0; i < luma; i += 64) {
+        checksum += y[i];
+    }
+    for (size_t i = 0; i < luma / 4; i += 64) {
+        checksum += u[i] + v[i];
+    }
+
+    *error = 0;
+    return true;
+}
+
+static const uint32_t bitrates[] = { 5000, 1500, 800, 2500, 512, 0, 700, 1200 };
+
+static const struct {
+    uint16_t width, height;
+} sizes[] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+
+static const uint32_t peers[] = { 1, 2, 4, 8, 16 };
+
+/* A synthetic capture source, a gradient that moves a little every frame. */
+static utox_av_video_frame source[SOURCE_FRAMES];
+
+static void make_source(uint16_t w, uint16_t h) {
+    for (int f = 0; f < SOURCE_FRAMES; ++f) {
+        free(source[f].y);
+        source[f]   = (utox_av_video_frame){ .w = w, .h = h, .y = malloc((size_t)w * h * 3 / 2) };
+        source[f].u = source[f].y + (size_t)w * h;
+        source[f].v = source[f].u + (size_t)w * h / 4;
+
+        for (uint32_t y = 0; y < h; ++y) {
+            for (uint32_t x = 0; x < w; ++x) {
+                source[f].y[y * w + x] = x + y + f * 4;
+            }
+        }
+        for (uint32_t y = 0; y < h / 2u; ++y) {
+            for (uint32_t x = 0; x < w / 2u; ++x) {
+                source[f].u[y * w / 2 + x] = x - f * 2;
+                source[f].v[y * w / 2 + x] = y + f * 2;
+            }
+        }
+    }
+}
+
+/* The friends in calls are spread out over the list. */
+static void start_calls(uint32_t count) {
+    for (uint32_t i = 0; i < FRIENDS; ++i) {
+        friends[i].call_state_self   = 0;
+        friends[i].call_state_friend = 0;
+        video_send_update(i);
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint32_t n = i * (FRIENDS / count);
+        friends[n].call_state_self   = TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V;
+        friends[n].call_state_friend = TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V;
+        video_send_set_bitrate(n, bitrates[i % COUNTOF(bitrates)]);
+    }
+}
+
+static uint8_t *scratch;
+
+static void send_scan_all(const utox_av_video_frame *frame) {
+    for (uint32_t i = 0; i < FRIENDS; ++i) {
+        if (!SEND_VIDEO_FRAME(i)) {
+            continue;
+        }
+
+        uint16_t w, h;
+        video_send_size(get_friend(i)->video_bitrate, frame->w, frame->h, &w, &h);
+        if (w == frame->w && h == frame->h) {
+            TOXAV_ERR_SEND_FRAME error;
+            toxav_video_send_frame(NULL, i, w, h, frame->y, frame->u, frame->v, &error);
+            continue;
+        }
+
+        const size_t luma = (size_t)w * h;
+        uint8_t *    y = scratch, *u = y + luma, *v = u + luma / 4;
+        scale_plane(frame->y, frame->w, frame->h, y, w, h);
+        scale_plane(frame->u, frame->w / 2, frame->h / 2, u, w / 2, h / 2);
+        scale_plane(frame->v, frame->w / 2, frame->h / 2, v, w / 2, h / 2);
+
+        TOXAV_ERR_SEND_FRAME error;
+        toxav_video_send_frame(NULL, i, w, h, y, u, v, &error);
+    }
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double measure(bool grouped, double duration) {
+    unsigned long frames = 0;
+    double        start  = now_ms(), elapsed;
+    do {
+        const utox_av_video_frame *frame = &source[frames % SOURCE_FRAMES];
+        if (grouped) {
+            video_send_frame(NULL, frame);
+        } else {
+            send_scan_all(frame);
+        }
+        frames++;
+    } while ((elapsed = now_ms() - start) < duration);
+
+    return frames * 1000.0 / elapsed;
+}
+
+int main(int argc, char **argv) {
+    const double duration = argc > 1 ? strtod(argv[1], NULL) : 250;
+
+    scratch = malloc(1920 * 1080 * 3 / 2);
+
+    printf("%-10s %6s %12s %12s  (frames/s)\n", "", "calls", "scan all", "grouped");
+    for (size_t s = 0; s < COUNTOF(sizes); ++s) {
+        make_source(sizes[s].width, sizes[s].height);
+
+        for (size_t p = 0; p < COUNTOF(peers); ++p) {
+            start_calls(peers[p]);
+            const double scan_all = measure(false, duration), grouped = measure(true, duration);
+            printf("%4ux%-5u %6u %12.1f %12.1f\n", sizes[s].width, sizes[s].height, peers[p], scan_all, grouped);
+        }
+    }
+
+    start_calls(0);
+    for (int f = 0; f < SOURCE_FRAMES; ++f) {
+        free(source[f].y);
+    }
+    free(scratch);
+    video_send_free();
+
+    printf("checksum %u\n", checksum);
+    return 0;
+}
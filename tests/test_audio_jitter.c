@@ -0,0 +1,275 @@
+#include "../src/av/audio_jitter.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define RATE 48000
+#define FRAME (RATE / 1000 * AUDIO_JITTER_FRAME_MS)
+#define MS (1000 * 1000ull)
+
+static uint64_t fake_time = 1000 * MS;
+
+uint64_t get_time(void) {
+    return fake_time;
+}
+
+static int16_t in[FRAME * 2];
+static int16_t out[AUDIO_JITTER_MAX_FRAME];
+
+/* Pushes frames of mono audio at a constant level, as if they arrived every 20ms. */
+static void arrive(AUDIO_JITTER *jitter, int16_t level, size_t frames) {
+    for (size_t i = 0; i < FRAME; ++i) {
+        in[i] = level;
+    }
+    for (size_t i = 0; i < frames; ++i) {
+        fake_time += AUDIO_JITTER_FRAME_MS * MS;
+        ck_assert(audio_jitter_push(jitter, in, FRAME, 1, RATE));
+    }
+}
+
+static size_t pull(AUDIO_JITTER *jitter, bool conceal) {
+    uint8_t  channels;
+    uint32_t sample_rate;
+    return audio_jitter_pull(jitter, out, &channels, &sample_rate, conceal);
+}
+
+static bool all(size_t samples, int16_t level) {
+    for (size_t i = 0; i < samples; ++i) {
+        if (out[i] != level) {
+            return false;
+        }
+    }
+    return true;
+}
+
+START_TEST(test_audio_jitter_prime)
+{
+    AUDIO_JITTER *jitter = audio_jitter_new();
+    ck_assert(jitter);
+
+    ck_assert(pull(jitter, true) == 0);
+
+    // Nothing comes out until there's as much as the target.
+    const size_t target = AUDIO_JITTER_MIN_MS / AUDIO_JITTER_FRAME_MS;
+    for (size_t i = 0; i < target - 1; ++i) {
+        arrive(jitter, 100, 1);
+        ck_assert(pull(jitter, true) == 0);
+    }
+    arrive(jitter, 100, 1);
+
+    AUDIO_JITTER_STATS stats;
+    audio_jitter_stats(jitter, &stats);
+    ck_assert(stats.jitter_ms == 0 && stats.target_ms == AUDIO_JITTER_MIN_MS);
+    ck_assert(stats.latency_ms == AUDIO_JITTER_MIN_MS);
+
+    uint8_t  channels;
+    uint32_t sample_rate;
+    ck_assert(audio_jitter_pull(jitter, out, &channels, &sample_rate, false) == FRAME);
+    ck_assert(channels == 1 && sample_rate == RATE);
+    ck_assert(all(FRAME, 100));
+
+    // Arriving on time keeps it going without ever running out.
+    for (size_t i = 0; i < 50; ++i) {
+        arrive(jitter, 100, 1);
+        ck_assert(pull(jitter, true) == FRAME);
+    }
+    audio_jitter_stats(jitter, &stats);
+    ck_assert(!stats.underruns && !stats.overruns && !stats.concealed);
+
+    audio_jitter_free(jitter);
+}
+END_TEST
+
+START_TEST(test_audio_jitter_conceal)
+{
+    AUDIO_JITTER *jitter = audio_jitter_new();
+    arrive(jitter, 1000, AUDIO_JITTER_MIN_MS / AUDIO_JITTER_FRAME_MS);
+    while (pull(jitter, false)) {
+        ck_assert(all(FRAME, 1000));
+    }
+
+    // Running out isn't missing audio yet, until there's nothing else to play.
+    AUDIO_JITTER_STATS stats;
+    audio_jitter_stats(jitter, &stats);
+    ck_assert(!stats.underruns);
+
+    ck_assert(pull(jitter, true) == FRAME);
+    ck_assert(all(FRAME, 500));
+    ck_assert(pull(jitter, true) == FRAME);
+    ck_assert(all(FRAME, 250));
+
+    // Then goes quiet, rather than making it up for ever.
+    for (size_t i = 2; i < AUDIO_JITTER_CONCEAL_MAX; ++i) {
+        ck_assert(pull(jitter, true) == FRAME);
+    }
+    ck_assert(pull(jitter, true) == 0);
+
+    audio_jitter_stats(jitter, &stats);
+    ck_assert(stats.underruns == 1 && stats.concealed == AUDIO_JITTER_CONCEAL_MAX);
+
+    // And waits for a longer target than before.
+    ck_assert(stats.target_ms > AUDIO_JITTER_MIN_MS);
+    arrive(jitter, 1000, AUDIO_JITTER_MIN_MS / AUDIO_JITTER_FRAME_MS);
+    ck_assert(pull(jitter, true) == 0);
+    arrive(jitter, 1000, (stats.target_ms - AUDIO_JITTER_MIN_MS + AUDIO_JITTER_FRAME_MS - 1) / AUDIO_JITTER_FRAME_MS);
+    ck_assert(pull(jitter, true) == FRAME);
+    ck_assert(all(FRAME, 1000));
+
+    audio_jitter_free(jitter);
+}
+END_TEST
+
+static uint32_t hook_missing;
+
+static void conceal_hook(int16_t *out_, const int16_t *last, size_t samples, uint8_t channels, uint32_t missing,
+                         void *userdata) {
+    ck_assert(userdata == &hook_missing);
+    ck_assert(last[0] == 7 || last[0] == -1);
+    hook_missing = missing;
+    for (size_t i = 0; i < samples * channels; ++i) {
+        out_[i] = -1;
+    }
+}
+
+START_TEST(test_audio_jitter_conceal_hook)
+{
+    AUDIO_JITTER *jitter = audio_jitter_new();
+    audio_jitter_set_conceal(jitter, conceal_hook, &hook_missing);
+
+    arrive(jitter, 7, AUDIO_JITTER_MIN_MS / AUDIO_JITTER_FRAME_MS);
+    while (pull(jitter, false)) {
+        continue;
+    }
+
+    ck_assert(pull(jitter, true) == FRAME);
+    ck_assert(hook_missing == 1 && all(FRAME, -1));
+    ck_assert(pull(jitter, true) == FRAME);
+    ck_assert(hook_missing == 2);
+
+    audio_jitter_set_conceal(jitter, NULL, NULL);
+    ck_assert(pull(jitter, true) == FRAME);
+    ck_assert(hook_missing == 2 && all(FRAME, 0));
+
+    audio_jitter_free(jitter);
+}
+END_TEST
+
+START_TEST(test_audio_jitter_adapt)
+{
+    AUDIO_JITTER *jitter = audio_jitter_new();
+
+    // Arriving in bursts pushes the target up.
+    for (size_t i = 0; i < 100; ++i) {
+        fake_time += 4 * AUDIO_JITTER_FRAME_MS * MS;
+        for (size_t j = 0; j < 4; ++j) {
+            ck_assert(audio_jitter_push(jitter, in, FRAME, 1, RATE));
+        }
+    }
+
+    AUDIO_JITTER_STATS stats;
+    audio_jitter_stats(jitter, &stats);
+    ck_assert(stats.jitter_ms >= AUDIO_JITTER_FRAME_MS);
+    ck_assert(stats.target_ms > AUDIO_JITTER_MIN_MS + AUDIO_JITTER_FRAME_MS * 2);
+    ck_assert(stats.target_ms <= AUDIO_JITTER_MAX_MS);
+
+    // And arriving evenly again brings it back down.
+    const uint32_t bursty = stats.target_ms;
+    for (size_t i = 0; i < 200; ++i) {
+        arrive(jitter, 0, 1);
+        pull(jitter, true);
+    }
+    audio_jitter_stats(jitter, &stats);
+    ck_assert(stats.target_ms < bursty);
+    ck_assert(stats.target_ms <= AUDIO_JITTER_MIN_MS + 2);
+
+    audio_jitter_free(jitter);
+}
+END_TEST
+
+START_TEST(test_audio_jitter_overrun)
+{
+    AUDIO_JITTER *jitter = audio_jitter_new();
+
+    // Nobody's playing it, so it's kept from falling further behind than the target allows.
+    arrive(jitter, 1, 20);
+
+    AUDIO_JITTER_STATS stats;
+    audio_jitter_stats(jitter, &stats);
+    ck_assert(stats.overruns > 0);
+    ck_assert(stats.latency_ms <= stats.target_ms + AUDIO_JITTER_EXCESS_MS);
+    ck_assert(stats.latency_ms >= stats.target_ms);
+
+    // Without losing what arrived last.
+    arrive(jitter, 2, 1);
+    size_t frames = 0;
+    while (pull(jitter, false)) {
+        frames++;
+    }
+    ck_assert(all(FRAME, 2));
+    ck_assert(frames * AUDIO_JITTER_FRAME_MS <= AUDIO_JITTER_MAX_MS + AUDIO_JITTER_EXCESS_MS);
+
+    audio_jitter_free(jitter);
+}
+END_TEST
+
+START_TEST(test_audio_jitter_format)
+{
+    AUDIO_JITTER *jitter = audio_jitter_new();
+
+    ck_assert(!audio_jitter_push(jitter, in, FRAME, 3, RATE));
+    ck_assert(!audio_jitter_push(jitter, in, FRAME, 1, 96000));
+
+    arrive(jitter, 5, AUDIO_JITTER_MIN_MS / AUDIO_JITTER_FRAME_MS);
+
+    // Changing format starts over.
+    for (size_t i = 0; i < FRAME / 2; ++i) {
+        in[i * 2]     = 3;
+        in[i * 2 + 1] = -3;
+    }
+    for (size_t i = 0; i < AUDIO_JITTER_MIN_MS / AUDIO_JITTER_FRAME_MS; ++i) {
+        fake_time += AUDIO_JITTER_FRAME_MS * MS;
+        ck_assert(audio_jitter_push(jitter, in, FRAME / 2, 2, RATE / 2));
+    }
+
+    uint8_t  channels;
+    uint32_t sample_rate;
+    ck_assert(audio_jitter_pull(jitter, out, &channels, &sample_rate, false) == FRAME / 2);
+    ck_assert(channels == 2 && sample_rate == RATE / 2);
+    ck_assert(out[0] == 3 && out[1] == -3 && out[FRAME - 2] == 3 && out[FRAME - 1] == -3);
+
+    audio_jitter_flush(jitter);
+    ck_assert(pull(jitter, true) == 0);
+
+    audio_jitter_free(jitter);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Audio Jitter");
+
+    MK_TEST_CASE(audio_jitter_prime)
+    MK_TEST_CASE(audio_jitter_conceal)
+    MK_TEST_CASE(audio_jitter_conceal_hook)
+    MK_TEST_CASE(audio_jitter_adapt)
+    MK_TEST_CASE(audio_jitter_overrun)
+    MK_TEST_CASE(audio_jitter_format)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
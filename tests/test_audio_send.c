@@ -0,0 +1,183 @@
+#include "../src/av/audio_send.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define FRIENDS 24
+
+static FRIEND friends[FRIENDS];
+
+FRIEND *get_friend(uint32_t friend_number) {
+    return friend_number < FRIENDS ? &friends[friend_number] : NULL;
+}
+
+static struct {
+    bool           group;
+    uint32_t       number;
+    const int16_t *pcm;
+} sent[UTOX_MAX_CALLS * 4];
+static size_t sent_count;
+
+static uint32_t failing_group = UINT32_MAX;
+
+bool toxav_audio_send_frame(ToxAV *av, uint32_t friend_number, const int16_t *pcm, size_t sample_count,
+                            uint8_t channels, uint32_t sampling_rate, TOXAV_ERR_SEND_FRAME *error) {
+    sent[sent_count].group  = false;
+    sent[sent_count].number = friend_number;
+    sent[sent_count].pcm    = pcm;
+    sent_count++;
+
+    *error = 0;
+    return true;
+}
+
+Tox *toxav_get_tox(const ToxAV *av) {
+    return NULL;
+}
+
+int toxav_group_send_audio(Tox *tox, uint32_t groupnumber, const int16_t *pcm, unsigned int samples, uint8_t channels,
+                           uint32_t sample_rate) {
+    if (groupnumber == failing_group) {
+        return -1;
+    }
+
+    sent[sent_count].group  = true;
+    sent[sent_count].number = groupnumber;
+    sent[sent_count].pcm    = pcm;
+    sent_count++;
+
+    return 0;
+}
+
+static int16_t pcm[960];
+
+static size_t send(void) {
+    sent_count = 0;
+    return audio_send_frame(NULL, pcm, COUNTOF(pcm), 1, 48000);
+}
+
+static bool was_sent(bool group, uint32_t number) {
+    for (size_t i = 0; i < sent_count; ++i) {
+        if (sent[i].group == group && sent[i].number == number) {
+            return sent[i].pcm == pcm;
+        }
+    }
+    return false;
+}
+
+static void set_call(uint32_t friend_number, uint8_t self_state, uint8_t friend_state) {
+    friends[friend_number].call_state_self   = self_state;
+    friends[friend_number].call_state_friend = friend_state;
+    audio_send_update(friend_number);
+}
+
+START_TEST(test_audio_send_calls)
+{
+    ck_assert(send() == 0);
+
+    const uint8_t both = TOXAV_FRIEND_CALL_STATE_SENDING_A | TOXAV_FRIEND_CALL_STATE_ACCEPTING_A;
+    set_call(3, both, both);
+    set_call(9, both, both);
+    ck_assert(send() == 2 && sent_count == 2);
+    ck_assert(was_sent(false, 3) && was_sent(false, 9));
+
+    // Only once, however often the state's updated.
+    set_call(3, both, both);
+    ck_assert(send() == 2);
+
+    // Not to friends who aren't taking audio, or when we're not sending it.
+    set_call(5, both, TOXAV_FRIEND_CALL_STATE_SENDING_A);
+    set_call(6, TOXAV_FRIEND_CALL_STATE_ACCEPTING_A, both);
+    ck_assert(send() == 2);
+
+    // Until they are.
+    set_call(5, both, both);
+    ck_assert(send() == 3 && was_sent(false, 5));
+
+    set_call(3, 0, 0);
+    set_call(9, 0, 0);
+    set_call(5, 0, 0);
+    ck_assert(send() == 0 && audio_send_count() == 0);
+
+    // Friends that are gone come out too.
+    audio_send_set(FRIENDS + 1, true);
+    ck_assert(audio_send_count() == 1);
+    audio_send_update(FRIENDS + 1);
+    ck_assert(audio_send_count() == 0);
+}
+END_TEST
+
+START_TEST(test_audio_send_groups)
+{
+    // Group and friend numbers don't get mixed up.
+    audio_send_group(3, true);
+    audio_send_set(3, true);
+    ck_assert(send() == 2 && was_sent(true, 3) && was_sent(false, 3));
+
+    audio_send_group(3, false);
+    ck_assert(send() == 1 && was_sent(false, 3));
+    audio_send_group(3, false);
+    audio_send_set(3, false);
+    ck_assert(send() == 0);
+
+    // A group that can't be sent to isn't counted.
+    audio_send_group(1, true);
+    audio_send_group(2, true);
+    failing_group = 1;
+    ck_assert(send() == 1 && was_sent(true, 2));
+    failing_group = UINT32_MAX;
+
+    audio_send_group(1, false);
+    audio_send_group(2, false);
+    ck_assert(audio_send_count() == 0);
+}
+END_TEST
+
+START_TEST(test_audio_send_full)
+{
+    // More calls than UTOX_MAX_CALLS between friends and groups, and every one of them is sent to.
+    const uint32_t groups = UTOX_MAX_CALLS * 2 + 1;
+    for (uint32_t i = 0; i < groups; ++i) {
+        ck_assert(audio_send_group(i, true));
+    }
+    ck_assert(audio_send_set(0, true));
+    ck_assert(audio_send_count() == groups + 1);
+    ck_assert(send() == groups + 1 && was_sent(true, groups - 1) && was_sent(false, 0));
+
+    audio_send_group(0, false);
+    ck_assert(send() == groups && was_sent(true, groups - 1) && !was_sent(true, 0));
+
+    for (uint32_t i = 0; i < groups; ++i) {
+        audio_send_group(i, false);
+    }
+    audio_send_set(0, false);
+    ck_assert(audio_send_count() == 0);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Audio Send");
+
+    MK_TEST_CASE(audio_send_calls)
+    MK_TEST_CASE(audio_send_groups)
+    MK_TEST_CASE(audio_send_full)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "../src/macros.h"
 #include "../src/chatlog.c"
@@ -23,11 +24,22 @@ void native_export_chatlog_init(uint32_t friend_number) {
 
 bool test_write_chatlog();
 bool test_read_chatlog();
+bool test_chatlog_index();
+bool test_chatlog_writer();
+bool test_chatlog_writer_failed();
 
 int main() {
     int result = 0;
     RUN_TEST(test_write_chatlog)
     RUN_TEST(test_read_chatlog)
+    RUN_TEST(test_chatlog_index)
+    RUN_TEST(test_chatlog_writer)
+    RUN_TEST(test_chatlog_writer_failed)
+
+    // and again without mapping the log
+    chatlog_mmap = false;
+    RUN_TEST(test_read_chatlog)
+    RUN_TEST(test_chatlog_index)
 
     return result;
 }
@@ -77,14 +89,14 @@ bool test_write_chatlog() {
     size_t length1;
     uint8_t *data1 = create_mock_message(&length1);
 
-    uint64_t disk_offset1 = utox_save_chatlog(id_str, data1, length1);
+    uint64_t disk_offset1 = utox_save_chatlog(id_str, data1, length1, NULL);
     LOG("disk offset 1: %lu", disk_offset1);
     assert(disk_offset1 == 0);
 
     size_t length2;
     uint8_t *data2 = create_mock_message(&length2);
 
-    uint64_t disk_offset2 = utox_save_chatlog(id_str, data2, length2);
+    uint64_t disk_offset2 = utox_save_chatlog(id_str, data2, length2, NULL);
     LOG("disk offset 2: %lu", disk_offset2);
     assert(disk_offset2 == length1);
 
@@ -94,11 +106,265 @@ bool test_write_chatlog() {
     return true;
 }
 
+static void free_loaded(MSG_HEADER **data, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (data[i]->log_map) {
+            utox_chatlog_map_release(data[i]->log_map);
+        } else {
+            free(data[i]->via.txt.msg);
+            free(data[i]);
+        }
+    }
+    free(data);
+}
+
+static uint8_t *create_mock_log(char id_str[TOX_PUBLIC_KEY_SIZE * 2], int count, size_t *length) {
+    uint8_t *data = create_mock_message(length);
+
+    utox_remove_friend_chatlog(id_str);
+    for (int i = 0; i < count; ++i) {
+        utox_save_chatlog(id_str, data, *length, NULL);
+    }
+
+    return data;
+}
+
+/**
+ * @covers utox_load_chatlog()
+ */
 bool test_read_chatlog() {
-    LOG_INFO("test", "testing...");
-//    FAIL("not good!");
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2] = MOCK_FRIEND_ID;
+
+    size_t length;
+    uint8_t *data = create_mock_log(id_str, 10, &length);
+
+    size_t count = 0;
+    MSG_HEADER **msgs = utox_load_chatlog(id_str, &count, 4, 0);
+    if (!msgs || count != 4) {
+        FAIL("expected 4 messages, got %lu", count);
+    }
+
+    if (!msgs[0]->log_map != !chatlog_mmap) {
+        FAIL("messages weren't loaded the way we asked for");
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (msgs[i]->disk_offset != (6 + i) * length) {
+            FAIL("message %lu has disk offset %lu", i, msgs[i]->disk_offset);
+        }
+
+        if (msgs[i]->via.txt.length != strlen("This is a test message.")
+            || memcmp(msgs[i]->via.txt.msg, "This is a test message.", msgs[i]->via.txt.length)) {
+            FAIL("message %lu has the wrong text", i);
+        }
+    }
+    free_loaded(msgs, count);
+
+    msgs = utox_load_chatlog(id_str, &count, 3, 5);
+    if (!msgs || count != 3 || msgs[0]->disk_offset != 2 * length) {
+        FAIL("expected 3 messages starting at %lu", 2 * length);
+    }
+    free_loaded(msgs, count);
 
-    // TODO implement
+    msgs = utox_load_chatlog(id_str, &count, 100, 10);
+    if (msgs) {
+        FAIL("skipping every message should return nothing");
+    }
+
+    free(data);
+    return true;
+}
+
+/**
+ * @covers chatlog_index_sync()
+ */
+bool test_chatlog_index() {
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2] = MOCK_FRIEND_ID;
+
+    size_t length;
+    uint8_t *data = create_mock_log(id_str, 10, &length);
+
+    size_t count = 0;
+    MSG_HEADER **msgs = utox_load_chatlog(id_str, &count, 100, 0);
+    free_loaded(msgs, count);
+
+    // Throw the index away, it has to be rebuilt from the log.
+    utox_get_file(MOCK_FRIEND_ID ".new.idx", NULL, UTOX_FILE_OPTS_DELETE);
+
+    msgs = utox_load_chatlog(id_str, &count, 100, 0);
+    if (!msgs || count != 10) {
+        FAIL("expected 10 messages after rebuilding the index, got %lu", count);
+    }
+    free_loaded(msgs, count);
+
+    // Append behind the index' back, it should pick up only the new tail.
+    FILE *log = utox_get_file(MOCK_FRIEND_ID ".new.txt", NULL, UTOX_FILE_OPTS_APPEND);
+    fwrite(data, length, 1, log);
+    fclose(log);
+
+    msgs = utox_load_chatlog(id_str, &count, 100, 0);
+    if (!msgs || count != 11 || msgs[10]->disk_offset != 10 * length) {
+        FAIL("expected 11 messages after appending to the log, got %lu", count);
+    }
+    uint32_t generation = msgs[3]->disk_generation;
+    free_loaded(msgs, count);
+
+    // Receipt updates rewrite a record in place, which must not invalidate the index.
+    LOG_FILE_MSG_HEADER header;
+    memcpy(&header, data, sizeof(header));
+    header.receipt = 0;
+    utox_update_chatlog(id_str, 3 * length, generation, (uint8_t *)&header, sizeof(header));
+
+    FILE *index = utox_get_file(MOCK_FRIEND_ID ".new.idx", NULL, UTOX_FILE_OPTS_READ);
+    LOG_FILE_INDEX_HEADER index_header;
+    if (!index || fread(&index_header, sizeof(index_header), 1, index) != 1) {
+        FAIL("unable to read the index");
+    }
+    fclose(index);
+
+    if (index_header.records != 11 || index_header.log_size != 11 * length) {
+        FAIL("index out of step with the log: %lu records, %lu bytes", index_header.records, index_header.log_size);
+    }
+
+    msgs = utox_load_chatlog(id_str, &count, 1, 7);
+    if (!msgs || count != 1 || msgs[0]->receipt_time) {
+        FAIL("expected the updated message to have no receipt");
+    }
+    free_loaded(msgs, count);
+
+    // Rewrite the log behind the index' back within the same second, without changing its size: the first record
+    // now runs over the second one. Sleep past the clock tick file times are kept in, but not the second.
+    nanosleep(&(struct timespec){ .tv_nsec = 20 * 1000 * 1000 }, NULL);
+    memcpy(&header, data, sizeof(header));
+    header.msg_length += length;
+    log = utox_get_file(MOCK_FRIEND_ID ".new.txt", NULL, UTOX_FILE_OPTS_READ | UTOX_FILE_OPTS_WRITE);
+    fwrite(&header, sizeof(header), 1, log);
+    fclose(log);
+
+    msgs = utox_load_chatlog(id_str, &count, 1, 9);
+    if (!msgs || count != 1 || msgs[0]->disk_offset != 0) {
+        FAIL("expected the index to be rebuilt with 10 messages after rewriting the log");
+    }
+    free_loaded(msgs, count);
+
+    free(data);
+    return true;
+}
+
+/**
+ * @covers chatlog_writer_thread()
+ */
+bool test_chatlog_writer() {
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2] = MOCK_FRIEND_ID;
+
+    size_t length;
+    uint8_t *data = create_mock_log(id_str, 0, &length);
+
+    utox_chatlog_writer_start();
+
+    // Offsets are handed out before anything reaches the disk.
+    uint32_t generation;
+    for (size_t i = 0; i < 20; ++i) {
+        size_t offset = utox_save_chatlog(id_str, data, length, &generation);
+        if (offset != i * length) {
+            FAIL("record %lu was given offset %lu", i, offset);
+        }
+    }
+
+    // A receipt update queued right behind its append has to land on top of it.
+    LOG_FILE_MSG_HEADER header;
+    memcpy(&header, data, sizeof(header));
+    header.receipt = 0;
+    utox_update_chatlog(id_str, 19 * length, generation, (uint8_t *)&header, sizeof(header));
+
+    size_t count = 0;
+    MSG_HEADER **msgs = utox_load_chatlog(id_str, &count, 100, 0);
+    if (!msgs || count != 20 || msgs[19]->receipt_time || !msgs[18]->receipt_time) {
+        FAIL("expected 20 messages with only the last one missing its receipt, got %lu", count);
+    }
+    free_loaded(msgs, count);
+
+    utox_save_chatlog(id_str, data, length, NULL);
+    utox_chatlog_writer_stop();
+
+    // Stopping the writer has to flush what's still queued.
+    msgs = utox_load_chatlog(id_str, &count, 100, 0);
+    if (!msgs || count != 21) {
+        FAIL("expected 21 messages after stopping the writer, got %lu", count);
+    }
+    free_loaded(msgs, count);
+
+    free(data);
+    return true;
+}
+
+/**
+ * @covers chatlog_writer_fail()
+ */
+bool test_chatlog_writer_failed() {
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2] = MOCK_FRIEND_ID;
+
+    size_t length;
+    uint8_t *data = create_mock_log(id_str, 0, &length);
+
+    utox_chatlog_writer_start();
+    utox_save_chatlog(id_str, data, length, NULL);
+
+    size_t count = 0;
+    MSG_HEADER **msgs = utox_load_chatlog(id_str, &count, 100, 0);
+    free_loaded(msgs, count);
+
+    // Something else grows the log behind the writer's back, so the next offset it hands out is already taken.
+    FILE *file = chatlog_get_file(id_str, true);
+    fwrite(data, length, 1, file);
+    fclose(file);
+
+    uint32_t stale_generation;
+    size_t   offset = utox_save_chatlog(id_str, data, length, &stale_generation);
+    if (offset != length) {
+        FAIL("expected the stale offset %lu, got %lu", length, offset);
+    }
+
+    // That write's dropped rather than landing somewhere else, and the writer starts over from the real end.
+    msgs = utox_load_chatlog(id_str, &count, 100, 0);
+    if (!msgs || count != 2) {
+        FAIL("expected the misplaced record to be dropped, got %lu messages", count);
+    }
+    free_loaded(msgs, count);
+
+    uint32_t generation;
+    offset = utox_save_chatlog(id_str, data, length, &generation);
+    if (offset != 2 * length) {
+        FAIL("expected the next record at %lu, got %lu", 2 * length, offset);
+    }
+
+    // A receipt for the dropped record mustn't land on the one that's at its offset now, but the new one still
+    // takes its own.
+    LOG_FILE_MSG_HEADER header;
+    memcpy(&header, data, sizeof(header));
+    header.receipt = 0;
+    if (utox_update_chatlog(id_str, length, stale_generation, (uint8_t *)&header, sizeof(header))) {
+        FAIL("updated the dropped record at %lu", length);
+    }
+    if (!utox_update_chatlog(id_str, 2 * length, generation, (uint8_t *)&header, sizeof(header))) {
+        FAIL("unable to update the record at %lu", 2 * length);
+    }
+    utox_chatlog_writer_stop();
+
+    msgs = utox_load_chatlog(id_str, &count, 100, 0);
+    if (!msgs || count != 3) {
+        FAIL("expected 3 messages after the writer recovered, got %lu", count);
+    }
+    if (!msgs[1]->receipt_time || msgs[2]->receipt_time) {
+        FAIL("expected only the last message to lose its receipt");
+    }
+    free_loaded(msgs, count);
+
+    // Nothing was saved at all, there's nothing to update.
+    if (utox_update_chatlog(id_str, UTOX_CHATLOG_OFFSET_NONE, generation, (uint8_t *)&header, sizeof(header))) {
+        FAIL("updated a record that was never saved");
+    }
 
+    free(data);
     return true;
 }
@@ -0,0 +1,139 @@
+#include "test.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/macros.h"
+#include "../src/chatlog.c"
+#include "../src/chatlog_search.c"
+#include "../src/text.c"
+
+#define FRIEND_A "6460FF76319AF777A999ABA2024D5D0AEB202360688ECBABFE56C9403B872D2F"
+#define FRIEND_B "0A1B2C3D4E5F60718293A4B5C6D7E8F90A1B2C3D4E5F60718293A4B5C6D7E8F9"
+#define FRIEND_C "F00DF00DF00DF00DF00DF00DF00DF00DF00DF00DF00DF00DF00DF00DF00DF00D"
+
+void native_export_chatlog_init(uint32_t friend_number) {}
+
+bool test_search_words();
+bool test_search_persist();
+bool test_search_catch_up();
+
+int main() {
+    int result = 0;
+    RUN_TEST(test_search_words)
+    RUN_TEST(test_search_persist)
+    RUN_TEST(test_search_catch_up)
+
+    return result;
+}
+
+static size_t search_count(const char *query) {
+    size_t count;
+    free(chatlog_search(query, strlen(query), &count));
+    return count;
+}
+
+/**
+ * @covers chatlog_search()
+ */
+bool test_search_words() {
+    utox_get_file(SEARCH_INDEX_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+    chatlog_search_start();
+
+    chatlog_search_add(FRIEND_A, 0, 100, "Hello World", 11);
+    chatlog_search_add(FRIEND_A, 100, 100, "hello there, hello", 18);
+    chatlog_search_add(FRIEND_A, 200, 100, "Goodbye world!", 14);
+    chatlog_search_add(FRIEND_B, 0, 100, "HELLO again", 11);
+
+    if (search_count("hello") != 3 || search_count("HEL") != 3 || search_count("world") != 2) {
+        FAIL("single word queries matched the wrong records");
+    }
+
+    size_t count;
+    CHATLOG_SEARCH_HIT *hits = chatlog_search("wor hello", 9, &count);
+    if (count != 1 || memcmp(hits[0].id_str, FRIEND_A, TOX_PUBLIC_KEY_SIZE * 2) || hits[0].offset != 0) {
+        FAIL("expected only the first message to contain both words, got %lu hits", count);
+    }
+    free(hits);
+
+    // grouped by friend, newest first
+    hits = chatlog_search("hello", 5, &count);
+    if (memcmp(hits[0].id_str, FRIEND_B, TOX_PUBLIC_KEY_SIZE * 2) || hits[1].offset != 100 || hits[2].offset != 0) {
+        FAIL("hits for a friend should come newest first");
+    }
+    free(hits);
+
+    if (search_count("hellooo") || search_count("orld") || search_count("") || search_count(" ,. ")) {
+        FAIL("queries matched records they shouldn't have");
+    }
+
+    // Records that don't follow on from what's indexed are left for the log scan.
+    chatlog_search_add(FRIEND_B, 500, 100, "skipped", 7);
+    if (search_count("skipped")) {
+        FAIL("a record past a gap was indexed");
+    }
+
+    chatlog_search_forget(FRIEND_B);
+    if (search_count("again") || search_count("hello") != 2) {
+        FAIL("a forgotten friend's history still matched");
+    }
+
+    chatlog_search_stop();
+    return true;
+}
+
+/**
+ * @covers search_save()
+ */
+bool test_search_persist() {
+    chatlog_search_start();
+    if (search_count("goodbye") != 1 || search_count("again")) {
+        FAIL("the saved index didn't come back the way it was left");
+    }
+
+    // New records carry on from where the saved index left off.
+    chatlog_search_add(FRIEND_A, 300, 100, "back again", 10);
+    if (search_count("again") != 1) {
+        FAIL("a record after reloading wasn't indexed");
+    }
+
+    chatlog_search_stop();
+    return true;
+}
+
+/**
+ * @covers search_thread()
+ */
+bool test_search_catch_up() {
+    utox_get_file(SEARCH_INDEX_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+    utox_remove_friend_chatlog(FRIEND_C);
+
+    // Write a log the index has never seen.
+    for (int i = 0; i < 10; ++i) {
+        char text[32];
+        size_t text_length = snprintf(text, sizeof(text), "message number %d", i);
+
+        LOG_FILE_MSG_HEADER header = { .log_version = LOGFILE_SAVE_VERSION, .msg_length = text_length };
+        uint8_t data[sizeof(header) + 32 + 1];
+        memcpy(data, &header, sizeof(header));
+        memcpy(data + sizeof(header), text, text_length);
+        data[sizeof(header) + text_length] = '\n';
+
+        utox_save_chatlog(FRIEND_C, data, sizeof(header) + text_length + 1, NULL);
+    }
+
+    chatlog_search_start();
+    chatlog_search_catch_up(FRIEND_C);
+
+    for (int i = 0; i < 100 && search_count("message") != 10; ++i) {
+        yieldcpu(10);
+    }
+
+    if (search_count("message") != 10 || search_count("7") != 1) {
+        FAIL("the background scan didn't index the log");
+    }
+
+    chatlog_search_stop();
+    return true;
+}
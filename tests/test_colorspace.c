@@ -0,0 +1,176 @@
+#include "../src/av/colorspace.c"
+#include "../src/av/colorspace_neon.c"
+#include "../src/av/colorspace_x86.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Every kernel set the CPU supports has to give exactly what the C kernels give, for every size, including the
+ * ragged ends of rows that don't fit a whole block. */
+
+static const uint16_t widths[]  = { 2, 6, 8, 14, 16, 18, 30, 34, 62, 66, 130, 320, 642 };
+static const uint16_t heights[] = { 2, 4, 6 };
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static void fill(uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+        data[i] = rng_state;
+    }
+}
+
+/* yuv420tobgr() as it was before the kernels were split out. */
+static void yuv420tobgr_reference(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u,
+                                  const uint8_t *v, unsigned int ystride, unsigned int ustride, unsigned int vstride,
+                                  uint8_t *out) {
+    for (unsigned long int i = 0; i < height; ++i) {
+        for (unsigned long int j = 0; j < width; ++j) {
+            uint8_t *point = out + 4 * ((i * width) + j);
+            int       t_y   = y[((i * ystride) + j)];
+            const int t_u   = u[(((i / 2) * ustride) + (j / 2))];
+            const int t_v   = v[(((i / 2) * vstride) + (j / 2))];
+            t_y            = t_y < 16 ? 16 : t_y;
+
+            const int r = (298 * (t_y - 16) + 409 * (t_v - 128) + 128) >> 8;
+            const int g = (298 * (t_y - 16) - 100 * (t_u - 128) - 208 * (t_v - 128) + 128) >> 8;
+            const int b = (298 * (t_y - 16) + 516 * (t_u - 128) + 128) >> 8;
+
+            point[2] = r > 255 ? 255 : r < 0 ? 0 : r;
+            point[1] = g > 255 ? 255 : g < 0 ? 0 : g;
+            point[0] = b > 255 ? 255 : b < 0 ? 0 : b;
+            point[3] = ~0;
+        }
+    }
+}
+
+static void check_yuv420(uint16_t width, uint16_t height) {
+    const unsigned ystride = width + 5, cstride = (width + 1) / 2 + 3;
+
+    uint8_t *y = malloc(ystride * height), *u = malloc(cstride * height), *v = malloc(cstride * height);
+    uint8_t *expected = malloc(width * height * 4), *got = malloc(width * height * 4);
+    fill(y, ystride * height);
+    fill(u, cstride * height);
+    fill(v, cstride * height);
+
+    yuv420tobgr_reference(width, height, y, u, v, ystride, cstride, cstride, expected);
+    yuv420tobgr(width, height, y, u, v, ystride, cstride, cstride, got);
+    ck_assert_msg(!memcmp(expected, got, width * height * 4), "%s yuv420tobgr differs at %ux%u", kernels->name,
+                  width, height);
+
+    free(y);
+    free(u);
+    free(v);
+    free(expected);
+    free(got);
+}
+
+typedef void (*to_yuv420)(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *in, uint16_t width,
+                          uint16_t height);
+
+static void check_to_yuv420(const char *name, to_yuv420 convert, to_yuv420 reference, size_t bpp, uint16_t width,
+                            uint16_t height) {
+    const size_t luma = width * height, chroma = luma / 4;
+
+    uint8_t *in = malloc(luma * bpp), *expected = malloc(luma + chroma * 2), *got = malloc(luma + chroma * 2);
+    fill(in, luma * bpp);
+
+    reference(expected, expected + luma, expected + luma + chroma, in, width, height);
+    convert(got, got + luma, got + luma + chroma, in, width, height);
+    ck_assert_msg(!memcmp(expected, got, luma), "%s %s luma differs at %ux%u", kernels->name, name, width, height);
+    ck_assert_msg(!memcmp(expected + luma, got + luma, chroma * 2), "%s %s chroma differs at %ux%u", kernels->name,
+                  name, width, height);
+
+    free(in);
+    free(expected);
+    free(got);
+}
+
+START_TEST(test_colorspace_kernels)
+{
+    colorspace_get();
+
+    for (size_t k = 0; k < COUNTOF(colorspace_all); ++k) {
+        if (colorspace_all[k]->supported && !colorspace_all[k]->supported()) {
+            continue;
+        }
+        kernels = colorspace_all[k];
+
+        for (size_t h = 0; h < COUNTOF(heights); ++h) {
+            for (size_t w = 0; w < COUNTOF(widths); ++w) {
+                check_yuv420(widths[w], heights[h]);
+                check_yuv420(widths[w] + 1, heights[h] + 1);
+
+                check_to_yuv420("yuv422to420", yuv422to420, yuv422to420_frame, 2, widths[w], heights[h]);
+                check_to_yuv420("bgrtoyuv420", bgrtoyuv420, bgrtoyuv420_frame, 3, widths[w], heights[h]);
+                check_to_yuv420("bgrxtoyuv420", bgrxtoyuv420, bgrxtoyuv420_frame, 4, widths[w], heights[h]);
+            }
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_colorspace_extremes)
+{
+    colorspace_get();
+
+    // Saturated colours are where the clamping and the rounding of negative chroma show up.
+    const uint8_t levels[] = { 0, 1, 15, 16, 17, 127, 128, 129, 235, 240, 254, 255 };
+    const uint16_t width = 64, height = 2;
+
+    uint8_t y[64 * 2], u[32], v[32], bgrx[64 * 2 * 4], got[64 * 2 * 4];
+    uint8_t planes[64 * 2 + 64], planes_got[64 * 2 + 64];
+    for (size_t i = 0; i < COUNTOF(levels) * COUNTOF(levels); ++i) {
+        memset(y, levels[i % COUNTOF(levels)], sizeof(y));
+        memset(u, levels[i / COUNTOF(levels)], sizeof(u));
+        memset(v, levels[(i * 7) % COUNTOF(levels)], sizeof(v));
+        y[i % sizeof(y)] = 255 - y[0];
+
+        yuv420tobgr_reference(width, height, y, u, v, width, width / 2, width / 2, bgrx);
+        bgrxtoyuv420_frame(planes, planes + 128, planes + 160, bgrx, width, height);
+
+        for (size_t k = 0; k < COUNTOF(colorspace_all); ++k) {
+            if (colorspace_all[k]->supported && !colorspace_all[k]->supported()) {
+                continue;
+            }
+            kernels = colorspace_all[k];
+
+            yuv420tobgr(width, height, y, u, v, width, width / 2, width / 2, got);
+            ck_assert_msg(!memcmp(bgrx, got, sizeof(got)), "%s yuv420tobgr differs for levels %u", kernels->name,
+                          (unsigned)i);
+
+            bgrxtoyuv420(planes_got, planes_got + 128, planes_got + 160, bgrx, width, height);
+            ck_assert_msg(!memcmp(planes, planes_got, sizeof(planes)), "%s bgrxtoyuv420 differs for levels %u",
+                          kernels->name, (unsigned)i);
+        }
+    }
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Colorspace");
+
+    MK_TEST_CASE(colorspace_kernels)
+    MK_TEST_CASE(colorspace_extremes)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
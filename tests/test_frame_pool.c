@@ -0,0 +1,142 @@
+#include "../src/av/frame_pool.c"
+#include "../src/msg_queue.c"
+
+#include "test.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define FRAMES 10000
+
+START_TEST(test_frame_pool_reuse)
+{
+    FRAME_POOL *pool = frame_pool_new();
+    ck_assert(pool);
+
+    UTOX_FRAME_PKG *frame = frame_pool_get(pool, 640, 480);
+    ck_assert(frame && frame->size == 640 * 480 * 4);
+    void *img = frame->img;
+    frame_release(frame);
+
+    // Same size or smaller comes straight back out of the pool.
+    for (int i = 0; i < 10; ++i) {
+        frame = frame_pool_get(pool, i % 2 ? 640 : 320, i % 2 ? 480 : 240);
+        ck_assert_msg(frame->img == img, "Frame %d wasn't reused", i);
+        frame_release(frame);
+    }
+    ck_assert_msg(pool->stats.hits == 10 && pool->stats.misses == 1, "Expected 10 hits and 1 miss got: %lu and %lu",
+                  (unsigned long)pool->stats.hits, (unsigned long)pool->stats.misses);
+
+    // Bigger has to grow it.
+    frame = frame_pool_get(pool, 1280, 720);
+    ck_assert(frame->capacity >= 1280 * 720 * 4);
+    ck_assert(pool->stats.misses == 2);
+    frame_release(frame);
+
+    frame_pool_free(pool);
+}
+END_TEST
+
+START_TEST(test_frame_pool_depth)
+{
+    FRAME_POOL *    pool = frame_pool_new();
+    UTOX_FRAME_PKG *frames[FRAME_POOL_DEPTH];
+
+    for (int i = 0; i < FRAME_POOL_DEPTH; ++i) {
+        frames[i] = frame_pool_get(pool, 16, 16);
+        ck_assert(frames[i]);
+    }
+    ck_assert_msg(!frame_pool_get(pool, 16, 16), "Handed out more than FRAME_POOL_DEPTH frames");
+    ck_assert(pool->stats.dropped == 1);
+
+    // A frame's only back once its last reference is.
+    frame_ref(frames[0]);
+    frame_release(frames[0]);
+    ck_assert(!frame_pool_get(pool, 16, 16));
+    frame_release(frames[0]);
+
+    frames[0] = frame_pool_get(pool, 16, 16);
+    ck_assert(frames[0]);
+
+    // Letting go of the pool with frames out leaves it to the last of them.
+    frame_pool_free(pool);
+    for (int i = 0; i < FRAME_POOL_DEPTH; ++i) {
+        frame_release(frames[i]);
+    }
+}
+END_TEST
+
+static MSG_QUEUE queue = MSG_QUEUE_INIT;
+
+static void *producer(void *args) {
+    FRAME_POOL *pool = args;
+    for (uint32_t i = 0; i < FRAMES; ++i) {
+        UTOX_FRAME_PKG *frame;
+        while (!(frame = frame_pool_get(pool, 64, 48))) {
+            yieldcpu(1);
+        }
+
+        memset(frame->img, i, frame->size);
+        msg_queue_post(&queue, NULL, 1, i, 0, frame);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_frame_pool_threads)
+{
+    FRAME_POOL *pool = frame_pool_new();
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, producer, pool);
+
+    // Frames are made on one thread and handed back on another, like the UI does.
+    uint32_t received = 0;
+    while (received < FRAMES) {
+        TOX_MSG msg;
+        if (!msg_queue_pop(&queue, &msg)) {
+            msg_queue_wait(&queue, 10);
+            continue;
+        }
+
+        UTOX_FRAME_PKG *frame = msg.data;
+        const uint8_t * img   = frame->img;
+        ck_assert_msg(img[0] == (uint8_t)msg.param1 && img[frame->size - 1] == (uint8_t)msg.param1,
+                      "Frame %u was overwritten while it was in flight", msg.param1);
+        frame_release(frame);
+        received++;
+    }
+    pthread_join(thread, NULL);
+
+    ck_assert_msg(pool->stats.misses <= FRAME_POOL_DEPTH, "Allocated %lu frames for %u in flight at most",
+                  (unsigned long)pool->stats.misses, FRAME_POOL_DEPTH);
+    ck_assert(pool->stats.hits + pool->stats.misses == FRAMES);
+
+    frame_pool_free(pool);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Frame Pool");
+
+    MK_TEST_CASE(frame_pool_reuse)
+    MK_TEST_CASE(frame_pool_depth)
+    MK_TEST_CASE(frame_pool_threads)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,256 @@
+#include "../src/ft_hash.c"
+#include "../src/ft_reader.c"
+
+#include "test.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+uint64_t get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static pthread_mutex_t posted_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  posted_cond = PTHREAD_COND_INITIALIZER;
+static UTOX_MSG_FT *   posted;
+static uint32_t        posted_hashed;
+
+void postmessage_toxcore(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    ck_assert(msg == TOX_FILE_SEND_HASHED && param1 == 7);
+
+    pthread_mutex_lock(&posted_lock);
+    posted        = data;
+    posted_hashed = param2;
+    pthread_cond_signal(&posted_cond);
+    pthread_mutex_unlock(&posted_lock);
+}
+
+static void hex(char *dest, const uint8_t *hash) {
+    for (int i = 0; i < TOX_HASH_LENGTH; ++i) {
+        sprintf(dest + i * 2, "%02x", hash[i]);
+    }
+}
+
+static bool sha256_is(const uint8_t *data, size_t length, size_t piece, const char *expected) {
+    FT_SHA256 sha;
+    ft_sha256_init(&sha);
+    for (size_t done = 0; done < length; done += piece) {
+        ft_sha256_update(&sha, data + done, MIN(piece, length - done));
+    }
+
+    uint8_t hash[TOX_HASH_LENGTH];
+    char    string[TOX_HASH_LENGTH * 2 + 1];
+    ft_sha256_final(&sha, hash);
+    hex(string, hash);
+    return !strcmp(string, expected);
+}
+
+/* Queues the file to be hashed, and waits for it to be handed back. */
+static bool hash_file(const char *path, uint8_t hash[TOX_HASH_LENGTH]) {
+    UTOX_MSG_FT *msg = calloc(1, sizeof(UTOX_MSG_FT));
+    msg->file        = fopen(path, "rb");
+    msg->name        = (uint8_t *)strdup(path);
+    if (!msg->file || !ft_hash_queue(7, msg)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&posted_lock);
+    while (!posted) {
+        pthread_cond_wait(&posted_cond, &posted_lock);
+    }
+    const bool handed_back = posted == msg;
+    posted = NULL;
+    const bool hashed = posted_hashed;
+    pthread_mutex_unlock(&posted_lock);
+
+    memcpy(hash, msg->hash, TOX_HASH_LENGTH);
+    fclose(msg->file);
+    free(msg->name);
+    free(msg);
+    return handed_back && hashed;
+}
+
+static void write_file(const char *path, uint8_t seed, size_t size) {
+    FILE *file = fopen(path, "wb");
+    for (size_t i = 0; i < size; ++i) {
+        fputc((uint8_t)(i * seed + (i >> 12)), file);
+    }
+    fclose(file);
+}
+
+static void set_mtime(const char *path, time_t mtime, long nsec) {
+    struct timespec times[2] = { { .tv_sec = mtime, .tv_nsec = nsec }, { .tv_sec = mtime, .tv_nsec = nsec } };
+    ck_assert(!utimensat(AT_FDCWD, path, times, 0));
+}
+
+START_TEST(test_ft_hash_sha256)
+{
+    ck_assert(sha256_is(NULL, 0, 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+    ck_assert(sha256_is((const uint8_t *)"abc", 3, 3,
+                        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+
+    const char *two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    ck_assert(sha256_is((const uint8_t *)two_blocks, strlen(two_blocks), 5,
+                        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+
+    // However it's split up.
+    uint8_t *million = malloc(1000 * 1000);
+    memset(million, 'a', 1000 * 1000);
+    const char *million_a = "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+    ck_assert(sha256_is(million, 1000 * 1000, 1000 * 1000, million_a));
+    ck_assert(sha256_is(million, 1000 * 1000, 63, million_a));
+    ck_assert(sha256_is(million, 1000 * 1000, 65537, million_a));
+    free(million);
+}
+END_TEST
+
+START_TEST(test_ft_hash_files)
+{
+    utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+
+    const char *path = "/tmp/utox_test_ft_hash";
+    const size_t size = FT_READER_BLOCK * 3 + 12345;
+    write_file(path, 3, size);
+    set_mtime(path, 1000000, 0);
+
+    uint8_t *data = malloc(size);
+    FILE *   file = fopen(path, "rb");
+    ck_assert(fread(data, size, 1, file) == 1);
+    fclose(file);
+
+    FT_SHA256 sha;
+    uint8_t   expected[TOX_HASH_LENGTH], hash[TOX_HASH_LENGTH];
+    ft_sha256_init(&sha);
+    ft_sha256_update(&sha, data, size);
+    ft_sha256_final(&sha, expected);
+    free(data);
+
+    ft_hash_start();
+    ck_assert(hash_file(path, hash));
+    ck_assert(!memcmp(hash, expected, TOX_HASH_LENGTH));
+    ft_hash_stop();
+
+    // Same size and time, so the saved id's used without reading it again.
+    write_file(path, 5, size);
+    set_mtime(path, 1000000, 0);
+    ft_hash_start();
+    ck_assert(hash_file(path, hash));
+    ck_assert(!memcmp(hash, expected, TOX_HASH_LENGTH));
+
+    // Once it's changed it's hashed again, even within the same second.
+    set_mtime(path, 1000000, 500 * 1000 * 1000);
+    ck_assert(hash_file(path, hash));
+    ck_assert(memcmp(hash, expected, TOX_HASH_LENGTH));
+    ck_assert(hasher.cache_count == 1);
+    ft_hash_stop();
+
+    // Swapped for another file with the same size and time, that's not the one that was hashed either.
+    const char *other = "/tmp/utox_test_ft_hash_other";
+    write_file(other, 3, size);
+    set_mtime(other, 1000000, 500 * 1000 * 1000);
+    ck_assert(!rename(other, path));
+    ft_hash_start();
+    ck_assert(hash_file(path, hash));
+    ck_assert(!memcmp(hash, expected, TOX_HASH_LENGTH));
+    ft_hash_stop();
+
+    // Not running, the caller sends it without an id.
+    UTOX_MSG_FT msg = { 0 };
+    ck_assert(!ft_hash_queue(7, &msg));
+
+    remove(path);
+    utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+}
+END_TEST
+
+START_TEST(test_ft_hash_cache_full)
+{
+    utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+    hasher.cache_loaded = true;
+
+    uint8_t hash[TOX_HASH_LENGTH] = { 0 };
+    char    path[32];
+    for (int i = 0; i < FT_HASH_CACHE_MAX + 10; ++i) {
+        snprintf(path, sizeof(path), "/files/%d", i);
+        hash[0] = i;
+        ft_hash_cache_add((uint8_t *)path, strlen(path), i, i, i, hash);
+    }
+    ck_assert(hasher.cache_count == FT_HASH_CACHE_MAX);
+    ck_assert(!ft_hash_cache_find((const uint8_t *)"/files/9", 8));
+
+    // Saved and read back, oldest forgotten first.
+    ft_hash_cache_free();
+    ft_hash_cache_load();
+    ck_assert(hasher.cache_count == FT_HASH_CACHE_MAX);
+    const FT_HASH_ENTRY *entry = ft_hash_cache_find((const uint8_t *)"/files/10", 9);
+    ck_assert(entry && entry == &hasher.cache[0] && entry->size == 10 && entry->mtime == 10 && entry->inode == 10
+              && entry->hash[0] == 10);
+
+    ft_hash_cache_free();
+    utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+}
+END_TEST
+
+START_TEST(test_ft_hash_cache_reorder)
+{
+    utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+
+    const char *first = "/tmp/utox_test_ft_hash_first", *second = "/tmp/utox_test_ft_hash_second";
+    write_file(first, 3, 1000);
+    write_file(second, 5, 1000);
+
+    uint8_t hash[TOX_HASH_LENGTH];
+    ft_hash_start();
+    ck_assert(hash_file(first, hash));
+    ck_assert(hash_file(second, hash));
+
+    // Using a saved id only moves it to the back, the cache isn't written out again for that...
+    utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+    ck_assert(hash_file(first, hash));
+    FILE *cache = utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_READ);
+    ck_assert(!cache);
+
+    // ...until the hasher stops.
+    ft_hash_stop();
+    ft_hash_cache_load();
+    ck_assert(hasher.cache_count == 2);
+    ck_assert(ft_hash_cache_find((const uint8_t *)first, strlen(first)) == &hasher.cache[1]);
+
+    ft_hash_cache_free();
+    remove(first);
+    remove(second);
+    utox_get_file(FT_HASH_CACHE_NAME, NULL, UTOX_FILE_OPTS_DELETE);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("File Transfer Hash");
+
+    MK_TEST_CASE(ft_hash_sha256)
+    MK_TEST_CASE(ft_hash_files)
+    MK_TEST_CASE(ft_hash_cache_full)
+    MK_TEST_CASE(ft_hash_cache_reorder)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
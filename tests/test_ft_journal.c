@@ -0,0 +1,138 @@
+#include "../src/ft_journal.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t id[TOX_FILE_ID_LENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+
+#define PATH "/home/user/Downloads/holiday.tar"
+
+static FILE *journal_with(bool incoming, uint64_t size) {
+    FILE *file = tmpfile();
+    ck_assert(ft_journal_start(file, incoming, id, size));
+    ck_assert(ft_journal_add_path(file, (const uint8_t *)PATH, strlen(PATH)));
+    return file;
+}
+
+START_TEST(test_ft_journal_roundtrip)
+{
+    FILE *file = journal_with(true, 100000);
+    ck_assert(ft_journal_add_range(file, 0, 4096));
+    ck_assert(ft_journal_add_range(file, 4096, 10000));
+
+    FT_JOURNAL journal;
+    ck_assert(ft_journal_read(file, &journal));
+    ck_assert(journal.incoming);
+    ck_assert(!memcmp(journal.file_id, id, sizeof(id)));
+    ck_assert(journal.size == 100000);
+    ck_assert(journal.path_length == strlen(PATH) && !strcmp((char *)journal.path, PATH));
+    ck_assert(journal.range_count == 1);
+    ck_assert(ft_journal_resume_offset(&journal) == 10000);
+    ft_journal_free(&journal);
+
+    // A later path replaces the first.
+    ck_assert(ft_journal_add_path(file, (const uint8_t *)"/tmp/x", 6));
+    ck_assert(ft_journal_read(file, &journal));
+    ck_assert(!strcmp((char *)journal.path, "/tmp/x"));
+    ft_journal_free(&journal);
+
+    fclose(file);
+}
+END_TEST
+
+START_TEST(test_ft_journal_out_of_order)
+{
+    FILE *file = journal_with(true, 50000);
+    ck_assert(ft_journal_add_range(file, 20000, 30000));
+    ck_assert(ft_journal_add_range(file, 5000, 8000));
+    ck_assert(ft_journal_add_range(file, 40000, 45000));
+
+    FT_JOURNAL journal;
+    ck_assert(ft_journal_read(file, &journal));
+    ck_assert(journal.range_count == 3);
+    ck_assert(journal.ranges[0].start == 5000 && journal.ranges[1].start == 20000);
+    // Nothing from the start yet.
+    ck_assert(ft_journal_resume_offset(&journal) == 0);
+    ft_journal_free(&journal);
+
+    // Filling the gaps joins everything up, and a range can't take it past the end of the file.
+    ck_assert(ft_journal_add_range(file, 0, 5000));
+    ck_assert(ft_journal_add_range(file, 7000, 21000));
+    ck_assert(ft_journal_add_range(file, 29000, 60000));
+    ck_assert(ft_journal_read(file, &journal));
+    ck_assert(journal.range_count == 1);
+    ck_assert(ft_journal_resume_offset(&journal) == 50000);
+    ft_journal_free(&journal);
+
+    fclose(file);
+}
+END_TEST
+
+START_TEST(test_ft_journal_damage)
+{
+    FILE *file = journal_with(false, 1234);
+    ck_assert(ft_journal_add_range(file, 0, 1000));
+
+    // A record this version doesn't know about gets skipped.
+    const uint8_t unknown[] = { 'Z', 2, 0, 0xAA, 0xBB };
+    ck_assert(fwrite(unknown, sizeof(unknown), 1, file) == 1);
+    ck_assert(ft_journal_add_range(file, 1000, 1200));
+
+    // As does one that was only half written when uTox went away.
+    const uint8_t torn[] = { 'R', 16, 0, 0, 0, 0 };
+    ck_assert(fwrite(torn, sizeof(torn), 1, file) == 1);
+    fflush(file);
+
+    FT_JOURNAL journal;
+    ck_assert(ft_journal_read(file, &journal));
+    ck_assert(!journal.incoming);
+    ck_assert(!strcmp((char *)journal.path, PATH));
+    ck_assert(ft_journal_resume_offset(&journal) == 1200);
+    ft_journal_free(&journal);
+    fclose(file);
+
+    // Not a journal at all, the raw struct older versions saved.
+    file = tmpfile();
+    uint8_t old[1200] = { 1, 1, 0, 0, 0, 1 };
+    ck_assert(fwrite(old, sizeof(old), 1, file) == 1);
+    ck_assert(!ft_journal_read(file, &journal));
+    ck_assert(!journal.path && !journal.ranges);
+    fclose(file);
+
+    // A version from the future.
+    file = journal_with(true, 1);
+    fseeko(file, 4, SEEK_SET);
+    fputc(FT_JOURNAL_VERSION + 1, file);
+    fflush(file);
+    ck_assert(!ft_journal_read(file, &journal));
+    fclose(file);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("File Transfer Journal");
+
+    MK_TEST_CASE(ft_journal_roundtrip)
+    MK_TEST_CASE(ft_journal_out_of_order)
+    MK_TEST_CASE(ft_journal_damage)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
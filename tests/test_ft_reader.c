@@ -0,0 +1,146 @@
+#include "../src/ft_reader.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MS (1000 * 1000ull)
+#define CHUNK 1371
+
+static uint64_t fake_time = 1000 * MS;
+
+uint64_t get_time(void) {
+    return fake_time;
+}
+
+/* A file a bit over two read blocks long, each byte telling where it is. */
+#define FILE_SIZE (FT_READER_BLOCK * 2 + 12345)
+
+static uint8_t byte_at(uint64_t position) {
+    return position * 7 + (position >> 9);
+}
+
+static FILE *make_file(uint64_t size) {
+    FILE *file = tmpfile();
+    ck_assert(file);
+
+    for (uint64_t i = 0; i < size; ++i) {
+        fputc(byte_at(i), file);
+    }
+    fflush(file);
+    rewind(file);
+
+    return file;
+}
+
+static bool chunk_is(const uint8_t *chunk, uint64_t position, size_t length) {
+    if (!chunk) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        if (chunk[i] != byte_at(position + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+START_TEST(test_ft_reader_read_through)
+{
+    FILE *     file   = make_file(FILE_SIZE);
+    FT_READER *reader = ft_reader_new(file, FILE_SIZE);
+    ck_assert(reader);
+
+    // In order, the way toxcore usually asks, all the way to a short last chunk. Some run over into the next block.
+    uint64_t position = 0;
+    while (position < FILE_SIZE) {
+        const size_t length = MIN(CHUNK, FILE_SIZE - position);
+        fake_time += MS;
+        ck_assert(chunk_is(ft_reader_chunk(reader, position, length), position, length));
+        position += length;
+    }
+    ck_assert(reader->stats.bytes == FILE_SIZE);
+    ck_assert(reader->stats.chunks == (FILE_SIZE + CHUNK - 1) / CHUNK);
+    ck_assert(reader->stats.last - reader->stats.started == (reader->stats.chunks - 1) * MS);
+
+    // Only going to the disk a block at a time.
+    ck_assert(reader->stats.reads == (FILE_SIZE + FT_READER_BLOCK - 1) / FT_READER_BLOCK);
+
+    // And out of order, for when a chunk has to be sent again.
+    const uint64_t again[] = { 0, FILE_SIZE - CHUNK, FT_READER_BLOCK - 10, 5, FT_READER_BLOCK * 2 };
+    for (size_t i = 0; i < COUNTOF(again); ++i) {
+        ck_assert(chunk_is(ft_reader_chunk(reader, again[i], CHUNK), again[i], CHUNK));
+    }
+
+    // Nothing past the end.
+    ck_assert(!ft_reader_chunk(reader, FILE_SIZE - 10, 11));
+    ck_assert(!ft_reader_chunk(reader, FILE_SIZE + 1, 0));
+    ck_assert(ft_reader_chunk(reader, FILE_SIZE, 0));
+
+    ft_reader_log_stats(reader, "test");
+    ft_reader_free(reader);
+    fclose(file);
+}
+END_TEST
+
+START_TEST(test_ft_reader_short_file)
+{
+    // The file's shorter than toxcore was told, reading what isn't there fails rather than sending garbage.
+    FILE *     file   = make_file(FILE_SIZE);
+    FT_READER *reader = ft_reader_new(file, FILE_SIZE + FT_READER_BLOCK);
+    ck_assert(reader);
+    ck_assert(chunk_is(ft_reader_chunk(reader, 0, CHUNK), 0, CHUNK));
+    ck_assert(!ft_reader_chunk(reader, FILE_SIZE - 1, CHUNK));
+
+    ft_reader_free(reader);
+    fclose(file);
+}
+END_TEST
+
+START_TEST(test_ft_reader_truncated)
+{
+    // Cut short while it's being sent, past what's already been read ahead.
+    const uint64_t size   = FT_READER_BLOCK * (FT_READER_BLOCKS + 2);
+    FILE *         file   = make_file(size);
+    FT_READER *    reader = ft_reader_new(file, size);
+    ck_assert(reader);
+    ck_assert(chunk_is(ft_reader_chunk(reader, 0, CHUNK), 0, CHUNK));
+
+    ck_assert(!ftruncate(fileno(file), FT_READER_BLOCK));
+    ck_assert(!ft_reader_chunk(reader, FT_READER_BLOCK * (FT_READER_BLOCKS + 1), CHUNK));
+
+    // What's still there can still be read.
+    ck_assert(chunk_is(ft_reader_chunk(reader, 10, CHUNK), 10, CHUNK));
+
+    ft_reader_free(reader);
+    fclose(file);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("File Transfer Reader");
+
+    MK_TEST_CASE(ft_reader_read_through)
+    MK_TEST_CASE(ft_reader_short_file)
+    MK_TEST_CASE(ft_reader_truncated)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,96 @@
+#include "../src/ft_table.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+START_TEST(test_ft_table_stable)
+{
+    FT_TABLE table = { 0 };
+    ck_assert(!ft_table_get(&table, 0));
+
+    FILE_TRANSFER *first = ft_table_make(&table, 0);
+    ck_assert(first && first == ft_table_get(&table, 0));
+    ck_assert(ft_table_make(&table, 0) == first);
+    first->file_number = 1234;
+    first->path[0]     = 'x';
+
+    // Lots more, with numbers all over the place, and nothing already handed out moves.
+    FILE_TRANSFER *made[300];
+    for (uint32_t i = 0; i < 300; ++i) {
+        const uint32_t number = i < 200 ? i + 1 : 65535 - i;
+        made[i]               = ft_table_make(&table, number);
+        ck_assert(made[i] && made[i]->file_number == 0);
+        made[i]->file_number = number;
+    }
+    ck_assert(table.count == 301);
+    ck_assert(table.slab_count < FT_TABLE_SLABS);
+
+    ck_assert(ft_table_get(&table, 0) == first && first->file_number == 1234 && first->path[0] == 'x');
+    for (uint32_t i = 0; i < 300; ++i) {
+        const uint32_t number = i < 200 ? i + 1 : 65535 - i;
+        ck_assert(ft_table_get(&table, number) == made[i] && made[i]->file_number == number);
+    }
+    ck_assert(!ft_table_get(&table, 250) && !ft_table_get(&table, 1 << 20));
+
+    ft_table_free(&table);
+    ck_assert(!ft_table_get(&table, 0));
+}
+END_TEST
+
+START_TEST(test_ft_table_reuse)
+{
+    FT_TABLE table = { 0 };
+
+    FILE_TRANSFER *a = ft_table_make(&table, 3);
+    FILE_TRANSFER *b = ft_table_make(&table, 9);
+    a->in_use        = true;
+    b->in_use        = true;
+
+    // Done with, its slot goes to the next one started, zeroed.
+    ft_table_release(&table, 3);
+    ck_assert(!ft_table_get(&table, 3) && table.count == 1);
+    ft_table_release(&table, 3);
+    ck_assert(table.count == 1);
+
+    FILE_TRANSFER *c = ft_table_make(&table, 40);
+    ck_assert(c == a && !c->in_use);
+    ck_assert(ft_table_get(&table, 9) == b && b->in_use);
+
+    // Starting and finishing transfers over and over only ever needs the one slab.
+    for (uint32_t i = 0; i < 1000; ++i) {
+        ck_assert(ft_table_make(&table, 100 + i % 200));
+        ft_table_release(&table, 100 + i % 200);
+    }
+    ck_assert(table.slab_count == 1);
+    ck_assert(ft_table_get(&table, 9) == b);
+
+    ft_table_free(&table);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("File Transfer Table");
+
+    MK_TEST_CASE(ft_table_stable)
+    MK_TEST_CASE(ft_table_reuse)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,176 @@
+#include "../src/ft_writer.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHUNK 1371
+
+uint64_t get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+static uint8_t byte_at(uint64_t position) {
+    return position * 7 + (position >> 9);
+}
+
+/* Pushes [from, to) the way toxcore would hand it over, a chunk at a time. */
+static void arrive(FT_WRITER *writer, uint64_t from, uint64_t to) {
+    static uint8_t chunk[CHUNK];
+
+    while (from < to) {
+        const size_t length = MIN(CHUNK, to - from);
+        for (size_t i = 0; i < length; ++i) {
+            chunk[i] = byte_at(from + i);
+        }
+        ck_assert(ft_writer_push(writer, from, chunk, length));
+        from += length;
+    }
+}
+
+static bool file_is(FILE *file, uint64_t from, uint64_t to) {
+    fseeko(file, from, SEEK_SET);
+    for (uint64_t i = from; i < to; ++i) {
+        if (fgetc(file) != byte_at(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+START_TEST(test_ft_writer_sequential)
+{
+    FILE *     file   = tmpfile();
+    FT_WRITER *writer = ft_writer_new(file, 0);
+    ck_assert(writer);
+
+    // More than fits in all the buffers at once.
+    const uint64_t size = FT_WRITER_BUFFER * (FT_WRITER_BUFFERS + 2) + 999;
+    arrive(writer, 0, size);
+    ck_assert(ft_writer_flush(writer));
+
+    uint64_t durable;
+    ck_assert(ft_writer_durable(writer, &durable) && durable == size);
+    ck_assert(!ft_writer_durable(writer, &durable) && durable == size);
+    ck_assert(file_is(file, 0, size));
+
+    // Gathered into big writes.
+    ck_assert(writer->stats.bytes == size);
+    ck_assert(writer->stats.writes <= FT_WRITER_BUFFERS + 3);
+    ck_assert(writer->stats.syncs >= 1);
+
+    ft_writer_log_stats(writer, "test");
+    ck_assert(ft_writer_free(writer));
+    fclose(file);
+}
+END_TEST
+
+START_TEST(test_ft_writer_resume)
+{
+    FILE *file = tmpfile();
+    ck_assert(fwrite("already here", 12, 1, file) == 1);
+    fflush(file);
+
+    // Carrying on from where it got to before.
+    FT_WRITER *writer = ft_writer_new(file, 12);
+    uint64_t   durable;
+    ck_assert(!ft_writer_durable(writer, &durable) && durable == 12);
+
+    arrive(writer, 12, 5000);
+    // Toxcore skipping ahead leaves a gap, and nothing past it counts as durable until it's filled.
+    arrive(writer, 9000, 12000);
+    ck_assert(ft_writer_flush(writer));
+    ck_assert(ft_writer_durable(writer, &durable) && durable == 5000);
+    ck_assert(file_is(file, 12, 5000) && file_is(file, 9000, 12000));
+
+    arrive(writer, 5000, 9000);
+    arrive(writer, 12000, 13000);
+    ck_assert(ft_writer_flush(writer));
+    ck_assert(ft_writer_durable(writer, &durable) && durable == 9000);
+
+    ck_assert(ft_writer_free(writer));
+
+    rewind(file);
+    char start[12];
+    ck_assert(fread(start, 12, 1, file) == 1 && !memcmp(start, "already here", 12));
+    fclose(file);
+}
+END_TEST
+
+START_TEST(test_ft_writer_idle)
+{
+    FILE *     file   = tmpfile();
+    FT_WRITER *writer = ft_writer_new(file, 0);
+
+    // A few chunks then nothing for a while still end up on disk.
+    arrive(writer, 0, CHUNK * 3);
+
+    uint64_t durable = 0;
+    for (int i = 0; i < 40 && durable != CHUNK * 3; ++i) {
+        usleep(100 * 1000);
+        ft_writer_durable(writer, &durable);
+    }
+    ck_assert(durable == CHUNK * 3);
+    ck_assert(file_is(file, 0, CHUNK * 3));
+
+    ck_assert(ft_writer_free(writer));
+    fclose(file);
+}
+END_TEST
+
+START_TEST(test_ft_writer_error)
+{
+    char  name[] = "/tmp/utox_ft_writer_XXXXXX";
+    int   fd     = mkstemp(name);
+    ck_assert(fd >= 0);
+    close(fd);
+
+    // Can't be written to.
+    FILE *file = fopen(name, "rb");
+    unlink(name);
+
+    FT_WRITER *writer = ft_writer_new(file, 0);
+    uint8_t    chunk[CHUNK] = { 0 };
+    ck_assert(ft_writer_push(writer, 0, chunk, CHUNK));
+    ck_assert(!ft_writer_flush(writer));
+    ck_assert(!ft_writer_push(writer, CHUNK, chunk, CHUNK));
+
+    uint64_t durable;
+    ck_assert(!ft_writer_durable(writer, &durable) && durable == 0);
+
+    ck_assert(!ft_writer_free(writer));
+    fclose(file);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("File Transfer Writer");
+
+    MK_TEST_CASE(ft_writer_sequential)
+    MK_TEST_CASE(ft_writer_resume)
+    MK_TEST_CASE(ft_writer_idle)
+    MK_TEST_CASE(ft_writer_error)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,226 @@
+#include "../src/av/group_mixer.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static int16_t in[GROUP_MIXER_FRAME * GROUP_MIXER_CHANNELS];
+static int16_t out[GROUP_MIXER_FRAME * GROUP_MIXER_CHANNELS];
+
+/* Pushes frames of mono audio at a constant level. */
+static void push(GROUP_MIXER *mixer, uint32_t peer, int16_t level, size_t frames) {
+    for (size_t i = 0; i < GROUP_MIXER_FRAME; ++i) {
+        in[i] = level;
+    }
+    for (size_t i = 0; i < frames; ++i) {
+        ck_assert(group_mixer_push(mixer, peer, in, GROUP_MIXER_FRAME, 1, GROUP_MIXER_SAMPLE_RATE));
+    }
+}
+
+static bool all(const int16_t *samples, int16_t level) {
+    for (size_t i = 0; i < GROUP_MIXER_FRAME * GROUP_MIXER_CHANNELS; ++i) {
+        if (samples[i] != level) {
+            return false;
+        }
+    }
+    return true;
+}
+
+START_TEST(test_group_mixer_sum)
+{
+    GROUP_MIXER *mixer = group_mixer_new();
+    ck_assert(mixer);
+
+    push(mixer, 0, 1000, GROUP_MIXER_JITTER_TARGET);
+    push(mixer, 7, -300, GROUP_MIXER_JITTER_TARGET);
+    ck_assert(group_mixer_ready(mixer));
+    ck_assert(group_mixer_mix(mixer, out) == 2);
+    ck_assert(all(out, 700));
+
+    // Stereo keeps its channels apart.
+    for (size_t i = 0; i < GROUP_MIXER_FRAME; ++i) {
+        in[i * 2]     = 100;
+        in[i * 2 + 1] = -100;
+    }
+    for (size_t i = 0; i < GROUP_MIXER_JITTER_TARGET; ++i) {
+        ck_assert(group_mixer_push(mixer, 3, in, GROUP_MIXER_FRAME, 2, GROUP_MIXER_SAMPLE_RATE));
+    }
+    ck_assert(group_mixer_mix(mixer, out) == 3);
+    ck_assert(out[0] == 800 && out[1] == 600);
+
+    // Nothing that would need resampling.
+    ck_assert(!group_mixer_push(mixer, 1, in, GROUP_MIXER_FRAME / 2, 1, 24000));
+    ck_assert(!group_mixer_push(mixer, 1, in, GROUP_MIXER_FRAME, 3, GROUP_MIXER_SAMPLE_RATE));
+    ck_assert(!group_mixer_push(mixer, GROUP_MIXER_MAX_PEERS, in, GROUP_MIXER_FRAME, 1, GROUP_MIXER_SAMPLE_RATE));
+
+    group_mixer_free(mixer);
+}
+END_TEST
+
+START_TEST(test_group_mixer_clipping)
+{
+    GROUP_MIXER *mixer = group_mixer_new();
+
+    const size_t frames = GROUP_MIXER_JITTER_MAX;
+    push(mixer, 0, 30000, frames);
+    push(mixer, 1, 30000, frames);
+
+    // Turned down straight away, without clipping.
+    group_mixer_mix(mixer, out);
+    ck_assert(out[0] >= INT16_MAX - 2 && out[0] <= INT16_MAX);
+    for (size_t i = 1; i < GROUP_MIXER_FRAME * GROUP_MIXER_CHANNELS; ++i) {
+        ck_assert(out[i] == out[0]);
+    }
+
+    // And only comes back up slowly once it's quieter.
+    group_mixer_peer_remove(mixer, 0);
+    group_mixer_mix(mixer, out);
+    ck_assert(out[0] > 15000 && out[0] < 29000);
+
+    int16_t last = out[0];
+    for (size_t i = 2; i < frames; ++i) {
+        group_mixer_mix(mixer, out);
+        ck_assert(out[0] >= last && out[0] <= 30000);
+        last = out[0];
+    }
+
+    // Even with everyone as loud as they go.
+    group_mixer_peer_remove(mixer, 1);
+    push(mixer, 2, INT16_MIN, GROUP_MIXER_JITTER_TARGET);
+    push(mixer, 3, INT16_MIN, GROUP_MIXER_JITTER_TARGET);
+    group_mixer_mix(mixer, out);
+    ck_assert(out[0] <= -INT16_MAX + 2 && all(out, out[0]));
+
+    group_mixer_free(mixer);
+}
+END_TEST
+
+START_TEST(test_group_mixer_jitter)
+{
+    GROUP_MIXER *mixer = group_mixer_new();
+
+    // Held back until there's enough to ride out a late packet or two.
+    for (size_t i = 0; i < GROUP_MIXER_JITTER_TARGET - 1; ++i) {
+        push(mixer, 0, 100, 1);
+        ck_assert(!group_mixer_ready(mixer));
+    }
+    push(mixer, 0, 100, 1);
+    ck_assert(group_mixer_ready(mixer));
+
+    for (size_t i = 0; i < GROUP_MIXER_JITTER_TARGET; ++i) {
+        ck_assert(group_mixer_mix(mixer, out) == 1);
+        ck_assert(all(out, 100));
+    }
+    ck_assert(!group_mixer_ready(mixer));
+
+    // Running dry goes quiet, and back to waiting for enough.
+    push(mixer, 0, 100, 1);
+    ck_assert(group_mixer_mix(mixer, out) == 1);
+    ck_assert(group_mixer_mix(mixer, out) == 0);
+    ck_assert(all(out, 0));
+    ck_assert(mixer->peers[0].underruns == 1);
+    push(mixer, 0, 100, 1);
+    ck_assert(!group_mixer_ready(mixer));
+
+    // A peer that's buffering doesn't hold anyone else up.
+    push(mixer, 1, 10, GROUP_MIXER_JITTER_TARGET);
+    ck_assert(group_mixer_mix(mixer, out) == 1);
+    ck_assert(all(out, 10));
+
+    // Half a frame at the end is still played, then silence.
+    group_mixer_flush(mixer);
+    push(mixer, 0, 100, GROUP_MIXER_JITTER_TARGET - 1);
+    ck_assert(group_mixer_push(mixer, 0, in, GROUP_MIXER_FRAME / 2, 1, GROUP_MIXER_SAMPLE_RATE));
+    push(mixer, 0, 100, 1);
+    for (size_t i = 0; i < GROUP_MIXER_JITTER_TARGET; ++i) {
+        group_mixer_mix(mixer, out);
+    }
+    ck_assert(group_mixer_mix(mixer, out) == 1);
+    ck_assert(out[0] == 100 && out[GROUP_MIXER_FRAME - 1] == 100 && out[GROUP_MIXER_FRAME] == 0);
+
+    group_mixer_free(mixer);
+}
+END_TEST
+
+START_TEST(test_group_mixer_overflow)
+{
+    GROUP_MIXER *mixer = group_mixer_new();
+
+    // Only the newest audio is kept.
+    push(mixer, 0, 1, GROUP_MIXER_JITTER_MAX);
+    push(mixer, 0, 2, 2);
+    ck_assert(mixer->peers[0].fill == RING_SIZE);
+    ck_assert(mixer->peers[0].dropped == 2 * GROUP_MIXER_FRAME);
+
+    for (size_t i = 0; i < GROUP_MIXER_JITTER_MAX - 2; ++i) {
+        group_mixer_mix(mixer, out);
+        ck_assert(all(out, 1));
+    }
+    group_mixer_mix(mixer, out);
+    ck_assert(all(out, 2));
+
+    // Even from one push that's too big.
+    static int16_t big[RING_SIZE + GROUP_MIXER_FRAME];
+    for (size_t i = 0; i < COUNTOF(big); ++i) {
+        big[i] = i < GROUP_MIXER_FRAME ? 5 : 6;
+    }
+    group_mixer_peer_remove(mixer, 0);
+    ck_assert(group_mixer_push(mixer, 0, big, COUNTOF(big), 1, GROUP_MIXER_SAMPLE_RATE));
+    ck_assert(mixer->peers[0].fill == RING_SIZE);
+    group_mixer_mix(mixer, out);
+    ck_assert(all(out, 6));
+
+    group_mixer_free(mixer);
+}
+END_TEST
+
+START_TEST(test_group_mixer_peers)
+{
+    GROUP_MIXER *mixer = group_mixer_new();
+
+    push(mixer, 0, 1, GROUP_MIXER_JITTER_TARGET);
+    push(mixer, 4, 40, GROUP_MIXER_JITTER_TARGET);
+
+    // The last peer takes the place of one that left, audio and all.
+    group_mixer_peer_remove(mixer, 0);
+    group_mixer_peer_move(mixer, 4, 0);
+    ck_assert(!mixer->peers[4].samples && mixer->peers[4].buffering);
+    ck_assert(group_mixer_mix(mixer, out) == 1);
+    ck_assert(all(out, 40));
+
+    group_mixer_peer_remove(mixer, 0);
+    ck_assert(!group_mixer_ready(mixer));
+    ck_assert(group_mixer_mix(mixer, out) == 0);
+    ck_assert(all(out, 0));
+
+    group_mixer_free(mixer);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Group Mixer");
+
+    MK_TEST_CASE(group_mixer_sum)
+    MK_TEST_CASE(group_mixer_clipping)
+    MK_TEST_CASE(group_mixer_jitter)
+    MK_TEST_CASE(group_mixer_overflow)
+    MK_TEST_CASE(group_mixer_peers)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,161 @@
+#include "../src/msg_queue.c"
+
+#include "test.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PRODUCERS 4
+#define MESSAGES  50000
+
+static MSG_QUEUE queue = MSG_QUEUE_INIT;
+
+START_TEST(test_msg_queue_full)
+{
+    MSG_QUEUE q = MSG_QUEUE_INIT;
+    TOX_MSG   msg;
+
+    for (uint32_t i = 0; i < MSG_QUEUE_SIZE; ++i) {
+        ck_assert_msg(msg_queue_push(&q, 1, i, 0, NULL), "Push %u failed before the queue was full", i);
+    }
+    ck_assert_msg(!msg_queue_push(&q, 1, 0, 0, NULL), "Pushed to a full queue");
+
+    // Go round the ring a few times.
+    for (uint32_t i = 0; i < MSG_QUEUE_SIZE * 3; ++i) {
+        ck_assert(msg_queue_pop(&q, &msg));
+        ck_assert_msg(msg.param1 == i, "Expected message %u got: %u", i, msg.param1);
+        ck_assert(msg_queue_push(&q, 1, i + MSG_QUEUE_SIZE, 0, NULL));
+    }
+}
+END_TEST
+
+static void *producer(void *args) {
+    for (uint32_t i = 0; i < MESSAGES; ++i) {
+        msg_queue_post(&queue, NULL, 1, (uintptr_t)args, i, NULL);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_msg_queue_producers)
+{
+    pthread_t threads[PRODUCERS];
+    for (uintptr_t i = 0; i < PRODUCERS; ++i) {
+        pthread_create(&threads[i], NULL, producer, (void *)i);
+    }
+
+    // Every producer's messages have to come out in the order it pushed them.
+    uint32_t next[PRODUCERS] = { 0 };
+    uint32_t received = 0;
+    while (received < PRODUCERS * MESSAGES) {
+        TOX_MSG msg;
+        if (!msg_queue_pop(&queue, &msg)) {
+            msg_queue_wait(&queue, 100);
+            continue;
+        }
+
+        ck_assert_msg(msg.param2 == next[msg.param1], "Producer %u: expected %u got: %u", msg.param1,
+                      next[msg.param1], msg.param2);
+        next[msg.param1]++;
+        received++;
+    }
+
+    for (int i = 0; i < PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
+END_TEST
+
+static void *delayed_push(void *args) {
+    yieldcpu(50);
+    msg_queue_push(args, 1, 0, 0, NULL);
+
+    return NULL;
+}
+
+START_TEST(test_msg_queue_wake)
+{
+    MSG_QUEUE q = MSG_QUEUE_INIT;
+
+    // A push has to cut the wait short.
+    pthread_t thread_temp;
+    pthread_create(&thread_temp, NULL, delayed_push, &q);
+
+    time_t start = time(NULL);
+    msg_queue_wait(&q, 10000);
+    ck_assert_msg(time(NULL) - start < 5, "Waited out the whole interval");
+
+    TOX_MSG msg;
+    ck_assert(msg_queue_pop(&q, &msg));
+    pthread_join(thread_temp, NULL);
+
+    // With nothing pushed it should sleep.
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    msg_queue_wait(&q, 20);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    ck_assert_msg((after.tv_sec - before.tv_sec) * 1000 + (after.tv_nsec - before.tv_nsec) / 1000000 >= 15,
+                  "Returned early from an empty queue");
+}
+END_TEST
+
+START_TEST(test_msg_queue_fd)
+{
+    MSG_QUEUE q = MSG_QUEUE_INIT;
+    ck_assert(msg_queue_open_fd(&q));
+
+    pthread_t thread_temp;
+    pthread_create(&thread_temp, NULL, delayed_push, &q);
+
+    time_t start = time(NULL);
+    msg_queue_wait(&q, 10000);
+    ck_assert_msg(time(NULL) - start < 5, "Waited out the whole interval on the wake fd");
+
+    TOX_MSG msg;
+    ck_assert(msg_queue_pop(&q, &msg));
+    pthread_join(thread_temp, NULL);
+
+    // Pushes while nobody's waiting mustn't leave the next wait returning straight away.
+    for (int i = 0; i < 3; ++i) {
+        ck_assert(msg_queue_push(&q, 1, 0, 0, NULL));
+        ck_assert(msg_queue_pop(&q, &msg));
+    }
+    msg_queue_wait(&q, 20);
+
+    ck_assert_msg(q.stats.wakeups == 1, "Expected 1 wakeup got: %lu", (unsigned long)q.stats.wakeups);
+    ck_assert_msg(q.stats.timeouts == 1, "Expected 1 timeout got: %lu", (unsigned long)q.stats.timeouts);
+
+    uint64_t popped = 0;
+    for (int i = 0; i < MSG_QUEUE_BUCKETS; ++i) {
+        popped += q.stats.latency[i];
+    }
+    ck_assert_msg(popped == 4, "Expected 4 latencies recorded got: %lu", (unsigned long)popped);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Msg Queue");
+
+    MK_TEST_CASE(msg_queue_full)
+    MK_TEST_CASE(msg_queue_producers)
+    MK_TEST_CASE(msg_queue_wake)
+    MK_TEST_CASE(msg_queue_fd)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
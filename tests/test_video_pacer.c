@@ -0,0 +1,122 @@
+#include "../src/av/video_pacer.c"
+
+#include "test.h"
+
+#include <stdint.h>
+
+#define MS (1000 * 1000ull)
+
+static void frame(VIDEO_PACER *pacer, uint64_t capture, uint64_t convert, uint64_t send, uint64_t now) {
+    const uint64_t stages[VIDEO_STAGE_COUNT] = { capture, convert, send };
+    video_pacer_done(pacer, true, stages, now);
+}
+
+START_TEST(test_video_pacer_no_drift)
+{
+    VIDEO_PACER pacer;
+    video_pacer_start(&pacer, 25, 1000 * MS);
+    ck_assert(pacer.interval == 40 * MS);
+    ck_assert(video_pacer_wait(&pacer, 1000 * MS) == 0);
+
+    // Waking up 3ms late every time, and taking 5ms over every frame, mustn't push the frames after back.
+    uint64_t now = 1000 * MS;
+    for (int i = 0; i < 250; ++i) {
+        now += video_pacer_wait(&pacer, now) + 3 * MS;
+        now += 5 * MS;
+        frame(&pacer, 1 * MS, 1 * MS, 3 * MS, now);
+    }
+
+    ck_assert_msg(pacer.deadline == 1000 * MS + 250 * 40 * MS, "Drifted %ld ns in 250 frames",
+                  (long)(pacer.deadline - (1000 * MS + 250 * 40 * MS)));
+    ck_assert(pacer.stats.frames == 250 && pacer.stats.dropped == 0);
+    ck_assert(video_pacer_wait(&pacer, now) == 40 * MS - 8 * MS);
+}
+END_TEST
+
+START_TEST(test_video_pacer_falls_behind)
+{
+    VIDEO_PACER pacer;
+    video_pacer_start(&pacer, 25, 0);
+
+    // Frames taking 100ms to send can only go out every third slot.
+    uint64_t now = 0;
+    for (int i = 0; i < 10; ++i) {
+        now += video_pacer_wait(&pacer, now);
+        now += 100 * MS;
+        frame(&pacer, 0, 10 * MS, 90 * MS, now);
+    }
+    ck_assert_msg(pacer.stats.dropped == 20, "Expected 20 dropped slots, got %lu", (unsigned long)pacer.stats.dropped);
+    ck_assert(pacer.deadline % pacer.interval == 0);
+
+    // Once it catches up again it goes back to every slot.
+    for (int i = 0; i < 50; ++i) {
+        now += video_pacer_wait(&pacer, now);
+        now += 5 * MS;
+        frame(&pacer, 0, 1 * MS, 4 * MS, now);
+    }
+    const uint64_t dropped = pacer.stats.dropped;
+    now += video_pacer_wait(&pacer, now) + 5 * MS;
+    frame(&pacer, 0, 1 * MS, 4 * MS, now);
+    ck_assert(pacer.stats.dropped == dropped);
+}
+END_TEST
+
+START_TEST(test_video_pacer_stall)
+{
+    VIDEO_PACER pacer;
+    video_pacer_start(&pacer, 25, 0);
+
+    // One frame stuck for a second skips the slots it missed instead of rushing out frames to make them up.
+    frame(&pacer, 0, 0, 1000 * MS, 1000 * MS);
+    ck_assert_msg(pacer.deadline >= 1000 * MS - 20 * MS && pacer.deadline <= 1000 * MS + 40 * MS,
+                  "Next frame due at %lu ms", (unsigned long)(pacer.deadline / MS));
+
+    // A little late isn't missing the slot.
+    video_pacer_start(&pacer, 25, 0);
+    frame(&pacer, 0, 0, 10 * MS, 50 * MS);
+    ck_assert(pacer.deadline == 40 * MS && pacer.stats.dropped == 0);
+}
+END_TEST
+
+START_TEST(test_video_pacer_stats)
+{
+    VIDEO_PACER pacer;
+    video_pacer_start(&pacer, 10, 0);
+
+    frame(&pacer, 4 * MS, 2 * MS, 10 * MS, 16 * MS);
+    frame(&pacer, 8 * MS, 2 * MS, 20 * MS, 130 * MS);
+    video_pacer_done(&pacer, false, (uint64_t[VIDEO_STAGE_COUNT]){ 50 * MS }, 250 * MS);
+
+    ck_assert(pacer.stats.frames == 2 && pacer.stats.empty == 1);
+    ck_assert(pacer.stats.stages[VIDEO_STAGE_CAPTURE].total == 12 * MS);
+    ck_assert(pacer.stats.stages[VIDEO_STAGE_CAPTURE].max == 8 * MS);
+    ck_assert(pacer.stats.stages[VIDEO_STAGE_SEND].total == 30 * MS);
+    ck_assert(pacer.stats.stages[VIDEO_STAGE_SEND].max == 20 * MS);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Video Pacer");
+
+    MK_TEST_CASE(video_pacer_no_drift)
+    MK_TEST_CASE(video_pacer_falls_behind)
+    MK_TEST_CASE(video_pacer_stall)
+    MK_TEST_CASE(video_pacer_stats)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,172 @@
+#include "../src/av/video_send.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define FRIENDS 24
+
+static FRIEND friends[FRIENDS];
+
+FRIEND *get_friend(uint32_t friend_number) {
+    return friend_number < FRIENDS ? &friends[friend_number] : NULL;
+}
+
+static struct {
+    uint32_t       friend_number;
+    uint16_t       w, h;
+    const uint8_t *y;
+} sent[FRIENDS];
+static size_t sent_count;
+
+bool toxav_video_send_frame(ToxAV *av, uint32_t friend_number, uint16_t width, uint16_t height, const uint8_t *y,
+                            const uint8_t *u, const uint8_t *v, TOXAV_ERR_SEND_FRAME *error) {
+    sent[sent_count].friend_number = friend_number;
+    sent[sent_count].w             = width;
+    sent[sent_count].h             = height;
+    sent[sent_count].y             = y;
+    sent_count++;
+
+    *error = 0;
+    return true;
+}
+
+static void start_call(uint32_t friend_number, uint32_t bitrate) {
+    friends[friend_number].call_state_self   = TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V;
+    friends[friend_number].call_state_friend = TOXAV_FRIEND_CALL_STATE_SENDING_V | TOXAV_FRIEND_CALL_STATE_ACCEPTING_V;
+    video_send_set_bitrate(friend_number, bitrate);
+}
+
+static void end_call(uint32_t friend_number) {
+    friends[friend_number].call_state_self   = 0;
+    friends[friend_number].call_state_friend = 0;
+    video_send_update(friend_number);
+}
+
+START_TEST(test_video_send_set)
+{
+    utox_av_video_frame frame = { .w = 64, .h = 48 };
+    uint8_t planes[64 * 48 * 3 / 2];
+    frame.y = planes;
+    frame.u = planes + 64 * 48;
+    frame.v = frame.u + 64 * 48 / 4;
+
+    ck_assert(video_send_frame(NULL, &frame) == 0);
+
+    start_call(3, 0);
+    start_call(7, 0);
+    ck_assert(video_send_frame(NULL, &frame) == 2);
+
+    // Only calls we're sending video in, and the friend's accepting it in, belong in the set.
+    friends[7].call_state_friend = TOXAV_FRIEND_CALL_STATE_SENDING_V;
+    video_send_update(7);
+    ck_assert(video_call_count == 1);
+
+    end_call(3);
+    end_call(7);
+    ck_assert(video_call_count == 0);
+
+    for (uint32_t i = 0; i < FRIENDS; ++i) {
+        start_call(i, 0);
+    }
+    ck_assert_msg(video_call_count == UTOX_MAX_CALLS, "Expected the set to stop at %u calls, got %lu", UTOX_MAX_CALLS,
+                  (unsigned long)video_call_count);
+
+    for (uint32_t i = 0; i < FRIENDS; ++i) {
+        end_call(i);
+    }
+    ck_assert(video_call_count == 0);
+}
+END_TEST
+
+START_TEST(test_video_send_size)
+{
+    uint16_t w, h;
+
+    video_send_size(0, 1280, 720, &w, &h);
+    ck_assert(w == 1280 && h == 720);
+
+    video_send_size(1000, 1920, 1080, &w, &h);
+    ck_assert(w == 1280 && h == 720);
+
+    video_send_size(UTOX_MIN_BITRATE_VIDEO, 1280, 720, &w, &h);
+    ck_assert(w == 640 && h == 360);
+
+    // Never scaled up.
+    video_send_size(UTOX_MIN_BITRATE_VIDEO, 320, 240, &w, &h);
+    ck_assert(w == 320 && h == 240);
+
+    // Always even, so the chroma planes are exactly a quarter.
+    video_send_size(600, 1366, 768, &w, &h);
+    ck_assert_msg(w % 2 == 0 && h == 480, "Got %ux%u", w, h);
+}
+END_TEST
+
+START_TEST(test_video_send_groups)
+{
+    const uint16_t width = 1280, height = 720;
+    uint8_t *      planes = malloc(width * height * 3 / 2);
+    for (size_t i = 0; i < width * height * 3 / 2u; ++i) {
+        planes[i] = i * 7;
+    }
+    utox_av_video_frame frame = { .w = width, .h = height, .y = planes };
+    frame.u = planes + width * height;
+    frame.v = frame.u + width * height / 4;
+
+    const uint32_t bitrates[] = { 5000, 800, 600, 2500, 700, 512 };
+    for (uint32_t i = 0; i < COUNTOF(bitrates); ++i) {
+        start_call(i, bitrates[i]);
+    }
+
+    sent_count = 0;
+    ck_assert(video_send_frame(NULL, &frame) == COUNTOF(bitrates));
+    ck_assert(sent_count == COUNTOF(bitrates));
+
+    // Calls at the same size get the very same planes, full size ones the captured frame itself.
+    for (size_t i = 0; i < sent_count; ++i) {
+        uint16_t w, h;
+        video_send_size(bitrates[sent[i].friend_number], width, height, &w, &h);
+        ck_assert(sent[i].w == w && sent[i].h == h);
+
+        if (w == width) {
+            ck_assert(sent[i].y == planes);
+        }
+
+        for (size_t j = 0; j < i; ++j) {
+            ck_assert((sent[j].w == sent[i].w) == (sent[j].y == sent[i].y));
+        }
+    }
+
+    for (uint32_t i = 0; i < COUNTOF(bitrates); ++i) {
+        end_call(i);
+    }
+    video_send_free();
+    free(planes);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Video Send");
+
+    MK_TEST_CASE(video_send_set)
+    MK_TEST_CASE(video_send_size)
+    MK_TEST_CASE(video_send_groups)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
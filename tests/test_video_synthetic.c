@@ -0,0 +1,123 @@
+#include "../src/av/colorspace.c"
+#include "../src/av/colorspace_neon.c"
+#include "../src/av/colorspace_x86.c"
+#include "../src/av/video_synthetic.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static uint64_t fake_time;
+
+uint64_t get_time(void) {
+    return fake_time;
+}
+
+START_TEST(test_video_synthetic_configure)
+{
+    ck_assert(!video_synthetic_enabled());
+
+    ck_assert(video_synthetic_configure("1280x720@30"));
+    ck_assert(synthetic.width == 1280 && synthetic.height == 720 && synthetic.fps == 30);
+    ck_assert_str_eq(video_synthetic_name(), "Test pattern 1280x720@30");
+    ck_assert(video_synthetic_enabled());
+
+    ck_assert(video_synthetic_configure("320x240"));
+    ck_assert(synthetic.fps == VIDEO_SYNTHETIC_DEFAULT_FPS);
+
+    ck_assert(video_synthetic_configure(NULL));
+    ck_assert(synthetic.width == VIDEO_SYNTHETIC_DEFAULT_WIDTH && synthetic.height == VIDEO_SYNTHETIC_DEFAULT_HEIGHT);
+
+    const char *bad[] = { "640", "640x", "x480", "640x480@", "640x480@0", "641x480", "640x481", "64x48", "640x480x" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        ck_assert_msg(!video_synthetic_configure(bad[i]), "Accepted %s", bad[i]);
+    }
+}
+END_TEST
+
+START_TEST(test_video_synthetic_frame_number)
+{
+    const uint16_t width = 320, height = 240;
+    uint8_t *      bgrx  = malloc(width * height * 4);
+    uint8_t *      again = malloc(width * height * 4);
+    uint8_t *      yuv   = malloc(width * height * 3 / 2);
+
+    const uint32_t frames[] = { 0, 1, 2, 3, 255, 256, 1000, 65535, 0xABCDEF, 0xFFFFFF };
+    for (size_t i = 0; i < sizeof(frames) / sizeof(frames[0]); ++i) {
+        video_synthetic_draw(bgrx, width, height, frames[i]);
+        video_synthetic_draw(again, width, height, frames[i]);
+        ck_assert_msg(!memcmp(bgrx, again, width * height * 4), "Frame %u isn't the same twice", frames[i]);
+
+        bgrxtoyuv420(yuv, yuv + width * height, yuv + width * height * 5 / 4, bgrx, width, height);
+        const int64_t number = video_synthetic_frame_number(yuv, width, width, height);
+        ck_assert_msg(number == frames[i], "Frame %u read back as %ld", frames[i], (long)number);
+    }
+
+    // A frame of something else isn't mistaken for one.
+    memset(yuv, 128, width * height);
+    ck_assert(video_synthetic_frame_number(yuv, width, width, height) == -1);
+
+    free(bgrx);
+    free(again);
+    free(yuv);
+}
+END_TEST
+
+START_TEST(test_video_synthetic_rate)
+{
+    ck_assert(video_synthetic_configure("160x120@10"));
+
+    uint16_t width, height;
+    fake_time = 5000 * 1000 * 1000ull;
+    ck_assert(video_synthetic_open(&width, &height));
+    ck_assert(width == 160 && height == 120);
+
+    uint8_t *yuv = malloc(width * height * 3 / 2);
+    uint8_t *y = yuv, *u = yuv + width * height, *v = u + width * height / 4;
+
+    ck_assert(video_synthetic_getframe(y, u, v, width, height) == 1);
+    ck_assert(video_synthetic_frame_number(y, width, width, height) == 0);
+    ck_assert(video_synthetic_getframe(y, u, v, width, height) == 0);
+
+    fake_time += 100 * 1000 * 1000;
+    ck_assert(video_synthetic_getframe(y, u, v, width, height) == 1);
+    ck_assert(video_synthetic_frame_number(y, width, width, height) == 1);
+
+    // Frames nobody asked for in time are skipped, as a camera's would be.
+    fake_time += 350 * 1000 * 1000;
+    ck_assert(video_synthetic_getframe(y, u, v, width, height) == 1);
+    ck_assert(video_synthetic_frame_number(y, width, width, height) == 4);
+    ck_assert(video_synthetic_getframe(y, u, v, width, height) == 0);
+
+    ck_assert(video_synthetic_getframe(y, u, v, 320, 240) == 0);
+
+    video_synthetic_close();
+    free(yuv);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Synthetic Video");
+
+    MK_TEST_CASE(video_synthetic_configure)
+    MK_TEST_CASE(video_synthetic_frame_number)
+    MK_TEST_CASE(video_synthetic_rate)
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}